@@ -0,0 +1,102 @@
+/**
+ * File:   alloc_counter.c
+ * Author: AWTK Develop Team
+ * Brief:  heap allocation counter for benchmarks and tests
+ *
+ * Copyright (c) 2023 - 2025 Guangzhou ZHIYUAN Electronics Co.,Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * License file for more details.
+ *
+ */
+
+/**
+ * History:
+ * ================================================================
+ * 2026-10-19 Li XianJing <lixianjing@zlg.cn> created
+ *
+ */
+
+#include <stdlib.h>
+#include "alloc_counter.h"
+
+#if defined(__GLIBC__)
+/*
+ * PC版的AWTK使用系统的malloc，在可执行文件中定义malloc等函数可以截获
+ * 所有共享库(包括awtk和modbus)的堆内存分配，转发给glibc的实现。
+ * 除了全局计数，调用了alloc_counter_begin的线程还单独计数，其它线程(如服务端线程)的分配不影响结果。
+ */
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+
+static volatile uint64_t s_alloc_count = 0;
+static __thread bool_t s_armed = FALSE;
+static __thread uint32_t s_thread_alloc_count = 0;
+
+static void alloc_counter_inc(void) {
+  s_alloc_count++;
+  if (s_armed) {
+    s_thread_alloc_count++;
+  }
+}
+
+void* malloc(size_t size) {
+  alloc_counter_inc();
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size) {
+  alloc_counter_inc();
+  return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+  alloc_counter_inc();
+  return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) {
+  __libc_free(ptr);
+}
+
+bool_t alloc_counter_is_supported(void) {
+  return TRUE;
+}
+
+uint64_t alloc_counter_get(void) {
+  return s_alloc_count;
+}
+
+ret_t alloc_counter_begin(void) {
+  s_thread_alloc_count = 0;
+  s_armed = TRUE;
+
+  return RET_OK;
+}
+
+uint32_t alloc_counter_end(void) {
+  s_armed = FALSE;
+
+  return s_thread_alloc_count;
+}
+#else
+bool_t alloc_counter_is_supported(void) {
+  return FALSE;
+}
+
+uint64_t alloc_counter_get(void) {
+  return 0;
+}
+
+ret_t alloc_counter_begin(void) {
+  return RET_NOT_IMPL;
+}
+
+uint32_t alloc_counter_end(void) {
+  return 0;
+}
+#endif /*__GLIBC__*/
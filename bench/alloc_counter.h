@@ -0,0 +1,59 @@
+/**
+ * File:   alloc_counter.h
+ * Author: AWTK Develop Team
+ * Brief:  heap allocation counter for benchmarks
+ *
+ * Copyright (c) 2023 - 2025 Guangzhou ZHIYUAN Electronics Co.,Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * License file for more details.
+ *
+ */
+
+/**
+ * History:
+ * ================================================================
+ * 2026-10-19 Li XianJing <lixianjing@zlg.cn> created
+ *
+ */
+
+#ifndef TK_MODBUS_BENCH_ALLOC_COUNTER_H
+#define TK_MODBUS_BENCH_ALLOC_COUNTER_H
+
+#include "tkc/types_def.h"
+
+BEGIN_C_DECLS
+
+/**
+ * @method alloc_counter_is_supported
+ * 当前平台是否支持统计堆内存分配次数(目前仅支持glibc)。
+ * @return {bool_t} 返回TRUE表示支持。
+ */
+bool_t alloc_counter_is_supported(void);
+
+/**
+ * @method alloc_counter_get
+ * 获取进程启动以来malloc/calloc/realloc的调用次数。
+ * @return {uint64_t} 返回调用次数。
+ */
+uint64_t alloc_counter_get(void);
+
+/**
+ * @method alloc_counter_begin
+ * 开始统计当前线程的堆内存分配次数(其它线程的分配不计入)。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t alloc_counter_begin(void);
+
+/**
+ * @method alloc_counter_end
+ * 停止统计当前线程的堆内存分配次数。
+ * @return {uint32_t} 返回alloc_counter_begin之后当前线程malloc/calloc/realloc的调用次数。
+ */
+uint32_t alloc_counter_end(void);
+
+END_C_DECLS
+
+#endif /*TK_MODBUS_BENCH_ALLOC_COUNTER_H*/
@@ -0,0 +1,328 @@
+/**
+ * File:   codec_bench.c
+ * Author: AWTK Develop Team
+ * Brief:  micro benchmark for modbus_common encode/decode
+ *
+ * Copyright (c) 2023 - 2025 Guangzhou ZHIYUAN Electronics Co.,Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * License file for more details.
+ *
+ */
+
+/**
+ * History:
+ * ================================================================
+ * 2026-10-19 Li XianJing <lixianjing@zlg.cn> created
+ *
+ */
+
+#include "tkc/time_now.h"
+#include "tkc/platform.h"
+#include "streams/mem/iostream_mem.h"
+#include "modbus_common.h"
+#include "alloc_counter.h"
+
+/*每批处理的帧数，每批之后重新创建内存流(不计入耗时和分配次数)*/
+#define CODEC_BENCH_BATCH 256
+/*单个ADU最大为260字节，留一些余量*/
+#define CODEC_BENCH_FRAME_SIZE 300
+#define CODEC_BENCH_BUFF_SIZE (CODEC_BENCH_BATCH * CODEC_BENCH_FRAME_SIZE)
+
+typedef struct _codec_bench_case_t {
+  uint8_t func_code;
+  uint16_t count;
+} codec_bench_case_t;
+
+typedef struct _codec_bench_t {
+  modbus_proto_t proto;
+  wbuffer_t client_wb;
+  wbuffer_t server_wb;
+  modbus_common_t client;
+  modbus_common_t server;
+  uint8_t bits[MODBUS_MAX_READ_BITS];
+  uint16_t registers[MODBUS_MAX_READ_REGISTERS];
+  uint8_t resp_data[MODBUS_MAX_PDU_SIZE];
+} codec_bench_t;
+
+static uint8_t s_req_buff[CODEC_BENCH_BUFF_SIZE];
+static uint8_t s_resp_buff[CODEC_BENCH_BUFF_SIZE];
+
+static const codec_bench_case_t s_cases[] = {
+    {MODBUS_FC_READ_COILS, 1},
+    {MODBUS_FC_READ_COILS, 64},
+    {MODBUS_FC_READ_COILS, MODBUS_MAX_READ_BITS},
+    {MODBUS_FC_READ_DISCRETE_INPUTS, 64},
+    {MODBUS_FC_READ_HOLDING_REGISTERS, 1},
+    {MODBUS_FC_READ_HOLDING_REGISTERS, 16},
+    {MODBUS_FC_READ_HOLDING_REGISTERS, MODBUS_MAX_READ_REGISTERS},
+    {MODBUS_FC_READ_INPUT_REGISTERS, 16},
+    {MODBUS_FC_WRITE_SINGLE_COIL, 1},
+    {MODBUS_FC_WRITE_SINGLE_HOLDING_REGISTER, 1},
+    {MODBUS_FC_WRITE_MULTIPLE_COILS, 64},
+    {MODBUS_FC_WRITE_MULTIPLE_COILS, MODBUS_MAX_WRITE_BITS},
+    {MODBUS_FC_WRITE_MULTIPLE_HOLDING_REGISTERS, 16},
+    {MODBUS_FC_WRITE_MULTIPLE_HOLDING_REGISTERS, MODBUS_MAX_WRITE_REGISTERS},
+    {MODBUS_FC_WRITE_AND_READ_REGISTERS, 16},
+    {MODBUS_FC_WRITE_AND_READ_REGISTERS, MODBUS_MAX_WR_WRITE_REGISTERS},
+    {MODBUS_FC_MASK_WRITE_REGISTER, 1},
+    {MODBUS_FC_READ_FIFO_QUEUE, MODBUS_MAX_FIFO_COUNT},
+};
+
+static ret_t codec_bench_attach_io(codec_bench_t* bench) {
+  tk_iostream_t* client_io =
+      tk_iostream_mem_create(s_resp_buff, sizeof(s_resp_buff), s_req_buff, sizeof(s_req_buff), FALSE);
+  tk_iostream_t* server_io =
+      tk_iostream_mem_create(s_req_buff, sizeof(s_req_buff), s_resp_buff, sizeof(s_resp_buff), FALSE);
+  return_value_if_fail(client_io != NULL && server_io != NULL, RET_OOM);
+
+  modbus_common_init(&(bench->client), client_io, bench->proto, &(bench->client_wb));
+  modbus_common_init(&(bench->server), server_io, bench->proto, &(bench->server_wb));
+  bench->client.slave = 1;
+  bench->server.slave = 1;
+
+  return RET_OK;
+}
+
+static ret_t codec_bench_detach_io(codec_bench_t* bench) {
+  TK_OBJECT_UNREF(bench->client.io);
+  TK_OBJECT_UNREF(bench->server.io);
+
+  return RET_OK;
+}
+
+static ret_t codec_bench_send_req(codec_bench_t* bench, const codec_bench_case_t* c) {
+  modbus_common_t* common = &(bench->client);
+
+  switch (c->func_code) {
+    case MODBUS_FC_READ_COILS:
+    case MODBUS_FC_READ_DISCRETE_INPUTS: {
+      return modbus_common_send_read_bits_req(common, c->func_code, 0, c->count);
+    }
+    case MODBUS_FC_READ_HOLDING_REGISTERS:
+    case MODBUS_FC_READ_INPUT_REGISTERS: {
+      return modbus_common_send_read_registers_req(common, c->func_code, 0, c->count);
+    }
+    case MODBUS_FC_WRITE_SINGLE_COIL: {
+      return modbus_common_send_write_bit_req(common, 0, 1);
+    }
+    case MODBUS_FC_WRITE_SINGLE_HOLDING_REGISTER: {
+      return modbus_common_send_write_register_req(common, 0, 0x1234);
+    }
+    case MODBUS_FC_WRITE_MULTIPLE_COILS: {
+      return modbus_common_send_write_bits_req(common, 0, c->count, bench->bits);
+    }
+    case MODBUS_FC_WRITE_MULTIPLE_HOLDING_REGISTERS: {
+      return modbus_common_send_write_registers_req(common, 0, c->count, bench->registers);
+    }
+    case MODBUS_FC_WRITE_AND_READ_REGISTERS: {
+      return modbus_common_send_write_and_read_registers_req(common, 0, c->count, bench->registers,
+                                                             0, c->count);
+    }
+    case MODBUS_FC_MASK_WRITE_REGISTER: {
+      return modbus_common_send_mask_write_register_req(common, 0, 0xff00, 0x0012);
+    }
+    case MODBUS_FC_READ_FIFO_QUEUE: {
+      return modbus_common_send_read_fifo_queue_req(common, 0);
+    }
+    default:
+      break;
+  }
+
+  return RET_NOT_IMPL;
+}
+
+static ret_t codec_bench_serve(codec_bench_t* bench) {
+  ret_t ret = RET_OK;
+  modbus_req_data_t req;
+  modbus_resp_data_t resp;
+
+  memset(&req, 0x00, sizeof(req));
+  memset(&resp, 0x00, sizeof(resp));
+  ret = modbus_common_recv_req(&(bench->server), &req);
+  return_value_if_fail(ret == RET_OK, ret);
+
+  resp.func_code = req.func_code;
+  resp.addr = req.addr;
+  resp.count = req.count;
+  switch (req.func_code) {
+    case MODBUS_FC_READ_COILS:
+    case MODBUS_FC_READ_DISCRETE_INPUTS: {
+      resp.bytes = modbus_bits_to_bytes(req.count);
+      resp.data = bench->resp_data;
+      break;
+    }
+    case MODBUS_FC_READ_HOLDING_REGISTERS:
+    case MODBUS_FC_READ_INPUT_REGISTERS:
+    case MODBUS_FC_WRITE_AND_READ_REGISTERS: {
+      resp.bytes = req.count * 2;
+      resp.data = bench->resp_data;
+      break;
+    }
+    case MODBUS_FC_READ_FIFO_QUEUE: {
+      resp.count = MODBUS_MAX_FIFO_COUNT;
+      resp.bytes = resp.count * 2;
+      resp.data = bench->resp_data;
+      break;
+    }
+    default: {
+      resp.bytes = req.bytes;
+      resp.data = req.data;
+      break;
+    }
+  }
+
+  return modbus_common_send_resp(&(bench->server), &resp);
+}
+
+static ret_t codec_bench_recv_resp(codec_bench_t* bench, const codec_bench_case_t* c) {
+  uint16_t count = c->count;
+  modbus_common_t* common = &(bench->client);
+
+  switch (c->func_code) {
+    case MODBUS_FC_READ_COILS:
+    case MODBUS_FC_READ_DISCRETE_INPUTS: {
+      return modbus_common_recv_read_bits_resp(common, c->func_code, bench->bits, &count);
+    }
+    case MODBUS_FC_READ_HOLDING_REGISTERS:
+    case MODBUS_FC_READ_INPUT_REGISTERS:
+    case MODBUS_FC_WRITE_AND_READ_REGISTERS: {
+      return modbus_common_recv_read_registers_resp(common, c->func_code, bench->registers,
+                                                    &count);
+    }
+    case MODBUS_FC_WRITE_SINGLE_COIL: {
+      return modbus_common_recv_write_bit_resp(common);
+    }
+    case MODBUS_FC_WRITE_SINGLE_HOLDING_REGISTER: {
+      return modbus_common_recv_write_register_resp(common);
+    }
+    case MODBUS_FC_WRITE_MULTIPLE_COILS: {
+      return modbus_common_recv_write_bits_resp(common);
+    }
+    case MODBUS_FC_WRITE_MULTIPLE_HOLDING_REGISTERS: {
+      return modbus_common_recv_write_registers_resp(common);
+    }
+    case MODBUS_FC_MASK_WRITE_REGISTER: {
+      return modbus_common_recv_mask_write_register_resp(common);
+    }
+    case MODBUS_FC_READ_FIFO_QUEUE: {
+      return modbus_common_recv_read_fifo_queue_resp(common, bench->registers, &count);
+    }
+    default:
+      break;
+  }
+
+  return RET_NOT_IMPL;
+}
+
+static ret_t codec_bench_run_case(codec_bench_t* bench, const codec_bench_case_t* c,
+                                  uint32_t frames, bool_t report) {
+  uint32_t i = 0;
+  uint32_t done = 0;
+  uint64_t cost = 0;
+  uint64_t allocs = 0;
+
+  while (done < frames) {
+    uint64_t start = 0;
+    uint64_t allocs_start = 0;
+    uint32_t n = tk_min(frames - done, CODEC_BENCH_BATCH);
+    return_value_if_fail(codec_bench_attach_io(bench) == RET_OK, RET_OOM);
+
+    allocs_start = alloc_counter_get();
+    start = time_now_us();
+    for (i = 0; i < n; i++) {
+      ret_t ret = codec_bench_send_req(bench, c);
+      if (ret == RET_OK) {
+        ret = codec_bench_serve(bench);
+      }
+      if (ret == RET_OK) {
+        ret = codec_bench_recv_resp(bench, c);
+      }
+
+      if (ret != RET_OK) {
+        log_warn("fc=%u count=%u failed: %d\n", c->func_code, c->count, ret);
+        codec_bench_detach_io(bench);
+        return ret;
+      }
+    }
+    cost += time_now_us() - start;
+    allocs += alloc_counter_get() - allocs_start;
+
+    codec_bench_detach_io(bench);
+    done += n;
+  }
+
+  if (!report) {
+    return RET_OK;
+  }
+
+  if (alloc_counter_is_supported()) {
+    log_info("%-4s fc=%-2u count=%-4u %8.1f ns/frame %6.2f allocs/frame\n",
+             bench->proto == MODBUS_PROTO_TCP ? "tcp" : "rtu", c->func_code, c->count,
+             cost * 1000.0 / frames, (double)allocs / frames);
+  } else {
+    log_info("%-4s fc=%-2u count=%-4u %8.1f ns/frame %6s allocs/frame\n",
+             bench->proto == MODBUS_PROTO_TCP ? "tcp" : "rtu", c->func_code, c->count,
+             cost * 1000.0 / frames, "n/a");
+  }
+
+  return RET_OK;
+}
+
+static ret_t codec_bench_run(modbus_proto_t proto, uint32_t frames) {
+  uint32_t i = 0;
+  ret_t ret = RET_OK;
+  codec_bench_t* bench = TKMEM_ZALLOC(codec_bench_t);
+  return_value_if_fail(bench != NULL, RET_OOM);
+
+  bench->proto = proto;
+  wbuffer_init_extendable(&(bench->client_wb));
+  wbuffer_init_extendable(&(bench->server_wb));
+  /*预先分配好缓冲区，测量的是稳定状态下的开销*/
+  wbuffer_extend_capacity(&(bench->client_wb), CODEC_BENCH_FRAME_SIZE);
+  wbuffer_extend_capacity(&(bench->server_wb), CODEC_BENCH_FRAME_SIZE);
+
+  for (i = 0; i < ARRAY_SIZE(bench->registers); i++) {
+    bench->registers[i] = (uint16_t)(i * 0x0101);
+  }
+  for (i = 0; i < ARRAY_SIZE(bench->bits); i++) {
+    bench->bits[i] = (uint8_t)(i % 3 == 0);
+  }
+  for (i = 0; i < ARRAY_SIZE(bench->resp_data); i++) {
+    bench->resp_data[i] = (uint8_t)i;
+  }
+
+  for (i = 0; i < ARRAY_SIZE(s_cases); i++) {
+    /*预热：让缓冲区扩展到最大，并排除冷缓存的影响*/
+    ret = codec_bench_run_case(bench, s_cases + i, CODEC_BENCH_BATCH, FALSE);
+    if (ret == RET_OK) {
+      ret = codec_bench_run_case(bench, s_cases + i, frames, TRUE);
+    }
+    break_if_fail(ret == RET_OK);
+  }
+
+  wbuffer_deinit(&(bench->client_wb));
+  wbuffer_deinit(&(bench->server_wb));
+  TKMEM_FREE(bench);
+
+  return ret;
+}
+
+int main(int argc, char* argv[]) {
+  uint32_t frames = argc > 1 ? tk_atoi(argv[1]) : 100000;
+
+  platform_prepare();
+
+  if (frames == 0) {
+    log_info("Usage: %s [frames]\n", argv[0]);
+    return 0;
+  }
+
+  log_info("frames per case: %u\n", frames);
+  codec_bench_run(MODBUS_PROTO_TCP, frames);
+  codec_bench_run(MODBUS_PROTO_RTU, frames);
+
+  return 0;
+}
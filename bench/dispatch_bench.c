@@ -0,0 +1,300 @@
+/**
+ * File:   dispatch_bench.c
+ * Author: AWTK Develop Team
+ * Brief:  compare dispatch cost of service backends with many idle connections
+ *
+ * Copyright (c) 2023 - 2025 Guangzhou ZHIYUAN Electronics Co.,Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * License file for more details.
+ *
+ */
+
+/**
+ * History:
+ * ================================================================
+ * 2026-10-19 Li XianJing <lixianjing@zlg.cn> created
+ *
+ */
+
+#include "tkc/thread.h"
+#include "tkc/tokenizer.h"
+#include "tkc/time_now.h"
+#include "tkc/socket_helper.h"
+#include "tkc/event_source_manager_default.h"
+#include "modbus_client.h"
+#include "modbus_histogram.h"
+#include "modbus_service_tcp.h"
+#include "modbus_memory_default.h"
+#include "streams/inet/iostream_tcp.h"
+
+#define DISPATCH_BENCH_MAX_CONNS 4096
+#define DISPATCH_BENCH_MAX_DEPTH 64
+#define DISPATCH_BENCH_READ_AHEAD 1024
+#define DISPATCH_BENCH_LISTENERS 4
+#define DISPATCH_BENCH_REQ_SIZE 12
+#define DISPATCH_BENCH_RESP_SIZE 11
+
+typedef struct _dispatch_bench_conf_t {
+  int port;
+  uint32_t depth;
+  uint32_t requests;
+  const char* conns;
+  const char* backends;
+} dispatch_bench_conf_t;
+
+typedef struct _dispatch_bench_server_t {
+  event_source_manager_t* esm;
+  volatile bool_t running;
+} dispatch_bench_server_t;
+
+static void* dispatch_bench_server_main(void* args) {
+  dispatch_bench_server_t* server = (dispatch_bench_server_t*)args;
+
+  /*不休眠，测量的是事件循环本身的开销*/
+  while (server->running) {
+    event_source_manager_dispatch(server->esm);
+  }
+
+  return NULL;
+}
+
+/*用modbus_client_t逐个发送请求*/
+static uint32_t dispatch_bench_send_one_by_one(const dispatch_bench_conf_t* conf, int port,
+                                               modbus_histogram_t* latency) {
+  char url[64];
+  uint32_t i = 0;
+  uint32_t ok = 0;
+  uint16_t value = 0;
+  modbus_client_t* client = NULL;
+
+  tk_snprintf(url, sizeof(url), "tcp://localhost:%d", port);
+  client = modbus_client_create(url);
+  return_value_if_fail(client != NULL, 0);
+
+  for (i = 0; i < conf->requests; i++) {
+    uint64_t t = time_now_us();
+    ret_t ret = modbus_client_read_registers(client, MODBUS_DEMO_REGISTERS_ADDRESS, 1, &value);
+    if (ret == RET_OK) {
+      modbus_histogram_record(latency, (uint32_t)(time_now_us() - t));
+      ok++;
+    }
+  }
+  modbus_client_destroy(client);
+
+  return ok;
+}
+
+/*一次发送depth个请求(流水线)，再接收全部响应*/
+static uint32_t dispatch_bench_send_pipelined(const dispatch_bench_conf_t* conf, int port,
+                                              modbus_histogram_t* latency) {
+  uint32_t i = 0;
+  uint32_t ok = 0;
+  tk_iostream_t* io = NULL;
+  uint8_t req[DISPATCH_BENCH_REQ_SIZE * DISPATCH_BENCH_MAX_DEPTH];
+  uint8_t resp[DISPATCH_BENCH_RESP_SIZE * DISPATCH_BENCH_MAX_DEPTH];
+  uint32_t req_size = DISPATCH_BENCH_REQ_SIZE * conf->depth;
+  uint32_t resp_size = DISPATCH_BENCH_RESP_SIZE * conf->depth;
+  int sock = tk_tcp_connect("localhost", port);
+  return_value_if_fail(sock >= 0, 0);
+
+  io = tk_iostream_tcp_create(sock);
+  return_value_if_fail(io != NULL, 0);
+
+  for (i = 0; i < conf->depth; i++) {
+    uint8_t* p = req + i * DISPATCH_BENCH_REQ_SIZE;
+    p[0] = (uint8_t)(i >> 8);
+    p[1] = (uint8_t)i;
+    p[2] = 0;
+    p[3] = 0;
+    p[4] = 0;
+    p[5] = 6;
+    p[6] = 0xff;
+    p[7] = MODBUS_FC_READ_HOLDING_REGISTERS;
+    p[8] = (uint8_t)(MODBUS_DEMO_REGISTERS_ADDRESS >> 8);
+    p[9] = (uint8_t)MODBUS_DEMO_REGISTERS_ADDRESS;
+    p[10] = 0;
+    p[11] = 1;
+  }
+
+  for (i = 0; i < conf->requests; i += conf->depth) {
+    uint64_t t = time_now_us();
+    if (tk_iostream_write_len(io, req, req_size, MODBUS_WRITE_TIMEOUT) != req_size ||
+        tk_iostream_read_len(io, resp, resp_size, MODBUS_READ_TIMEOUT) != resp_size) {
+      break;
+    }
+    modbus_histogram_record(latency, (uint32_t)(time_now_us() - t));
+    ok += conf->depth;
+  }
+  TK_OBJECT_UNREF(io);
+
+  return ok;
+}
+
+static ret_t dispatch_bench_run(const dispatch_bench_conf_t* conf, modbus_memory_t* memory,
+                                const char* name, uint32_t idle_conns, int port) {
+  str_t str;
+  uint32_t i = 0;
+  uint32_t ok = 0;
+  uint32_t total = 0;
+  uint64_t start = 0;
+  uint64_t elapsed = 0;
+  int* socks = NULL;
+  tk_thread_t* thread = NULL;
+  modbus_service_args_t args;
+  dispatch_bench_server_t server;
+  modbus_histogram_t* latency = TKMEM_ZALLOC(modbus_histogram_t);
+  return_value_if_fail(latency != NULL, RET_OOM);
+
+  memset(&args, 0x00, sizeof(args));
+  args.memory = memory;
+  args.proto = MODBUS_PROTO_TCP;
+  args.slave = 0xff;
+  if (tk_str_start_with(name, "epoll")) {
+    args.backend = MODBUS_SERVICE_BACKEND_EPOLL;
+    args.read_ahead = tk_str_eq(name, "epoll-ra") ? DISPATCH_BENCH_READ_AHEAD : 0;
+    args.listeners = tk_str_eq(name, "epoll-x4") ? DISPATCH_BENCH_LISTENERS : 0;
+  }
+
+  server.running = TRUE;
+  server.esm = event_source_manager_default_create();
+  goto_error_if_fail(server.esm != NULL);
+  goto_error_if_fail(modbus_service_tcp_start_by_args(server.esm, &args, port) == RET_OK);
+  thread = tk_thread_create(dispatch_bench_server_main, &server);
+  goto_error_if_fail(thread != NULL);
+  tk_thread_start(thread);
+
+  /*空闲连接：只连接不发送请求*/
+  socks = TKMEM_ZALLOCN(int, idle_conns + 1);
+  goto_error_if_fail(socks != NULL);
+  for (i = 0; i < idle_conns; i++) {
+    socks[i] = tk_tcp_connect("localhost", port);
+    if (socks[i] < 0) {
+      log_warn("connect failed after %u connections\n", i);
+      idle_conns = i;
+      break;
+    }
+  }
+  sleep_ms(200 + idle_conns);
+
+  start = time_now_us();
+  if (conf->depth > 1) {
+    ok = dispatch_bench_send_pipelined(conf, port, latency);
+    total = (conf->requests + conf->depth - 1) / conf->depth * conf->depth;
+  } else {
+    ok = dispatch_bench_send_one_by_one(conf, port, latency);
+    total = conf->requests;
+  }
+  elapsed = time_now_us() - start;
+
+  str_init(&str, 256);
+  str_append_format(&str, 256,
+                    "backend=%-8s idle_conns=%-5u depth=%-2u ok=%u/%u throughput=%.1f req/s\n",
+                    name, idle_conns, conf->depth, ok, total,
+                    elapsed > 0 ? ok * 1000000.0 / elapsed : 0.0);
+  modbus_histogram_to_str(latency, "  latency(us)", &str);
+  log_info("%s", str.str);
+  str_reset(&str);
+
+error:
+  if (socks != NULL) {
+    for (i = 0; i < idle_conns; i++) {
+      tk_socket_close(socks[i]);
+    }
+    TKMEM_FREE(socks);
+  }
+  if (thread != NULL) {
+    server.running = FALSE;
+    /*唤醒事件循环*/
+    tk_socket_close(tk_tcp_connect("localhost", port));
+    tk_thread_destroy(thread);
+  }
+  modbus_service_tcp_stop();
+  if (server.esm != NULL) {
+    event_source_manager_destroy(server.esm);
+  }
+  TKMEM_FREE(latency);
+
+  return ok > 0 && ok == total ? RET_OK : RET_FAIL;
+}
+
+static ret_t dispatch_bench_parse_args(dispatch_bench_conf_t* conf, int argc, char* argv[]) {
+  int i = 0;
+
+  memset(conf, 0x00, sizeof(*conf));
+  conf->port = 2602;
+  conf->depth = 1;
+  conf->requests = 10000;
+  conf->conns = "0,100,500";
+  conf->backends = "default,epoll,epoll-ra";
+
+  for (i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+
+    if (tk_str_start_with(arg, "port=")) {
+      conf->port = tk_atoi(arg + 5);
+    } else if (tk_str_start_with(arg, "requests=")) {
+      conf->requests = tk_max(1, tk_atoi(arg + 9));
+    } else if (tk_str_start_with(arg, "depth=")) {
+      conf->depth = tk_atoi(arg + 6);
+    } else if (tk_str_start_with(arg, "conns=")) {
+      conf->conns = arg + 6;
+    } else if (tk_str_start_with(arg, "backends=")) {
+      conf->backends = arg + 9;
+    } else {
+      log_info("invalid arg: %s\n", arg);
+      return RET_BAD_PARAMS;
+    }
+  }
+
+  return_value_if_fail(conf->depth > 0 && conf->depth <= DISPATCH_BENCH_MAX_DEPTH,
+                       RET_BAD_PARAMS);
+
+  return RET_OK;
+}
+
+int main(int argc, char* argv[]) {
+  int port = 0;
+  tokenizer_t backends;
+  dispatch_bench_conf_t conf;
+  modbus_memory_t* memory = NULL;
+
+  platform_prepare();
+
+  if (dispatch_bench_parse_args(&conf, argc, argv) != RET_OK) {
+    log_info("Usage: %s [conns=N,N,...] [backends=default,epoll,epoll-ra,epoll-x4] [depth=N] "
+             "[requests=N] [port=P]\n",
+             argv[0]);
+    log_info(" ex: %s conns=0,100,500,900 requests=20000\n", argv[0]);
+    log_info(" ex: %s conns=0 backends=epoll,epoll-ra depth=16\n", argv[0]);
+    return 0;
+  }
+
+  tk_socket_init();
+  memory = modbus_memory_default_create_test();
+  port = conf.port;
+
+  tokenizer_init(&backends, conf.backends, tk_strlen(conf.backends), ",");
+  while (tokenizer_has_more(&backends)) {
+    tokenizer_t conns;
+    char name[32];
+
+    tk_strncpy(name, tokenizer_next_str(&backends), sizeof(name) - 1);
+
+    tokenizer_init(&conns, conf.conns, tk_strlen(conf.conns), ",");
+    while (tokenizer_has_more(&conns)) {
+      uint32_t n = tk_min(tokenizer_next_int(&conns, 0), DISPATCH_BENCH_MAX_CONNS);
+      /*每次使用不同的端口，避免等待端口释放*/
+      dispatch_bench_run(&conf, memory, name, n, port++);
+    }
+    tokenizer_deinit(&conns);
+  }
+  tokenizer_deinit(&backends);
+
+  modbus_memory_destroy(memory);
+  tk_socket_deinit();
+
+  return 0;
+}
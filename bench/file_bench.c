@@ -0,0 +1,212 @@
+/**
+ * File:   file_bench.c
+ * Author: AWTK Develop Team
+ * Brief:  compare file record transfers with register transfers
+ *
+ * Copyright (c) 2023 - 2025 Guangzhou ZHIYUAN Electronics Co.,Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * License file for more details.
+ *
+ */
+
+/**
+ * History:
+ * ================================================================
+ * 2026-10-19 Li XianJing <lixianjing@zlg.cn> created
+ *
+ */
+
+#include "tkc/mem.h"
+#include "tkc/utils.h"
+#include "tkc/time_now.h"
+#include "tkc/socket_helper.h"
+#include "modbus_client.h"
+
+#define FILE_BENCH_MAX_RECORDS 64
+
+typedef struct _file_bench_conf_t {
+  const char* url;
+  uint8_t slave;
+  uint16_t file;
+  uint16_t addr;
+  uint32_t regs;
+  uint32_t records;
+  uint32_t rounds;
+} file_bench_conf_t;
+
+typedef ret_t (*file_bench_func_t)(modbus_client_t* client, const file_bench_conf_t* conf,
+                                   uint16_t* data);
+
+static ret_t file_bench_write_registers(modbus_client_t* client, const file_bench_conf_t* conf,
+                                        uint16_t* data) {
+  uint32_t offset = 0;
+
+  while (offset < conf->regs) {
+    uint16_t n = tk_min(conf->regs - offset, MODBUS_MAX_WRITE_REGISTERS);
+    ret_t ret = modbus_client_write_registers(client, conf->addr + offset, n, data + offset);
+    return_value_if_fail(ret == RET_OK, ret);
+    offset += n;
+  }
+
+  return RET_OK;
+}
+
+static ret_t file_bench_read_registers(modbus_client_t* client, const file_bench_conf_t* conf,
+                                       uint16_t* data) {
+  uint32_t offset = 0;
+
+  while (offset < conf->regs) {
+    uint16_t n = tk_min(conf->regs - offset, MODBUS_MAX_READ_REGISTERS);
+    ret_t ret = modbus_client_read_registers(client, conf->addr + offset, n, data + offset);
+    return_value_if_fail(ret == RET_OK, ret);
+    offset += n;
+  }
+
+  return RET_OK;
+}
+
+/*把数据平均分成conf->records个记录*/
+static uint32_t file_bench_make_records(const file_bench_conf_t* conf, uint16_t* data,
+                                        modbus_file_record_t* records) {
+  uint32_t i = 0;
+  uint32_t offset = 0;
+  uint32_t size = (conf->regs + conf->records - 1) / conf->records;
+
+  for (i = 0; i < conf->records && offset < conf->regs; i++) {
+    records[i].file_number = conf->file;
+    records[i].record_number = conf->addr + offset;
+    records[i].record_length = tk_min(size, conf->regs - offset);
+    records[i].data = data + offset;
+    offset += records[i].record_length;
+  }
+
+  return i;
+}
+
+static ret_t file_bench_write_file(modbus_client_t* client, const file_bench_conf_t* conf,
+                                   uint16_t* data) {
+  modbus_file_record_t records[FILE_BENCH_MAX_RECORDS];
+  uint32_t nr = file_bench_make_records(conf, data, records);
+
+  return modbus_client_write_file_records(client, records, nr);
+}
+
+static ret_t file_bench_read_file(modbus_client_t* client, const file_bench_conf_t* conf,
+                                  uint16_t* data) {
+  modbus_file_record_t records[FILE_BENCH_MAX_RECORDS];
+  uint32_t nr = file_bench_make_records(conf, data, records);
+
+  return modbus_client_read_file_records(client, records, nr);
+}
+
+static ret_t file_bench_run(modbus_client_t* client, const file_bench_conf_t* conf,
+                            const char* name, file_bench_func_t func, uint16_t* data) {
+  uint32_t i = 0;
+  uint64_t start = 0;
+  uint64_t cost = 0;
+  ret_t ret = RET_OK;
+
+  modbus_client_reset_stats(client);
+  start = time_now_us();
+  for (i = 0; i < conf->rounds && ret == RET_OK; i++) {
+    ret = func(client, conf, data);
+  }
+  cost = time_now_us() - start;
+
+  if (ret != RET_OK) {
+    log_info("%-12s failed: ret=%d exception=%d\n", name, ret,
+             modbus_common_get_last_exception_code(MODBUS_COMMON(client)));
+    return ret;
+  }
+
+  log_info("%-12s rounds=%u regs=%u requests=%u (%.1f/round) elapsed=%.1fms %.0f regs/s\n", name,
+           conf->rounds, conf->regs, client->stats.num_requests,
+           (double)(client->stats.num_requests) / conf->rounds, cost / 1000.0,
+           cost > 0 ? (double)(conf->regs) * conf->rounds * 1000000.0 / cost : 0.0);
+
+  return RET_OK;
+}
+
+static ret_t file_bench_parse_args(file_bench_conf_t* conf, int argc, char* argv[]) {
+  int i = 0;
+
+  memset(conf, 0x00, sizeof(*conf));
+  conf->url = argv[1];
+  conf->slave = 0xff;
+  conf->file = 1;
+  conf->regs = 1000;
+  conf->records = 4;
+  conf->rounds = 100;
+
+  for (i = 2; i < argc; i++) {
+    const char* arg = argv[i];
+
+    if (tk_str_start_with(arg, "file=")) {
+      conf->file = tk_atoi(arg + 5);
+    } else if (tk_str_start_with(arg, "addr=")) {
+      conf->addr = tk_atoi(arg + 5);
+    } else if (tk_str_start_with(arg, "regs=")) {
+      conf->regs = tk_atoi(arg + 5);
+    } else if (tk_str_start_with(arg, "records=")) {
+      conf->records = tk_atoi(arg + 8);
+    } else if (tk_str_start_with(arg, "rounds=")) {
+      conf->rounds = tk_atoi(arg + 7);
+    } else if (tk_str_start_with(arg, "slave=")) {
+      conf->slave = tk_atoi(arg + 6);
+    } else {
+      log_info("invalid arg: %s\n", arg);
+      return RET_BAD_PARAMS;
+    }
+  }
+
+  return_value_if_fail(conf->regs > 0 && conf->rounds > 0, RET_BAD_PARAMS);
+  return_value_if_fail(conf->records > 0 && conf->records <= FILE_BENCH_MAX_RECORDS,
+                       RET_BAD_PARAMS);
+
+  return RET_OK;
+}
+
+int main(int argc, char* argv[]) {
+  uint32_t i = 0;
+  uint16_t* data = NULL;
+  file_bench_conf_t conf;
+  modbus_client_t* client = NULL;
+
+  platform_prepare();
+
+  if (argc < 2 || file_bench_parse_args(&conf, argc, argv) != RET_OK) {
+    log_info("Usage: %s url [file=N] [addr=A] [regs=N] [records=N] [rounds=N] [slave=ID]\n",
+             argv[0]);
+    log_info(" ex: %s tcp://localhost:502 file=1 regs=1000 records=4\n", argv[0]);
+    return 0;
+  }
+
+  tk_socket_init();
+
+  data = TKMEM_ZALLOCN(uint16_t, conf.regs);
+  client = modbus_client_create(conf.url);
+  if (data != NULL && client != NULL) {
+    modbus_client_set_slave(client, conf.slave);
+    for (i = 0; i < conf.regs; i++) {
+      data[i] = i;
+    }
+
+    log_info("url=%s file=%u addr=%u regs=%u records=%u\n", conf.url, conf.file, conf.addr,
+             conf.regs, conf.records);
+    file_bench_run(client, &conf, "fc16(write)", file_bench_write_registers, data);
+    file_bench_run(client, &conf, "fc21(write)", file_bench_write_file, data);
+    file_bench_run(client, &conf, "fc03(read)", file_bench_read_registers, data);
+    file_bench_run(client, &conf, "fc20(read)", file_bench_read_file, data);
+  }
+
+  if (client != NULL) {
+    modbus_client_destroy(client);
+  }
+  TKMEM_FREE(data);
+  tk_socket_deinit();
+
+  return 0;
+}
@@ -0,0 +1,356 @@
+/**
+ * File:   load_gen.c
+ * Author: AWTK Develop Team
+ * Brief:  modbus tcp load generator
+ *
+ * Copyright (c) 2023 - 2025 Guangzhou ZHIYUAN Electronics Co.,Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * License file for more details.
+ *
+ */
+
+/**
+ * History:
+ * ================================================================
+ * 2026-10-19 Li XianJing <lixianjing@zlg.cn> created
+ *
+ */
+
+#include "tkc/thread.h"
+#include "tkc/tokenizer.h"
+#include "tkc/time_now.h"
+#include "tkc/socket_helper.h"
+#include "modbus_client.h"
+#include "modbus_histogram.h"
+
+#define LOAD_GEN_MAX_OPS 9
+#define LOAD_GEN_MAX_CONNS 1024
+
+typedef struct _load_gen_op_t {
+  uint8_t func_code;
+  uint32_t weight;
+} load_gen_op_t;
+
+typedef struct _load_gen_conf_t {
+  const char* url;
+  uint8_t slave;
+  uint16_t addr;
+  uint16_t count;
+  uint32_t conns;
+  uint32_t duration;
+  uint32_t rate;
+  uint32_t ops_nr;
+  uint32_t total_weight;
+  load_gen_op_t ops[LOAD_GEN_MAX_OPS];
+} load_gen_conf_t;
+
+typedef struct _load_gen_worker_t {
+  const load_gen_conf_t* conf;
+  tk_thread_t* thread;
+  uint32_t seed;
+  bool_t connected;
+  uint64_t ok;
+  uint64_t failed;
+  uint64_t ok_by_fc[LOAD_GEN_MAX_OPS];
+  modbus_histogram_t latency;
+} load_gen_worker_t;
+
+static uint32_t load_gen_rand(load_gen_worker_t* worker) {
+  /*xorshift32: 每个线程独立的随机数，避免random()在线程间竞争*/
+  uint32_t x = worker->seed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  worker->seed = x;
+
+  return x;
+}
+
+static uint32_t load_gen_pick_op(load_gen_worker_t* worker) {
+  uint32_t i = 0;
+  const load_gen_conf_t* conf = worker->conf;
+  uint32_t n = load_gen_rand(worker) % conf->total_weight;
+
+  for (i = 0; i < conf->ops_nr; i++) {
+    if (n < conf->ops[i].weight) {
+      return i;
+    }
+    n -= conf->ops[i].weight;
+  }
+
+  return 0;
+}
+
+static ret_t load_gen_do_op(modbus_client_t* client, uint8_t func_code, uint16_t addr,
+                            uint16_t count, uint16_t* registers, uint8_t* bits) {
+  switch (func_code) {
+    case MODBUS_FC_READ_COILS: {
+      return modbus_client_read_bits(client, addr, tk_min(count, MODBUS_MAX_READ_BITS), bits);
+    }
+    case MODBUS_FC_READ_DISCRETE_INPUTS: {
+      return modbus_client_read_input_bits(client, addr, tk_min(count, MODBUS_MAX_READ_BITS),
+                                           bits);
+    }
+    case MODBUS_FC_READ_HOLDING_REGISTERS: {
+      return modbus_client_read_registers(client, addr, tk_min(count, MODBUS_MAX_READ_REGISTERS),
+                                          registers);
+    }
+    case MODBUS_FC_READ_INPUT_REGISTERS: {
+      return modbus_client_read_input_registers(client, addr,
+                                                tk_min(count, MODBUS_MAX_READ_REGISTERS), registers);
+    }
+    case MODBUS_FC_WRITE_SINGLE_COIL: {
+      return modbus_client_write_bit(client, addr, bits[0]);
+    }
+    case MODBUS_FC_WRITE_SINGLE_HOLDING_REGISTER: {
+      return modbus_client_write_register(client, addr, registers[0]);
+    }
+    case MODBUS_FC_WRITE_MULTIPLE_COILS: {
+      return modbus_client_write_bits(client, addr, tk_min(count, MODBUS_MAX_WRITE_BITS), bits);
+    }
+    case MODBUS_FC_WRITE_MULTIPLE_HOLDING_REGISTERS: {
+      return modbus_client_write_registers(client, addr, tk_min(count, MODBUS_MAX_WRITE_REGISTERS),
+                                           registers);
+    }
+    case MODBUS_FC_WRITE_AND_READ_REGISTERS: {
+      uint16_t n = tk_min(count, MODBUS_MAX_WR_WRITE_REGISTERS);
+      return modbus_client_write_and_read_registers(client, addr, n, registers, addr, n,
+                                                    registers);
+    }
+    default:
+      break;
+  }
+
+  return RET_NOT_IMPL;
+}
+
+static void* load_gen_worker_main(void* args) {
+  uint32_t i = 0;
+  uint64_t start = 0;
+  uint64_t deadline = 0;
+  uint64_t sent = 0;
+  uint64_t interval = 0;
+  uint8_t bits[MODBUS_MAX_READ_BITS];
+  uint16_t registers[MODBUS_MAX_READ_REGISTERS];
+  load_gen_worker_t* worker = (load_gen_worker_t*)args;
+  const load_gen_conf_t* conf = worker->conf;
+  modbus_client_t* client = modbus_client_create(conf->url);
+
+  if (client == NULL) {
+    log_warn("connect %s failed\n", conf->url);
+    return NULL;
+  }
+
+  worker->connected = TRUE;
+  modbus_client_set_slave(client, conf->slave);
+  for (i = 0; i < ARRAY_SIZE(registers); i++) {
+    registers[i] = (uint16_t)i;
+  }
+  for (i = 0; i < ARRAY_SIZE(bits); i++) {
+    bits[i] = (uint8_t)(i & 0x01);
+  }
+
+  interval = conf->rate > 0 ? 1000000 / conf->rate : 0;
+  start = time_now_us();
+  deadline = start + (uint64_t)(conf->duration) * 1000000;
+
+  while (TRUE) {
+    ret_t ret = RET_OK;
+    uint64_t t0 = time_now_us();
+    uint32_t op = load_gen_pick_op(worker);
+
+    if (interval > 0) {
+      /*开环模式：按计划时间计算延时，避免协同遗漏(coordinated omission)低估尾部延时*/
+      uint64_t planned = start + sent * interval;
+      if (planned > t0) {
+        sleep_us(planned - t0);
+      }
+      t0 = planned;
+    }
+
+    if (t0 >= deadline) {
+      break;
+    }
+
+    ret = load_gen_do_op(client, conf->ops[op].func_code, conf->addr, conf->count, registers, bits);
+    modbus_histogram_record(&(worker->latency), (uint32_t)(time_now_us() - t0));
+    sent++;
+
+    if (ret == RET_OK) {
+      worker->ok++;
+      worker->ok_by_fc[op]++;
+    } else {
+      worker->failed++;
+    }
+  }
+
+  modbus_client_destroy(client);
+
+  return NULL;
+}
+
+static ret_t load_gen_parse_mix(load_gen_conf_t* conf, const char* mix) {
+  tokenizer_t t;
+
+  conf->ops_nr = 0;
+  conf->total_weight = 0;
+  tokenizer_init(&t, mix, tk_strlen(mix), ",");
+  while (tokenizer_has_more(&t) && conf->ops_nr < LOAD_GEN_MAX_OPS) {
+    const char* item = tokenizer_next_str(&t);
+    const char* p = strchr(item, ':');
+    load_gen_op_t* op = conf->ops + conf->ops_nr;
+
+    op->func_code = (uint8_t)tk_atoi(item);
+    op->weight = p != NULL ? tk_atoi(p + 1) : 1;
+    if (op->weight > 0) {
+      conf->total_weight += op->weight;
+      conf->ops_nr++;
+    }
+  }
+  tokenizer_deinit(&t);
+
+  return conf->ops_nr > 0 ? RET_OK : RET_BAD_PARAMS;
+}
+
+static ret_t load_gen_parse_args(load_gen_conf_t* conf, int argc, char* argv[]) {
+  int i = 0;
+
+  memset(conf, 0x00, sizeof(*conf));
+  conf->url = argv[1];
+  conf->slave = 0xff;
+  conf->addr = 0;
+  conf->count = 10;
+  conf->conns = 1;
+  conf->duration = 10;
+  conf->rate = 0;
+  load_gen_parse_mix(conf, "3");
+
+  for (i = 2; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* value = strchr(arg, '=');
+    return_value_if_fail(value != NULL, RET_BAD_PARAMS);
+    value++;
+
+    if (tk_str_start_with(arg, "conns=")) {
+      conf->conns = tk_max(1, tk_min(tk_atoi(value), LOAD_GEN_MAX_CONNS));
+    } else if (tk_str_start_with(arg, "duration=")) {
+      conf->duration = tk_max(1, tk_atoi(value));
+    } else if (tk_str_start_with(arg, "rate=")) {
+      conf->rate = tk_atoi(value);
+    } else if (tk_str_start_with(arg, "addr=")) {
+      conf->addr = (uint16_t)tk_atoi(value);
+    } else if (tk_str_start_with(arg, "count=")) {
+      conf->count = (uint16_t)tk_max(1, tk_atoi(value));
+    } else if (tk_str_start_with(arg, "slave=")) {
+      conf->slave = (uint8_t)tk_atoi(value);
+    } else if (tk_str_start_with(arg, "mix=")) {
+      return_value_if_fail(load_gen_parse_mix(conf, value) == RET_OK, RET_BAD_PARAMS);
+    } else {
+      log_warn("unknown option: %s\n", arg);
+      return RET_BAD_PARAMS;
+    }
+  }
+
+  return RET_OK;
+}
+
+static void load_gen_report(const load_gen_conf_t* conf, load_gen_worker_t* workers,
+                            uint64_t elapsed_us) {
+  str_t str;
+  uint32_t i = 0;
+  uint32_t j = 0;
+  uint64_t ok = 0;
+  uint64_t failed = 0;
+  uint32_t connected = 0;
+  modbus_histogram_t* latency = TKMEM_ZALLOC(modbus_histogram_t);
+  return_if_fail(latency != NULL);
+
+  for (i = 0; i < conf->conns; i++) {
+    load_gen_worker_t* worker = workers + i;
+    ok += worker->ok;
+    failed += worker->failed;
+    connected += worker->connected ? 1 : 0;
+    modbus_histogram_merge(latency, &(worker->latency));
+  }
+
+  str_init(&str, 256);
+  str_append_format(&str, 256, "url=%s conns=%u/%u duration=%ums rate=%s\n", conf->url,
+                    connected, conf->conns, (uint32_t)(elapsed_us / 1000),
+                    conf->rate > 0 ? "open-loop" : "closed-loop");
+  for (j = 0; j < conf->ops_nr; j++) {
+    uint64_t n = 0;
+    for (i = 0; i < conf->conns; i++) {
+      n += workers[i].ok_by_fc[j];
+    }
+    str_append_format(&str, 128, "  fc=%u weight=%u ok=%llu\n", conf->ops[j].func_code,
+                      conf->ops[j].weight, (unsigned long long)n);
+  }
+  str_append_format(&str, 128, "requests: ok=%llu failed=%llu throughput=%.1f req/s\n",
+                    (unsigned long long)ok, (unsigned long long)failed,
+                    elapsed_us > 0 ? (ok + failed) * 1000000.0 / elapsed_us : 0.0);
+  modbus_histogram_to_str(latency, "latency(us)", &str);
+  log_info("%s", str.str);
+
+  str_reset(&str);
+  TKMEM_FREE(latency);
+}
+
+int main(int argc, char* argv[]) {
+  uint32_t i = 0;
+  int exit_code = 1;
+  uint64_t start = 0;
+  load_gen_conf_t conf;
+  load_gen_worker_t* workers = NULL;
+
+  platform_prepare();
+
+  if (argc < 2 || load_gen_parse_args(&conf, argc, argv) != RET_OK) {
+    log_info("Usage: %s url [conns=N] [duration=S] [rate=R] [mix=fc:weight,...] [addr=A] "
+             "[count=C] [slave=ID]\n",
+             argv[0]);
+    log_info(" rate: requests per second per connection, 0 means closed-loop.\n");
+    log_info(" ex: %s tcp://localhost:502 conns=16 duration=30 mix=3:70,16:20,1:10\n", argv[0]);
+    log_info(" ex: %s tcp://localhost:502 conns=4 rate=500 mix=4\n", argv[0]);
+    return 1;
+  }
+
+  tk_socket_init();
+
+  workers = TKMEM_ZALLOCN(load_gen_worker_t, conf.conns);
+  if (workers != NULL) {
+    for (i = 0; i < conf.conns; i++) {
+      load_gen_worker_t* worker = workers + i;
+      worker->conf = &conf;
+      worker->seed = 2463534242u + i * 7919;
+      modbus_histogram_init(&(worker->latency));
+      worker->thread = tk_thread_create(load_gen_worker_main, worker);
+    }
+
+    start = time_now_us();
+    for (i = 0; i < conf.conns; i++) {
+      if (workers[i].thread != NULL) {
+        tk_thread_start(workers[i].thread);
+      }
+    }
+
+    for (i = 0; i < conf.conns; i++) {
+      if (workers[i].thread != NULL) {
+        /*tk_thread_destroy会等待线程结束*/
+        tk_thread_destroy(workers[i].thread);
+      }
+    }
+
+    load_gen_report(&conf, workers, time_now_us() - start);
+    TKMEM_FREE(workers);
+    exit_code = 0;
+  } else {
+    log_info("out of memory: conns=%u\n", conf.conns);
+  }
+
+  tk_socket_deinit();
+
+  return exit_code;
+}
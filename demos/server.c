@@ -67,10 +67,9 @@ int main(int argc, char* argv[]) {
     start_rtu(esm, url, memory);
   }
 
+  /*阻塞到有请求(或者定时器到期)，不需要休眠*/
   while(1) {
     event_source_manager_dispatch(esm);
-
-    sleep_ms(50);
   }
 
   event_source_manager_destroy(esm);
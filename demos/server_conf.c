@@ -24,6 +24,7 @@
 #include "conf_io/conf_node.h"
 #include "conf_io/conf_ini.h"
 #include "modbus_memory_default.h"
+#include "modbus_service.h"
 
 static bool_t s_auto_inc_input_registers = FALSE;
 
@@ -99,3 +100,34 @@ static modbus_memory_t* server_conf_load_doc(conf_doc_t* doc) {
 
   return modbus_memory_init_data(m, doc);
 }
+
+static uint32_t server_conf_load_units(conf_doc_t* doc, modbus_memory_t** units) {
+  uint32_t n = 0;
+  conf_node_t* iter = NULL;
+  conf_node_t* node = conf_node_find_child(doc->root, "units");
+
+  if (node == NULL) {
+    return 0;
+  }
+
+  iter = conf_node_get_first_child(node);
+  while (iter != NULL) {
+    int32_t unit_id = conf_node_get_child_value_int32(iter, "unit_id", -1);
+    conf_node_t* channels = conf_node_find_child(iter, "channels");
+
+    if (unit_id < 0 || unit_id >= MODBUS_SERVICE_UNITS_NR || channels == NULL) {
+      log_debug("invalid unit: %d\n", unit_id);
+    } else if (units[unit_id] != NULL) {
+      log_debug("duplicated unit: %d\n", unit_id);
+    } else {
+      units[unit_id] = modbus_memory_default_create_with_conf(channels);
+      if (units[unit_id] != NULL) {
+        n++;
+      }
+    }
+
+    iter = iter->next;
+  }
+
+  return n;
+}
@@ -26,23 +26,40 @@
 #include "modbus_memory_default.h"
 #include "modbus_memory_custom.h"
 #include "tkc/socket_helper.h"
+#include "tkc/timer_manager.h"
+#include "tkc/event_source_timer.h"
 #include "streams/stream_factory.h"
 #include "streams/inet/iostream_tcp.h"
 #include "conf_io/conf_json.h"
 
 #include "server_conf.c"
 
-static ret_t start_rtu(event_source_manager_t* esm, const char* url, modbus_memory_t* memory,
-                       uint8_t unit_id) {
-  return modbus_service_rtu_start(esm, memory, url, unit_id);
+static modbus_memory_t* s_units[MODBUS_SERVICE_UNITS_NR];
+
+static ret_t add_default_unit(modbus_service_args_t* args) {
+  if (args->units != NULL && args->units[args->slave] == NULL) {
+    args->units[args->slave] = args->memory;
+  }
+
+  return RET_OK;
+}
+
+static ret_t start_rtu(event_source_manager_t* esm, const char* url,
+                       modbus_service_args_t* args) {
+  args->proto = MODBUS_PROTO_RTU;
+  add_default_unit(args);
+  return modbus_service_rtu_start_by_args(esm, args, url);
 }
 
-static ret_t start_tcp(event_source_manager_t* esm, const char* url, modbus_memory_t* memory,
+static ret_t start_tcp(event_source_manager_t* esm, const char* url, modbus_service_args_t* args,
                        modbus_proto_t proto) {
   const char* p = strrchr(url, ':');
   int port = p != NULL ? tk_atoi(p + 1) : 502;
 
-  return modbus_service_tcp_start(esm, memory, port, proto, MODBUS_DEMO_SLAVE_ID);
+  args->proto = proto;
+  args->slave = MODBUS_DEMO_SLAVE_ID;
+  add_default_unit(args);
+  return modbus_service_tcp_start_by_args(esm, args, port);
 }
 
 static ret_t update_input_registers(modbus_memory_default_t* memory_default) {
@@ -59,14 +76,41 @@ static ret_t update_input_registers(modbus_memory_default_t* memory_default) {
   return RET_OK;
 }
 
+/*定时更新输入寄存器(单位毫秒)*/
+#define UPDATE_INPUT_REGISTERS_INTERVAL 100
+
+static ret_t on_update_input_registers(const timer_info_t* info) {
+  update_input_registers(MODBUS_MEMORY_DEFAULT(info->ctx));
+
+  return RET_REPEAT;
+}
+
+/*用定时器更新，事件循环不需要按固定间隔休眠*/
+static ret_t start_update_input_registers(event_source_manager_t* esm, modbus_memory_t* memory) {
+  event_source_t* source = NULL;
+  timer_manager_t* timer_manager = timer_manager_create();
+  return_value_if_fail(timer_manager != NULL, RET_OOM);
+
+  timer_manager_add(timer_manager, on_update_input_registers, memory,
+                    UPDATE_INPUT_REGISTERS_INTERVAL);
+  source = event_source_timer_create(timer_manager);
+  return_value_if_fail(source != NULL, RET_OOM);
+
+  event_source_manager_add(esm, source);
+  TK_OBJECT_UNREF(source);
+
+  return RET_OK;
+}
+
 static ret_t start_modbus_server_with_conf(const char* filename) {
   uint32_t size = 0;
   const char* url = NULL;
   uint8_t unit_id = 0xff;
+  int32_t diag_addr = -1;
   conf_doc_t* doc = NULL;
+  static modbus_service_args_t args;
   modbus_memory_t* memory = NULL;
   event_source_manager_t* esm = NULL;
-  modbus_memory_default_t* memory_default = NULL;
   char* data = (char*)file_read(filename, &size);
   return_value_if_fail(data != NULL, RET_OOM);
 
@@ -81,25 +125,43 @@ static ret_t start_modbus_server_with_conf(const char* filename) {
   } else {
     unit_id = conf_doc_get_int(doc, "unit_id", 0xff);
   }
-  log_debug("url=%s unit_id=%d\n", url, unit_id);
+  diag_addr = conf_doc_get_int(doc, "diag_addr", -1);
+  log_debug("url=%s unit_id=%d diag_addr=%d\n", url, unit_id, diag_addr);
   esm = event_source_manager_default_create();
 
   goto_error_if_fail(memory != NULL && url != NULL && esm != NULL);
+  memset(&args, 0x00, sizeof(args));
+  args.memory = memory;
+  args.slave = unit_id;
+  args.diag_enable = diag_addr >= 0;
+  args.diag_addr = diag_addr >= 0 ? (uint16_t)diag_addr : 0;
+  args.rate_limit = conf_doc_get_int(doc, "rate_limit", 0);
+  args.rate_burst = conf_doc_get_int(doc, "rate_burst", 0);
+  args.max_in_flight = conf_doc_get_int(doc, "max_in_flight", 0);
+  args.idle_timeout = conf_doc_get_int(doc, "idle_timeout", 0);
+  args.max_connections = conf_doc_get_int(doc, "max_connections", 0);
+  args.pool_size = conf_doc_get_int(doc, "pool_size", 0);
+  if (server_conf_load_units(doc, s_units) > 0) {
+    args.units = s_units;
+  }
+
   if (tk_str_start_with(url, STR_SCHEMA_TCP)) {
-    start_tcp(esm, url, memory, MODBUS_PROTO_TCP);
+    start_tcp(esm, url, &args, MODBUS_PROTO_TCP);
   } else if (tk_str_start_with(url, STR_SCHEMA_RTU_OVER_TCP)) {
-    start_tcp(esm, url, memory, MODBUS_PROTO_RTU);
+    start_tcp(esm, url, &args, MODBUS_PROTO_RTU);
   } else {
-    start_rtu(esm, url, memory, unit_id);
+    start_rtu(esm, url, &args);
   }
   conf_doc_destroy(doc);
   doc = NULL;
 
-  memory_default = MODBUS_MEMORY_DEFAULT(memory);
+  if (s_auto_inc_input_registers) {
+    start_update_input_registers(esm, memory);
+  }
+
+  /*阻塞到有请求(或者定时器到期)，收到请求立即处理*/
   while (1) {
     event_source_manager_dispatch(esm);
-    sleep_ms(100);
-    update_input_registers(memory_default);
   }
 
   event_source_manager_destroy(esm);
@@ -110,6 +172,13 @@ error:
   }
 
   if (memory != NULL) {
+    uint32_t i = 0;
+    for (i = 0; i < ARRAY_SIZE(s_units); i++) {
+      if (s_units[i] != NULL && s_units[i] != memory) {
+        modbus_memory_destroy(s_units[i]);
+      }
+      s_units[i] = NULL;
+    }
     modbus_memory_destroy(memory);
   }
 
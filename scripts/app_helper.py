@@ -8,5 +8,8 @@ def Helper(ARGUMENTS):
     
     COMPILE_CONFIG['BUILD_TESTS'] = { 'value' : True, 'type' : bool.__name__, 'desc' : ['build awtk-modbus\'s gtest demo'], 'help_info' : 'build awtk-modbus\'s gtest demo, value is true or false, default value is true' }
     COMPILE_CONFIG['BUILD_DEMOS'] = { 'value' : True, 'type' : bool.__name__, 'desc' : ['build awtk-modbus\'s demo examples'], 'help_info' : 'build awtk-modbus\'s demo examples, value is true or false, default value is true' }
+    COMPILE_CONFIG['BUILD_BENCH'] = { 'value' : True, 'type' : bool.__name__, 'desc' : ['build awtk-modbus\'s benchmark tools'], 'help_info' : 'build awtk-modbus\'s benchmark tools, value is true or false, default value is true' }
+    COMPILE_CONFIG['STATIC_BUFFERS'] = { 'value' : False, 'type' : bool.__name__, 'desc' : ['use fixed-size buffers instead of heap allocations in request paths'], 'help_info' : 'define MODBUS_STATIC_BUFFERS, value is true or false, default value is false' }
+    COMPILE_CONFIG['STATIC_MEMORY'] = { 'value' : False, 'type' : bool.__name__, 'desc' : ['static memory profile for small MCUs'], 'help_info' : 'define MODBUS_STATIC_MEMORY(implies MODBUS_STATIC_BUFFERS), value is true or false, default value is false' }
 
     return AppHelperBase(ARGUMENTS)
\ No newline at end of file
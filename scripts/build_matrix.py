@@ -0,0 +1,117 @@
+import os
+import sys
+import glob
+import shutil
+import tempfile
+import subprocess
+
+import awtk_locator as locator
+import size_report
+
+# 用不同的编译选项(见src/modbus_types_def.h)编译src中的全部文件，比较代码大小。
+# 用法: python scripts/build_matrix.py [AWTK_ROOT=path] [CC=gcc] [CFLAGS=...] [SIZE=size] [NM=nm] [VERBOSE=True]
+# service/client两列是modbus_service_t/modbus_client_t的大小(见scripts/size_probe.c)。
+# 任何一个配置编译失败时返回非0。
+
+CONFIGS = [
+    ('default', []),
+    ('no-client', ['-DMODBUS_WITH_CLIENT=0']),
+    ('no-tcp', ['-DMODBUS_WITH_TCP=0']),
+    ('no-fc23', ['-DMODBUS_WITH_FC23=0']),
+    ('no-file-record', ['-DMODBUS_WITH_FILE_RECORD=0']),
+    ('no-stats', ['-DMODBUS_WITH_STATS=0']),
+    ('rtu-slave', ['-DMODBUS_WITH_CLIENT=0', '-DMODBUS_WITH_TCP=0', '-DMODBUS_WITH_FC23=0',
+                   '-DMODBUS_WITH_FILE_RECORD=0']),
+    ('rtu-slave-static', ['-DMODBUS_WITH_CLIENT=0', '-DMODBUS_WITH_TCP=0',
+                          '-DMODBUS_WITH_FC23=0', '-DMODBUS_WITH_FILE_RECORD=0',
+                          '-DMODBUS_STATIC_MEMORY']),
+]
+
+ROOT = os.path.abspath(os.path.join(os.path.dirname(__file__), '..'))
+
+
+def parse_args(args):
+    conf = {'CC': os.environ.get('CC', 'gcc'), 'CFLAGS': os.environ.get('CFLAGS', ''),
+            'SIZE': os.environ.get('SIZE', 'size'), 'NM': os.environ.get('NM', 'nm'),
+            'VERBOSE': 'False'}
+    arguments = {}
+
+    for arg in args:
+        if '=' not in arg:
+            print('Usage: python ' + sys.argv[0] +
+                  ' [AWTK_ROOT=path] [CC=gcc] [CFLAGS=...] [SIZE=size] [NM=nm] [VERBOSE=True]')
+            sys.exit(0)
+        key, value = arg.split('=', 1)
+        arguments[key] = value
+        conf[key] = value
+
+    locator.init(arguments)
+
+    return conf
+
+
+def build(conf, name, defines, out_dir):
+    objs = []
+    awtk_src = os.path.join(locator.getAwtkRoot(), 'src')
+    flags = ['-c', '-Os', '-DHAS_STDIO', '-DWITH_SOCKET', '-I' + awtk_src,
+             '-I' + os.path.join(ROOT, 'src')] + conf['CFLAGS'].split() + defines
+
+    if sys.platform.startswith('linux'):
+        flags.append('-DLINUX')
+
+    for src in sorted(glob.glob(os.path.join(ROOT, 'src', '*.c'))):
+        obj = os.path.join(out_dir, os.path.basename(src)[:-2] + '.o')
+        if subprocess.call([conf['CC']] + flags + [src, '-o', obj]) != 0:
+            print('%s: failed to compile %s' % (name, src))
+            return None
+        objs.append(obj)
+
+    probe = os.path.join(out_dir, 'size_probe.o')
+    if subprocess.call([conf['CC']] + flags + [os.path.join(ROOT, 'scripts', 'size_probe.c'),
+                                               '-o', probe]) != 0:
+        print('%s: failed to compile size_probe.c' % name)
+        return None
+
+    return objs, probe
+
+
+def main():
+    failed = 0
+    base = None
+    conf = parse_args(sys.argv[1:])
+    out_dir = tempfile.mkdtemp(prefix='modbus_matrix_')
+
+    print('%-18s %8s %8s %8s %8s %8s %8s' % ('config', 'text', 'data', 'bss', 'delta', 'service',
+                                           'client'))
+    try:
+        for (name, defines) in CONFIGS:
+            result = build(conf, name, defines, out_dir)
+            if result is None:
+                failed += 1
+                continue
+
+            objs, probe = result
+            modules = size_report.run_size(conf['SIZE'], objs)
+            structs = dict(size_report.run_nm(conf['NM'], probe))
+            text = sum(m[1] for m in modules)
+            data = sum(m[2] for m in modules)
+            bss = sum(m[3] for m in modules)
+            if base is None:
+                base = text + data
+            print('%-18s %8d %8d %8d %+8d %8d %8s' % (name, text, data, bss, text + data - base,
+                                                     structs.get('modbus_service_t', 0),
+                                                     structs.get('modbus_client_t', '-')))
+
+            if conf['VERBOSE'] == 'True':
+                size_report.report(modules)
+                print('')
+                size_report.report_structs(structs.items())
+                print('')
+    finally:
+        shutil.rmtree(out_dir)
+
+    return 1 if failed > 0 else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
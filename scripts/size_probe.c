@@ -0,0 +1,39 @@
+/**
+ * File:   size_probe.c
+ * Author: AWTK Develop Team
+ * Brief:  expose the size of the main structs as symbols for size_report.py
+ *
+ * Copyright (c) 2023 - 2025 Guangzhou ZHIYUAN Electronics Co.,Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * License file for more details.
+ *
+ */
+
+/**
+ * History:
+ * ================================================================
+ * 2026-10-19 Li XianJing <lixianjing@zlg.cn> created
+ *
+ */
+
+#include "modbus_service.h"
+#include "modbus_memory_default.h"
+#include "modbus_server_channel.h"
+#if MODBUS_WITH_CLIENT
+#include "modbus_client.h"
+#endif /*MODBUS_WITH_CLIENT*/
+
+/*只编译不链接：每个符号的大小(nm -S)就是对应结构体的大小，交叉编译时也不需要运行目标程序。*/
+#define MODBUS_SIZEOF(type) char modbus_sizeof_##type[sizeof(type)]
+
+MODBUS_SIZEOF(modbus_service_t);
+MODBUS_SIZEOF(modbus_service_stats_t);
+MODBUS_SIZEOF(modbus_histogram_t);
+MODBUS_SIZEOF(modbus_memory_default_t);
+MODBUS_SIZEOF(modbus_server_channel_t);
+#if MODBUS_WITH_CLIENT
+MODBUS_SIZEOF(modbus_client_t);
+#endif /*MODBUS_WITH_CLIENT*/
@@ -0,0 +1,105 @@
+import os
+import sys
+import subprocess
+
+# 统计库/目标文件各个模块的flash(text+data)和RAM(data+bss)占用。
+# 用法: python scripts/size_report.py [--size=arm-none-eabi-size] libmodbus.a|*.o ...
+# 也可以用环境变量SIZE指定size工具(交叉编译时)。
+#
+# --structs=size_probe.o 同时列出主要结构体(modbus_service_t/modbus_client_t等)的大小，
+# size_probe.o由scripts/size_probe.c用编译库时相同的宏编译得到，用nm(--nm或者环境变量NM)读取。
+
+def usage():
+    print('Usage: python ' + sys.argv[0] +
+          ' [--size=SIZE_TOOL] [--nm=NM_TOOL] [--structs=size_probe.o] file.a|file.o ...')
+    print(' ex: python ' + sys.argv[0] + ' lib/libmodbus.a')
+    print(' ex: python ' + sys.argv[0] + ' --size=arm-none-eabi-size build/*.o')
+    print(' ex: python ' + sys.argv[0] + ' --nm=arm-none-eabi-nm --structs=build/size_probe.o build/*.o')
+    sys.exit(0)
+
+
+def parse_args(args):
+    size_tool = os.environ.get('SIZE', 'size')
+    nm_tool = os.environ.get('NM', 'nm')
+    probe = None
+    files = []
+
+    for arg in args:
+        if arg.startswith('--size='):
+            size_tool = arg[len('--size='):]
+        elif arg.startswith('--nm='):
+            nm_tool = arg[len('--nm='):]
+        elif arg.startswith('--structs='):
+            probe = arg[len('--structs='):]
+        elif arg.startswith('-'):
+            usage()
+        else:
+            files.append(arg)
+
+    if len(files) == 0:
+        usage()
+
+    return size_tool, nm_tool, probe, files
+
+
+def run_size(size_tool, files):
+    output = subprocess.check_output([size_tool, '-B'] + files)
+    modules = []
+
+    # text    data     bss     dec     hex filename
+    for line in output.decode('utf-8', 'ignore').splitlines()[1:]:
+        items = line.split()
+        if len(items) < 6 or not items[0].isdigit():
+            continue
+        name = os.path.basename(' '.join(items[5:]).split(' (ex ')[0])
+        modules.append((name, int(items[0]), int(items[1]), int(items[2])))
+
+    return modules
+
+
+def run_nm(nm_tool, probe):
+    prefix = 'modbus_sizeof_'
+    output = subprocess.check_output([nm_tool, '-S', probe])
+    structs = []
+
+    # address size type name
+    for line in output.decode('utf-8', 'ignore').splitlines():
+        items = line.split()
+        if len(items) != 4:
+            continue
+        name = items[3].lstrip('_')
+        if name.startswith(prefix):
+            structs.append((name[len(prefix):], int(items[1], 16)))
+
+    return structs
+
+
+def report_structs(structs):
+    print('%-32s %8s' % ('struct', 'size'))
+    for (name, size) in sorted(structs):
+        print('%-32s %8d' % (name, size))
+
+
+def report(modules):
+    total_text = 0
+    total_data = 0
+    total_bss = 0
+
+    modules.sort(key=lambda m: m[1] + m[2], reverse=True)
+    print('%-32s %8s %8s %8s %8s %8s' % ('module', 'text', 'data', 'bss', 'flash', 'ram'))
+    for (name, text, data, bss) in modules:
+        print('%-32s %8d %8d %8d %8d %8d' % (name, text, data, bss, text + data, data + bss))
+        total_text += text
+        total_data += data
+        total_bss += bss
+
+    print('%-32s %8d %8d %8d %8d %8d' % ('total', total_text, total_data, total_bss,
+                                         total_text + total_data, total_data + total_bss))
+
+
+if __name__ == '__main__':
+    size_tool, nm_tool, probe, files = parse_args(sys.argv[1:])
+    report(run_size(size_tool, files))
+    if probe is not None:
+        print('')
+        report_structs(run_nm(nm_tool, probe))
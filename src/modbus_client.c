@@ -20,6 +20,7 @@
  */
 
 #include "tkc/url.h"
+#include "tkc/thread.h"
 #include "tkc/time_now.h"
 //#include "streams/inet/iostream_tcp.h"
 #include "streams/serial/iostream_serial.h"
@@ -27,9 +28,33 @@
 
 #include "modbus_client.h"
 
+#if MODBUS_WITH_CLIENT
+
 #define MODBUS_CLIENT_DEFAULT_RETRY_TIMES 3
 
+#define MODBUS_CLIENT_IS_READ_BITS(func_code) \
+  ((func_code) == MODBUS_FC_READ_COILS || (func_code) == MODBUS_FC_READ_DISCRETE_INPUTS)
+
+/*一次请求的参数(未使用的字段为0)*/
+typedef struct _modbus_client_req_t {
+  uint8_t func_code;
+  uint16_t addr;
+  uint16_t count;
+  uint16_t value;
+  const void* data;
+  uint16_t read_addr;
+  uint16_t read_count;
+  void* buff;
+  uint16_t or_mask;
+  uint16_t* result_count;
+} modbus_client_req_t;
+
 static ret_t modbus_client_deinit(modbus_client_t* client);
+static ret_t modbus_client_init_lock(modbus_client_t* client);
+static ret_t modbus_client_deinit_lock(modbus_client_t* client);
+static ret_t modbus_client_request(modbus_client_t* client, modbus_client_req_t* req);
+static ret_t modbus_client_read(modbus_client_t* client, uint8_t func_code, uint16_t addr,
+                                uint16_t count, void* buff);
 
 static uint32_t modbus_client_calculate_frame_gap_time(tk_iostream_t* io) {
   float_t frame_bits = 1;
@@ -56,9 +81,17 @@ static uint32_t modbus_client_calculate_frame_gap_time(tk_iostream_t* io) {
 
 static ret_t modbus_client_init_with_io(modbus_client_t* client, tk_iostream_t* io, modbus_proto_t proto, uint32_t retry_times) {
   return_value_if_fail(client!= NULL && io != NULL, RET_BAD_PARAMS);
+#ifdef MODBUS_STATIC_BUFFERS
+  /*使用内嵌的固定缓冲区，tk_client_deinit不会释放它*/
+  client->client.io = io;
+  wbuffer_init(&(client->client.wb), client->wbuffer_data, sizeof(client->wbuffer_data));
+#else
   tk_client_init(&(client->client), io, NULL);
+#endif /*MODBUS_STATIC_BUFFERS*/
   modbus_common_init(&client->common, io, proto, &(client->client.wb));
   modbus_client_set_retry_times(client, retry_times);
+  client->turnaround_delay = MODBUS_TURNAROUND_DELAY;
+  client->frame_gap_spin_time = MODBUS_FRAME_GAP_SPIN_TIME;
   client->is_connected = TRUE;
   client->auto_reconnect = TRUE;
   return RET_OK;
@@ -71,10 +104,15 @@ modbus_client_t* modbus_client_create_with_io(tk_iostream_t* io, modbus_proto_t
   client = TKMEM_ZALLOC(modbus_client_t);
   goto_error_if_fail(client != NULL);
 
+  goto_error_if_fail(modbus_client_init_lock(client) == RET_OK);
   goto_error_if_fail(modbus_client_init_with_io(client, io, proto, MODBUS_CLIENT_DEFAULT_RETRY_TIMES) == RET_OK);
 
   return client;
 error:
+  if (client != NULL) {
+    modbus_client_deinit_lock(client);
+    TKMEM_FREE(client);
+  }
   TK_OBJECT_UNREF(io);
 
   return NULL;
@@ -123,6 +161,7 @@ modbus_client_t* modbus_client_create(const char* url) {
   return_value_if_fail(client != NULL, NULL);
   client->url = tk_strdup(url);
   goto_error_if_fail(client->url != NULL);
+  goto_error_if_fail(modbus_client_init_lock(client) == RET_OK);
 
   io = modbus_client_create_iostream(client->url);
   goto_error_if_fail(io != NULL);
@@ -152,6 +191,22 @@ ret_t modbus_client_set_frame_gap_time(modbus_client_t* client, uint32_t frame_g
   return RET_OK;
 }
 
+ret_t modbus_client_set_frame_gap_spin_time(modbus_client_t* client, uint32_t spin_time) {
+  return_value_if_fail(client != NULL, RET_BAD_PARAMS);
+
+  client->frame_gap_spin_time = spin_time;
+
+  return RET_OK;
+}
+
+ret_t modbus_client_set_turnaround_delay(modbus_client_t* client, uint32_t turnaround_delay) {
+  return_value_if_fail(client != NULL, RET_BAD_PARAMS);
+
+  client->turnaround_delay = turnaround_delay;
+
+  return RET_OK;
+}
+
 ret_t modbus_client_set_retry_times(modbus_client_t* client, uint32_t retry_times) {
   return_value_if_fail(client != NULL, RET_BAD_PARAMS);
 
@@ -161,13 +216,48 @@ ret_t modbus_client_set_retry_times(modbus_client_t* client, uint32_t retry_time
 }
 
 static ret_t modbus_client_wait_for_frame_gap_time(modbus_client_t* client, uint64_t start_time) {
-  uint64_t diff = time_now_us() - start_time;
+  uint64_t now = time_now_us();
+  uint64_t diff = now - start_time;
+
+  client->resp_time = now;
   if (diff < client->frame_gap_time) {
-    sleep_us(client->frame_gap_time - diff);
+    modbus_common_wait_until(start_time + client->frame_gap_time, client->frame_gap_spin_time);
   }
   return RET_OK;
 }
 
+static bool_t modbus_client_is_broadcast(modbus_client_t* client) {
+  modbus_common_t* common = MODBUS_COMMON(client);
+
+  return common->proto == MODBUS_PROTO_RTU && common->slave == MODBUS_BROADCAST_ADDRESS;
+}
+
+static bool_t modbus_client_is_write_func_code(uint8_t func_code) {
+  switch (func_code) {
+    case MODBUS_FC_WRITE_SINGLE_COIL:
+    case MODBUS_FC_WRITE_SINGLE_HOLDING_REGISTER:
+    case MODBUS_FC_WRITE_MULTIPLE_COILS:
+    case MODBUS_FC_WRITE_MULTIPLE_HOLDING_REGISTERS:
+    case MODBUS_FC_MASK_WRITE_REGISTER:
+    case MODBUS_FC_WRITE_FILE_RECORD: {
+      return TRUE;
+    }
+    default: {
+      return FALSE;
+    }
+  }
+}
+
+/*广播请求没有响应，等待从站处理完成后再发送下一个请求*/
+static ret_t modbus_client_wait_for_turnaround_delay(modbus_client_t* client) {
+  if (client->turnaround_delay > 0) {
+    sleep_ms(client->turnaround_delay);
+  }
+  client->resp_time = time_now_us();
+
+  return RET_OK;
+}
+
 static ret_t modbus_client_check_and_set_recv_timeout(modbus_client_t* client, uint64_t start_time) {
   uint64_t diff = time_now_ms() - start_time;
   modbus_common_t* common = MODBUS_COMMON(client);
@@ -202,161 +292,205 @@ static ret_t modbus_client_check_and_auto_connect(modbus_client_t* client) {
   return modbus_client_init(client, client->url, io, common->slave, client->retry_times);
 }
 
-static ret_t modbus_client_read_bits_ex(modbus_client_t* client, uint16_t func_code, uint16_t addr,
-                                        uint16_t count, uint8_t* buff) {
-  uint64_t t = 0;
-  ret_t ret = RET_OK;
-  modbus_common_t* common = MODBUS_COMMON(client);
-  return_value_if_fail(common != NULL && buff != NULL, RET_BAD_PARAMS);
+static modbus_client_stats_t* modbus_client_get_unit_stats_ex(modbus_client_t* client,
+                                                              uint8_t unit_id, bool_t create) {
+#if MODBUS_WITH_STATS
+  modbus_client_stats_t* stats = client->unit_stats[unit_id];
 
-  t = time_now_ms();
-  ret = modbus_common_send_read_bits_req(common, func_code, addr, count);
-  return_value_if_fail(ret == RET_OK, ret);
+  if (stats == NULL && create) {
+    stats = TKMEM_ZALLOC(modbus_client_stats_t);
+    client->unit_stats[unit_id] = stats;
+  }
 
-  if (modbus_client_check_and_set_recv_timeout(client, t) != RET_OK) {
-    return RET_TIMEOUT;
+  return stats;
+#else
+  (void)client;
+  (void)unit_id;
+  (void)create;
+
+  return NULL;
+#endif /*MODBUS_WITH_STATS*/
+}
+
+/*统计数据由占用总线的线程更新，其它线程读取，所以读写都在client->mutex中进行。*/
+static void modbus_client_stats_lock(modbus_client_t* client) {
+  if (client->mutex != NULL) {
+    tk_mutex_lock(client->mutex);
   }
-  t = time_now_us();
-  ret = modbus_common_recv_read_bits_resp(common, func_code, buff, &count);
-  modbus_client_wait_for_frame_gap_time(client, t);
-  return ret;
 }
 
-static ret_t modbus_client_flush_read_buffer(modbus_client_t* client) {
-  modbus_common_t* common = MODBUS_COMMON(client);
-  return_value_if_fail(common != NULL, RET_BAD_PARAMS);
+static void modbus_client_stats_unlock(modbus_client_t* client) {
+  if (client->mutex != NULL) {
+    tk_mutex_unlock(client->mutex);
+  }
+}
 
-  log_debug("%s flush read buffer\n", __FUNCTION__);
-  return modbus_common_flush_read_buffer(common);
+static ret_t modbus_client_stats_update(modbus_client_stats_t* stats, ret_t ret,
+                                        bool_t is_exception, bool_t is_timeout, int64_t rtt) {
+  stats->num_requests++;
+
+  if (rtt >= 0) {
+    modbus_histogram_record(&(stats->rtt), rtt > 0xffffffff ? 0xffffffff : (uint32_t)rtt);
+  }
+
+  if (ret == RET_OK) {
+    stats->num_ok++;
+    return RET_OK;
+  }
+
+  if (is_exception) {
+    stats->num_exceptions++;
+  } else if (is_timeout) {
+    stats->num_timeouts++;
+  } else if (ret == RET_CRC) {
+    stats->num_crc_errors++;
+  } else if (ret == RET_SKIP) {
+    stats->num_slave_mismatches++;
+  } else {
+    stats->num_io_errors++;
+  }
+
+  stats->last_error = ret;
+  stats->last_error_time = time_now_ms();
+
+  return RET_OK;
 }
 
-// RET_SKIP 表示slave不匹配，需要跳过。（返回时已清空缓冲区）
-#define MODBUS_NEED_RETRY(ret) ((ret) == RET_CRC || (ret) == RET_SKIP)
+static ret_t modbus_client_on_retry(modbus_client_t* client) {
+  modbus_client_stats_t* unit_stats = NULL;
 
-ret_t modbus_client_read_bits(modbus_client_t* client, uint16_t addr, uint16_t count,
-                              uint8_t* buff) {
-  uint32_t i = 0;
-  ret_t ret = RET_OK;
-  return_value_if_fail(client != NULL && buff != NULL, RET_BAD_PARAMS);
-  ret = modbus_client_check_and_auto_connect(client);
-  if (ret != RET_OK) {
-    return ret;
+  modbus_client_stats_lock(client);
+  unit_stats = modbus_client_get_unit_stats_ex(client, client->common.slave, FALSE);
+  client->stats.num_retries++;
+  if (unit_stats != NULL) {
+    unit_stats->num_retries++;
   }
+  modbus_client_stats_unlock(client);
 
-  for (i = 0; i < client->retry_times; i++) {
-    ret = modbus_client_read_bits_ex(client, MODBUS_FC_READ_COILS, addr, count, buff);
-    if (!MODBUS_NEED_RETRY(ret)) {
-      modbus_client_check_connect_status(client, ret);
-      return ret;
-    }
+  return RET_OK;
+}
 
-    log_debug("%s retry:%d\n", __FUNCTION__, i + 1);
+static ret_t modbus_client_begin_request(modbus_client_t* client, uint32_t retry) {
+  if (retry > 0) {
+    modbus_client_on_retry(client);
   }
 
-  modbus_client_check_connect_status(client, ret);
-  // clear the old resp data when comm error, ensure the next req and resp tid sync
-  modbus_client_flush_read_buffer(client);
-  return ret;
+  client->resp_time = 0;
+  client->req_start_time = time_now_us();
+  client->req_num_exceptions = client->common.num_exceptions;
+
+  return RET_OK;
 }
 
-ret_t modbus_client_read_input_bits(modbus_client_t* client, uint16_t addr, uint16_t count,
-                                    uint8_t* buff) {
-  uint32_t i = 0;
-  ret_t ret = RET_OK;
-  return_value_if_fail(client != NULL && buff != NULL, RET_BAD_PARAMS);
-  ret = modbus_client_check_and_auto_connect(client);
-  if (ret != RET_OK) {
-    return ret;
+static ret_t modbus_client_end_request(modbus_client_t* client, ret_t ret) {
+  int64_t rtt = -1;
+  bool_t is_timeout = ret == RET_TIMEOUT;
+  modbus_common_t* common = MODBUS_COMMON(client);
+  bool_t is_exception = common->num_exceptions != client->req_num_exceptions;
+  modbus_client_stats_t* unit_stats = NULL;
+
+  if (ret == RET_IO && common->io != NULL) {
+    /*连接正常但数据没有收全，认为是超时*/
+    is_timeout = tk_object_get_prop_bool(TK_OBJECT(common->io), TK_STREAM_PROP_IS_OK, FALSE);
   }
 
-  for (i = 0; i < client->retry_times; i++) {
-    ret = modbus_client_read_bits_ex(client, MODBUS_FC_READ_DISCRETE_INPUTS, addr, count, buff);
-    if (!MODBUS_NEED_RETRY(ret)) {
-      modbus_client_check_connect_status(client, ret);
-      return ret;
-    }
+  if ((ret == RET_OK || is_exception) && client->resp_time >= client->req_start_time) {
+    rtt = client->resp_time - client->req_start_time;
+  }
 
-    log_debug("%s retry:%d\n", __FUNCTION__, i + 1);
+  modbus_client_stats_lock(client);
+  unit_stats = modbus_client_get_unit_stats_ex(client, common->slave, TRUE);
+  modbus_client_stats_update(&(client->stats), ret, is_exception, is_timeout, rtt);
+  if (unit_stats != NULL) {
+    modbus_client_stats_update(unit_stats, ret, is_exception, is_timeout, rtt);
   }
+  modbus_client_stats_unlock(client);
 
-  modbus_client_check_connect_status(client, ret);
-  // clear the old resp data when comm error, ensure the next req and resp tid sync
-  modbus_client_flush_read_buffer(client);
-  return ret;
+  return RET_OK;
+}
+
+static ret_t modbus_client_send_read_req(modbus_client_t* client, uint8_t func_code,
+                                         uint16_t addr, uint16_t count) {
+  modbus_common_t* common = MODBUS_COMMON(client);
+  return_value_if_fail(common != NULL, RET_BAD_PARAMS);
+
+  if (MODBUS_CLIENT_IS_READ_BITS(func_code)) {
+    return modbus_common_send_read_bits_req(common, func_code, addr, count);
+  } else {
+    return modbus_common_send_read_registers_req(common, func_code, addr, count);
+  }
 }
 
-static ret_t modbus_client_read_registers_ex(modbus_client_t* client, uint16_t func_code,
-                                             uint16_t addr, uint16_t count, uint16_t* buff) {
+static ret_t modbus_client_recv_read_resp(modbus_client_t* client, uint8_t func_code,
+                                          uint16_t count, void* buff, uint64_t start_time) {
   uint64_t t = 0;
   ret_t ret = RET_OK;
   modbus_common_t* common = MODBUS_COMMON(client);
   return_value_if_fail(common != NULL && buff != NULL, RET_BAD_PARAMS);
 
-  t = time_now_ms();
-  ret = modbus_common_send_read_registers_req(common, func_code, addr, count);
-  return_value_if_fail(ret == RET_OK, ret);
-
-  if (modbus_client_check_and_set_recv_timeout(client, t) != RET_OK) {
+  if (modbus_client_check_and_set_recv_timeout(client, start_time) != RET_OK) {
     return RET_TIMEOUT;
   }
+
   t = time_now_us();
-  ret = modbus_common_recv_read_registers_resp(common, func_code, buff, &count);
+  if (MODBUS_CLIENT_IS_READ_BITS(func_code)) {
+    ret = modbus_common_recv_read_bits_resp(common, func_code, (uint8_t*)buff, &count);
+  } else {
+    ret = modbus_common_recv_read_registers_resp(common, func_code, (uint16_t*)buff, &count);
+  }
   modbus_client_wait_for_frame_gap_time(client, t);
+
   return ret;
 }
 
-ret_t modbus_client_read_registers(modbus_client_t* client, uint16_t addr, uint16_t count,
-                                   uint16_t* buff) {
-  uint32_t i = 0;
+static ret_t modbus_client_read_ex(modbus_client_t* client, uint8_t func_code, uint16_t addr,
+                                   uint16_t count, void* buff) {
   ret_t ret = RET_OK;
+  uint64_t t = time_now_ms();
+
+  ret = modbus_client_send_read_req(client, func_code, addr, count);
+  return_value_if_fail(ret == RET_OK, ret);
+
+  return modbus_client_recv_read_resp(client, func_code, count, buff, t);
+}
+
+static ret_t modbus_client_flush_read_buffer(modbus_client_t* client) {
+  modbus_common_t* common = MODBUS_COMMON(client);
+  return_value_if_fail(common != NULL, RET_BAD_PARAMS);
+
+  log_debug("%s flush read buffer\n", __FUNCTION__);
+  return modbus_common_flush_read_buffer(common);
+}
+
+// RET_SKIP 表示slave不匹配，需要跳过。（返回时已清空缓冲区）
+#define MODBUS_NEED_RETRY(ret) ((ret) == RET_CRC || (ret) == RET_SKIP)
+
+ret_t modbus_client_read_bits(modbus_client_t* client, uint16_t addr, uint16_t count,
+                              uint8_t* buff) {
   return_value_if_fail(client != NULL && buff != NULL, RET_BAD_PARAMS);
-  ret = modbus_client_check_and_auto_connect(client);
-  if (ret != RET_OK) {
-    return ret;
-  }
 
-  for (i = 0; i < client->retry_times; i++) {
-    ret = modbus_client_read_registers_ex(client, MODBUS_FC_READ_HOLDING_REGISTERS, addr, count,
-                                          buff);
-    if (!MODBUS_NEED_RETRY(ret)) {
-      modbus_client_check_connect_status(client, ret);
-      return ret;
-    }
+  return modbus_client_read(client, MODBUS_FC_READ_COILS, addr, count, buff);
+}
 
-    log_debug("%s retry:%d\n", __FUNCTION__, i + 1);
-  }
+ret_t modbus_client_read_input_bits(modbus_client_t* client, uint16_t addr, uint16_t count,
+                                    uint8_t* buff) {
+  return_value_if_fail(client != NULL && buff != NULL, RET_BAD_PARAMS);
 
-  modbus_client_check_connect_status(client, ret);
-  // clear the old resp data when comm error, ensure the next req and resp tid sync
-  modbus_client_flush_read_buffer(client);
-  return ret;
+  return modbus_client_read(client, MODBUS_FC_READ_DISCRETE_INPUTS, addr, count, buff);
 }
 
-ret_t modbus_client_read_input_registers(modbus_client_t* client, uint16_t addr, uint16_t count,
-                                         uint16_t* buff) {
-  uint32_t i = 0;
-  ret_t ret = RET_OK;
+ret_t modbus_client_read_registers(modbus_client_t* client, uint16_t addr, uint16_t count,
+                                   uint16_t* buff) {
   return_value_if_fail(client != NULL && buff != NULL, RET_BAD_PARAMS);
-  ret = modbus_client_check_and_auto_connect(client);
-  if (ret != RET_OK) {
-    return ret;
-  }
 
-  for (i = 0; i < client->retry_times; i++) {
-    ret =
-        modbus_client_read_registers_ex(client, MODBUS_FC_READ_INPUT_REGISTERS, addr, count, buff);
-    if (!MODBUS_NEED_RETRY(ret)) {
-      modbus_client_check_connect_status(client, ret);
-      return ret;
-    }
+  return modbus_client_read(client, MODBUS_FC_READ_HOLDING_REGISTERS, addr, count, buff);
+}
 
-    log_debug("%s retry:%d\n", __FUNCTION__, i + 1);
-  }
+ret_t modbus_client_read_input_registers(modbus_client_t* client, uint16_t addr, uint16_t count,
+                                         uint16_t* buff) {
+  return_value_if_fail(client != NULL && buff != NULL, RET_BAD_PARAMS);
 
-  modbus_client_check_connect_status(client, ret);
-  // clear the old resp data when comm error, ensure the next req and resp tid sync
-  modbus_client_flush_read_buffer(client);
-  return ret;
+  return modbus_client_read(client, MODBUS_FC_READ_INPUT_REGISTERS, addr, count, buff);
 }
 
 static ret_t modbus_client_write_bit_impl(modbus_client_t* client, uint16_t addr, uint8_t value) {
@@ -369,6 +503,10 @@ static ret_t modbus_client_write_bit_impl(modbus_client_t* client, uint16_t addr
   ret = modbus_common_send_write_bit_req(common, addr, value);
   return_value_if_fail(ret == RET_OK, ret);
 
+  if (modbus_client_is_broadcast(client)) {
+    return modbus_client_wait_for_turnaround_delay(client);
+  }
+
   if (modbus_client_check_and_set_recv_timeout(client, t) != RET_OK) {
     return RET_TIMEOUT;
   }
@@ -389,6 +527,10 @@ static ret_t modbus_client_write_register_impl(modbus_client_t* client, uint16_t
   ret = modbus_common_send_write_register_req(common, addr, value);
   return_value_if_fail(ret == RET_OK, ret);
 
+  if (modbus_client_is_broadcast(client)) {
+    return modbus_client_wait_for_turnaround_delay(client);
+  }
+
   if (modbus_client_check_and_set_recv_timeout(client, t) != RET_OK) {
     return RET_TIMEOUT;
   }
@@ -410,6 +552,10 @@ static ret_t modbus_client_write_bits_impl(modbus_client_t* client, uint16_t add
   ret = modbus_common_send_write_bits_req(common, addr, count, buff);
   return_value_if_fail(ret == RET_OK, ret);
 
+  if (modbus_client_is_broadcast(client)) {
+    return modbus_client_wait_for_turnaround_delay(client);
+  }
+
   if (modbus_client_check_and_set_recv_timeout(client, t) != RET_OK) {
     return RET_TIMEOUT;
   }
@@ -431,6 +577,10 @@ static ret_t modbus_client_write_registers_impl(modbus_client_t* client, uint16_
   ret = modbus_common_send_write_registers_req(common, addr, count, buff);
   return_value_if_fail(ret == RET_OK, ret);
 
+  if (modbus_client_is_broadcast(client)) {
+    return modbus_client_wait_for_turnaround_delay(client);
+  }
+
   if (modbus_client_check_and_set_recv_timeout(client, t) != RET_OK) {
     return RET_TIMEOUT;
   }
@@ -441,6 +591,7 @@ static ret_t modbus_client_write_registers_impl(modbus_client_t* client, uint16_
   return ret;
 }
 
+#if MODBUS_WITH_FC23
 static ret_t modbus_client_write_and_read_registers_impl(modbus_client_t* client,
                                                          uint16_t write_addr, uint16_t write_nb, const uint16_t *src,
                                                          uint16_t read_addr, uint16_t read_nb, uint16_t *dest) {
@@ -463,136 +614,1100 @@ static ret_t modbus_client_write_and_read_registers_impl(modbus_client_t* client
   modbus_client_wait_for_frame_gap_time(client, t);
   return ret == RET_OK && read_nb == dest_count ? RET_OK : RET_FAIL;
 }
+#endif /*MODBUS_WITH_FC23*/
 
-ret_t modbus_client_write_bit(modbus_client_t* client, uint16_t addr, uint8_t value) {
-  uint32_t i = 0;
+static ret_t modbus_client_mask_write_register_impl(modbus_client_t* client, uint16_t addr,
+                                                    uint16_t and_mask, uint16_t or_mask) {
+  uint64_t t = 0;
   ret_t ret = RET_OK;
-  return_value_if_fail(client != NULL, RET_BAD_PARAMS);
-  ret = modbus_client_check_and_auto_connect(client);
-  if (ret != RET_OK) {
-    return ret;
-  }
+  modbus_common_t* common = MODBUS_COMMON(client);
+  return_value_if_fail(common != NULL, RET_BAD_PARAMS);
 
-  for (i = 0; i < client->retry_times; i++) {
-    ret = modbus_client_write_bit_impl(client, addr, value);
-    if (!MODBUS_NEED_RETRY(ret)) {
-      modbus_client_check_connect_status(client, ret);
-      return ret;
-    }
+  t = time_now_ms();
+  ret = modbus_common_send_mask_write_register_req(common, addr, and_mask, or_mask);
+  return_value_if_fail(ret == RET_OK, ret);
 
-    log_debug("%s retry:%d\n", __FUNCTION__, i + 1);
+  if (modbus_client_is_broadcast(client)) {
+    return modbus_client_wait_for_turnaround_delay(client);
   }
 
-  modbus_client_check_connect_status(client, ret);
-  // clear the old resp data when comm error, ensure the next req and resp tid sync
-  modbus_client_flush_read_buffer(client);
+  if (modbus_client_check_and_set_recv_timeout(client, t) != RET_OK) {
+    return RET_TIMEOUT;
+  }
+
+  t = time_now_us();
+  ret = modbus_common_recv_mask_write_register_resp(common);
+  modbus_client_wait_for_frame_gap_time(client, t);
   return ret;
 }
 
-ret_t modbus_client_write_register(modbus_client_t* client, uint16_t addr, uint16_t value) {
-  uint32_t i = 0;
+static ret_t modbus_client_read_fifo_queue_impl(modbus_client_t* client, uint16_t addr,
+                                                uint16_t* buff, uint16_t* count) {
+  uint64_t t = 0;
   ret_t ret = RET_OK;
-  return_value_if_fail(client != NULL, RET_BAD_PARAMS);
-  ret = modbus_client_check_and_auto_connect(client);
-  if (ret != RET_OK) {
-    return ret;
-  }
+  modbus_common_t* common = MODBUS_COMMON(client);
+  return_value_if_fail(common != NULL && buff != NULL && count != NULL, RET_BAD_PARAMS);
 
-  for (i = 0; i < client->retry_times; i++) {
-    ret = modbus_client_write_register_impl(client, addr, value);
-    if (!MODBUS_NEED_RETRY(ret)) {
-      modbus_client_check_connect_status(client, ret);
-      return ret;
-    }
+  t = time_now_ms();
+  ret = modbus_common_send_read_fifo_queue_req(common, addr);
+  return_value_if_fail(ret == RET_OK, ret);
 
-    log_debug("%s retry:%d\n", __FUNCTION__, i + 1);
+  if (modbus_client_check_and_set_recv_timeout(client, t) != RET_OK) {
+    return RET_TIMEOUT;
   }
 
-  modbus_client_check_connect_status(client, ret);
-  // clear the old resp data when comm error, ensure the next req and resp tid sync
-  modbus_client_flush_read_buffer(client);
+  t = time_now_us();
+  ret = modbus_common_recv_read_fifo_queue_resp(common, buff, count);
+  modbus_client_wait_for_frame_gap_time(client, t);
   return ret;
 }
 
-ret_t modbus_client_write_bits(modbus_client_t* client, uint16_t addr, uint16_t count,
-                               const uint8_t* buff) {
-  uint32_t i = 0;
+#if MODBUS_WITH_FILE_RECORD
+static ret_t modbus_client_read_file_records_impl(modbus_client_t* client,
+                                                  modbus_file_record_t* records, uint32_t nr) {
+  uint64_t t = 0;
   ret_t ret = RET_OK;
-  return_value_if_fail(client != NULL && buff != NULL, RET_BAD_PARAMS);
-  ret = modbus_client_check_and_auto_connect(client);
-  if (ret != RET_OK) {
-    return ret;
-  }
+  modbus_common_t* common = MODBUS_COMMON(client);
+  return_value_if_fail(common != NULL && records != NULL, RET_BAD_PARAMS);
 
-  for (i = 0; i < client->retry_times; i++) {
-    ret = modbus_client_write_bits_impl(client, addr, count, buff);
-    if (!MODBUS_NEED_RETRY(ret)) {
-      modbus_client_check_connect_status(client, ret);
-      return ret;
-    }
+  t = time_now_ms();
+  ret = modbus_common_send_read_file_record_req(common, records, nr);
+  return_value_if_fail(ret == RET_OK, ret);
 
-    log_debug("%s retry:%d\n", __FUNCTION__, i + 1);
+  if (modbus_client_check_and_set_recv_timeout(client, t) != RET_OK) {
+    return RET_TIMEOUT;
   }
 
-  modbus_client_check_connect_status(client, ret);
-  // clear the old resp data when comm error, ensure the next req and resp tid sync
-  modbus_client_flush_read_buffer(client);
+  t = time_now_us();
+  ret = modbus_common_recv_read_file_record_resp(common, records, nr);
+  modbus_client_wait_for_frame_gap_time(client, t);
   return ret;
 }
 
-ret_t modbus_client_write_registers(modbus_client_t* client, uint16_t addr, uint16_t count,
-                                    const uint16_t* buff) {
+static ret_t modbus_client_write_file_records_impl(modbus_client_t* client,
+                                                   const modbus_file_record_t* records,
+                                                   uint32_t nr) {
+  uint64_t t = 0;
+  ret_t ret = RET_OK;
+  modbus_common_t* common = MODBUS_COMMON(client);
+  return_value_if_fail(common != NULL && records != NULL, RET_BAD_PARAMS);
+
+  t = time_now_ms();
+  ret = modbus_common_send_write_file_record_req(common, records, nr);
+  return_value_if_fail(ret == RET_OK, ret);
+
+  if (modbus_client_is_broadcast(client)) {
+    return modbus_client_wait_for_turnaround_delay(client);
+  }
+
+  if (modbus_client_check_and_set_recv_timeout(client, t) != RET_OK) {
+    return RET_TIMEOUT;
+  }
+
+  t = time_now_us();
+  ret = modbus_common_recv_write_file_record_resp(common);
+  modbus_client_wait_for_frame_gap_time(client, t);
+  return ret;
+}
+#endif /*MODBUS_WITH_FILE_RECORD*/
+
+static ret_t modbus_client_request_once(modbus_client_t* client, modbus_client_req_t* req) {
+  switch (req->func_code) {
+    case MODBUS_FC_READ_COILS:
+    case MODBUS_FC_READ_DISCRETE_INPUTS:
+    case MODBUS_FC_READ_HOLDING_REGISTERS:
+    case MODBUS_FC_READ_INPUT_REGISTERS: {
+      return modbus_client_read_ex(client, req->func_code, req->addr, req->count, req->buff);
+    }
+    case MODBUS_FC_WRITE_SINGLE_COIL: {
+      return modbus_client_write_bit_impl(client, req->addr, (uint8_t)(req->value));
+    }
+    case MODBUS_FC_WRITE_SINGLE_HOLDING_REGISTER: {
+      return modbus_client_write_register_impl(client, req->addr, req->value);
+    }
+    case MODBUS_FC_WRITE_MULTIPLE_COILS: {
+      return modbus_client_write_bits_impl(client, req->addr, req->count,
+                                           (const uint8_t*)(req->data));
+    }
+    case MODBUS_FC_WRITE_MULTIPLE_HOLDING_REGISTERS: {
+      return modbus_client_write_registers_impl(client, req->addr, req->count,
+                                                (const uint16_t*)(req->data));
+    }
+#if MODBUS_WITH_FC23
+    case MODBUS_FC_WRITE_AND_READ_REGISTERS: {
+      return modbus_client_write_and_read_registers_impl(
+          client, req->addr, req->count, (const uint16_t*)(req->data), req->read_addr,
+          req->read_count, (uint16_t*)(req->buff));
+    }
+#endif /*MODBUS_WITH_FC23*/
+    case MODBUS_FC_MASK_WRITE_REGISTER: {
+      return modbus_client_mask_write_register_impl(client, req->addr, req->value, req->or_mask);
+    }
+    case MODBUS_FC_READ_FIFO_QUEUE: {
+      /*重试时恢复buff的容量*/
+      *(req->result_count) = req->count;
+      return modbus_client_read_fifo_queue_impl(client, req->addr, (uint16_t*)(req->buff),
+                                                req->result_count);
+    }
+#if MODBUS_WITH_FILE_RECORD
+    case MODBUS_FC_READ_FILE_RECORD: {
+      return modbus_client_read_file_records_impl(client, (modbus_file_record_t*)(req->buff),
+                                                  req->count);
+    }
+    case MODBUS_FC_WRITE_FILE_RECORD: {
+      return modbus_client_write_file_records_impl(
+          client, (const modbus_file_record_t*)(req->data), req->count);
+    }
+#endif /*MODBUS_WITH_FILE_RECORD*/
+    default: {
+      return RET_NOT_IMPL;
+    }
+  }
+}
+
+static ret_t modbus_client_request(modbus_client_t* client, modbus_client_req_t* req) {
   uint32_t i = 0;
   ret_t ret = RET_OK;
-  return_value_if_fail(client != NULL && buff != NULL, RET_BAD_PARAMS);
+
+  modbus_client_lock(client, MODBUS_CLIENT_PRIORITY_NORMAL);
+  if (modbus_client_is_broadcast(client) && !modbus_client_is_write_func_code(req->func_code)) {
+    log_debug("%s fc=%d can not be broadcast\n", __FUNCTION__, req->func_code);
+    modbus_client_unlock(client);
+    return RET_BAD_PARAMS;
+  }
+
   ret = modbus_client_check_and_auto_connect(client);
   if (ret != RET_OK) {
+    modbus_client_unlock(client);
     return ret;
   }
 
   for (i = 0; i < client->retry_times; i++) {
-    ret = modbus_client_write_registers_impl(client, addr, count, buff);
+    modbus_client_begin_request(client, i);
+    ret = modbus_client_request_once(client, req);
+    modbus_client_end_request(client, ret);
     if (!MODBUS_NEED_RETRY(ret)) {
       modbus_client_check_connect_status(client, ret);
+      modbus_client_unlock(client);
       return ret;
     }
 
-    log_debug("%s retry:%d\n", __FUNCTION__, i + 1);
+    log_debug("%s fc=%d retry:%d\n", __FUNCTION__, req->func_code, i + 1);
   }
 
   modbus_client_check_connect_status(client, ret);
   // clear the old resp data when comm error, ensure the next req and resp tid sync
   modbus_client_flush_read_buffer(client);
+  modbus_client_unlock(client);
+
   return ret;
 }
 
+static bool_t modbus_client_has_higher_waiting(modbus_client_t* client,
+                                               modbus_client_priority_t priority) {
+  uint32_t i = 0;
+
+  for (i = 0; i < priority; i++) {
+    if (client->waiting[i] > 0) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+static ret_t modbus_client_wake_up_next(modbus_client_t* client) {
+  uint32_t i = 0;
+
+  /*每个优先级一个条件变量，只唤醒优先级最高的等待者*/
+  for (i = 0; i < MODBUS_CLIENT_PRIORITY_NR; i++) {
+    if (client->waiting[i] > 0) {
+      return tk_cond_signal(client->cond[i]);
+    }
+  }
+
+  return RET_OK;
+}
+
+/*调用前需要持有client->mutex*/
+static ret_t modbus_client_wait_for_bus(modbus_client_t* client, modbus_client_priority_t priority) {
+  client->waiting[priority]++;
+  while (client->depth > 0 || modbus_client_has_higher_waiting(client, priority)) {
+    tk_cond_wait(client->cond[priority], client->mutex);
+  }
+  client->waiting[priority]--;
+
+  return RET_OK;
+}
+
+/*调用前需要持有client->mutex*/
+static ret_t modbus_client_yield(modbus_client_t* client) {
+  uint32_t depth = client->depth;
+  uint64_t owner = client->owner;
+  uint64_t lock_time = client->lock_time;
+  uint8_t slave = client->common.slave;
+  modbus_client_priority_t priority = client->owner_priority;
+
+  client->depth = 0;
+  client->owner = 0;
+  client->priority_stats[priority].num_preemptions++;
+  modbus_client_wake_up_next(client);
+
+  modbus_client_wait_for_bus(client, priority);
+
+  /*恢复现场(其它线程可能修改了slave)*/
+  client->depth = depth;
+  client->owner = owner;
+  client->lock_time = lock_time;
+  client->owner_priority = priority;
+  client->common.slave = slave;
+
+  return RET_OK;
+}
+
+ret_t modbus_client_lock(modbus_client_t* client, modbus_client_priority_t priority) {
+  uint64_t start = 0;
+  uint64_t self = tk_thread_self();
+  return_value_if_fail(client != NULL && client->mutex != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(priority < MODBUS_CLIENT_PRIORITY_NR, RET_BAD_PARAMS);
+
+  tk_mutex_lock(client->mutex);
+  if (client->depth > 0 && client->owner == self) {
+    /*嵌套调用：在请求边界让出总线给更高优先级的请求*/
+    if (client->no_yield == 0 && modbus_client_has_higher_waiting(client, client->owner_priority)) {
+      modbus_client_yield(client);
+    }
+    client->depth++;
+    tk_mutex_unlock(client->mutex);
+
+    return RET_OK;
+  }
+
+  start = time_now_us();
+  modbus_client_wait_for_bus(client, priority);
+
+  client->depth = 1;
+  client->owner = self;
+  client->lock_time = start;
+  client->owner_priority = priority;
+  client->priority_stats[priority].num_requests++;
+  modbus_histogram_record(&(client->priority_stats[priority].wait_time),
+                          (uint32_t)(time_now_us() - start));
+  tk_mutex_unlock(client->mutex);
+
+  return RET_OK;
+}
+
+ret_t modbus_client_unlock(modbus_client_t* client) {
+  return_value_if_fail(client != NULL && client->mutex != NULL, RET_BAD_PARAMS);
+
+  tk_mutex_lock(client->mutex);
+  if (client->depth == 0 || client->owner != tk_thread_self()) {
+    tk_mutex_unlock(client->mutex);
+    log_warn("%s: not the owner\n", __FUNCTION__);
+    return RET_FAIL;
+  }
+
+  client->depth--;
+  if (client->depth == 0) {
+    modbus_client_priority_t priority = client->owner_priority;
+    modbus_histogram_record(&(client->priority_stats[priority].latency),
+                            (uint32_t)(time_now_us() - client->lock_time));
+    client->owner = 0;
+    modbus_client_wake_up_next(client);
+  }
+  tk_mutex_unlock(client->mutex);
+
+  return RET_OK;
+}
+
+ret_t modbus_client_get_priority_stats(modbus_client_t* client, modbus_client_priority_t priority,
+                                       modbus_client_priority_stats_t* stats) {
+  return_value_if_fail(client != NULL && client->mutex != NULL && stats != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(priority < MODBUS_CLIENT_PRIORITY_NR, RET_BAD_PARAMS);
+
+  tk_mutex_lock(client->mutex);
+  memcpy(stats, client->priority_stats + priority, sizeof(*stats));
+  tk_mutex_unlock(client->mutex);
+
+  return RET_OK;
+}
+
+static ret_t modbus_client_init_lock(modbus_client_t* client) {
+  uint32_t i = 0;
+
+  client->mutex = tk_mutex_create();
+  return_value_if_fail(client->mutex != NULL, RET_OOM);
+
+  for (i = 0; i < MODBUS_CLIENT_PRIORITY_NR; i++) {
+    client->cond[i] = tk_cond_create();
+    return_value_if_fail(client->cond[i] != NULL, RET_OOM);
+  }
+
+  return RET_OK;
+}
+
+static ret_t modbus_client_deinit_lock(modbus_client_t* client) {
+  uint32_t i = 0;
+
+  for (i = 0; i < MODBUS_CLIENT_PRIORITY_NR; i++) {
+    if (client->cond[i] != NULL) {
+      tk_cond_destroy(client->cond[i]);
+      client->cond[i] = NULL;
+    }
+  }
+
+  if (client->mutex != NULL) {
+    tk_mutex_destroy(client->mutex);
+    client->mutex = NULL;
+  }
+
+  return RET_OK;
+}
+
+ret_t modbus_client_write_bit(modbus_client_t* client, uint16_t addr, uint8_t value) {
+  modbus_client_req_t req;
+  return_value_if_fail(client != NULL, RET_BAD_PARAMS);
+
+  memset(&req, 0x00, sizeof(req));
+  req.func_code = MODBUS_FC_WRITE_SINGLE_COIL;
+  req.addr = addr;
+  req.value = value;
+
+  return modbus_client_request(client, &req);
+}
+
+ret_t modbus_client_write_register(modbus_client_t* client, uint16_t addr, uint16_t value) {
+  modbus_client_req_t req;
+  return_value_if_fail(client != NULL, RET_BAD_PARAMS);
+
+  memset(&req, 0x00, sizeof(req));
+  req.func_code = MODBUS_FC_WRITE_SINGLE_HOLDING_REGISTER;
+  req.addr = addr;
+  req.value = value;
+
+  return modbus_client_request(client, &req);
+}
+
+ret_t modbus_client_write_bits(modbus_client_t* client, uint16_t addr, uint16_t count,
+                               const uint8_t* buff) {
+  modbus_client_req_t req;
+  return_value_if_fail(client != NULL && buff != NULL, RET_BAD_PARAMS);
+
+  memset(&req, 0x00, sizeof(req));
+  req.func_code = MODBUS_FC_WRITE_MULTIPLE_COILS;
+  req.addr = addr;
+  req.count = count;
+  req.data = buff;
+
+  return modbus_client_request(client, &req);
+}
+
+ret_t modbus_client_write_registers(modbus_client_t* client, uint16_t addr, uint16_t count,
+                                    const uint16_t* buff) {
+  modbus_client_req_t req;
+  return_value_if_fail(client != NULL && buff != NULL, RET_BAD_PARAMS);
+
+  memset(&req, 0x00, sizeof(req));
+  req.func_code = MODBUS_FC_WRITE_MULTIPLE_HOLDING_REGISTERS;
+  req.addr = addr;
+  req.count = count;
+  req.data = buff;
+
+  return modbus_client_request(client, &req);
+}
+
+#if MODBUS_WITH_FC23
+ret_t modbus_client_write_and_read_registers(modbus_client_t* client, 
+                                             uint16_t write_addr, uint16_t write_nb, const uint16_t *src,
+                                             uint16_t read_addr, uint16_t read_nb, uint16_t *dest) {
+  modbus_client_req_t req;
+  return_value_if_fail(client != NULL && src != NULL && dest != NULL, RET_BAD_PARAMS);
+
+  memset(&req, 0x00, sizeof(req));
+  req.func_code = MODBUS_FC_WRITE_AND_READ_REGISTERS;
+  req.addr = write_addr;
+  req.count = write_nb;
+  req.data = src;
+  req.read_addr = read_addr;
+  req.read_count = read_nb;
+  req.buff = dest;
+
+  return modbus_client_request(client, &req);
+}
+#else
 ret_t modbus_client_write_and_read_registers(modbus_client_t* client, 
                                              uint16_t write_addr, uint16_t write_nb, const uint16_t *src,
                                              uint16_t read_addr, uint16_t read_nb, uint16_t *dest) {
+  return RET_NOT_IMPL;
+}
+#endif /*MODBUS_WITH_FC23*/
+
+ret_t modbus_client_mask_write_register(modbus_client_t* client, uint16_t addr, uint16_t and_mask,
+                                        uint16_t or_mask) {
+  modbus_client_req_t req;
+  return_value_if_fail(client != NULL, RET_BAD_PARAMS);
+
+  memset(&req, 0x00, sizeof(req));
+  req.func_code = MODBUS_FC_MASK_WRITE_REGISTER;
+  req.addr = addr;
+  req.value = and_mask;
+  req.or_mask = or_mask;
+
+  return modbus_client_request(client, &req);
+}
+
+ret_t modbus_client_read_fifo_queue(modbus_client_t* client, uint16_t addr, uint16_t* buff,
+                                    uint16_t* count) {
+  modbus_client_req_t req;
+  return_value_if_fail(client != NULL && buff != NULL && count != NULL, RET_BAD_PARAMS);
+
+  memset(&req, 0x00, sizeof(req));
+  req.func_code = MODBUS_FC_READ_FIFO_QUEUE;
+  req.addr = addr;
+  req.count = *count;
+  req.buff = buff;
+  req.result_count = count;
+
+  return modbus_client_request(client, &req);
+}
+
+#if MODBUS_WITH_FILE_RECORD
+/*一个PDU中最多的子请求个数(读请求每个子请求7字节)*/
+#define MODBUS_CLIENT_MAX_FILE_SUB_REQS (MODBUS_MAX_READ_FILE_RECORD_BYTES / 7)
+
+static ret_t modbus_client_send_file_records(modbus_client_t* client, uint8_t func_code,
+                                             modbus_file_record_t* pieces, uint32_t nr) {
+  modbus_client_req_t req;
+
+  memset(&req, 0x00, sizeof(req));
+  req.func_code = func_code;
+  req.count = nr;
+  req.data = pieces;
+  req.buff = pieces;
+
+  return modbus_client_request(client, &req);
+}
+
+/*
+ * 把记录拆分成子请求，每个PDU中尽量多放子请求：
+ * 读：响应中每个子响应占2+2*n字节，总共不超过MODBUS_MAX_READ_FILE_RECORD_BYTES。
+ * 写：请求中每个子请求占7+2*n字节，总共不超过MODBUS_MAX_WRITE_FILE_RECORD_BYTES。
+ */
+static ret_t modbus_client_transfer_file_records(modbus_client_t* client, uint8_t func_code,
+                                                 const modbus_file_record_t* records, uint32_t nr) {
   uint32_t i = 0;
+  uint32_t k = 0;
+  uint32_t done = 0;
+  uint32_t bytes = 0;
   ret_t ret = RET_OK;
-  return_value_if_fail(client != NULL && src != NULL && dest != NULL, RET_BAD_PARAMS);
+  bool_t is_read = func_code == MODBUS_FC_READ_FILE_RECORD;
+  uint32_t budget =
+      is_read ? MODBUS_MAX_READ_FILE_RECORD_BYTES : MODBUS_MAX_WRITE_FILE_RECORD_BYTES;
+  uint32_t overhead = is_read ? 2 : 7;
+  modbus_file_record_t pieces[MODBUS_CLIENT_MAX_FILE_SUB_REQS];
+
+  for (i = 0; i < nr; i++) {
+    const modbus_file_record_t* r = records + i;
+    return_value_if_fail(r->data != NULL || r->record_length == 0, RET_BAD_PARAMS);
+    return_value_if_fail((uint32_t)(r->record_number) + r->record_length <=
+                             MODBUS_MAX_FILE_RECORD_NUMBER + 1,
+                         RET_BAD_PARAMS);
+  }
+
+  modbus_client_lock(client, MODBUS_CLIENT_PRIORITY_NORMAL);
+  i = 0;
+  while (i < nr && ret == RET_OK) {
+    const modbus_file_record_t* r = records + i;
+    uint32_t n = 0;
+
+    if (done >= r->record_length) {
+      i++;
+      done = 0;
+      continue;
+    }
+
+    if (k < ARRAY_SIZE(pieces) && bytes + overhead + 2 <= budget) {
+      n = tk_min((budget - bytes - overhead) / 2, r->record_length - done);
+      pieces[k].file_number = r->file_number;
+      pieces[k].record_number = r->record_number + done;
+      pieces[k].record_length = n;
+      pieces[k].data = r->data + done;
+      bytes += overhead + n * 2;
+      done += n;
+      k++;
+    } else {
+      ret = modbus_client_send_file_records(client, func_code, pieces, k);
+      k = 0;
+      bytes = 0;
+    }
+  }
+
+  if (ret == RET_OK && k > 0) {
+    ret = modbus_client_send_file_records(client, func_code, pieces, k);
+  }
+  modbus_client_unlock(client);
+
+  return ret;
+}
+
+ret_t modbus_client_read_file_records(modbus_client_t* client, modbus_file_record_t* records,
+                                      uint32_t nr) {
+  return_value_if_fail(client != NULL && records != NULL, RET_BAD_PARAMS);
+
+  return modbus_client_transfer_file_records(client, MODBUS_FC_READ_FILE_RECORD, records, nr);
+}
+
+ret_t modbus_client_write_file_records(modbus_client_t* client,
+                                       const modbus_file_record_t* records, uint32_t nr) {
+  return_value_if_fail(client != NULL && records != NULL, RET_BAD_PARAMS);
+
+  return modbus_client_transfer_file_records(client, MODBUS_FC_WRITE_FILE_RECORD, records, nr);
+}
+#else
+ret_t modbus_client_read_file_records(modbus_client_t* client, modbus_file_record_t* records,
+                                      uint32_t nr) {
+  return RET_NOT_IMPL;
+}
+
+ret_t modbus_client_write_file_records(modbus_client_t* client,
+                                       const modbus_file_record_t* records, uint32_t nr) {
+  return RET_NOT_IMPL;
+}
+#endif /*MODBUS_WITH_FILE_RECORD*/
+
+/*批量读取时拆分出来的一个请求*/
+typedef struct _modbus_client_chunk_t {
+  uint8_t func_code;
+  uint16_t addr;
+  uint16_t count;
+  /*第一个相关区间在排序后数组中的位置*/
+  uint32_t first;
+  /*为TRUE时直接读到区间的缓冲区中，否则读到临时缓冲区后再复制到各个区间*/
+  bool_t direct;
+  void* buff;
+  uint16_t tid;
+  uint64_t send_time;
+  ret_t result;
+  /*result为RET_FAIL且收到异常应答时的异常码*/
+  uint8_t exception_code;
+} modbus_client_chunk_t;
+
+/*按功能码和地址顺序生成请求*/
+typedef struct _modbus_client_chunk_planner_t {
+  modbus_client_range_t** sorted;
+  uint32_t nr;
+  uint32_t index;
+  uint32_t cursor;
+  uint8_t func_code;
+} modbus_client_chunk_planner_t;
+
+static int modbus_client_range_compare(const void* a, const void* b) {
+  const modbus_client_range_t* r1 = *(const modbus_client_range_t* const*)a;
+  const modbus_client_range_t* r2 = *(const modbus_client_range_t* const*)b;
+
+  if (r1->func_code != r2->func_code) {
+    return (int)(r1->func_code) - (int)(r2->func_code);
+  }
+
+  return (int)(r1->addr) - (int)(r2->addr);
+}
+
+static uint32_t modbus_client_get_elem_size(uint8_t func_code) {
+  return MODBUS_CLIENT_IS_READ_BITS(func_code) ? sizeof(uint8_t) : sizeof(uint16_t);
+}
+
+static uint16_t* modbus_client_get_max_read_count_ref(modbus_client_t* client, uint8_t unit_id,
+                                                      uint8_t func_code) {
+  if (MODBUS_CLIENT_IS_READ_BITS(func_code)) {
+    return client->max_read_bits + unit_id;
+  } else {
+    return client->max_read_registers + unit_id;
+  }
+}
+
+/*当前从站单个读请求的最大个数*/
+static uint32_t modbus_client_get_chunk_size(modbus_client_t* client, uint8_t func_code) {
+  return modbus_client_get_max_read_count(client, client->common.slave, func_code);
+}
+
+static bool_t modbus_client_next_chunk(modbus_client_t* client,
+                                       modbus_client_chunk_planner_t* planner,
+                                       modbus_client_chunk_t* chunk) {
+  while (planner->index < planner->nr) {
+    uint32_t j = 0;
+    uint32_t end = 0;
+    uint32_t start = 0;
+    uint32_t limit = 0;
+    uint32_t merged = 1;
+    modbus_client_range_t* r = planner->sorted[planner->index];
+    uint32_t r_end = r->addr + r->count;
+
+    if (r->func_code != planner->func_code) {
+      planner->cursor = 0;
+      planner->func_code = r->func_code;
+    }
+
+    if (r->count == 0 || r_end <= planner->cursor) {
+      planner->index++;
+      continue;
+    }
+
+    start = tk_max(planner->cursor, r->addr);
+    limit = start + modbus_client_get_chunk_size(client, r->func_code);
+    end = tk_min(r_end, limit);
+
+    /*合并后面相邻、重叠或者间隔较小的区间*/
+    for (j = planner->index + 1; j < planner->nr; j++) {
+      modbus_client_range_t* iter = planner->sorted[j];
+      if (iter->func_code != r->func_code || iter->addr >= limit ||
+          iter->addr > end + client->read_merge_gap) {
+        break;
+      }
+
+      if (iter->count > 0) {
+        end = tk_max(end, tk_min(iter->addr + iter->count, limit));
+        merged++;
+      }
+    }
+
+    memset(chunk, 0x00, sizeof(*chunk));
+    chunk->func_code = r->func_code;
+    chunk->addr = start;
+    chunk->count = end - start;
+    chunk->first = planner->index;
+    if (merged == 1) {
+      chunk->direct = TRUE;
+      chunk->buff = (uint8_t*)(r->buff) + (start - r->addr) * modbus_client_get_elem_size(r->func_code);
+    }
+    planner->cursor = end;
+
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+static ret_t modbus_client_read_once(modbus_client_t* client, uint8_t func_code, uint16_t addr,
+                                     uint16_t count, void* buff, uint8_t* exception_code) {
+  ret_t ret = RET_OK;
+  modbus_client_req_t req;
+  modbus_common_t* common = MODBUS_COMMON(client);
+  uint32_t num_exceptions = common->num_exceptions;
+
+  memset(&req, 0x00, sizeof(req));
+  req.func_code = func_code;
+  req.addr = addr;
+  req.count = count;
+  req.buff = buff;
+
+  ret = modbus_client_request(client, &req);
+  if (ret != RET_OK && common->num_exceptions != num_exceptions) {
+    *exception_code = common->last_exception_code;
+  } else {
+    *exception_code = 0;
+  }
+
+  return ret;
+}
+
+static bool_t modbus_client_chunk_is_too_large(modbus_client_chunk_t* chunk) {
+  return chunk->result == RET_FAIL && chunk->count > 1 &&
+         (chunk->exception_code == MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS ||
+          chunk->exception_code == MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE);
+}
+
+/*
+ * 二分查找从chunk->addr开始可以一次读取的最大个数。
+ * 返回0表示不是长度的限制(比如中间有地址空洞)。
+ */
+static uint32_t modbus_client_probe_max_read_count(modbus_client_t* client,
+                                                   modbus_client_chunk_t* chunk) {
+  ret_t ret = RET_OK;
+  uint32_t lo = 0;
+  uint32_t hi = chunk->count - 1;
+  uint8_t exception_code = 0;
+
+  while (lo < hi) {
+    uint32_t mid = (lo + hi + 1) / 2;
+
+    ret = modbus_client_read_once(client, chunk->func_code, chunk->addr, mid, chunk->buff,
+                                  &exception_code);
+    if (ret == RET_OK) {
+      lo = mid;
+    } else if (exception_code == MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS ||
+               exception_code == MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE) {
+      hi = mid - 1;
+    } else {
+      return 0;
+    }
+  }
+
+  if (lo == 0) {
+    return 0;
+  }
+
+  /*第一个读不到的地址单独能读，说明是长度的限制，而不是地址空洞*/
+  ret = modbus_client_read_once(client, chunk->func_code, chunk->addr + lo, 1,
+                                (uint8_t*)(chunk->buff) + lo * modbus_client_get_elem_size(chunk->func_code),
+                                &exception_code);
+
+  return ret == RET_OK ? lo : 0;
+}
+
+/*请求太长被拒绝时，按(学习到的)从站的最大个数分开读取*/
+static ret_t modbus_client_read_chunk_adaptive(modbus_client_t* client,
+                                               modbus_client_chunk_t* chunk) {
+  uint32_t offset = 0;
+  ret_t ret = chunk->result;
+  uint8_t exception_code = 0;
+  uint32_t elem_size = modbus_client_get_elem_size(chunk->func_code);
+  uint32_t size = modbus_client_get_chunk_size(client, chunk->func_code);
+
+  if (size >= chunk->count) {
+    if (!client->adaptive_read_size) {
+      return ret;
+    }
+
+    size = modbus_client_probe_max_read_count(client, chunk);
+    if (size == 0) {
+      return ret;
+    }
+
+    log_debug("unit %u: max read count of fc %u is %u\n", (unsigned)client->common.slave,
+              (unsigned)chunk->func_code, size);
+    *modbus_client_get_max_read_count_ref(client, client->common.slave, chunk->func_code) = size;
+  }
+
+  for (offset = 0; offset < chunk->count; offset += size) {
+    uint32_t n = tk_min(size, chunk->count - offset);
+    ret = modbus_client_read_once(client, chunk->func_code, chunk->addr + offset, n,
+                                  (uint8_t*)(chunk->buff) + offset * elem_size, &exception_code);
+    if (ret != RET_OK) {
+      break;
+    }
+  }
+
+  return ret;
+}
+
+static ret_t modbus_client_read_chunk(modbus_client_t* client, modbus_client_chunk_t* chunk) {
+  chunk->result = modbus_client_read_once(client, chunk->func_code, chunk->addr, chunk->count,
+                                          chunk->buff, &(chunk->exception_code));
+  if (modbus_client_chunk_is_too_large(chunk)) {
+    chunk->result = modbus_client_read_chunk_adaptive(client, chunk);
+  }
+
+  return chunk->result;
+}
+
+static ret_t modbus_client_read_chunks_pipelined(modbus_client_t* client,
+                                                 modbus_client_chunk_t* chunks, uint32_t nr) {
+  uint32_t i = 0;
+  uint32_t j = 0;
+  uint32_t sent = 0;
+  ret_t ret = RET_OK;
+  uint16_t last_tid = 0;
+  modbus_common_t* common = MODBUS_COMMON(client);
+
   ret = modbus_client_check_and_auto_connect(client);
   if (ret != RET_OK) {
+    for (i = 0; i < nr; i++) {
+      chunks[i].result = ret;
+    }
     return ret;
   }
 
-  for (i = 0; i < client->retry_times; i++) {
-    ret = modbus_client_write_and_read_registers_impl(client, write_addr, write_nb, src, read_addr, read_nb, dest);
-    if (!MODBUS_NEED_RETRY(ret)) {
-      modbus_client_check_connect_status(client, ret);
-      return ret;
+  /*先发送全部请求，再按顺序接收应答*/
+  for (sent = 0; sent < nr; sent++) {
+    chunks[sent].send_time = time_now_us();
+    if (modbus_client_send_read_req(client, chunks[sent].func_code, chunks[sent].addr,
+                                    chunks[sent].count) != RET_OK) {
+      break;
     }
+    chunks[sent].tid = common->transaction_id;
+  }
 
-    log_debug("%s retry:%d\n", __FUNCTION__, i + 1);
+  last_tid = common->transaction_id;
+  for (i = 0; i < sent; i++) {
+    modbus_client_chunk_t* c = chunks + i;
+
+    common->transaction_id = c->tid;
+    modbus_client_begin_request(client, 0);
+    client->req_start_time = c->send_time;
+    ret = modbus_client_recv_read_resp(client, c->func_code, c->count, c->buff, time_now_ms());
+    modbus_client_end_request(client, ret);
+    c->result = ret;
+
+    if (ret != RET_OK) {
+      if (common->num_exceptions == client->req_num_exceptions) {
+        /*不是异常应答，后面的应答已经不可靠了*/
+        break;
+      }
+      c->exception_code = common->last_exception_code;
+    }
   }
+  common->transaction_id = last_tid;
+
+  /*先丢弃连接中剩下的流水线应答(或者处理断开的连接)，再发送新的请求*/
+  if (i < nr) {
+    modbus_client_check_connect_status(client, ret);
+    if (client->is_connected) {
+      modbus_client_flush_read_buffer(client);
+    }
+  }
+
+  for (j = 0; j < i; j++) {
+    if (modbus_client_chunk_is_too_large(chunks + j)) {
+      chunks[j].result = modbus_client_read_chunk_adaptive(client, chunks + j);
+    }
+  }
+
+  /*没有完成的请求逐个重新读取*/
+  for (; i < nr; i++) {
+    modbus_client_read_chunk(client, chunks + i);
+  }
+
+  return RET_OK;
+}
+
+static ret_t modbus_client_read_chunks(modbus_client_t* client, modbus_client_chunk_t* chunks,
+                                       uint32_t nr) {
+  uint32_t i = 0;
+  ret_t ret = RET_OK;
+
+  modbus_client_lock(client, MODBUS_CLIENT_PRIORITY_NORMAL);
+  if (nr > 1 && client->common.proto == MODBUS_PROTO_TCP) {
+    ret = modbus_client_read_chunks_pipelined(client, chunks, nr);
+  } else {
+    for (i = 0; i < nr; i++) {
+      modbus_client_read_chunk(client, chunks + i);
+    }
+  }
+  modbus_client_unlock(client);
 
-  modbus_client_check_connect_status(client, ret);
-  // clear the old resp data when comm error, ensure the next req and resp tid sync
-  modbus_client_flush_read_buffer(client);
   return ret;
 }
 
+static ret_t modbus_client_dispatch_chunk(modbus_client_chunk_planner_t* planner,
+                                          modbus_client_chunk_t* chunk) {
+  uint32_t i = 0;
+  uint32_t chunk_end = chunk->addr + chunk->count;
+  uint32_t elem_size = modbus_client_get_elem_size(chunk->func_code);
+
+  for (i = chunk->first; i < planner->nr; i++) {
+    uint32_t start = 0;
+    uint32_t end = 0;
+    modbus_client_range_t* r = planner->sorted[i];
+
+    if (r->func_code != chunk->func_code || r->addr >= chunk_end) {
+      break;
+    }
+
+    start = tk_max(r->addr, chunk->addr);
+    end = tk_min(r->addr + r->count, chunk_end);
+    if (start >= end) {
+      continue;
+    }
+
+    if (chunk->result != RET_OK) {
+      if (r->result == RET_OK) {
+        r->result = chunk->result;
+      }
+    } else if (!chunk->direct) {
+      memcpy((uint8_t*)(r->buff) + (start - r->addr) * elem_size,
+             (uint8_t*)(chunk->buff) + (start - chunk->addr) * elem_size,
+             (end - start) * elem_size);
+    }
+  }
+
+  return RET_OK;
+}
+
+ret_t modbus_client_read_ranges(modbus_client_t* client, modbus_client_range_t* ranges,
+                                uint32_t nr) {
+  uint32_t i = 0;
+  uint32_t n = 0;
+  uint32_t depth = 1;
+  ret_t ret = RET_OK;
+  uint8_t* temp = NULL;
+  modbus_client_chunk_planner_t planner;
+  modbus_client_chunk_t chunks[MODBUS_CLIENT_PIPELINE_DEPTH];
+  modbus_client_range_t* sorted[MODBUS_CLIENT_MAX_RANGES];
+  return_value_if_fail(client != NULL && ranges != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(!modbus_client_is_broadcast(client), RET_BAD_PARAMS);
+
+  memset(&planner, 0x00, sizeof(planner));
+  if (nr <= ARRAY_SIZE(sorted)) {
+    planner.sorted = sorted;
+  } else {
+#ifdef MODBUS_STATIC_BUFFERS
+    log_warn("too many ranges: %u > %u\n", nr, (uint32_t)ARRAY_SIZE(sorted));
+    return RET_BAD_PARAMS;
+#else
+    planner.sorted = TKMEM_ALLOC(sizeof(modbus_client_range_t*) * nr);
+    return_value_if_fail(planner.sorted != NULL, RET_OOM);
+#endif /*MODBUS_STATIC_BUFFERS*/
+  }
+#ifdef MODBUS_STATIC_BUFFERS
+  temp = client->ranges_temp;
+#endif /*MODBUS_STATIC_BUFFERS*/
+
+  for (i = 0; i < nr; i++) {
+    modbus_client_range_t* r = ranges + i;
+    bool_t is_read = MODBUS_CLIENT_IS_READ_BITS(r->func_code) ||
+                     r->func_code == MODBUS_FC_READ_HOLDING_REGISTERS ||
+                     r->func_code == MODBUS_FC_READ_INPUT_REGISTERS;
+
+    if (!is_read || r->buff == NULL || (r->addr + r->count) > 0x10000) {
+      r->result = RET_BAD_PARAMS;
+    } else {
+      r->result = RET_OK;
+      planner.sorted[planner.nr++] = r;
+    }
+  }
+  qsort(planner.sorted, planner.nr, sizeof(modbus_client_range_t*), modbus_client_range_compare);
+
+  if (client->common.proto == MODBUS_PROTO_TCP) {
+    depth = MODBUS_CLIENT_PIPELINE_DEPTH;
+  }
+
+  modbus_client_lock(client, MODBUS_CLIENT_PRIORITY_NORMAL);
+  do {
+    for (n = 0; n < depth && modbus_client_next_chunk(client, &planner, chunks + n); n++) {
+      if (!chunks[n].direct) {
+        if (temp == NULL) {
+          temp = TKMEM_ALLOC(depth * MODBUS_MAX_READ_BITS);
+          goto_error_if_fail(temp != NULL);
+        }
+        chunks[n].buff = temp + n * MODBUS_MAX_READ_BITS;
+      }
+    }
+
+    if (n > 0) {
+#ifdef MODBUS_STATIC_BUFFERS
+      /*
+       * ranges_temp是每个client一个，读取和分发之间不能让出总线：
+       * 其它线程的modbus_client_read_ranges会覆盖还没有复制出去的数据。只在两批之间让出。
+       */
+      client->no_yield++;
+#endif /*MODBUS_STATIC_BUFFERS*/
+      modbus_client_read_chunks(client, chunks, n);
+      for (i = 0; i < n; i++) {
+        modbus_client_dispatch_chunk(&planner, chunks + i);
+      }
+#ifdef MODBUS_STATIC_BUFFERS
+      client->no_yield--;
+      /*嵌套加锁：有更高优先级的请求在等待时在这里让出总线*/
+      modbus_client_lock(client, MODBUS_CLIENT_PRIORITY_NORMAL);
+      modbus_client_unlock(client);
+#endif /*MODBUS_STATIC_BUFFERS*/
+    }
+  } while (n > 0);
+  modbus_client_unlock(client);
+
+#ifndef MODBUS_STATIC_BUFFERS
+  TKMEM_FREE(temp);
+#endif /*MODBUS_STATIC_BUFFERS*/
+  if (planner.sorted != sorted) {
+    TKMEM_FREE(planner.sorted);
+  }
+
+  for (i = 0; i < nr; i++) {
+    if (ranges[i].result != RET_OK) {
+      ret = ranges[i].result;
+      break;
+    }
+  }
+
+  return ret;
+error:
+  modbus_client_unlock(client);
+  if (planner.sorted != sorted) {
+    TKMEM_FREE(planner.sorted);
+  }
+
+  return RET_OOM;
+}
+
+static ret_t modbus_client_read(modbus_client_t* client, uint8_t func_code, uint16_t addr,
+                                uint16_t count, void* buff) {
+  ret_t ret = RET_OK;
+  modbus_client_chunk_t chunk;
+  return_value_if_fail(!modbus_client_is_broadcast(client), RET_BAD_PARAMS);
+
+  if (count > modbus_client_get_chunk_size(client, func_code)) {
+    modbus_client_range_t range;
+
+    memset(&range, 0x00, sizeof(range));
+    range.func_code = func_code;
+    range.addr = addr;
+    range.count = count;
+    range.buff = buff;
+
+    return modbus_client_read_ranges(client, &range, 1);
+  }
+
+  memset(&chunk, 0x00, sizeof(chunk));
+  chunk.func_code = func_code;
+  chunk.addr = addr;
+  chunk.count = count;
+  chunk.direct = TRUE;
+  chunk.buff = buff;
+
+  modbus_client_lock(client, MODBUS_CLIENT_PRIORITY_NORMAL);
+  ret = modbus_client_read_chunk(client, &chunk);
+  modbus_client_unlock(client);
+
+  return ret;
+}
+
+ret_t modbus_client_set_adaptive_read_size(modbus_client_t* client, bool_t adaptive_read_size) {
+  return_value_if_fail(client != NULL, RET_BAD_PARAMS);
+
+  client->adaptive_read_size = adaptive_read_size;
+
+  return RET_OK;
+}
+
+ret_t modbus_client_set_max_read_count(modbus_client_t* client, uint8_t unit_id,
+                                       uint8_t func_code, uint16_t count) {
+  return_value_if_fail(client != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(func_code >= MODBUS_FC_READ_COILS &&
+                           func_code <= MODBUS_FC_READ_INPUT_REGISTERS,
+                       RET_BAD_PARAMS);
+
+  if (MODBUS_CLIENT_IS_READ_BITS(func_code)) {
+    count = tk_min(count, MODBUS_MAX_READ_BITS);
+  } else {
+    count = tk_min(count, MODBUS_MAX_READ_REGISTERS);
+  }
+  *modbus_client_get_max_read_count_ref(client, unit_id, func_code) = count;
+
+  return RET_OK;
+}
+
+uint32_t modbus_client_get_max_read_count(modbus_client_t* client, uint8_t unit_id,
+                                          uint8_t func_code) {
+  uint16_t count = 0;
+  return_value_if_fail(client != NULL, 0);
+
+  count = *modbus_client_get_max_read_count_ref(client, unit_id, func_code);
+  if (count > 0) {
+    return count;
+  }
+
+  return MODBUS_CLIENT_IS_READ_BITS(func_code) ? MODBUS_MAX_READ_BITS : MODBUS_MAX_READ_REGISTERS;
+}
+
+ret_t modbus_client_set_read_merge_gap(modbus_client_t* client, uint32_t read_merge_gap) {
+  return_value_if_fail(client != NULL, RET_BAD_PARAMS);
+
+  client->read_merge_gap = read_merge_gap;
+
+  return RET_OK;
+}
+
 ret_t modbus_client_set_slave(modbus_client_t* client, uint8_t slave) {
   modbus_common_t* common = MODBUS_COMMON(client);
   return_value_if_fail(common != NULL, RET_BAD_PARAMS);
@@ -617,10 +1732,90 @@ static ret_t modbus_client_deinit(modbus_client_t* client) {
   return RET_OK;
 }
 
+ret_t modbus_client_get_stats(modbus_client_t* client, modbus_client_stats_t* stats) {
+  return_value_if_fail(client != NULL && stats != NULL, RET_BAD_PARAMS);
+
+  modbus_client_stats_lock(client);
+  memcpy(stats, &(client->stats), sizeof(*stats));
+  modbus_client_stats_unlock(client);
+
+  return RET_OK;
+}
+
+ret_t modbus_client_get_unit_stats(modbus_client_t* client, uint8_t unit_id,
+                                   modbus_client_stats_t* stats) {
+#if MODBUS_WITH_STATS
+  modbus_client_stats_t* unit_stats = NULL;
+  return_value_if_fail(client != NULL && stats != NULL, RET_BAD_PARAMS);
+
+  modbus_client_stats_lock(client);
+  unit_stats = modbus_client_get_unit_stats_ex(client, unit_id, FALSE);
+  if (unit_stats != NULL) {
+    memcpy(stats, unit_stats, sizeof(*stats));
+  }
+  modbus_client_stats_unlock(client);
+
+  return unit_stats != NULL ? RET_OK : RET_NOT_FOUND;
+#else
+  (void)unit_id;
+  return_value_if_fail(client != NULL && stats != NULL, RET_BAD_PARAMS);
+
+  return RET_NOT_IMPL;
+#endif /*MODBUS_WITH_STATS*/
+}
+
+ret_t modbus_client_reset_stats(modbus_client_t* client) {
+#if MODBUS_WITH_STATS
+  uint32_t i = 0;
+#endif /*MODBUS_WITH_STATS*/
+  return_value_if_fail(client != NULL, RET_BAD_PARAMS);
+
+  modbus_client_stats_lock(client);
+  memset(&(client->stats), 0x00, sizeof(client->stats));
+  memset(client->priority_stats, 0x00, sizeof(client->priority_stats));
+#if MODBUS_WITH_STATS
+  for (i = 0; i < ARRAY_SIZE(client->unit_stats); i++) {
+    if (client->unit_stats[i] != NULL) {
+      memset(client->unit_stats[i], 0x00, sizeof(modbus_client_stats_t));
+    }
+  }
+#endif /*MODBUS_WITH_STATS*/
+  modbus_client_stats_unlock(client);
+
+  return RET_OK;
+}
+
+ret_t modbus_client_stats_to_str(const modbus_client_stats_t* stats, const char* name, str_t* str) {
+  return_value_if_fail(stats != NULL && str != NULL, RET_BAD_PARAMS);
+
+  if (name == NULL) {
+    name = "client";
+  }
+
+  str_append_format(str, 256,
+                    "%s: requests=%u ok=%u retries=%u timeouts=%u crc_errors=%u exceptions=%u "
+                    "slave_mismatches=%u io_errors=%u last_error=%d last_error_time=%llu\n",
+                    name, stats->num_requests, stats->num_ok, stats->num_retries,
+                    stats->num_timeouts, stats->num_crc_errors, stats->num_exceptions,
+                    stats->num_slave_mismatches, stats->num_io_errors, (int)(stats->last_error),
+                    (unsigned long long)(stats->last_error_time));
+
+  return modbus_histogram_to_str(&(stats->rtt), "rtt_us", str);
+}
+
 ret_t modbus_client_destroy(modbus_client_t* client) {
+#if MODBUS_WITH_STATS
+  uint32_t i = 0;
+#endif /*MODBUS_WITH_STATS*/
   return_value_if_fail(client != NULL, RET_BAD_PARAMS);
 
   modbus_client_deinit(client);
+  modbus_client_deinit_lock(client);
+#if MODBUS_WITH_STATS
+  for (i = 0; i < ARRAY_SIZE(client->unit_stats); i++) {
+    TKMEM_FREE(client->unit_stats[i]);
+  }
+#endif /*MODBUS_WITH_STATS*/
   if (client->url != NULL) {
     TKMEM_FREE(client->url);
     client->url = NULL;
@@ -629,4 +1824,4 @@ ret_t modbus_client_destroy(modbus_client_t* client) {
 
   return RET_OK;
 }
-
+#endif /*MODBUS_WITH_CLIENT*/
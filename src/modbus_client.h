@@ -22,11 +22,207 @@
 #ifndef TK_MODBUS_CLIENT_H
 #define TK_MODBUS_CLIENT_H
 
+#include "tkc/cond.h"
+#include "tkc/mutex.h"
 #include "service/client.h"
 #include "modbus_common.h"
+#include "modbus_histogram.h"
 
 BEGIN_C_DECLS
 
+/**
+ * @enum modbus_client_priority_t
+ * @prefix MODBUS_CLIENT_PRIORITY_
+ * 请求的优先级。
+ *
+ * 多个线程共用一个client时，总线空闲后优先处理高优先级的请求，同一优先级内不保证顺序。
+ */
+typedef enum _modbus_client_priority_t {
+  /**
+   * @const MODBUS_CLIENT_PRIORITY_HIGH
+   * 高优先级(如操作员下发的命令)。
+   */
+  MODBUS_CLIENT_PRIORITY_HIGH = 0,
+  /**
+   * @const MODBUS_CLIENT_PRIORITY_NORMAL
+   * 普通优先级(如报警量的轮询，缺省值)。
+   */
+  MODBUS_CLIENT_PRIORITY_NORMAL,
+  /**
+   * @const MODBUS_CLIENT_PRIORITY_LOW
+   * 低优先级(如趋势数据的轮询)。
+   */
+  MODBUS_CLIENT_PRIORITY_LOW,
+  /**
+   * @const MODBUS_CLIENT_PRIORITY_NR
+   * 优先级的个数。
+   */
+  MODBUS_CLIENT_PRIORITY_NR
+} modbus_client_priority_t;
+
+/**
+ * @class modbus_client_priority_stats_t
+ * 按优先级统计的排队数据。
+ */
+typedef struct _modbus_client_priority_stats_t {
+  /**
+   * @property {uint32_t} num_requests
+   * @annotation ["readable"]
+   * 获得总线的次数(嵌套的modbus_client_lock只统计一次)。
+   */
+  uint32_t num_requests;
+  /**
+   * @property {uint32_t} num_preemptions
+   * @annotation ["readable"]
+   * 在请求边界让出总线给更高优先级请求的次数。
+   */
+  uint32_t num_preemptions;
+  /**
+   * @property {modbus_histogram_t} wait_time
+   * @annotation ["readable"]
+   * 排队等待的时间(单位：us)。
+   */
+  modbus_histogram_t wait_time;
+  /**
+   * @property {modbus_histogram_t} latency
+   * @annotation ["readable"]
+   * 从请求总线到释放总线的时间(单位：us)。
+   */
+  modbus_histogram_t latency;
+} modbus_client_priority_stats_t;
+
+/**
+ * @const MODBUS_CLIENT_PIPELINE_DEPTH
+ * TCP模式下批量读取时，最多同时发出的请求数(不等待应答就发送下一个请求)。
+ */
+#ifndef MODBUS_CLIENT_PIPELINE_DEPTH
+#define MODBUS_CLIENT_PIPELINE_DEPTH 4
+#endif /*MODBUS_CLIENT_PIPELINE_DEPTH*/
+
+/**
+ * @const MODBUS_CLIENT_MAX_RANGES
+ * 批量读取时，区间个数不超过该值时使用栈上的数组排序(定义MODBUS_STATIC_BUFFERS时为区间个数的上限)。
+ */
+#ifndef MODBUS_CLIENT_MAX_RANGES
+#define MODBUS_CLIENT_MAX_RANGES 32
+#endif /*MODBUS_CLIENT_MAX_RANGES*/
+
+/**
+ * @const MODBUS_CLIENT_WBUFFER_SIZE
+ * 定义MODBUS_STATIC_BUFFERS时，modbus_client_t内嵌的收发缓冲区大小。
+ */
+#ifndef MODBUS_CLIENT_WBUFFER_SIZE
+#define MODBUS_CLIENT_WBUFFER_SIZE 1024
+#endif /*MODBUS_CLIENT_WBUFFER_SIZE*/
+
+/**
+ * @class modbus_client_range_t
+ * 批量读取(modbus_client_read_ranges)的一个区间。
+ */
+typedef struct _modbus_client_range_t {
+  /**
+   * @property {uint8_t} func_code
+   * 功能码(MODBUS_FC_READ_COILS/MODBUS_FC_READ_DISCRETE_INPUTS/MODBUS_FC_READ_HOLDING_REGISTERS/MODBUS_FC_READ_INPUT_REGISTERS)。
+   */
+  uint8_t func_code;
+  /**
+   * @property {uint16_t} addr
+   * 起始地址。
+   */
+  uint16_t addr;
+  /**
+   * @property {uint32_t} count
+   * 个数(不受单个请求最大长度的限制，addr + count不能超过65536)。
+   */
+  uint32_t count;
+  /**
+   * @property {void*} buff
+   * 用于返回数据。读位时每个位占一个字节，读寄存器时每个寄存器为一个uint16_t。
+   */
+  void* buff;
+  /**
+   * @property {ret_t} result
+   * @annotation ["readable"]
+   * 该区间的读取结果。
+   */
+  ret_t result;
+} modbus_client_range_t;
+
+/**
+ * @class modbus_client_stats_t
+ * modbus client的统计数据。
+ *
+ * 每次发送请求(包括重试)都会被统计，可以按client统计，也可以按从站地址(unit id)统计。
+ */
+typedef struct _modbus_client_stats_t {
+  /**
+   * @property {uint32_t} num_requests
+   * @annotation ["readable"]
+   * 发送请求的次数(包括重试)。
+   */
+  uint32_t num_requests;
+  /**
+   * @property {uint32_t} num_ok
+   * @annotation ["readable"]
+   * 成功的次数。
+   */
+  uint32_t num_ok;
+  /**
+   * @property {uint32_t} num_retries
+   * @annotation ["readable"]
+   * 重试的次数。
+   */
+  uint32_t num_retries;
+  /**
+   * @property {uint32_t} num_timeouts
+   * @annotation ["readable"]
+   * 超时的次数。
+   */
+  uint32_t num_timeouts;
+  /**
+   * @property {uint32_t} num_crc_errors
+   * @annotation ["readable"]
+   * CRC错误的次数。
+   */
+  uint32_t num_crc_errors;
+  /**
+   * @property {uint32_t} num_exceptions
+   * @annotation ["readable"]
+   * 收到异常回复的次数。
+   */
+  uint32_t num_exceptions;
+  /**
+   * @property {uint32_t} num_slave_mismatches
+   * @annotation ["readable"]
+   * 回复的从站地址不匹配的次数。
+   */
+  uint32_t num_slave_mismatches;
+  /**
+   * @property {uint32_t} num_io_errors
+   * @annotation ["readable"]
+   * 其它错误(如连接断开)的次数。
+   */
+  uint32_t num_io_errors;
+  /**
+   * @property {ret_t} last_error
+   * @annotation ["readable"]
+   * 最后一次错误。
+   */
+  ret_t last_error;
+  /**
+   * @property {uint64_t} last_error_time
+   * @annotation ["readable"]
+   * 最后一次错误的时间(time_now_ms)。
+   */
+  uint64_t last_error_time;
+  /**
+   * @property {modbus_histogram_t} rtt
+   * @annotation ["readable"]
+   * 从发送请求到收到回复的时间(单位为微秒，只统计收到回复的请求)。
+   */
+  modbus_histogram_t rtt;
+} modbus_client_stats_t;
+
 /**
  * @class modbus_client_t
  * 
@@ -87,6 +283,20 @@ typedef struct _modbus_client_t {
    */
   uint32_t frame_gap_time;
 
+  /**
+   * @property {uint32_t} frame_gap_spin_time
+   * @annotation ["readable"]
+   * 等待帧间隔时最后忙等的时间，缺省为MODBUS_FRAME_GAP_SPIN_TIME。(单位：us)
+   */
+  uint32_t frame_gap_spin_time;
+
+  /**
+   * @property {uint32_t} turnaround_delay
+   * @annotation ["readable"]
+   * 广播请求(RTU从站地址为0)发送后的等待时间，让从站有时间处理请求。(单位：ms)
+   */
+  uint32_t turnaround_delay;
+
   /**
    * @property {bool_t} auto_reconnect
    * @annotation ["readable"]
@@ -107,11 +317,64 @@ typedef struct _modbus_client_t {
    */
   uint32_t retry_times;
 
+  /**
+   * @property {uint32_t} read_merge_gap
+   * @annotation ["readable"]
+   * 批量读取时，两个区间之间的间隔不超过该值时合并为一个请求(缺省为0，只合并相邻或重叠的区间)。
+   * 有的设备地址不连续，读取空洞会返回异常，所以缺省不跨越空洞。
+   */
+  uint32_t read_merge_gap;
+
+  /**
+   * @property {bool_t} adaptive_read_size
+   * @annotation ["readable"]
+   * 读请求因为长度被从站拒绝时，是否自动探测从站支持的最大个数(缺省为FALSE)。
+   */
+  bool_t adaptive_read_size;
+
   /**
    * @property {char*} url
    * modbus server的url。
    */
   char* url;
+
+  /**
+   * @property {modbus_client_stats_t} stats
+   * @annotation ["readable"]
+   * 统计数据。
+   */
+  modbus_client_stats_t stats;
+
+  /**
+   * @property {modbus_client_priority_stats_t*} priority_stats
+   * @annotation ["readable"]
+   * 按优先级统计的排队数据。
+   */
+  modbus_client_priority_stats_t priority_stats[MODBUS_CLIENT_PRIORITY_NR];
+
+  /*private*/
+  tk_mutex_t* mutex;
+  tk_cond_t* cond[MODBUS_CLIENT_PRIORITY_NR];
+  uint32_t waiting[MODBUS_CLIENT_PRIORITY_NR];
+  uint64_t owner;
+  uint32_t depth;
+  uint64_t lock_time;
+  modbus_client_priority_t owner_priority;
+  /*大于0时嵌套的modbus_client_lock不让出总线(ranges_temp中有暂存的数据)*/
+  uint32_t no_yield;
+  uint64_t resp_time;
+  uint64_t req_start_time;
+  uint32_t req_num_exceptions;
+#if MODBUS_WITH_STATS
+  modbus_client_stats_t* unit_stats[256];
+#endif /*MODBUS_WITH_STATS*/
+  /*按从站地址保存的单个读请求的最大个数(0表示使用协议规定的最大值)*/
+  uint16_t max_read_bits[256];
+  uint16_t max_read_registers[256];
+#ifdef MODBUS_STATIC_BUFFERS
+  uint8_t wbuffer_data[MODBUS_CLIENT_WBUFFER_SIZE];
+  uint8_t ranges_temp[MODBUS_CLIENT_PIPELINE_DEPTH * MODBUS_MAX_READ_BITS];
+#endif /*MODBUS_STATIC_BUFFERS*/
 } modbus_client_t;
 
 /**
@@ -193,12 +456,36 @@ ret_t modbus_client_set_response_timeout(modbus_client_t* client, uint32_t respo
  */
 ret_t modbus_client_set_frame_gap_time(modbus_client_t* client, uint32_t frame_gap_time);
 
+/**
+ * @method modbus_client_set_frame_gap_spin_time
+ * 设置等待帧间隔时最后忙等的时间(缺省为MODBUS_FRAME_GAP_SPIN_TIME)。
+ *
+ * 先休眠到帧间隔结束前spin_time，再忙等到结束，减小sleep_us多等待的时间(见modbus_common_wait_until)。
+ * 为0时只休眠(不占用CPU，但是误差较大)。
+ * @param {modbus_client_t*} client modbus client对象。
+ * @param {uint32_t} spin_time 忙等的时间。(单位：us)
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_client_set_frame_gap_spin_time(modbus_client_t* client, uint32_t spin_time);
+
+/**
+ * @method modbus_client_set_turnaround_delay
+ * 设置广播请求的等待时间(缺省为MODBUS_TURNAROUND_DELAY)。
+ *
+ * RTU模式下从站地址设置为MODBUS_BROADCAST_ADDRESS时为广播请求：
+ * 只能使用写请求，发送后不等待响应，而是等待turnaround_delay后返回。
+ * @param {modbus_client_t*} client modbus client对象。
+ * @param {uint32_t} turnaround_delay 等待时间。(单位：ms)
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_client_set_turnaround_delay(modbus_client_t* client, uint32_t turnaround_delay);
+
 /**
  * @method modbus_client_read_bits
  * 读取bits。
  * @param {modbus_client_t*} client modbus client对象。
  * @param {uint16_t} addr 地址。
- * @param {uint16_t} count 个数。
+ * @param {uint16_t} count 个数(超过单个请求的最大长度时自动拆分为多个请求)。
  * @param {uint8_t*} buff 读取的数据(每个bit在buff中占据1个字节)。
  * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
  */
@@ -209,7 +496,7 @@ ret_t modbus_client_read_bits(modbus_client_t* client, uint16_t addr, uint16_t c
  * 读取input bits。
  * @param {modbus_client_t*} client modbus client对象。
  * @param {uint16_t} addr 地址。
- * @param {uint16_t} count 个数。
+ * @param {uint16_t} count 个数(超过单个请求的最大长度时自动拆分为多个请求)。
  * @param {uint8_t*} buff 读取的数据(每个bit在buff中占据1个字节)。
  * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
  */
@@ -221,7 +508,7 @@ ret_t modbus_client_read_input_bits(modbus_client_t* client, uint16_t addr, uint
  * 读取registers。
  * @param {modbus_client_t*} client modbus client对象。
  * @param {uint16_t} addr 地址。
- * @param {uint16_t} count 个数。
+ * @param {uint16_t} count 个数(超过单个请求的最大长度时自动拆分为多个请求)。
  * @param {uint16_t*} buff 读取的数据。
  * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
  */
@@ -233,7 +520,7 @@ ret_t modbus_client_read_registers(modbus_client_t* client, uint16_t addr, uint1
  * 读取input registers。
  * @param {modbus_client_t*} client modbus client对象。
  * @param {uint16_t} addr 地址。
- * @param {uint16_t} count 个数。
+ * @param {uint16_t} count 个数(超过单个请求的最大长度时自动拆分为多个请求)。
  * @param {uint16_t*} buff 读取的数据。
  * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
  */
@@ -300,6 +587,130 @@ ret_t modbus_client_write_and_read_registers(modbus_client_t* client,
                                              uint16_t write_addr, uint16_t write_nb, const uint16_t *src,
                                              uint16_t read_addr, uint16_t read_nb, uint16_t *dest);
 
+/**
+ * @method modbus_client_mask_write_register
+ * 用掩码修改单个holding register(由从站完成读取-修改-写入，只需要一次请求)。
+ * 结果为：(当前值 & and_mask) | (or_mask & ~and_mask)。
+ * 如置位bit3：and_mask=0xfff7, or_mask=0x0008；清除bit3：and_mask=0xfff7, or_mask=0。
+ * @param {modbus_client_t*} client modbus client对象。
+ * @param {uint16_t} addr 地址。
+ * @param {uint16_t} and_mask AND掩码。
+ * @param {uint16_t} or_mask OR掩码。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_client_mask_write_register(modbus_client_t* client, uint16_t addr, uint16_t and_mask,
+                                        uint16_t or_mask);
+
+/**
+ * @method modbus_client_read_fifo_queue
+ * 读取FIFO队列(一次请求最多读取MODBUS_MAX_FIFO_COUNT个数据)。
+ * @param {modbus_client_t*} client modbus client对象。
+ * @param {uint16_t} addr FIFO指针地址。
+ * @param {uint16_t*} buff 读取的数据。
+ * @param {uint16_t*} count 输入为buff的容量，输出为读取的个数。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_client_read_fifo_queue(modbus_client_t* client, uint16_t addr, uint16_t* buff,
+                                    uint16_t* count);
+
+/**
+ * @method modbus_client_read_file_records
+ * 读取多个文件记录(0x14功能码)。
+ * 较长的记录自动拆分，多个子请求尽量打包到同一个请求中，以减少请求的次数。
+ * 读取的数据放到每个记录的data中。
+ * @param {modbus_client_t*} client modbus client对象。
+ * @param {modbus_file_record_t*} records 记录数组。
+ * @param {uint32_t} nr 记录的个数。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_client_read_file_records(modbus_client_t* client, modbus_file_record_t* records,
+                                      uint32_t nr);
+
+/**
+ * @method modbus_client_write_file_records
+ * 写入多个文件记录(0x15功能码)。
+ * 较长的记录自动拆分，多个子请求尽量打包到同一个请求中，以减少请求的次数。
+ * @param {modbus_client_t*} client modbus client对象。
+ * @param {const modbus_file_record_t*} records 记录数组。
+ * @param {uint32_t} nr 记录的个数。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_client_write_file_records(modbus_client_t* client,
+                                       const modbus_file_record_t* records, uint32_t nr);
+
+/**
+ * @method modbus_client_read_ranges
+ * 批量读取多个区间。
+ *
+ * * 同一功能码的区间按地址排序，相邻或重叠(或间隔不超过read_merge_gap)的区间合并到同一个请求中。
+ * * 超过单个请求最大长度的区间自动拆分为多个请求。
+ * * TCP模式下，最多同时发出MODBUS_CLIENT_PIPELINE_DEPTH个请求，以减少往返的等待时间。
+ *
+ * 某个请求失败时，继续读取其它请求，每个区间的结果放在result中。
+ *
+ *```c
+ *  uint8_t bits[3000];
+ *  uint16_t regs[1000];
+ *  modbus_client_range_t ranges[] = {
+ *    {MODBUS_FC_READ_HOLDING_REGISTERS, 0, 1000, regs},
+ *    {MODBUS_FC_READ_COILS, 100, 3000, bits},
+ *  };
+ *  modbus_client_read_ranges(client, ranges, ARRAY_SIZE(ranges));
+ *```
+ * @param {modbus_client_t*} client modbus client对象。
+ * @param {modbus_client_range_t*} ranges 区间数组。
+ * @param {uint32_t} nr 区间的个数。
+ * @return {ret_t} 全部成功返回RET_OK，否则返回第一个失败的结果。
+ */
+ret_t modbus_client_read_ranges(modbus_client_t* client, modbus_client_range_t* ranges,
+                                uint32_t nr);
+
+/**
+ * @method modbus_client_set_adaptive_read_size
+ * 设置是否自动探测从站支持的最大读取个数。
+ *
+ * 有的设备不支持协议规定的最大长度(如只支持一次读取64个寄存器)，请求太长时会返回
+ * ILLEGAL_DATA_ADDRESS或ILLEGAL_DATA_VALUE异常。启用后，收到这两种异常时用二分法找出
+ * 从起始地址开始能够一次读取的最大个数。如果紧接着的地址能单独读取，说明是长度的限制，
+ * 按从站地址和功能码(位/寄存器)缓存该值，后续的请求按它拆分；否则认为是地址空洞，不缓存。
+ * @param {modbus_client_t*} client modbus client对象。
+ * @param {bool_t} adaptive_read_size 是否自动探测。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_client_set_adaptive_read_size(modbus_client_t* client, bool_t adaptive_read_size);
+
+/**
+ * @method modbus_client_set_max_read_count
+ * 设置从站单个读请求的最大个数(已知设备的限制时可以直接设置，不用探测)。
+ * @param {modbus_client_t*} client modbus client对象。
+ * @param {uint8_t} unit_id 从站地址。
+ * @param {uint8_t} func_code 读取的功能码(线圈和离散输入共用一个值，保持寄存器和输入寄存器共用一个值)。
+ * @param {uint16_t} count 最大个数(0表示恢复为协议规定的最大值)。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_client_set_max_read_count(modbus_client_t* client, uint8_t unit_id,
+                                       uint8_t func_code, uint16_t count);
+
+/**
+ * @method modbus_client_get_max_read_count
+ * 获取从站单个读请求的最大个数。
+ * @param {modbus_client_t*} client modbus client对象。
+ * @param {uint8_t} unit_id 从站地址。
+ * @param {uint8_t} func_code 读取的功能码。
+ * @return {uint32_t} 返回最大个数。
+ */
+uint32_t modbus_client_get_max_read_count(modbus_client_t* client, uint8_t unit_id,
+                                          uint8_t func_code);
+
+/**
+ * @method modbus_client_set_read_merge_gap
+ * 设置批量读取时合并区间的最大间隔。
+ * @param {modbus_client_t*} client modbus client对象。
+ * @param {uint32_t} read_merge_gap 最大间隔(寄存器或位的个数)。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_client_set_read_merge_gap(modbus_client_t* client, uint32_t read_merge_gap);
+
 /**
  * @method modbus_client_set_slave
  * 设置slave。
@@ -318,6 +729,86 @@ ret_t modbus_client_set_slave(modbus_client_t* client, uint8_t slave);
  */
 ret_t modbus_client_set_auto_reconnect(modbus_client_t* client, bool_t auto_reconnect);
 
+/**
+ * @method modbus_client_lock
+ * 以指定的优先级获得总线的使用权。
+ *
+ * 每个请求函数内部都会以MODBUS_CLIENT_PRIORITY_NORMAL获得总线，请求完成后立即释放。
+ * 在外面调用modbus_client_lock可以指定更高或更低的优先级，也可以把多个请求作为一批执行(期间的set_slave等设置不会被其它线程修改)。
+ *
+ * 同一线程可以嵌套调用(嵌套时忽略priority)。持有总线的线程在每个请求开始前，如果有更高优先级的请求在等待，
+ * 会先让出总线，等它们完成后再继续，所以高优先级请求最多等待一个正在进行的请求。
+ *
+ *```c
+ *  modbus_client_lock(client, MODBUS_CLIENT_PRIORITY_HIGH);
+ *  modbus_client_set_slave(client, 1);
+ *  modbus_client_write_register(client, 100, 1234);
+ *  modbus_client_unlock(client);
+ *```
+ * @param {modbus_client_t*} client modbus client对象。
+ * @param {modbus_client_priority_t} priority 优先级。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_client_lock(modbus_client_t* client, modbus_client_priority_t priority);
+
+/**
+ * @method modbus_client_unlock
+ * 释放总线的使用权(与modbus_client_lock配对使用)。
+ * @param {modbus_client_t*} client modbus client对象。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_client_unlock(modbus_client_t* client);
+
+/**
+ * @method modbus_client_get_priority_stats
+ * 获取指定优先级的排队统计数据的快照。
+ * @param {modbus_client_t*} client modbus client对象。
+ * @param {modbus_client_priority_t} priority 优先级。
+ * @param {modbus_client_priority_stats_t*} stats 用于返回统计数据。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_client_get_priority_stats(modbus_client_t* client, modbus_client_priority_t priority,
+                                       modbus_client_priority_stats_t* stats);
+
+/**
+ * @method modbus_client_get_stats
+ * 获取统计数据的快照。
+ * > 在client->mutex中复制，可以在其它线程中调用，不需要占用总线。
+ * @param {modbus_client_t*} client modbus client对象。
+ * @param {modbus_client_stats_t*} stats 用于返回统计数据。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_client_get_stats(modbus_client_t* client, modbus_client_stats_t* stats);
+
+/**
+ * @method modbus_client_get_unit_stats
+ * 获取指定从站地址的统计数据的快照。
+ * @param {modbus_client_t*} client modbus client对象。
+ * @param {uint8_t} unit_id 从站地址。
+ * @param {modbus_client_stats_t*} stats 用于返回统计数据。
+ * @return {ret_t} 返回RET_OK表示成功，没有该从站的数据时返回RET_NOT_FOUND，MODBUS_WITH_STATS为0时返回RET_NOT_IMPL。
+ */
+ret_t modbus_client_get_unit_stats(modbus_client_t* client, uint8_t unit_id,
+                                   modbus_client_stats_t* stats);
+
+/**
+ * @method modbus_client_reset_stats
+ * 清除统计数据。
+ * @param {modbus_client_t*} client modbus client对象。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_client_reset_stats(modbus_client_t* client);
+
+/**
+ * @method modbus_client_stats_to_str
+ * 把统计数据以文本的形式追加到str中。
+ * @param {const modbus_client_stats_t*} stats 统计数据。
+ * @param {const char*} name 名称。
+ * @param {str_t*} str 用于返回结果。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_client_stats_to_str(const modbus_client_stats_t* stats, const char* name, str_t* str);
+
 /**
  * @method modbus_client_destroy
  * 销毁modbus client。
@@ -22,6 +22,17 @@
 #include "tkc/mem.h"
 #include "modbus_client_channel.h"
 
+#if MODBUS_WITH_CLIENT
+
+#ifndef MODBUS_CLIENT_CHANNEL_MERGE_REGISTERS_GAP
+/*两段变化之间不超过该个数的寄存器时合并为一个请求(多写几个寄存器比多一个请求的开销小)*/
+#define MODBUS_CLIENT_CHANNEL_MERGE_REGISTERS_GAP 4
+#endif /*MODBUS_CLIENT_CHANNEL_MERGE_REGISTERS_GAP*/
+
+#ifndef MODBUS_CLIENT_CHANNEL_MERGE_BITS_GAP
+#define MODBUS_CLIENT_CHANNEL_MERGE_BITS_GAP 64
+#endif /*MODBUS_CLIENT_CHANNEL_MERGE_BITS_GAP*/
+
 static ret_t modbus_client_channel_init(modbus_client_channel_t* channel);
 static ret_t modbus_client_channel_load(modbus_client_channel_t* channel, conf_node_t* node);
 
@@ -53,92 +64,37 @@ modbus_client_channel_t* modbus_client_channel_create(conf_node_t* node) {
   return channel;
 }
 
-ret_t modbus_client_channel_read(modbus_client_channel_t* channel) {
+static ret_t modbus_client_channel_read_impl(modbus_client_channel_t* channel,
+                                             modbus_client_t* client) {
   ret_t ret = RET_FAIL;
-  modbus_client_t* client = NULL;
-  return_value_if_fail(channel != NULL, RET_BAD_PARAMS);
-  if (channel->client == NULL) {
-    modbus_client_clear_buffer_if_fail(channel);
-  }
-  client = channel->client;
-  return_value_if_fail(client != NULL, RET_BAD_PARAMS);
-  
+  modbus_client_range_t range;
+
   if (channel->unit_id) {
     modbus_client_set_slave(client, channel->unit_id);
   }
 
-  switch (channel->access_type) {
-    case MODBUS_FC_READ_COILS: {
-      /*如果长度超过了最大长度(MODBUS_MAX_READ_BITS)，需要分包读取*/
-      uint32_t offset = 0;
-      uint32_t length = channel->bits_length;
+  /*超过单个请求最大长度时，由modbus_client_read_ranges分包读取*/
+  memset(&range, 0x00, sizeof(range));
+  range.func_code = channel->access_type;
+  range.addr = channel->read_offset;
 
-      while (length > 0) {
-        uint32_t len = length > MODBUS_MAX_READ_BITS ? MODBUS_MAX_READ_BITS : length;
-        ret = modbus_client_read_bits(client, channel->read_offset + offset, len,
-                                      channel->bits_buffer);
-        if (ret != RET_OK) {
-          break;
-        }
-        tk_bits_data_from_bytes_data(channel->read_buffer + offset / 8, tk_bits_to_bytes(len),
-                                     channel->bits_buffer, len);
-        offset += len;
-        length -= len;
-      }
-      break;
-    }
+  switch (channel->access_type) {
+    case MODBUS_FC_READ_COILS:
     case MODBUS_FC_READ_DISCRETE_INPUTS: {
-      /*如果长度超过了最大长度(MODBUS_MAX_READ_BITS)，需要分包读取*/
-      uint32_t offset = 0;
-      uint32_t length = channel->bits_length;
-      while (length > 0) {
-        uint32_t len = length > MODBUS_MAX_READ_BITS ? MODBUS_MAX_READ_BITS : length;
-        ret = modbus_client_read_input_bits(client, channel->read_offset + offset, len,
-                                            channel->bits_buffer);
-        if (ret != RET_OK) {
-          break;
-        }
-        tk_bits_data_from_bytes_data(channel->read_buffer + offset / 8, tk_bits_to_bytes(len),
-                                     channel->bits_buffer, len);
-        offset += len;
-        length -= len;
-      }
-      break;
-    }
-    case MODBUS_FC_READ_HOLDING_REGISTERS: {
-      /*如果长度超过了最大长度(MODBUS_MAX_READ_REGISTERS)，需要分包读取*/
-      uint32_t offset = 0;
-      uint32_t length = channel->read_buffer_length / sizeof(uint16_t);
-
-      while (length > 0) {
-        uint32_t len = length > MODBUS_MAX_READ_REGISTERS ? MODBUS_MAX_READ_REGISTERS : length;
-        ret = modbus_client_read_registers(
-            client, channel->read_offset + offset, len,
-            (uint16_t*)(channel->read_buffer + offset * sizeof(uint16_t)));
-        if (ret != RET_OK) {
-          break;
-        }
-        offset += len;
-        length -= len;
+      range.count = channel->bits_length;
+      range.buff = channel->bits_buffer;
+      ret = modbus_client_read_ranges(client, &range, 1);
+      if (ret == RET_OK) {
+        tk_bits_data_from_bytes_data(channel->read_buffer, channel->read_buffer_length,
+                                     channel->bits_buffer, channel->bits_length);
       }
       break;
     }
+    case MODBUS_FC_READ_HOLDING_REGISTERS:
     case MODBUS_FC_READ_INPUT_REGISTERS: {
-      /*如果长度超过了最大长度(MODBUS_MAX_READ_REGISTERS)，需要分包读取*/
-      uint32_t offset = 0;
-      uint32_t length = channel->read_buffer_length / sizeof(uint16_t);
-
-      while (length > 0) {
-        uint32_t len = length > MODBUS_MAX_READ_REGISTERS ? MODBUS_MAX_READ_REGISTERS : length;
-        ret = modbus_client_read_input_registers(
-            client, channel->read_offset + offset, len,
-            (uint16_t*)(channel->read_buffer + offset * sizeof(uint16_t)));
-        if (ret != RET_OK) {
-          break;
-        }
-        offset += len;
-        length -= len;
-      }
+      range.count = channel->read_buffer_length / sizeof(uint16_t);
+      range.buff = channel->read_buffer;
+      ret = modbus_client_read_ranges(client, &range, 1);
       break;
     }
     default: {
@@ -146,6 +102,23 @@ ret_t modbus_client_channel_read(modbus_client_channel_t* channel) {
     }
   }
 
+  return ret;
+}
+
+ret_t modbus_client_channel_read(modbus_client_channel_t* channel) {
+  ret_t ret = RET_FAIL;
+  modbus_client_t* client = NULL;
+  return_value_if_fail(channel != NULL, RET_BAD_PARAMS);
+  if (channel->client == NULL) {
+    modbus_client_clear_buffer_if_fail(channel);
+  }
+  client = channel->client;
+  return_value_if_fail(client != NULL, RET_BAD_PARAMS);
+
+  modbus_client_lock(client, channel->priority);
+  ret = modbus_client_channel_read_impl(channel, client);
+  modbus_client_unlock(client);
+
   if (ret == RET_OK) {
     channel->read_ok_count++;
   } else {
@@ -156,16 +129,10 @@ ret_t modbus_client_channel_read(modbus_client_channel_t* channel) {
   return ret;
 }
 
-ret_t modbus_client_channel_write(modbus_client_channel_t* channel) {
+static ret_t modbus_client_channel_write_all(modbus_client_channel_t* channel,
+                                             modbus_client_t* client) {
   ret_t ret = RET_FAIL;
-  modbus_client_t* client = NULL;
-  return_value_if_fail(channel != NULL, RET_BAD_PARAMS);
-  client = channel->client;
-  return_value_if_fail(client != NULL, RET_BAD_PARAMS);
 
-  if (channel->unit_id) {
-    modbus_client_set_slave(client, channel->unit_id);
-  }
   switch (channel->access_type) {
     case MODBUS_FC_WRITE_SINGLE_COIL: {
       ret = modbus_client_write_bit(client, channel->write_offset, channel->write_buffer[0] & 0x01);
@@ -236,6 +203,182 @@ ret_t modbus_client_channel_write(modbus_client_channel_t* channel) {
     }
   }
 
+  return ret;
+}
+
+static bool_t modbus_client_channel_get_bit(const uint8_t* buff, uint32_t index) {
+  return (buff[index / 8] >> (index % 8)) & 0x01;
+}
+
+static void modbus_client_channel_set_bit(uint8_t* buff, uint32_t index, bool_t value) {
+  if (value) {
+    buff[index / 8] |= (1 << (index % 8));
+  } else {
+    buff[index / 8] &= ~(1 << (index % 8));
+  }
+}
+
+static ret_t modbus_client_channel_write_changed_registers(modbus_client_channel_t* channel,
+                                                           modbus_client_t* client) {
+  uint32_t i = 0;
+  ret_t ret = RET_NOT_MODIFIED;
+  uint16_t* w = (uint16_t*)(channel->write_buffer);
+  uint16_t* s = (uint16_t*)(channel->shadow_buffer);
+  uint32_t n = channel->write_buffer_length / sizeof(uint16_t);
+
+  while (i < n) {
+    uint32_t j = 0;
+    uint32_t end = 0;
+    uint32_t start = 0;
+
+    if (w[i] == s[i]) {
+      i++;
+      continue;
+    }
+
+    /*把间隔较小的变化合并到一个请求中，以减少请求次数*/
+    start = i;
+    end = i + 1;
+    for (j = i + 1; j < n && j - start < MODBUS_MAX_WRITE_REGISTERS; j++) {
+      if (w[j] != s[j]) {
+        end = j + 1;
+      } else if (j - end >= MODBUS_CLIENT_CHANNEL_MERGE_REGISTERS_GAP) {
+        break;
+      }
+    }
+
+    ret = modbus_client_write_registers(client, channel->write_offset + start, end - start,
+                                        w + start);
+    if (ret != RET_OK) {
+      break;
+    }
+
+    memcpy(s + start, w + start, (end - start) * sizeof(uint16_t));
+    i = end;
+  }
+
+  return ret;
+}
+
+static ret_t modbus_client_channel_write_changed_bits(modbus_client_channel_t* channel,
+                                                      modbus_client_t* client) {
+  uint32_t i = 0;
+  uint32_t k = 0;
+  ret_t ret = RET_NOT_MODIFIED;
+  uint8_t* w = channel->write_buffer;
+  uint8_t* s = channel->shadow_buffer;
+  uint32_t n = channel->bits_length;
+
+  while (i < n) {
+    uint32_t j = 0;
+    uint32_t end = 0;
+    uint32_t start = 0;
+
+    if (modbus_client_channel_get_bit(w, i) == modbus_client_channel_get_bit(s, i)) {
+      i++;
+      continue;
+    }
+
+    /*把间隔较小的变化合并到一个请求中，以减少请求次数*/
+    start = i;
+    end = i + 1;
+    for (j = i + 1; j < n && j - start < MODBUS_MAX_WRITE_BITS; j++) {
+      if (modbus_client_channel_get_bit(w, j) != modbus_client_channel_get_bit(s, j)) {
+        end = j + 1;
+      } else if (j - end >= MODBUS_CLIENT_CHANNEL_MERGE_BITS_GAP) {
+        break;
+      }
+    }
+
+    for (k = start; k < end; k++) {
+      channel->bits_buffer[k - start] = modbus_client_channel_get_bit(w, k);
+    }
+
+    ret = modbus_client_write_bits(client, channel->write_offset + start, end - start,
+                                   channel->bits_buffer);
+    if (ret != RET_OK) {
+      break;
+    }
+
+    for (k = start; k < end; k++) {
+      modbus_client_channel_set_bit(s, k, channel->bits_buffer[k - start]);
+    }
+    i = end;
+  }
+
+  return ret;
+}
+
+static ret_t modbus_client_channel_write_changed(modbus_client_channel_t* channel,
+                                                 modbus_client_t* client) {
+  ret_t ret = RET_NOT_MODIFIED;
+
+  switch (channel->access_type) {
+    case MODBUS_FC_WRITE_SINGLE_COIL: {
+      if ((channel->write_buffer[0] ^ channel->shadow_buffer[0]) & 0x01) {
+        ret = modbus_client_write_bit(client, channel->write_offset, channel->write_buffer[0] & 0x01);
+        if (ret == RET_OK) {
+          channel->shadow_buffer[0] = channel->write_buffer[0];
+        }
+      }
+      break;
+    }
+    case MODBUS_FC_WRITE_SINGLE_HOLDING_REGISTER: {
+      if (memcmp(channel->write_buffer, channel->shadow_buffer, sizeof(uint16_t)) != 0) {
+        ret = modbus_client_write_register(client, channel->write_offset,
+                                           *(uint16_t*)(channel->write_buffer));
+        if (ret == RET_OK) {
+          memcpy(channel->shadow_buffer, channel->write_buffer, sizeof(uint16_t));
+        }
+      }
+      break;
+    }
+    case MODBUS_FC_WRITE_MULTIPLE_COILS: {
+      ret = modbus_client_channel_write_changed_bits(channel, client);
+      break;
+    }
+    case MODBUS_FC_WRITE_MULTIPLE_HOLDING_REGISTERS: {
+      ret = modbus_client_channel_write_changed_registers(channel, client);
+      break;
+    }
+    default: {
+      ret = modbus_client_channel_write_all(channel, client);
+      break;
+    }
+  }
+
+  return ret;
+}
+
+ret_t modbus_client_channel_write(modbus_client_channel_t* channel) {
+  ret_t ret = RET_FAIL;
+  modbus_client_t* client = NULL;
+  return_value_if_fail(channel != NULL, RET_BAD_PARAMS);
+  client = channel->client;
+  return_value_if_fail(client != NULL, RET_BAD_PARAMS);
+
+  modbus_client_lock(client, channel->priority);
+  if (channel->unit_id) {
+    modbus_client_set_slave(client, channel->unit_id);
+  }
+
+  channel->dirty = FALSE;
+  if (channel->shadow_buffer != NULL && channel->shadow_valid) {
+    ret = modbus_client_channel_write_changed(channel, client);
+  } else {
+    ret = modbus_client_channel_write_all(channel, client);
+    if (ret == RET_OK && channel->shadow_buffer != NULL) {
+      memcpy(channel->shadow_buffer, channel->write_buffer, channel->write_buffer_length);
+      channel->shadow_valid = TRUE;
+    }
+  }
+  modbus_client_unlock(client);
+
+  if (ret == RET_NOT_MODIFIED) {
+    channel->write_skip_count++;
+    return RET_OK;
+  }
+
   if (ret == RET_OK) {
     channel->write_ok_count++;
   } else {
@@ -245,6 +388,32 @@ ret_t modbus_client_channel_write(modbus_client_channel_t* channel) {
   return ret;
 }
 
+ret_t modbus_client_channel_set_write_only_on_change(modbus_client_channel_t* channel,
+                                                     bool_t write_only_on_change) {
+  return_value_if_fail(channel != NULL, RET_BAD_PARAMS);
+
+  channel->write_only_on_change = write_only_on_change;
+  channel->shadow_valid = FALSE;
+  TKMEM_FREE(channel->shadow_buffer);
+
+  /*读写寄存器(0x17)每次都需要读取，不支持只写入变化的数据*/
+  if (write_only_on_change && channel->write_buffer_length > 0 &&
+      channel->access_type != MODBUS_FC_WRITE_AND_READ_REGISTERS) {
+    channel->shadow_buffer = TKMEM_ALLOC(channel->write_buffer_length);
+    return_value_if_fail(channel->shadow_buffer != NULL, RET_OOM);
+  }
+
+  return RET_OK;
+}
+
+ret_t modbus_client_channel_mark_dirty(modbus_client_channel_t* channel) {
+  return_value_if_fail(channel != NULL, RET_BAD_PARAMS);
+
+  channel->dirty = TRUE;
+
+  return RET_OK;
+}
+
 static ret_t modbus_client_channel_init(modbus_client_channel_t* channel) {
   return_value_if_fail(channel != NULL, RET_BAD_PARAMS);
 
@@ -311,6 +480,10 @@ static ret_t modbus_client_channel_init(modbus_client_channel_t* channel) {
   channel->mutex = tk_mutex_create();
   return_value_if_fail(channel->mutex != NULL, RET_OOM);
 
+  if (channel->write_only_on_change) {
+    return modbus_client_channel_set_write_only_on_change(channel, TRUE);
+  }
+
   return RET_OK;
 }
 
@@ -326,7 +499,7 @@ bool_t modbus_client_channel_need_update(modbus_client_channel_t* modbus_channel
                                          uint64_t current_time) {
   return_value_if_fail(modbus_channel != NULL, FALSE);
 
-  return modbus_channel->next_update_time <= current_time;
+  return modbus_channel->dirty || modbus_channel->next_update_time <= current_time;
 }
 
 ret_t modbus_client_channel_update(modbus_client_channel_t* channel, uint64_t current_time) {
@@ -339,7 +512,7 @@ ret_t modbus_client_channel_update(modbus_client_channel_t* channel, uint64_t cu
 
   return_value_if_fail(channel->client != NULL, RET_BAD_PARAMS);
 
-  if (channel->next_update_time > current_time) {
+  if (channel->next_update_time > current_time && !channel->dirty) {
     return RET_NOT_MODIFIED;
   }
 
@@ -394,6 +567,25 @@ ret_t modbus_client_channel_set_unit_id(modbus_client_channel_t* channel, uint8_
   return RET_OK;
 }
 
+ret_t modbus_client_channel_set_priority(modbus_client_channel_t* channel,
+                                         modbus_client_priority_t priority) {
+  return_value_if_fail(channel != NULL && priority < MODBUS_CLIENT_PRIORITY_NR, RET_BAD_PARAMS);
+
+  channel->priority = priority;
+
+  return RET_OK;
+}
+
+static modbus_client_priority_t modbus_client_channel_priority_from_str(const char* str) {
+  if (tk_str_eq(str, "high")) {
+    return MODBUS_CLIENT_PRIORITY_HIGH;
+  } else if (tk_str_eq(str, "low")) {
+    return MODBUS_CLIENT_PRIORITY_LOW;
+  } else {
+    return MODBUS_CLIENT_PRIORITY_NORMAL;
+  }
+}
+
 static ret_t modbus_client_channel_load(modbus_client_channel_t* channel, conf_node_t* node) {
   return_value_if_fail(channel != NULL && node != NULL, RET_BAD_PARAMS);
 
@@ -404,6 +596,8 @@ static ret_t modbus_client_channel_load(modbus_client_channel_t* channel, conf_n
     channel->update_interval = conf_node_get_child_value_int32(node, "cycle_time", -1);
   }
   channel->unit_id = conf_node_get_child_value_int32(node, "unit_id", 0);
+  channel->priority = modbus_client_channel_priority_from_str(
+      conf_node_get_child_value_str(node, "priority", "normal"));
 
   {
     const char* error_handling = NULL;
@@ -425,6 +619,8 @@ static ret_t modbus_client_channel_load(modbus_client_channel_t* channel, conf_n
     if (write_info != NULL) {
       channel->write_offset = conf_node_get_child_value_int32(write_info, "offset", 0);
       channel->write_buffer_length = conf_node_get_child_value_int32(write_info, "length", 0);
+      channel->write_only_on_change =
+          conf_node_get_child_value_bool(write_info, "only_on_change", FALSE);
     }
   }
 
@@ -438,9 +634,11 @@ ret_t modbus_client_channel_destroy(modbus_client_channel_t* channel) {
   TKMEM_FREE(channel->bits_buffer);
   TKMEM_FREE(channel->read_buffer);
   TKMEM_FREE(channel->write_buffer);
+  TKMEM_FREE(channel->shadow_buffer);
   tk_mutex_destroy(channel->mutex);
 
   TKMEM_FREE(channel);
 
   return RET_OK;
 }
+#endif /*MODBUS_WITH_CLIENT*/
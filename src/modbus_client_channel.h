@@ -105,6 +105,13 @@ typedef struct _modbus_client_channel_t {
    * 读取失败时是否保留上次的值。
    */
   bool_t keep_last_value_if_read_failed;
+  /**
+   * @property {modbus_client_priority_t} priority
+   * @annotation ["readable"]
+   * 请求的优先级(缺省为MODBUS_CLIENT_PRIORITY_NORMAL)。
+   * 配置文件中可以用"priority"指定，取值为"high"、"normal"或"low"。
+   */
+  modbus_client_priority_t priority;
   /**
    * @property {modbus_client_t*} client
    * @annotation ["readable"]
@@ -135,12 +142,29 @@ typedef struct _modbus_client_channel_t {
    * 写入失败次数。
    */
   uint32_t write_fail_count;
+  /**
+   * @property {bool_t} write_only_on_change
+   * @annotation ["readable"]
+   * 是否只写入有变化的数据。
+   * 启用后，会保留最后一次写入成功的数据，每次只写入有变化的部分(相近的变化会合并到一个请求中)。
+   */
+  bool_t write_only_on_change;
+  /**
+   * @property {uint32_t} write_skip_count
+   * @annotation ["readable"]
+   * 因数据没有变化而跳过写入的次数。
+   */
+  uint32_t write_skip_count;
 
   /*private*/
   /*对于bits操作，在bits_buffer中，每个bit占一个字节*/
   uint8_t* bits_buffer;
   uint32_t bits_length;
   tk_mutex_t* mutex;
+  /*最后一次写入成功的数据(仅write_only_on_change时有效)*/
+  uint8_t* shadow_buffer;
+  bool_t shadow_valid;
+  bool_t dirty;
 } modbus_client_channel_t;
 
 /**
@@ -191,6 +215,40 @@ ret_t modbus_client_channel_set_name(modbus_client_channel_t* channel, const cha
  */
 ret_t modbus_client_channel_set_unit_id(modbus_client_channel_t* channel, uint8_t unit_id);
 
+/**
+ * @method modbus_client_channel_set_priority
+ * 设置请求的优先级。
+ * 
+ * 通道的一次读写可能分为多个请求，在请求之间会把总线让给更高优先级的通道或命令。
+ * @param {modbus_client_channel_t*} channel 对象。
+ * @param {modbus_client_priority_t} priority 优先级。
+ * 
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_client_channel_set_priority(modbus_client_channel_t* channel,
+                                         modbus_client_priority_t priority);
+
+/**
+ * @method modbus_client_channel_set_write_only_on_change
+ * 设置是否只写入有变化的数据。
+ * @param {modbus_client_channel_t*} channel 对象。
+ * @param {bool_t} write_only_on_change 是否只写入有变化的数据。
+ * 
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_client_channel_set_write_only_on_change(modbus_client_channel_t* channel,
+                                                     bool_t write_only_on_change);
+
+/**
+ * @method modbus_client_channel_mark_dirty
+ * 通知写入缓冲区已经修改，下次调用modbus_client_channel_update时立即写入(不等待update_interval)。
+ * 在写入之前多次修改，只会写入最后的值。
+ * @param {modbus_client_channel_t*} channel 对象。
+ * 
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_client_channel_mark_dirty(modbus_client_channel_t* channel);
+
 /**
  * @method modbus_client_channel_read
  * 读取数据。
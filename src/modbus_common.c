@@ -99,12 +99,80 @@ ret_t modbus_common_init(modbus_common_t* common, tk_iostream_t* io, modbus_prot
   common->write_timeout = MODBUS_WRITE_TIMEOUT;
   common->wbuffer = wb;
   common->is_shared_transport = FALSE;
+  common->any_slave = FALSE;
+  common->bytes_in = 0;
+  common->bytes_out = 0;
+  common->num_exceptions = 0;
+  common->num_reads = 0;
+  common->rbuffer = NULL;
+  common->rbuffer_size = 0;
+  common->rstart = 0;
+  common->rend = 0;
+  common->rnonblock = FALSE;
+  common->rframe_end = 0;
 
   return RET_OK;
 }
 
+/*从预读缓冲区中读取，缓冲区空了再从底层流读取尽可能多的数据*/
+static int32_t modbus_common_read_len_buffered(modbus_common_t* common, uint8_t* buff,
+                                               uint32_t len) {
+  uint32_t offset = 0;
+  tk_istream_t* in = tk_iostream_get_istream(common->io);
+
+  while (offset < len) {
+    uint32_t n = common->rend - common->rstart;
+
+    if (n == 0) {
+      int32_t size = 0;
+      ret_t ret = RET_OK;
+
+      /*非阻塞模式只解析完整的请求，数据不够说明请求格式错误*/
+      if (common->rnonblock) {
+        break;
+      }
+
+      ret = tk_istream_wait_for_data(in, common->read_timeout);
+
+      common->rstart = 0;
+      common->rend = 0;
+      if (ret != RET_OK && ret != RET_NOT_IMPL) {
+        break;
+      }
+
+      size = tk_iostream_read(common->io, common->rbuffer, common->rbuffer_size);
+      common->num_reads++;
+      if (size <= 0) {
+        break;
+      }
+      common->rend = size;
+      common->bytes_in += size;
+      continue;
+    }
+
+    n = tk_min(n, len - offset);
+    memcpy(buff + offset, common->rbuffer + common->rstart, n);
+    common->rstart += n;
+    offset += n;
+  }
+
+  return offset;
+}
+
 static int32_t modbus_common_read_len(modbus_common_t* common, uint8_t* buff, uint32_t len) {
-  return tk_iostream_read_len(common->io, buff, len, common->read_timeout);
+  int32_t ret = 0;
+
+  if (common->rbuffer != NULL) {
+    return modbus_common_read_len_buffered(common, buff, len);
+  }
+
+  ret = tk_iostream_read_len(common->io, buff, len, common->read_timeout);
+  common->num_reads++;
+  if (ret > 0) {
+    common->bytes_in += ret;
+  }
+
+  return ret;
 }
 
 static ret_t modbus_common_send_wbuffer(modbus_common_t* common) {
@@ -112,9 +180,14 @@ static ret_t modbus_common_send_wbuffer(modbus_common_t* common) {
   uint32_t len = common->wbuffer->cursor;
   int32_t ret = tk_iostream_write_len(common->io, buff, len, common->write_timeout);
 
+  if (ret > 0) {
+    common->bytes_out += ret;
+  }
+
   return ret == len ? RET_OK : RET_IO;
 }
 
+#if MODBUS_WITH_CLIENT
 static uint32_t modbus_common_get_resp_playload_length(modbus_common_t* common, uint8_t func_code) {
   switch (func_code) {
     case MODBUS_FC_WRITE_SINGLE_COIL:
@@ -123,11 +196,19 @@ static uint32_t modbus_common_get_resp_playload_length(modbus_common_t* common,
     case MODBUS_FC_WRITE_MULTIPLE_HOLDING_REGISTERS: {
       return 4;
     }
+    case MODBUS_FC_MASK_WRITE_REGISTER: {
+      return 6;
+    }
+    case MODBUS_FC_READ_FIFO_QUEUE: {
+      return 2;
+    }
     case MODBUS_FC_READ_COILS:
     case MODBUS_FC_READ_DISCRETE_INPUTS:
     case MODBUS_FC_READ_HOLDING_REGISTERS:
     case MODBUS_FC_WRITE_AND_READ_REGISTERS:
-    case MODBUS_FC_READ_INPUT_REGISTERS: {
+    case MODBUS_FC_READ_INPUT_REGISTERS:
+    case MODBUS_FC_READ_FILE_RECORD:
+    case MODBUS_FC_WRITE_FILE_RECORD: {
       return 1;
     }
     default: {
@@ -136,6 +217,7 @@ static uint32_t modbus_common_get_resp_playload_length(modbus_common_t* common,
     }
   }
 }
+#endif /*MODBUS_WITH_CLIENT*/
 
 static ret_t modbus_common_check_crc(modbus_common_t* common, const uint8_t* data, uint32_t size) {
   if (common->proto == MODBUS_PROTO_RTU) {
@@ -169,6 +251,7 @@ static ret_t modbus_common_read_rtu_header(modbus_common_t* common, modbus_rtu_h
   return RET_OK;
 }
 
+#if MODBUS_WITH_CLIENT
 static ret_t modbus_common_recv_resp(modbus_common_t* common, uint8_t expected_func_code,
                                      modbus_resp_data_t* resp) {
   int32_t len = 0;
@@ -220,7 +303,8 @@ static ret_t modbus_common_recv_resp(modbus_common_t* common, uint8_t expected_f
     bytes = modbus_common_get_resp_playload_length(common, expected_func_code);
     return_value_if_fail((bytes + wb->cursor + 1) < MODBUS_MAX_PAYLOAD, RET_IO);
 
-    wbuffer_extend_capacity(wb, bytes + wb->cursor + 1);
+    /*固定大小的缓冲区(MODBUS_STATIC_BUFFERS)不能扩展*/
+    return_value_if_fail(wbuffer_extend_capacity(wb, bytes + wb->cursor + 1) == RET_OK, RET_IO);
     buff = wb->data + wb->cursor;
     len = modbus_common_read_len(common, buff, bytes);
     return_value_if_fail(len == bytes, RET_IO);
@@ -229,6 +313,7 @@ static ret_t modbus_common_recv_resp(modbus_common_t* common, uint8_t expected_f
     /*对于读请求，读取后面的数据*/
     if (bytes == 1) {
       bytes = *buff;
+      return_value_if_fail(wbuffer_extend_capacity(wb, bytes + wb->cursor + 1) == RET_OK, RET_IO);
       buff = wb->data + wb->cursor;
       len = modbus_common_read_len(common, buff, bytes);
       return_value_if_fail(len == bytes, RET_IO);
@@ -239,6 +324,23 @@ static ret_t modbus_common_recv_resp(modbus_common_t* common, uint8_t expected_f
         resp->bytes = bytes;
         resp->data = buff;
       }
+    } else if (bytes == 2) {
+      /*FIFO队列的字节数占2个字节*/
+      uint16_t fifo_bytes = (buff[0] << 8) | buff[1];
+      return_value_if_fail(fifo_bytes <= 2 + MODBUS_MAX_FIFO_COUNT * 2, RET_IO);
+
+      return_value_if_fail(wbuffer_extend_capacity(wb, fifo_bytes + wb->cursor + 1) == RET_OK,
+                           RET_IO);
+      buff = wb->data + wb->cursor;
+      len = modbus_common_read_len(common, buff, fifo_bytes);
+      return_value_if_fail(len == fifo_bytes, RET_IO);
+      wbuffer_skip(wb, fifo_bytes);
+
+      if (resp != NULL) {
+        resp->func_code = func_code;
+        resp->bytes = fifo_bytes;
+        resp->data = buff;
+      }
     }
 
     if (modbus_common_check_crc(common, wb->data, wb->cursor) != RET_OK) {
@@ -250,6 +352,7 @@ static ret_t modbus_common_recv_resp(modbus_common_t* common, uint8_t expected_f
     uint8_t exception_code = 0;
     len = modbus_common_read_len(common, &exception_code, 1);
     common->last_exception_code = (modbus_exeption_code_t)exception_code;
+    common->num_exceptions++;
     log_debug("%d: %s\n", expected_func_code, modbus_common_get_last_exception_str(common));
     if (modbus_common_check_crc(common, wb->data, wb->cursor) != RET_OK) {
       return RET_CRC;
@@ -473,6 +576,7 @@ ret_t modbus_common_recv_write_registers_resp(modbus_common_t* common) {
   return modbus_common_recv_resp(common, MODBUS_FC_WRITE_MULTIPLE_HOLDING_REGISTERS, NULL);
 }
 
+#if MODBUS_WITH_FC23
 ret_t modbus_common_send_write_and_read_registers_req(modbus_common_t* common, uint16_t write_addr,
                                                       uint16_t write_nb, const uint16_t* src,
                                                       uint16_t read_addr, uint16_t read_nb) {
@@ -487,10 +591,178 @@ ret_t modbus_common_send_write_and_read_registers_req(modbus_common_t* common, u
   modbus_common_pack_tail(common);
   return modbus_common_send_wbuffer(common);
 }
+#endif /*MODBUS_WITH_FC23*/
+
+ret_t modbus_common_send_mask_write_register_req(modbus_common_t* common, uint16_t addr,
+                                                 uint16_t and_mask, uint16_t or_mask) {
+  return_value_if_fail(common != NULL && common->io != NULL, RET_BAD_PARAMS);
+
+  modbus_common_update_transaction_id(common);
+  modbus_common_pack_header(common, MODBUS_FC_MASK_WRITE_REGISTER, 6);
+  modbus_common_pack_uint16(common, addr);
+  modbus_common_pack_uint16(common, and_mask);
+  modbus_common_pack_uint16(common, or_mask);
+  modbus_common_pack_tail(common);
+
+  return modbus_common_send_wbuffer(common);
+}
+
+ret_t modbus_common_recv_mask_write_register_resp(modbus_common_t* common) {
+  return modbus_common_recv_resp(common, MODBUS_FC_MASK_WRITE_REGISTER, NULL);
+}
+
+ret_t modbus_common_send_read_fifo_queue_req(modbus_common_t* common, uint16_t addr) {
+  return_value_if_fail(common != NULL && common->io != NULL, RET_BAD_PARAMS);
+
+  modbus_common_update_transaction_id(common);
+  modbus_common_pack_header(common, MODBUS_FC_READ_FIFO_QUEUE, 2);
+  modbus_common_pack_uint16(common, addr);
+  modbus_common_pack_tail(common);
+
+  return modbus_common_send_wbuffer(common);
+}
+
+ret_t modbus_common_recv_read_fifo_queue_resp(modbus_common_t* common, uint16_t* buffer,
+                                              uint16_t* count) {
+  ret_t ret = RET_OK;
+  uint16_t fifo_count = 0;
+  modbus_resp_data_t resp;
+  return_value_if_fail(common != NULL && common->io != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(buffer != NULL && count != NULL, RET_BAD_PARAMS);
+
+  memset(&resp, 0x00, sizeof(resp));
+  ret = modbus_common_recv_resp(common, MODBUS_FC_READ_FIFO_QUEUE, &resp);
+  if (ret != RET_OK) {
+    return ret;
+  }
+
+  /*FIFO个数(2字节) + 数据*/
+  return_value_if_fail(resp.bytes >= 2, RET_BAD_PARAMS);
+  fifo_count = resp.data[0] << 8 | resp.data[1];
+  return_value_if_fail(fifo_count <= *count, RET_BAD_PARAMS);
+
+  resp.data += 2;
+  resp.bytes -= 2;
+  ret = modbus_common_decode_registers(&resp, buffer, fifo_count);
+  if (ret == RET_OK) {
+    *count = fifo_count;
+  }
+
+  return ret;
+}
+
+#if MODBUS_WITH_FILE_RECORD
+ret_t modbus_common_send_read_file_record_req(modbus_common_t* common,
+                                              const modbus_file_record_t* records, uint32_t nr) {
+  uint32_t i = 0;
+  uint32_t resp_bytes = 0;
+  uint32_t bytes = nr * 7;
+  return_value_if_fail(common != NULL && common->io != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(records != NULL && nr > 0, RET_BAD_PARAMS);
+  return_value_if_fail(bytes <= MODBUS_MAX_READ_FILE_RECORD_BYTES, RET_BAD_PARAMS);
+
+  for (i = 0; i < nr; i++) {
+    resp_bytes += 2 + records[i].record_length * 2;
+  }
+  return_value_if_fail(resp_bytes <= MODBUS_MAX_READ_FILE_RECORD_BYTES, RET_BAD_PARAMS);
+
+  modbus_common_update_transaction_id(common);
+  modbus_common_pack_header(common, MODBUS_FC_READ_FILE_RECORD, 1 + bytes);
+  modbus_common_pack_uint8(common, bytes);
+  for (i = 0; i < nr; i++) {
+    modbus_common_pack_uint8(common, MODBUS_FILE_RECORD_REF_TYPE);
+    modbus_common_pack_uint16(common, records[i].file_number);
+    modbus_common_pack_uint16(common, records[i].record_number);
+    modbus_common_pack_uint16(common, records[i].record_length);
+  }
+  modbus_common_pack_tail(common);
+
+  return modbus_common_send_wbuffer(common);
+}
+
+ret_t modbus_common_recv_read_file_record_resp(modbus_common_t* common,
+                                               modbus_file_record_t* records, uint32_t nr) {
+  uint32_t i = 0;
+  ret_t ret = RET_OK;
+  modbus_resp_data_t resp;
+  modbus_resp_data_t sub;
+  return_value_if_fail(common != NULL && common->io != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(records != NULL && nr > 0, RET_BAD_PARAMS);
+
+  memset(&resp, 0x00, sizeof(resp));
+  ret = modbus_common_recv_resp(common, MODBUS_FC_READ_FILE_RECORD, &resp);
+  if (ret != RET_OK) {
+    return ret;
+  }
+
+  /*每个子响应：长度(1字节，包括参考类型) + 参考类型(1字节) + 数据*/
+  for (i = 0; i < nr; i++) {
+    uint8_t len = 0;
+    return_value_if_fail(resp.bytes >= 2, RET_BAD_PARAMS);
+
+    len = resp.data[0];
+    return_value_if_fail(len == 1 + records[i].record_length * 2, RET_BAD_PARAMS);
+    return_value_if_fail(resp.data[1] == MODBUS_FILE_RECORD_REF_TYPE, RET_BAD_PARAMS);
+    return_value_if_fail(resp.bytes >= 1 + len, RET_BAD_PARAMS);
+
+    memset(&sub, 0x00, sizeof(sub));
+    sub.data = resp.data + 2;
+    sub.bytes = len - 1;
+    ret = modbus_common_decode_registers(&sub, records[i].data, records[i].record_length);
+    return_value_if_fail(ret == RET_OK, ret);
+
+    resp.data += 1 + len;
+    resp.bytes -= 1 + len;
+  }
+
+  return resp.bytes == 0 ? RET_OK : RET_BAD_PARAMS;
+}
+
+ret_t modbus_common_send_write_file_record_req(modbus_common_t* common,
+                                               const modbus_file_record_t* records, uint32_t nr) {
+  uint32_t i = 0;
+  uint32_t j = 0;
+  uint32_t bytes = 0;
+  return_value_if_fail(common != NULL && common->io != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(records != NULL && nr > 0, RET_BAD_PARAMS);
+
+  for (i = 0; i < nr; i++) {
+    return_value_if_fail(records[i].data != NULL || records[i].record_length == 0, RET_BAD_PARAMS);
+    bytes += 7 + records[i].record_length * 2;
+  }
+  return_value_if_fail(bytes <= MODBUS_MAX_WRITE_FILE_RECORD_BYTES, RET_BAD_PARAMS);
+
+  modbus_common_update_transaction_id(common);
+  modbus_common_pack_header(common, MODBUS_FC_WRITE_FILE_RECORD, 1 + bytes);
+  modbus_common_pack_uint8(common, bytes);
+  for (i = 0; i < nr; i++) {
+    const modbus_file_record_t* r = records + i;
+
+    modbus_common_pack_uint8(common, MODBUS_FILE_RECORD_REF_TYPE);
+    modbus_common_pack_uint16(common, r->file_number);
+    modbus_common_pack_uint16(common, r->record_number);
+    modbus_common_pack_uint16(common, r->record_length);
+    for (j = 0; j < r->record_length; j++) {
+      modbus_common_pack_uint16(common, r->data[j]);
+    }
+  }
+  modbus_common_pack_tail(common);
+
+  return modbus_common_send_wbuffer(common);
+}
+
+ret_t modbus_common_recv_write_file_record_resp(modbus_common_t* common) {
+  return modbus_common_recv_resp(common, MODBUS_FC_WRITE_FILE_RECORD, NULL);
+}
+#endif /*MODBUS_WITH_FILE_RECORD*/
+#endif /*MODBUS_WITH_CLIENT*/
 
 ret_t modbus_common_deinit(modbus_common_t* common) {
   return_value_if_fail(common != NULL, RET_BAD_PARAMS);
 
+  TKMEM_FREE(common->rbuffer);
+  common->rbuffer_size = 0;
+
   return RET_OK;
 }
 
@@ -534,7 +806,7 @@ const char* modbus_common_get_last_exception_str(modbus_common_t* common) {
 }
 
 /*for server side*/
-ret_t modbus_common_recv_req(modbus_common_t* common, modbus_req_data_t* req_data) {
+static ret_t modbus_common_recv_req_impl(modbus_common_t* common, modbus_req_data_t* req_data) {
   int32_t ret = 0;
   uint8_t bytes = 0;
   uint8_t func_code = 0;
@@ -578,7 +850,9 @@ ret_t modbus_common_recv_req(modbus_common_t* common, modbus_req_data_t* req_dat
 
   req_data->func_code = func_code;
 
-  if (req_data->slave != common->slave) {
+  /*RTU的广播请求由调用者决定是否执行(不回复)*/
+  if (!common->any_slave && req_data->slave != common->slave &&
+      !(common->proto == MODBUS_PROTO_RTU && req_data->slave == MODBUS_BROADCAST_ADDRESS)) {
     log_warn("[modbus] slave/unit id mismatch: got=%u expect=%u\n", (unsigned)req_data->slave,
              (unsigned)common->slave);
     modbus_common_flush_read_buffer(common);
@@ -587,6 +861,7 @@ ret_t modbus_common_recv_req(modbus_common_t* common, modbus_req_data_t* req_dat
   buff = wb->data + wb->cursor;
 
   switch (func_code) {
+#if MODBUS_WITH_FC23
     case MODBUS_FC_WRITE_AND_READ_REGISTERS: {
       ret = modbus_common_read_len(common, buff, 9);
       return_value_if_fail(ret == 9, RET_IO);
@@ -611,6 +886,7 @@ ret_t modbus_common_recv_req(modbus_common_t* common, modbus_req_data_t* req_dat
       wbuffer_skip(wb, req_data->bytes_ex);
       break;
     }
+#endif /*MODBUS_WITH_FC23*/
     case MODBUS_FC_READ_COILS:
     case MODBUS_FC_READ_DISCRETE_INPUTS:
     case MODBUS_FC_READ_HOLDING_REGISTERS:
@@ -627,7 +903,8 @@ ret_t modbus_common_recv_req(modbus_common_t* common, modbus_req_data_t* req_dat
       break;
     }
     case MODBUS_FC_WRITE_SINGLE_COIL:
-    case MODBUS_FC_WRITE_SINGLE_HOLDING_REGISTER: {
+    case MODBUS_FC_WRITE_SINGLE_HOLDING_REGISTER:
+    case MODBUS_FC_DIAGNOSTICS: {
       ret = modbus_common_read_len(common, buff, 4);
       return_value_if_fail(ret == 4, RET_IO);
       wbuffer_skip(wb, 4);
@@ -638,6 +915,47 @@ ret_t modbus_common_recv_req(modbus_common_t* common, modbus_req_data_t* req_dat
       req_data->bytes = 2;
       break;
     }
+    case MODBUS_FC_MASK_WRITE_REGISTER: {
+      ret = modbus_common_read_len(common, buff, 6);
+      return_value_if_fail(ret == 6, RET_IO);
+      wbuffer_skip(wb, 6);
+      addr = buff[0] << 8 | buff[1];
+      req_data->addr = addr;
+      req_data->count = 1;
+      req_data->data = buff + 2;
+      req_data->bytes = 4;
+      break;
+    }
+#if MODBUS_WITH_FILE_RECORD
+    case MODBUS_FC_READ_FILE_RECORD:
+    case MODBUS_FC_WRITE_FILE_RECORD: {
+      ret = modbus_common_read_len(common, buff, 1);
+      return_value_if_fail(ret == 1, RET_IO);
+      wbuffer_skip(wb, 1);
+      bytes = buff[0];
+      req_data->addr = 0;
+      req_data->count = 0;
+      req_data->data = buff + 1;
+      req_data->bytes = bytes;
+
+      buff = wb->data + wb->cursor;
+      ret = modbus_common_read_len(common, buff, bytes);
+      return_value_if_fail(ret == bytes, RET_IO);
+      wbuffer_skip(wb, bytes);
+      break;
+    }
+#endif /*MODBUS_WITH_FILE_RECORD*/
+    case MODBUS_FC_READ_FIFO_QUEUE: {
+      ret = modbus_common_read_len(common, buff, 2);
+      return_value_if_fail(ret == 2, RET_IO);
+      wbuffer_skip(wb, 2);
+      addr = buff[0] << 8 | buff[1];
+      req_data->addr = addr;
+      req_data->count = 0;
+      req_data->data = NULL;
+      req_data->bytes = 0;
+      break;
+    }
     case MODBUS_FC_WRITE_MULTIPLE_COILS:
     case MODBUS_FC_WRITE_MULTIPLE_HOLDING_REGISTERS: {
       ret = modbus_common_read_len(common, buff, 5);
@@ -669,6 +987,21 @@ ret_t modbus_common_recv_req(modbus_common_t* common, modbus_req_data_t* req_dat
   return RET_OK;
 }
 
+ret_t modbus_common_recv_req(modbus_common_t* common, modbus_req_data_t* req_data) {
+  ret_t ret = RET_OK;
+  return_value_if_fail(common != NULL, RET_BAD_PARAMS);
+
+  ret = modbus_common_recv_req_impl(common, req_data);
+
+  /*非阻塞模式下不管解析是否成功，都跳到请求的结尾(MBAP头中的长度可能比解析的长)*/
+  if (common->rnonblock && common->rframe_end > common->rstart) {
+    common->rstart = tk_min(common->rframe_end, common->rend);
+  }
+  common->rframe_end = 0;
+
+  return ret;
+}
+
 ret_t modbus_common_send_resp(modbus_common_t* common, modbus_resp_data_t* resp_data) {
   wbuffer_t* wb = NULL;
   uint8_t func_code = 0;
@@ -713,7 +1046,8 @@ ret_t modbus_common_send_resp(modbus_common_t* common, modbus_resp_data_t* resp_
       modbus_common_pack_uint16(common, resp_data->count);
       break;
     }
-    case MODBUS_FC_WRITE_SINGLE_HOLDING_REGISTER: {
+    case MODBUS_FC_WRITE_SINGLE_HOLDING_REGISTER:
+    case MODBUS_FC_DIAGNOSTICS: {
       uint16_t data_len = 4;
       modbus_common_pack_header(common, func_code, data_len);
       modbus_common_pack_uint16(common, resp_data->addr);
@@ -721,6 +1055,33 @@ ret_t modbus_common_send_resp(modbus_common_t* common, modbus_resp_data_t* resp_
       modbus_common_pack_uint8(common, resp_data->data[1]);
       break;
     }
+#if MODBUS_WITH_FILE_RECORD
+    case MODBUS_FC_READ_FILE_RECORD:
+    case MODBUS_FC_WRITE_FILE_RECORD: {
+      uint8_t bytes = resp_data->bytes;
+      uint16_t data_len = 1 + bytes;
+      modbus_common_pack_header(common, func_code, data_len);
+      modbus_common_pack_uint8(common, bytes);
+      wbuffer_write_binary(wb, resp_data->data, bytes);
+      break;
+    }
+#endif /*MODBUS_WITH_FILE_RECORD*/
+    case MODBUS_FC_MASK_WRITE_REGISTER: {
+      uint16_t data_len = 6;
+      modbus_common_pack_header(common, func_code, data_len);
+      modbus_common_pack_uint16(common, resp_data->addr);
+      wbuffer_write_binary(wb, resp_data->data, 4);
+      break;
+    }
+    case MODBUS_FC_READ_FIFO_QUEUE: {
+      uint16_t bytes = resp_data->count * 2;
+      uint16_t data_len = 4 + bytes;
+      modbus_common_pack_header(common, func_code, data_len);
+      modbus_common_pack_uint16(common, bytes + 2);
+      modbus_common_pack_uint16(common, resp_data->count);
+      wbuffer_write_binary(wb, resp_data->data, bytes);
+      break;
+    }
     default:
       break;
   }
@@ -746,9 +1107,173 @@ ret_t modbus_common_send_exception_resp(modbus_common_t* common, uint8_t func_co
 ret_t modbus_common_flush_read_buffer(modbus_common_t* common) {
   return_value_if_fail(common != NULL && common->io != NULL, RET_BAD_PARAMS);
 
+  int32_t ret = 0;
   uint8_t flush_buffer[260];
-  while (tk_iostream_read_len(common->io, flush_buffer, sizeof(flush_buffer), 0) > 0) {
-    ;
+
+  /*非阻塞模式只丢弃当前的请求(见modbus_common_recv_req)，不读取底层流*/
+  if (common->rnonblock) {
+    return RET_OK;
+  }
+
+  common->rstart = 0;
+  common->rend = 0;
+  while ((ret = tk_iostream_read_len(common->io, flush_buffer, sizeof(flush_buffer), 0)) > 0) {
+    common->bytes_in += ret;
+  }
+  return RET_OK;
+}
+
+ret_t modbus_common_set_read_ahead(modbus_common_t* common, uint32_t size) {
+  return_value_if_fail(common != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(common->rstart == common->rend, RET_BUSY);
+
+  TKMEM_FREE(common->rbuffer);
+  common->rbuffer_size = 0;
+  common->rstart = 0;
+  common->rend = 0;
+
+  if (size > 0) {
+    common->rbuffer = TKMEM_ALLOC(size);
+    return_value_if_fail(common->rbuffer != NULL, RET_OOM);
+    common->rbuffer_size = size;
+  }
+
+  return RET_OK;
+}
+
+uint32_t modbus_common_get_buffered_size(modbus_common_t* common) {
+  return_value_if_fail(common != NULL, 0);
+
+  return common->rend - common->rstart;
+}
+
+ret_t modbus_common_fill_read_buffer(modbus_common_t* common) {
+  return_value_if_fail(common != NULL && common->io != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(common->rbuffer != NULL, RET_BAD_PARAMS);
+
+  common->rnonblock = TRUE;
+
+  /*不完整的请求移到缓冲区开头*/
+  if (common->rstart > 0) {
+    memmove(common->rbuffer, common->rbuffer + common->rstart, common->rend - common->rstart);
+    common->rend -= common->rstart;
+    common->rstart = 0;
+  }
+
+  while (common->rend < common->rbuffer_size) {
+    int32_t size = tk_iostream_read(common->io, common->rbuffer + common->rend,
+                                    common->rbuffer_size - common->rend);
+    common->num_reads++;
+    if (size > 0) {
+      common->rend += size;
+      common->bytes_in += size;
+    } else if (size == 0) {
+      return RET_EOS;
+    } else {
+      /*没有数据时(EAGAIN)流仍然正常*/
+      return tk_object_get_prop_bool(TK_OBJECT(common->io), TK_STREAM_PROP_IS_OK, FALSE) ? RET_OK
+                                                                                           : RET_IO;
+    }
+  }
+
+  return RET_CONTINUE;
+}
+
+/*请求的PDU(从功能码开始)的长度，返回0表示还需要更多数据才能确定，不支持的功能码返回0xffffffff*/
+static uint32_t modbus_common_get_req_pdu_size(const uint8_t* pdu, uint32_t size) {
+  if (size < 1) {
+    return 0;
+  }
+
+  switch (pdu[0]) {
+    case MODBUS_FC_READ_COILS:
+    case MODBUS_FC_READ_DISCRETE_INPUTS:
+    case MODBUS_FC_READ_HOLDING_REGISTERS:
+    case MODBUS_FC_READ_INPUT_REGISTERS:
+    case MODBUS_FC_WRITE_SINGLE_COIL:
+    case MODBUS_FC_WRITE_SINGLE_HOLDING_REGISTER:
+    case MODBUS_FC_DIAGNOSTICS: {
+      return 5;
+    }
+    case MODBUS_FC_MASK_WRITE_REGISTER: {
+      return 7;
+    }
+    case MODBUS_FC_READ_FIFO_QUEUE: {
+      return 3;
+    }
+    case MODBUS_FC_READ_FILE_RECORD:
+    case MODBUS_FC_WRITE_FILE_RECORD: {
+      return size >= 2 ? 2 + pdu[1] : 0;
+    }
+    case MODBUS_FC_WRITE_MULTIPLE_COILS:
+    case MODBUS_FC_WRITE_MULTIPLE_HOLDING_REGISTERS: {
+      return size >= 6 ? 6 + pdu[5] : 0;
+    }
+    case MODBUS_FC_WRITE_AND_READ_REGISTERS: {
+      return size >= 10 ? 10 + pdu[9] : 0;
+    }
+    default: {
+      return 0xffffffff;
+    }
+  }
+}
+
+bool_t modbus_common_has_complete_req(modbus_common_t* common) {
+  const uint8_t* p = NULL;
+  uint32_t size = 0;
+  uint32_t pdu_size = 0;
+  uint32_t frame_size = 0;
+  return_value_if_fail(common != NULL, FALSE);
+
+  common->rframe_end = 0;
+  p = common->rbuffer + common->rstart;
+  size = common->rend - common->rstart;
+  if (common->proto == MODBUS_PROTO_TCP) {
+    /*MBAP头(7字节)+功能码*/
+    if (size < 8) {
+      return FALSE;
+    }
+
+    frame_size = tk_max(6 + ((p[4] << 8) | p[5]), 8);
+    pdu_size = modbus_common_get_req_pdu_size(p + 7, size - 7);
+    if (pdu_size == 0) {
+      return FALSE;
+    }
+    if (pdu_size != 0xffffffff) {
+      frame_size = tk_max(frame_size, 7 + pdu_size);
+    }
+  } else {
+    /*从站地址+PDU+CRC，不支持的功能码无法确定长度，丢弃已经收到的全部数据*/
+    pdu_size = modbus_common_get_req_pdu_size(p + 1, size > 0 ? size - 1 : 0);
+    if (pdu_size == 0) {
+      return FALSE;
+    }
+    frame_size = pdu_size != 0xffffffff ? 1 + pdu_size + 2 : size;
   }
+
+  if (size < frame_size) {
+    return FALSE;
+  }
+
+  common->rframe_end = common->rstart + frame_size;
+
+  return TRUE;
+}
+
+ret_t modbus_common_wait_until(uint64_t deadline, uint32_t spin_time) {
+  uint64_t now = time_now_us();
+
+  if (now >= deadline) {
+    return RET_OK;
+  }
+
+  if (deadline - now > spin_time) {
+    sleep_us(deadline - now - spin_time);
+  }
+
+  /*休眠可能提前返回(时钟源不同)，保证不早于deadline*/
+  while (time_now_us() < deadline) {
+  }
+
   return RET_OK;
 }
@@ -82,6 +82,44 @@ typedef struct _modbus_common_t {
    * 底层传输是否是共享资源(如串口)，错误时不能直接断开，需要flush继续。(仅从站使用)
    */
   bool_t is_shared_transport;
+  /**
+   * @property {bool_t} any_slave
+   * 是否接收任意从站地址的请求(由modbus service按从站地址分发)。(仅从站使用)
+   */
+  bool_t any_slave;
+  /**
+   * @property {uint64_t} bytes_in
+   * @annotation ["readable"]
+   * 累计接收的字节数(包括被丢弃的数据)。
+   */
+  uint64_t bytes_in;
+  /**
+   * @property {uint64_t} bytes_out
+   * @annotation ["readable"]
+   * 累计发送的字节数。
+   */
+  uint64_t bytes_out;
+  /**
+   * @property {uint32_t} num_exceptions
+   * @annotation ["readable"]
+   * 累计收到的异常回复数(仅主站使用)。
+   */
+  uint32_t num_exceptions;
+  /**
+   * @property {uint32_t} num_reads
+   * @annotation ["readable"]
+   * 累计读取底层流的次数(用于评估预读的效果)。
+   */
+  uint32_t num_reads;
+
+  /*private*/
+  uint8_t* rbuffer;
+  uint32_t rbuffer_size;
+  uint32_t rstart;
+  uint32_t rend;
+  /*调用过modbus_common_fill_read_buffer，只从缓冲区中读取(rframe_end为当前请求的结尾)*/
+  bool_t rnonblock;
+  uint32_t rframe_end;
 } modbus_common_t;
 
 /**
@@ -233,6 +271,88 @@ ret_t modbus_common_recv_write_registers_resp(modbus_common_t* common);
 ret_t modbus_common_send_write_and_read_registers_req(modbus_common_t* common, uint16_t write_addr, uint16_t write_nb, const uint16_t *src,
                                                       uint16_t read_addr, uint16_t read_nb);
 
+/**
+ * @method modbus_common_send_mask_write_register_req
+ * 发送掩码写入register请求。
+ * 结果为：(当前值 & and_mask) | (or_mask & ~and_mask)。
+ * @param {modbus_common_t*} common modbus_common_t对象。
+ * @param {uint16_t} addr 地址。
+ * @param {uint16_t} and_mask AND掩码。
+ * @param {uint16_t} or_mask OR掩码。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_common_send_mask_write_register_req(modbus_common_t* common, uint16_t addr,
+                                                 uint16_t and_mask, uint16_t or_mask);
+
+/**
+ * @method modbus_common_recv_mask_write_register_resp
+ * 接收掩码写入register响应。
+ * @param {modbus_common_t*} common modbus_common_t对象。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_common_recv_mask_write_register_resp(modbus_common_t* common);
+
+/**
+ * @method modbus_common_send_read_fifo_queue_req
+ * 发送读取FIFO队列请求。
+ * @param {modbus_common_t*} common modbus_common_t对象。
+ * @param {uint16_t} addr FIFO指针地址。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_common_send_read_fifo_queue_req(modbus_common_t* common, uint16_t addr);
+
+/**
+ * @method modbus_common_recv_read_fifo_queue_resp
+ * 接收读取FIFO队列响应。
+ * @param {modbus_common_t*} common modbus_common_t对象。
+ * @param {uint16_t*} buffer 读取的数据。
+ * @param {uint16_t*} count 读取的个数(输入为buffer的容量，输出为队列中数据的个数)。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_common_recv_read_fifo_queue_resp(modbus_common_t* common, uint16_t* buffer,
+                                              uint16_t* count);
+
+/**
+ * @method modbus_common_send_read_file_record_req
+ * 发送读取文件记录请求(一个请求包含多个子请求)。
+ * @param {modbus_common_t*} common modbus_common_t对象。
+ * @param {const modbus_file_record_t*} records 子请求。
+ * @param {uint32_t} nr 子请求的个数。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_common_send_read_file_record_req(modbus_common_t* common,
+                                              const modbus_file_record_t* records, uint32_t nr);
+
+/**
+ * @method modbus_common_recv_read_file_record_resp
+ * 接收读取文件记录响应。
+ * @param {modbus_common_t*} common modbus_common_t对象。
+ * @param {modbus_file_record_t*} records 子请求(和请求时一致，数据写入data)。
+ * @param {uint32_t} nr 子请求的个数。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_common_recv_read_file_record_resp(modbus_common_t* common,
+                                               modbus_file_record_t* records, uint32_t nr);
+
+/**
+ * @method modbus_common_send_write_file_record_req
+ * 发送写入文件记录请求(一个请求包含多个子请求)。
+ * @param {modbus_common_t*} common modbus_common_t对象。
+ * @param {const modbus_file_record_t*} records 子请求。
+ * @param {uint32_t} nr 子请求的个数。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_common_send_write_file_record_req(modbus_common_t* common,
+                                               const modbus_file_record_t* records, uint32_t nr);
+
+/**
+ * @method modbus_common_recv_write_file_record_resp
+ * 接收写入文件记录响应。
+ * @param {modbus_common_t*} common modbus_common_t对象。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_common_recv_write_file_record_resp(modbus_common_t* common);
+
 /**
  * @method modbus_common_get_last_exception_code
  * 获取最后一次的错误码。
@@ -296,6 +416,62 @@ ret_t modbus_common_send_exception_resp(modbus_common_t* common, uint8_t func_co
  */
 ret_t modbus_common_flush_read_buffer(modbus_common_t* common);
 
+/**
+ * @method modbus_common_set_read_ahead
+ * 设置预读缓冲区。
+ *
+ * 启用后每次从底层流读取尽可能多的数据(最多size字节)，一个请求的多个字段(以及连续发送的多个请求)
+ * 只需要一次读取，减少系统调用。
+ *
+ * > 缓冲区中的数据底层流是看不到的，事件循环要用modbus_common_get_buffered_size检查(见modbus_service_dispatch_available)。
+ *
+ * @param {modbus_common_t*} common modbus_common_t对象。
+ * @param {uint32_t} size 缓冲区大小(字节)，为0时不预读。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_common_set_read_ahead(modbus_common_t* common, uint32_t size);
+
+/**
+ * @method modbus_common_get_buffered_size
+ * 获取预读缓冲区中还没有处理的字节数。
+ * @param {modbus_common_t*} common modbus_common_t对象。
+ * @return {uint32_t} 返回字节数。
+ */
+uint32_t modbus_common_get_buffered_size(modbus_common_t* common);
+
+/**
+ * @method modbus_common_fill_read_buffer
+ * 把底层流中已经收到的数据读到预读缓冲区(用于非阻塞的流，不等待数据)。
+ *
+ * 调用后解析请求时只从缓冲区中读取，不再读取底层流。
+ * 要先用modbus_common_has_complete_req确认缓冲区中有完整的请求，不完整的请求留在缓冲区中等下次收到数据。
+ *
+ * @param {modbus_common_t*} common modbus_common_t对象。
+ * @return {ret_t} 返回RET_OK表示已经读完，RET_CONTINUE表示缓冲区满了(处理完请求后再调用)，RET_EOS表示连接已经关闭，RET_IO表示出错。
+ */
+ret_t modbus_common_fill_read_buffer(modbus_common_t* common);
+
+/**
+ * @method modbus_common_has_complete_req
+ * 检查预读缓冲区中是否有完整的请求(TCP按MBAP头中的长度和功能码，RTU按功能码计算请求的长度)。
+ * @param {modbus_common_t*} common modbus_common_t对象。
+ * @return {bool_t} 返回TRUE表示有完整的请求。
+ */
+bool_t modbus_common_has_complete_req(modbus_common_t* common);
+
+/**
+ * @method modbus_common_wait_until
+ * 等待到指定的时间(与time_now_us比较)。
+ *
+ * 先休眠到deadline前spin_time微秒，再忙等到deadline。
+ * sleep_us通常会多等待几十到上百微秒，波特率较高时帧间隔(t3.5)的误差很明显，忙等可以减小误差。
+ *
+ * @param {uint64_t} deadline 截止时间(微秒)。
+ * @param {uint32_t} spin_time 忙等的最长时间(微秒)，为0时只休眠(休眠提前返回时忙等补足)。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_common_wait_until(uint64_t deadline, uint32_t spin_time);
+
 #define MODBUS_COMMON(obj) ((obj) != NULL ? &((obj)->common) : NULL)
 
 END_C_DECLS
@@ -0,0 +1,200 @@
+/**
+ * File:   modbus_histogram.c
+ * Author: AWTK Develop Team
+ * Brief:  fixed memory latency histogram
+ *
+ * Copyright (c) 2023 - 2025 Guangzhou ZHIYUAN Electronics Co.,Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * License file for more details.
+ *
+ */
+
+/**
+ * History:
+ * ================================================================
+ * 2026-10-19 Li XianJing <lixianjing@zlg.cn> created
+ *
+ */
+
+#include "tkc/utils.h"
+#include "modbus_histogram.h"
+
+#if MODBUS_WITH_STATS
+#define MODBUS_HISTOGRAM_SUB_NR (1u << MODBUS_HISTOGRAM_SUB_BITS)
+
+static uint32_t modbus_histogram_msb(uint32_t value) {
+  uint32_t n = 0;
+
+  if (value >= 0x10000) {
+    value >>= 16;
+    n += 16;
+  }
+  if (value >= 0x100) {
+    value >>= 8;
+    n += 8;
+  }
+  if (value >= 0x10) {
+    value >>= 4;
+    n += 4;
+  }
+  if (value >= 0x4) {
+    value >>= 2;
+    n += 2;
+  }
+  if (value >= 0x2) {
+    n += 1;
+  }
+
+  return n;
+}
+
+static uint32_t modbus_histogram_index_of(uint32_t value) {
+  uint32_t msb = 0;
+  uint32_t shift = 0;
+
+  if (value < MODBUS_HISTOGRAM_SUB_NR) {
+    return value;
+  }
+
+  msb = modbus_histogram_msb(value);
+  shift = msb - MODBUS_HISTOGRAM_SUB_BITS;
+
+  return ((shift + 1) << MODBUS_HISTOGRAM_SUB_BITS) +
+         ((value >> shift) & (MODBUS_HISTOGRAM_SUB_NR - 1));
+}
+
+static uint32_t modbus_histogram_upper_of(uint32_t index) {
+  uint64_t low = 0;
+  uint32_t shift = 0;
+  uint32_t sub = index & (MODBUS_HISTOGRAM_SUB_NR - 1);
+
+  if (index < MODBUS_HISTOGRAM_SUB_NR) {
+    return index;
+  }
+
+  shift = (index >> MODBUS_HISTOGRAM_SUB_BITS) - 1;
+  low = ((uint64_t)(MODBUS_HISTOGRAM_SUB_NR + sub)) << shift;
+
+  return (uint32_t)(low + (((uint64_t)1) << shift) - 1);
+}
+#endif /*MODBUS_WITH_STATS*/
+
+ret_t modbus_histogram_init(modbus_histogram_t* histogram) {
+  return_value_if_fail(histogram != NULL, RET_BAD_PARAMS);
+  memset(histogram, 0x00, sizeof(*histogram));
+
+  return RET_OK;
+}
+
+ret_t modbus_histogram_reset(modbus_histogram_t* histogram) {
+  return modbus_histogram_init(histogram);
+}
+
+ret_t modbus_histogram_record(modbus_histogram_t* histogram, uint32_t value) {
+  return_value_if_fail(histogram != NULL, RET_BAD_PARAMS);
+
+  if (histogram->total == 0 || value < histogram->min) {
+    histogram->min = value;
+  }
+  if (value > histogram->max) {
+    histogram->max = value;
+  }
+
+  histogram->total++;
+  histogram->sum += value;
+#if MODBUS_WITH_STATS
+  histogram->counts[modbus_histogram_index_of(value)]++;
+#endif /*MODBUS_WITH_STATS*/
+
+  return RET_OK;
+}
+
+ret_t modbus_histogram_merge(modbus_histogram_t* histogram, const modbus_histogram_t* other) {
+#if MODBUS_WITH_STATS
+  uint32_t i = 0;
+#endif /*MODBUS_WITH_STATS*/
+  return_value_if_fail(histogram != NULL && other != NULL, RET_BAD_PARAMS);
+
+  if (other->total == 0) {
+    return RET_OK;
+  }
+
+  if (histogram->total == 0 || other->min < histogram->min) {
+    histogram->min = other->min;
+  }
+  if (other->max > histogram->max) {
+    histogram->max = other->max;
+  }
+
+  histogram->total += other->total;
+  histogram->sum += other->sum;
+#if MODBUS_WITH_STATS
+  for (i = 0; i < MODBUS_HISTOGRAM_BUCKETS_NR; i++) {
+    histogram->counts[i] += other->counts[i];
+  }
+#endif /*MODBUS_WITH_STATS*/
+
+  return RET_OK;
+}
+
+uint32_t modbus_histogram_get_percentile(const modbus_histogram_t* histogram, double percentile) {
+#if MODBUS_WITH_STATS
+  uint32_t i = 0;
+  uint64_t acc = 0;
+  uint64_t target = 0;
+#endif /*MODBUS_WITH_STATS*/
+  return_value_if_fail(histogram != NULL, 0);
+
+  if (histogram->total == 0) {
+    return 0;
+  }
+
+#if MODBUS_WITH_STATS
+  if (percentile >= 100) {
+    return histogram->max;
+  } else if (percentile < 0) {
+    percentile = 0;
+  }
+
+  target = (uint64_t)(histogram->total * percentile / 100.0 + 0.5);
+  if (target == 0) {
+    target = 1;
+  }
+
+  for (i = 0; i < MODBUS_HISTOGRAM_BUCKETS_NR; i++) {
+    acc += histogram->counts[i];
+    if (acc >= target) {
+      uint32_t upper = modbus_histogram_upper_of(i);
+      return tk_min(upper, histogram->max);
+    }
+  }
+#else
+  (void)percentile;
+#endif /*MODBUS_WITH_STATS*/
+
+  return histogram->max;
+}
+
+uint32_t modbus_histogram_get_mean(const modbus_histogram_t* histogram) {
+  return_value_if_fail(histogram != NULL, 0);
+
+  if (histogram->total == 0) {
+    return 0;
+  }
+
+  return (uint32_t)(histogram->sum / histogram->total);
+}
+
+ret_t modbus_histogram_to_str(const modbus_histogram_t* histogram, const char* name, str_t* str) {
+  return_value_if_fail(histogram != NULL && str != NULL, RET_BAD_PARAMS);
+
+  return str_append_format(
+      str, 256, "%s: count=%u min=%u mean=%u p50=%u p90=%u p99=%u p999=%u max=%u\n",
+      name != NULL ? name : "histogram", histogram->total, histogram->min,
+      modbus_histogram_get_mean(histogram), modbus_histogram_get_percentile(histogram, 50),
+      modbus_histogram_get_percentile(histogram, 90), modbus_histogram_get_percentile(histogram, 99),
+      modbus_histogram_get_percentile(histogram, 99.9), histogram->max);
+}
@@ -0,0 +1,152 @@
+/**
+ * File:   modbus_histogram.h
+ * Author: AWTK Develop Team
+ * Brief:  fixed memory latency histogram
+ *
+ * Copyright (c) 2023 - 2025 Guangzhou ZHIYUAN Electronics Co.,Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * License file for more details.
+ *
+ */
+
+/**
+ * History:
+ * ================================================================
+ * 2026-10-19 Li XianJing <lixianjing@zlg.cn> created
+ *
+ */
+
+#ifndef TK_MODBUS_HISTOGRAM_H
+#define TK_MODBUS_HISTOGRAM_H
+
+#include "tkc/str.h"
+#include "modbus_types_def.h"
+
+BEGIN_C_DECLS
+
+/**
+ * @const MODBUS_HISTOGRAM_SUB_BITS
+ * 每个2的幂区间再细分为(1 << MODBUS_HISTOGRAM_SUB_BITS)个桶，缺省为4，相对误差不超过6.25%。
+ *
+ * 每减小1，桶的个数和内存大约减半，相对误差加倍。
+ */
+#ifndef MODBUS_HISTOGRAM_SUB_BITS
+#define MODBUS_HISTOGRAM_SUB_BITS 4
+#endif /*MODBUS_HISTOGRAM_SUB_BITS*/
+
+/**
+ * @const MODBUS_HISTOGRAM_BUCKETS_NR
+ * 桶的个数(覆盖整个uint32_t范围)。
+ */
+#define MODBUS_HISTOGRAM_BUCKETS_NR ((32 - MODBUS_HISTOGRAM_SUB_BITS + 1) << MODBUS_HISTOGRAM_SUB_BITS)
+
+/**
+ * @class modbus_histogram_t
+ * 固定内存的直方图(HDR风格的对数-线性分桶)。
+ *
+ * 用于统计请求耗时等数据的分布，记录操作为O(1)且不分配内存。
+ * 数值的单位由调用者决定(一般为微秒)。
+ *
+ */
+typedef struct _modbus_histogram_t {
+  /**
+   * @property {uint32_t} total
+   * @annotation ["readable"]
+   * 记录的样本数。
+   */
+  uint32_t total;
+  /**
+   * @property {uint32_t} min
+   * @annotation ["readable"]
+   * 最小值。
+   */
+  uint32_t min;
+  /**
+   * @property {uint32_t} max
+   * @annotation ["readable"]
+   * 最大值。
+   */
+  uint32_t max;
+  /**
+   * @property {uint64_t} sum
+   * @annotation ["readable"]
+   * 所有样本的和。
+   */
+  uint64_t sum;
+#if MODBUS_WITH_STATS
+  /**
+   * @property {uint32_t*} counts
+   * @annotation ["readable"]
+   * 各个桶的计数(MODBUS_WITH_STATS为0时没有)。
+   */
+  uint32_t counts[MODBUS_HISTOGRAM_BUCKETS_NR];
+#endif /*MODBUS_WITH_STATS*/
+} modbus_histogram_t;
+
+/**
+ * @method modbus_histogram_init
+ * 初始化直方图。
+ * @param {modbus_histogram_t*} histogram 直方图对象。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_histogram_init(modbus_histogram_t* histogram);
+
+/**
+ * @method modbus_histogram_reset
+ * 清除全部样本。
+ * @param {modbus_histogram_t*} histogram 直方图对象。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_histogram_reset(modbus_histogram_t* histogram);
+
+/**
+ * @method modbus_histogram_record
+ * 记录一个样本。
+ * @param {modbus_histogram_t*} histogram 直方图对象。
+ * @param {uint32_t} value 样本值。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_histogram_record(modbus_histogram_t* histogram, uint32_t value);
+
+/**
+ * @method modbus_histogram_merge
+ * 把other中的样本合并到histogram中。
+ * @param {modbus_histogram_t*} histogram 直方图对象。
+ * @param {const modbus_histogram_t*} other 另外一个直方图对象。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_histogram_merge(modbus_histogram_t* histogram, const modbus_histogram_t* other);
+
+/**
+ * @method modbus_histogram_get_percentile
+ * 获取百分位数(返回所在桶的上界，不超过最大值。MODBUS_WITH_STATS为0时没有分桶，返回最大值)。
+ * @param {const modbus_histogram_t*} histogram 直方图对象。
+ * @param {double} percentile 百分位(0-100，如99.9)。
+ * @return {uint32_t} 返回百分位数。
+ */
+uint32_t modbus_histogram_get_percentile(const modbus_histogram_t* histogram, double percentile);
+
+/**
+ * @method modbus_histogram_get_mean
+ * 获取平均值。
+ * @param {const modbus_histogram_t*} histogram 直方图对象。
+ * @return {uint32_t} 返回平均值。
+ */
+uint32_t modbus_histogram_get_mean(const modbus_histogram_t* histogram);
+
+/**
+ * @method modbus_histogram_to_str
+ * 把统计摘要(个数/最小/平均/p50/p90/p99/p999/最大)以一行文本的形式追加到str中。
+ * @param {const modbus_histogram_t*} histogram 直方图对象。
+ * @param {const char*} name 名称。
+ * @param {str_t*} str 用于返回结果。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_histogram_to_str(const modbus_histogram_t* histogram, const char* name, str_t* str);
+
+END_C_DECLS
+
+#endif /*TK_MODBUS_HISTOGRAM_H*/
@@ -21,6 +21,8 @@
 
 #include "modbus_init_req.h"
 
+#if MODBUS_WITH_CLIENT
+
 static ret_t modbus_init_req_load(modbus_init_req_t* init, conf_node_t* node) {
   return_value_if_fail(init != NULL && node != NULL, RET_BAD_PARAMS);
 
@@ -69,20 +71,29 @@ ret_t modbus_init_req_request(modbus_init_req_t* init, modbus_client_t* client)
       break;
     }
     case MODBUS_FC_WRITE_MULTIPLE_COILS: {
-      uint8_t* values = TKMEM_ALLOC(init->length);
-      memset(values, init->value, init->length);
-      ret = modbus_client_write_bits(client, init->offset, init->length, values);
-      TKMEM_FREE(values);
+      /*每个位一个字节，写入的值都相同，用栈上的缓冲区分块写入*/
+      uint32_t offset = 0;
+      uint8_t values[MODBUS_MAX_WRITE_REGISTERS * sizeof(uint16_t)];
+      memset(values, init->value, sizeof(values));
+      while (offset < init->length && ret == RET_OK) {
+        uint16_t n = tk_min(init->length - offset, sizeof(values));
+        ret = modbus_client_write_bits(client, init->offset + offset, n, values);
+        offset += n;
+      }
       break;
     }
     case MODBUS_FC_WRITE_MULTIPLE_HOLDING_REGISTERS: {
-      uint16_t* values = TKMEM_ALLOC(init->length * sizeof(uint16_t));
       uint32_t i = 0;
-      for (i = 0; i < init->length; i++) {
+      uint32_t offset = 0;
+      uint16_t values[MODBUS_MAX_WRITE_REGISTERS];
+      for (i = 0; i < ARRAY_SIZE(values); i++) {
         values[i] = init->value;
       }
-      ret = modbus_client_write_registers(client, init->offset, init->length, values);
-      TKMEM_FREE(values);
+      while (offset < init->length && ret == RET_OK) {
+        uint16_t n = tk_min(init->length - offset, ARRAY_SIZE(values));
+        ret = modbus_client_write_registers(client, init->offset + offset, n, values);
+        offset += n;
+      }
       break;
     }
     default: {
@@ -100,3 +111,4 @@ ret_t modbus_init_req_destroy(modbus_init_req_t* init) {
 
   return RET_OK;
 }
+#endif /*MODBUS_WITH_CLIENT*/
@@ -107,6 +107,51 @@ ret_t modbus_memory_write_registers(modbus_memory_t* memory, uint16_t addr, uint
   return RET_NOT_IMPL;
 }
 
+ret_t modbus_memory_mask_write_register(modbus_memory_t* memory, uint16_t addr, uint16_t and_mask,
+                                        uint16_t or_mask) {
+  return_value_if_fail(memory != NULL, RET_BAD_PARAMS);
+
+  if (memory->mask_write_register != NULL) {
+    return memory->mask_write_register(memory, addr, and_mask, or_mask);
+  }
+
+  return RET_NOT_IMPL;
+}
+
+ret_t modbus_memory_read_fifo_queue(modbus_memory_t* memory, uint16_t addr, uint16_t* count,
+                                    uint16_t* buff) {
+  return_value_if_fail(memory != NULL && count != NULL && buff != NULL, RET_BAD_PARAMS);
+
+  if (memory->read_fifo_queue != NULL) {
+    return memory->read_fifo_queue(memory, addr, count, buff);
+  }
+
+  return RET_NOT_IMPL;
+}
+
+ret_t modbus_memory_read_file_record(modbus_memory_t* memory, uint16_t file_number,
+                                     uint16_t record_number, uint16_t count, uint16_t* buff) {
+  return_value_if_fail(memory != NULL && buff != NULL, RET_BAD_PARAMS);
+
+  if (memory->read_file_record != NULL) {
+    return memory->read_file_record(memory, file_number, record_number, count, buff);
+  }
+
+  return RET_NOT_IMPL;
+}
+
+ret_t modbus_memory_write_file_record(modbus_memory_t* memory, uint16_t file_number,
+                                      uint16_t record_number, uint16_t count,
+                                      const uint16_t* buff) {
+  return_value_if_fail(memory != NULL && buff != NULL, RET_BAD_PARAMS);
+
+  if (memory->write_file_record != NULL) {
+    return memory->write_file_record(memory, file_number, record_number, count, buff);
+  }
+
+  return RET_NOT_IMPL;
+}
+
 ret_t modbus_memory_destroy(modbus_memory_t* memory) {
   return_value_if_fail(memory != NULL, RET_BAD_PARAMS);
 
@@ -44,6 +44,16 @@ typedef ret_t (*modbus_memory_write_bits_t)(modbus_memory_t* memory, uint16_t ad
                                             const uint8_t* buff);
 typedef ret_t (*modbus_memory_write_registers_t)(modbus_memory_t* memory, uint16_t addr,
                                                  uint16_t count, const uint16_t* buff);
+typedef ret_t (*modbus_memory_mask_write_register_t)(modbus_memory_t* memory, uint16_t addr,
+                                                     uint16_t and_mask, uint16_t or_mask);
+typedef ret_t (*modbus_memory_read_fifo_queue_t)(modbus_memory_t* memory, uint16_t addr,
+                                                 uint16_t* count, uint16_t* buff);
+typedef ret_t (*modbus_memory_read_file_record_t)(modbus_memory_t* memory, uint16_t file_number,
+                                                  uint16_t record_number, uint16_t count,
+                                                  uint16_t* buff);
+typedef ret_t (*modbus_memory_write_file_record_t)(modbus_memory_t* memory, uint16_t file_number,
+                                                   uint16_t record_number, uint16_t count,
+                                                   const uint16_t* buff);
 typedef ret_t (*modbus_memory_destroy_t)(modbus_memory_t* memory);
 
 /**
@@ -60,6 +70,10 @@ struct _modbus_memory_t {
   modbus_memory_write_register_t write_register;
   modbus_memory_write_bits_t write_bits;
   modbus_memory_write_registers_t write_registers;
+  modbus_memory_mask_write_register_t mask_write_register;
+  modbus_memory_read_fifo_queue_t read_fifo_queue;
+  modbus_memory_read_file_record_t read_file_record;
+  modbus_memory_write_file_record_t write_file_record;
   modbus_memory_destroy_t destroy;
 };
 
@@ -154,6 +168,60 @@ ret_t modbus_memory_write_bits(modbus_memory_t* memory, uint16_t addr, uint16_t
 ret_t modbus_memory_write_registers(modbus_memory_t* memory, uint16_t addr, uint16_t count,
                                     const uint16_t* buff);
 
+/**
+ * @method modbus_memory_mask_write_register
+ * 用掩码修改register(读取-修改-写入必须是原子的)。
+ * 结果为：(当前值 & and_mask) | (or_mask & ~and_mask)。
+ * @param {modbus_memory_t*} memory modbus memory对象。
+ * @param {uint16_t} addr 地址。
+ * @param {uint16_t} and_mask AND掩码(主机字节序)。
+ * @param {uint16_t} or_mask OR掩码(主机字节序)。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_memory_mask_write_register(modbus_memory_t* memory, uint16_t addr, uint16_t and_mask,
+                                        uint16_t or_mask);
+
+/**
+ * @method modbus_memory_read_fifo_queue
+ * 读取FIFO队列(不清除队列中的数据)。
+ * 队列中数据的个数超过MODBUS_MAX_FIFO_COUNT时返回RET_EXCEED_RANGE。
+ * @param {modbus_memory_t*} memory modbus memory对象。
+ * @param {uint16_t} addr FIFO指针地址。
+ * @param {uint16_t*} count 输入为buff的容量，输出为队列中数据的个数。
+ * @param {uint16_t*} buff 读取的数据(格式同read_registers)。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_memory_read_fifo_queue(modbus_memory_t* memory, uint16_t addr, uint16_t* count,
+                                    uint16_t* buff);
+
+/**
+ * @method modbus_memory_read_file_record
+ * 读取文件记录。
+ * 文件记录由memory的实现者决定如何存储(如Flash中的日志/配方)，不实现时回复异常1(非法功能)。
+ * @param {modbus_memory_t*} memory modbus memory对象。
+ * @param {uint16_t} file_number 文件号。
+ * @param {uint16_t} record_number 起始记录号。
+ * @param {uint16_t} count 记录的个数。
+ * @param {uint16_t*} buff 读取的数据(格式同read_registers)。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_memory_read_file_record(modbus_memory_t* memory, uint16_t file_number,
+                                     uint16_t record_number, uint16_t count, uint16_t* buff);
+
+/**
+ * @method modbus_memory_write_file_record
+ * 写入文件记录。
+ * @param {modbus_memory_t*} memory modbus memory对象。
+ * @param {uint16_t} file_number 文件号。
+ * @param {uint16_t} record_number 起始记录号。
+ * @param {uint16_t} count 记录的个数。
+ * @param {const uint16_t*} buff 写入的数据(格式同write_registers)。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_memory_write_file_record(modbus_memory_t* memory, uint16_t file_number,
+                                      uint16_t record_number, uint16_t count,
+                                      const uint16_t* buff);
+
 /**
  * @method modbus_memory_destroy
  * 销毁modbus memory。
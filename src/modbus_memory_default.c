@@ -27,6 +27,13 @@ static void modbus_memory_default_on_hook_error(const char* hook_name, ret_t ret
   log_warn("%s hook failed: %d\n", hook_name, ret);
 }
 
+static void modbus_memory_default_notify_changed(modbus_memory_default_t* memory) {
+  /*静态初始化的memory没有emitter*/
+  if (memory->emitter != NULL) {
+    emitter_dispatch_simple_event(memory->emitter, EVT_PROPS_CHANGED);
+  }
+}
+
 static void modbus_memory_default_before_read_bits(modbus_memory_default_t* memory, uint16_t addr,
                                                    uint16_t count) {
   if (memory->hooks.before_read_bits != NULL) {
@@ -151,7 +158,7 @@ static ret_t modbus_memory_default_write_bit(modbus_memory_t* memory, uint16_t a
   ret = modbus_server_channel_write_bit(m->bits, addr, value);
   if (ret == RET_OK) {
     modbus_memory_default_after_write_bit(m, addr);
-    emitter_dispatch_simple_event(m->emitter, EVT_PROPS_CHANGED);
+    modbus_memory_default_notify_changed(m);
   }
 
   return ret;
@@ -166,7 +173,7 @@ static ret_t modbus_memory_default_write_bits(modbus_memory_t* memory, uint16_t
   ret = modbus_server_channel_write_bits(m->bits, addr, count, buff);
   if (ret == RET_OK) {
     modbus_memory_default_after_write_bits(m, addr, count);
-    emitter_dispatch_simple_event(m->emitter, EVT_PROPS_CHANGED);
+    modbus_memory_default_notify_changed(m);
   }
 
   return ret;
@@ -181,7 +188,7 @@ static ret_t modbus_memory_default_write_register(modbus_memory_t* memory, uint1
   ret = modbus_server_channel_write_register(m->registers, addr, value);
   if (ret == RET_OK) {
     modbus_memory_default_after_write_register(m, addr);
-    emitter_dispatch_simple_event(m->emitter, EVT_PROPS_CHANGED);
+    modbus_memory_default_notify_changed(m);
   }
 
   return ret;
@@ -196,13 +203,83 @@ static ret_t modbus_memory_default_write_registers(modbus_memory_t* memory, uint
   ret = modbus_server_channel_write_registers(m->registers, addr, count, buff);
   if (ret == RET_OK) {
     modbus_memory_default_after_write_registers(m, addr, count);
-    emitter_dispatch_simple_event(m->emitter, EVT_PROPS_CHANGED);
+    modbus_memory_default_notify_changed(m);
+  }
+
+  return ret;
+}
+
+static ret_t modbus_memory_default_mask_write_register(modbus_memory_t* memory, uint16_t addr,
+                                                       uint16_t and_mask, uint16_t or_mask) {
+  ret_t ret = RET_OK;
+  modbus_memory_default_t* m = MODBUS_MEMORY_DEFAULT(memory);
+  return_value_if_fail(m != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(m->registers != NULL, RET_INVALID_ADDR);
+  ret = modbus_server_channel_mask_write_register(m->registers, addr, and_mask, or_mask);
+  if (ret == RET_OK) {
+    modbus_memory_default_after_write_register(m, addr);
+    modbus_memory_default_notify_changed(m);
+  }
+
+  return ret;
+}
+
+static ret_t modbus_memory_default_read_fifo_queue(modbus_memory_t* memory, uint16_t addr,
+                                                   uint16_t* count, uint16_t* buff) {
+  modbus_memory_default_t* m = MODBUS_MEMORY_DEFAULT(memory);
+  return_value_if_fail(m != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(m->registers != NULL, RET_INVALID_ADDR);
+  modbus_memory_default_before_read_registers(m, addr, *count + 1);
+  return modbus_server_channel_read_fifo_queue(m->registers, addr, count, buff);
+}
+
+static modbus_server_channel_t* modbus_memory_default_find_file(modbus_memory_default_t* memory,
+                                                                 uint16_t file_number) {
+  uint32_t i = 0;
+
+  for (i = 0; i < MODBUS_MEMORY_DEFAULT_MAX_FILES; i++) {
+    if (memory->files[i] != NULL && memory->file_numbers[i] == file_number) {
+      return memory->files[i];
+    }
+  }
+
+  return NULL;
+}
+
+static ret_t modbus_memory_default_read_file_record(modbus_memory_t* memory, uint16_t file_number,
+                                                    uint16_t record_number, uint16_t count,
+                                                    uint16_t* buff) {
+  modbus_server_channel_t* file = NULL;
+  modbus_memory_default_t* m = MODBUS_MEMORY_DEFAULT(memory);
+  return_value_if_fail(m != NULL, RET_BAD_PARAMS);
+
+  file = modbus_memory_default_find_file(m, file_number);
+  return_value_if_fail(file != NULL, RET_INVALID_ADDR);
+
+  return modbus_server_channel_read_registers(file, record_number, count, buff);
+}
+
+static ret_t modbus_memory_default_write_file_record(modbus_memory_t* memory, uint16_t file_number,
+                                                     uint16_t record_number, uint16_t count,
+                                                     const uint16_t* buff) {
+  ret_t ret = RET_OK;
+  modbus_server_channel_t* file = NULL;
+  modbus_memory_default_t* m = MODBUS_MEMORY_DEFAULT(memory);
+  return_value_if_fail(m != NULL, RET_BAD_PARAMS);
+
+  file = modbus_memory_default_find_file(m, file_number);
+  return_value_if_fail(file != NULL, RET_INVALID_ADDR);
+
+  ret = modbus_server_channel_write_registers(file, record_number, count, buff);
+  if (ret == RET_OK) {
+    modbus_memory_default_notify_changed(m);
   }
 
   return ret;
 }
 
 static ret_t modbus_memory_default_destroy(modbus_memory_t* memory) {
+  uint32_t i = 0;
   modbus_memory_default_t* memory_default = MODBUS_MEMORY_DEFAULT(memory);
   return_value_if_fail(memory_default != NULL, RET_BAD_PARAMS);
 
@@ -210,9 +287,19 @@ static ret_t modbus_memory_default_destroy(modbus_memory_t* memory) {
   modbus_server_channel_destroy(memory_default->input_bits);
   modbus_server_channel_destroy(memory_default->registers);
   modbus_server_channel_destroy(memory_default->input_registers);
+  for (i = 0; i < MODBUS_MEMORY_DEFAULT_MAX_FILES; i++) {
+    if (memory_default->files[i] != NULL) {
+      modbus_server_channel_destroy(memory_default->files[i]);
+    }
+  }
+
+  if (memory_default->emitter != NULL) {
+    emitter_destroy(memory_default->emitter);
+  }
 
-  emitter_destroy(memory_default->emitter);
-  TKMEM_FREE(memory_default);
+  if (!memory_default->is_static) {
+    TKMEM_FREE(memory_default);
+  }
 
   return RET_OK;
 }
@@ -233,13 +320,11 @@ modbus_memory_t* modbus_memory_default_create_test(void) {
   return modbus_memory_default_create(bits, input_bits, registers, input_registers);
 }
 
-modbus_memory_t* modbus_memory_default_create(modbus_server_channel_t* bits,
-                                              modbus_server_channel_t* input_bits,
-                                              modbus_server_channel_t* registers,
-                                              modbus_server_channel_t* input_registers) {
-  modbus_memory_default_t* memory = TKMEM_ZALLOC(modbus_memory_default_t);
-  return_value_if_fail(memory != NULL, NULL);
-
+static modbus_memory_t* modbus_memory_default_init(modbus_memory_default_t* memory,
+                                                   modbus_server_channel_t* bits,
+                                                   modbus_server_channel_t* input_bits,
+                                                   modbus_server_channel_t* registers,
+                                                   modbus_server_channel_t* input_registers) {
   memory->memory.read_bits = modbus_memory_default_read_bits;
   memory->memory.read_input_bits = modbus_memory_default_read_input_bits;
   memory->memory.read_registers = modbus_memory_default_read_registers;
@@ -248,6 +333,10 @@ modbus_memory_t* modbus_memory_default_create(modbus_server_channel_t* bits,
   memory->memory.write_bits = modbus_memory_default_write_bits;
   memory->memory.write_register = modbus_memory_default_write_register;
   memory->memory.write_registers = modbus_memory_default_write_registers;
+  memory->memory.mask_write_register = modbus_memory_default_mask_write_register;
+  memory->memory.read_fifo_queue = modbus_memory_default_read_fifo_queue;
+  memory->memory.read_file_record = modbus_memory_default_read_file_record;
+  memory->memory.write_file_record = modbus_memory_default_write_file_record;
   memory->memory.destroy = modbus_memory_default_destroy;
 
   memory->bits = bits;
@@ -278,16 +367,44 @@ modbus_memory_t* modbus_memory_default_create(modbus_server_channel_t* bits,
   }
   log_debug("-------------------------------------------------\n");
 
+  return (modbus_memory_t*)memory;
+}
+
+modbus_memory_t* modbus_memory_default_create(modbus_server_channel_t* bits,
+                                              modbus_server_channel_t* input_bits,
+                                              modbus_server_channel_t* registers,
+                                              modbus_server_channel_t* input_registers) {
+  modbus_memory_default_t* memory = TKMEM_ZALLOC(modbus_memory_default_t);
+  return_value_if_fail(memory != NULL, NULL);
+
   memory->emitter = emitter_create();
 
-  return (modbus_memory_t*)memory;
+  return modbus_memory_default_init(memory, bits, input_bits, registers, input_registers);
+}
+
+modbus_memory_t* modbus_memory_default_init_static(modbus_memory_default_t* memory,
+                                                   modbus_server_channel_t* bits,
+                                                   modbus_server_channel_t* input_bits,
+                                                   modbus_server_channel_t* registers,
+                                                   modbus_server_channel_t* input_registers) {
+  return_value_if_fail(memory != NULL, NULL);
+
+  memset(memory, 0x00, sizeof(*memory));
+  memory->is_static = TRUE;
+
+  return modbus_memory_default_init(memory, bits, input_bits, registers, input_registers);
 }
 
 modbus_memory_t* modbus_memory_default_create_with_conf(conf_node_t* node) {
+  uint32_t i = 0;
+  modbus_memory_t* memory = NULL;
   modbus_server_channel_t* bits = NULL;
   modbus_server_channel_t* input_bits = NULL;
   modbus_server_channel_t* registers = NULL;
   modbus_server_channel_t* input_registers = NULL;
+  uint16_t file_numbers[MODBUS_MEMORY_DEFAULT_MAX_FILES];
+  modbus_server_channel_t* files[MODBUS_MEMORY_DEFAULT_MAX_FILES];
+  uint32_t files_nr = 0;
   conf_node_t* iter = conf_node_get_first_child(node);
   return_value_if_fail(iter != NULL, NULL);
 
@@ -303,6 +420,10 @@ modbus_memory_t* modbus_memory_default_create_with_conf(conf_node_t* node) {
         registers = channel;
       } else if (tk_str_eq(channel->name, MODBUS_SERVER_CHANNEL_INPUT_REGISTERS)) {
         input_registers = channel;
+      } else if (tk_str_eq(channel->name, MODBUS_SERVER_CHANNEL_FILE) &&
+                 files_nr < MODBUS_MEMORY_DEFAULT_MAX_FILES) {
+        file_numbers[files_nr] = conf_node_get_child_value_int32(iter, "file_number", 1);
+        files[files_nr++] = channel;
       } else {
         modbus_server_channel_destroy(channel);
         log_debug("invalid channel name: %s\n", channel->name);
@@ -312,7 +433,15 @@ modbus_memory_t* modbus_memory_default_create_with_conf(conf_node_t* node) {
     iter = iter->next;
   }
 
-  return modbus_memory_default_create(bits, input_bits, registers, input_registers);
+  memory = modbus_memory_default_create(bits, input_bits, registers, input_registers);
+  for (i = 0; i < files_nr; i++) {
+    if (memory == NULL ||
+        modbus_memory_default_add_file(memory, file_numbers[i], files[i]) != RET_OK) {
+      modbus_server_channel_destroy(files[i]);
+    }
+  }
+
+  return memory;
 }
 
 ret_t modbus_memory_default_set_hooks(modbus_memory_t* memory,
@@ -329,6 +458,32 @@ ret_t modbus_memory_default_set_hooks(modbus_memory_t* memory,
   return RET_OK;
 }
 
+ret_t modbus_memory_default_add_file(modbus_memory_t* memory, uint16_t file_number,
+                                     modbus_server_channel_t* records) {
+  uint32_t i = 0;
+  modbus_memory_default_t* memory_default = MODBUS_MEMORY_DEFAULT(memory);
+  return_value_if_fail(memory_default != NULL && records != NULL, RET_BAD_PARAMS);
+
+  for (i = 0; i < MODBUS_MEMORY_DEFAULT_MAX_FILES; i++) {
+    if (memory_default->files[i] != NULL && memory_default->file_numbers[i] == file_number) {
+      modbus_server_channel_destroy(memory_default->files[i]);
+      memory_default->files[i] = records;
+      return RET_OK;
+    }
+  }
+
+  for (i = 0; i < MODBUS_MEMORY_DEFAULT_MAX_FILES; i++) {
+    if (memory_default->files[i] == NULL) {
+      memory_default->file_numbers[i] = file_number;
+      memory_default->files[i] = records;
+      log_debug("file %u: start=%u length=%u\n", file_number, records->start, records->length);
+      return RET_OK;
+    }
+  }
+
+  return RET_EXCEED_RANGE;
+}
+
 modbus_memory_default_t* modbus_memory_default_cast(modbus_memory_t* memory) {
   return_value_if_fail(memory != NULL, NULL);
 
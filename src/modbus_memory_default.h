@@ -54,6 +54,10 @@ typedef struct _modbus_memory_default_hooks_t {
   modbus_memory_default_after_write_registers_hook_t after_write_registers;
 } modbus_memory_default_hooks_t;
 
+#ifndef MODBUS_MEMORY_DEFAULT_MAX_FILES
+#define MODBUS_MEMORY_DEFAULT_MAX_FILES 4
+#endif /*MODBUS_MEMORY_DEFAULT_MAX_FILES*/
+
 /**
  * @class modbus_memory_default_t
  * 
@@ -74,6 +78,9 @@ typedef struct _modbus_memory_default_t {
   modbus_server_channel_t* registers;
   modbus_server_channel_t* input_registers;
   modbus_memory_default_hooks_t hooks;
+  uint16_t file_numbers[MODBUS_MEMORY_DEFAULT_MAX_FILES];
+  modbus_server_channel_t* files[MODBUS_MEMORY_DEFAULT_MAX_FILES];
+  bool_t is_static;
 } modbus_memory_default_t;
 
 /**
@@ -91,6 +98,26 @@ modbus_memory_t* modbus_memory_default_create(modbus_server_channel_t* bits,
                                               modbus_server_channel_t* registers,
                                               modbus_server_channel_t* input_registers);
 
+/**
+ * @method modbus_memory_default_init_static
+ * 在调用者提供的存储上初始化modbus_memory_default_t对象，不分配堆内存。
+ *
+ * 一般和modbus_server_channel_init_static一起使用。不创建emitter(emitter为NULL，不分发EVT_PROPS_CHANGED事件)，
+ * modbus_memory_destroy时销毁各个channel，但不释放memory本身。
+ * @param {modbus_memory_default_t*} memory 存储memory的对象。
+ * @param {modbus_server_channel_t*} bits bits channel。
+ * @param {modbus_server_channel_t*} input_bits input bits channel。
+ * @param {modbus_server_channel_t*} registers registers channel。
+ * @param {modbus_server_channel_t*} input_registers input registers channel。
+ * 
+ * @return {modbus_memory_t*} 返回modbus_memory_t对象。
+ */
+modbus_memory_t* modbus_memory_default_init_static(modbus_memory_default_t* memory,
+                                                   modbus_server_channel_t* bits,
+                                                   modbus_server_channel_t* input_bits,
+                                                   modbus_server_channel_t* registers,
+                                                   modbus_server_channel_t* input_registers);
+
 /**
  * @method modbus_memory_default_create_test
  * 创建modbus_memory_default_t对象。
@@ -119,6 +146,19 @@ modbus_memory_t* modbus_memory_default_create_with_conf(conf_node_t* node);
 ret_t modbus_memory_default_set_hooks(modbus_memory_t* memory,
                                       const modbus_memory_default_hooks_t* hooks);
 
+/**
+ * @method modbus_memory_default_add_file
+ * 增加一个文件(用于0x14/0x15功能码)。
+ * 记录号即channel中的地址，文件号相同时替换原来的文件。
+ * @param {modbus_memory_t*} memory modbus memory对象。
+ * @param {uint16_t} file_number 文件号。
+ * @param {modbus_server_channel_t*} records 保存记录的channel(由memory负责销毁)。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_memory_default_add_file(modbus_memory_t* memory, uint16_t file_number,
+                                     modbus_server_channel_t* records);
+
 /**
  * @method modbus_memory_default_cast
  * 转换为modbus_memory_default_t。
@@ -22,16 +22,20 @@
 #include "tkc/mem.h"
 #include "modbus_server_channel.h"
 
-static ret_t modbus_server_channel_init(modbus_server_channel_t* channel) {
-  uint32_t bytes = 0;
-  return_value_if_fail(channel != NULL, RET_BAD_PARAMS);
-
+static uint32_t modbus_server_channel_get_bytes(modbus_server_channel_t* channel) {
   if (strstr(channel->name, MODBUS_SERVER_CHANNEL_BITS) != NULL ||
       strstr(channel->name, MODBUS_SERVER_CHANNEL_INPUT_BITS) != NULL) {
-    bytes = tk_bits_to_bytes(channel->length);
+    return tk_bits_to_bytes(channel->length);
   } else {
-    bytes = channel->length * sizeof(uint16_t);
+    return channel->length * sizeof(uint16_t);
   }
+}
+
+static ret_t modbus_server_channel_init(modbus_server_channel_t* channel) {
+  uint32_t bytes = 0;
+  return_value_if_fail(channel != NULL, RET_BAD_PARAMS);
+
+  bytes = modbus_server_channel_get_bytes(channel);
   return_value_if_fail(bytes > 0, RET_BAD_PARAMS);
 
   channel->lock = tk_mutex_nest_create();
@@ -52,6 +56,11 @@ ret_t modbus_server_channel_destroy(modbus_server_channel_t* channel) {
     tk_mutex_nest_destroy(channel->lock);
     channel->lock = NULL;
   }
+
+  if (channel->is_static) {
+    return RET_OK;
+  }
+
   TKMEM_FREE(channel->data);
   TKMEM_FREE(channel->name);
   TKMEM_FREE(channel);
@@ -59,6 +68,29 @@ ret_t modbus_server_channel_destroy(modbus_server_channel_t* channel) {
   return RET_OK;
 }
 
+ret_t modbus_server_channel_init_static(modbus_server_channel_t* channel, const char* name,
+                                        uint32_t start, uint32_t length, bool_t writable,
+                                        uint8_t* data, uint32_t size) {
+  uint32_t bytes = 0;
+  return_value_if_fail(channel != NULL && name != NULL && data != NULL, RET_BAD_PARAMS);
+
+  memset(channel, 0x00, sizeof(*channel));
+  channel->name = (char*)name;
+  channel->start = start;
+  channel->length = length;
+  channel->writable = writable;
+  channel->is_static = TRUE;
+
+  bytes = modbus_server_channel_get_bytes(channel);
+  return_value_if_fail(bytes > 0 && bytes <= size, RET_BAD_PARAMS);
+
+  channel->bytes = bytes;
+  channel->data = data;
+  memset(channel->data, 0, bytes);
+
+  return RET_OK;
+}
+
 modbus_server_channel_t* modbus_server_channel_create(const char* name, uint32_t start,
                                                       uint32_t length, bool_t writable) {
   modbus_server_channel_t* channel = TKMEM_ZALLOC(modbus_server_channel_t);
@@ -108,11 +140,18 @@ static ret_t modbus_server_channel_read_bit(modbus_server_channel_t* channel, ui
 
 ret_t modbus_server_channel_lock(modbus_server_channel_t* channel) {
   return_value_if_fail(channel != NULL, RET_BAD_PARAMS);
+  /*静态初始化的通道没有锁*/
+  if (channel->lock == NULL) {
+    return RET_OK;
+  }
   return tk_mutex_nest_lock(channel->lock);
 }
 
 ret_t modbus_server_channel_unlock(modbus_server_channel_t* channel) {
   return_value_if_fail(channel != NULL, RET_BAD_PARAMS);
+  if (channel->lock == NULL) {
+    return RET_OK;
+  }
   return tk_mutex_nest_unlock(channel->lock);
 }
 
@@ -277,3 +316,64 @@ ret_t modbus_server_channel_write_registers(modbus_server_channel_t* channel, ui
 
   return RET_OK;
 }
+
+ret_t modbus_server_channel_mask_write_register(modbus_server_channel_t* channel, uint16_t addr,
+                                                uint16_t and_mask, uint16_t or_mask) {
+  uint16_t* data = NULL;
+  uint16_t offset = 0;
+  return_value_if_fail(channel != NULL && channel->data != NULL, RET_BAD_PARAMS);
+  if (strstr(channel->name, MODBUS_SERVER_CHANNEL_INPUT_BITS) != NULL || strstr(channel->name, MODBUS_SERVER_CHANNEL_INPUT_REGISTERS) != NULL) {
+    return_value_if_fail(channel->writable, RET_BAD_PARAMS);
+  }
+
+  data = (uint16_t*)channel->data;
+  /*检测地址是否合法*/
+  if (addr < channel->start || addr >= (channel->start + channel->length)) {
+    log_debug("%s mask write register invalid addr: addr:%d, start:%d, length:%d\n",
+              channel->name, (int)addr, (int)(channel->start), (int)(channel->length));
+    return RET_INVALID_ADDR;
+  }
+
+  /*读取-修改-写入在锁内完成，避免和其它写入交错*/
+  offset = addr - channel->start;
+  modbus_server_channel_lock(channel);
+  data[offset] = (data[offset] & and_mask) | (or_mask & ~and_mask);
+  modbus_server_channel_unlock(channel);
+
+  return RET_OK;
+}
+
+ret_t modbus_server_channel_read_fifo_queue(modbus_server_channel_t* channel, uint16_t addr,
+                                            uint16_t* count, uint16_t* buff) {
+  uint16_t i = 0;
+  uint16_t n = 0;
+  ret_t ret = RET_OK;
+  uint16_t offset = 0;
+  uint16_t* data = NULL;
+  return_value_if_fail(channel != NULL && channel->data != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(count != NULL && buff != NULL, RET_BAD_PARAMS);
+
+  data = (uint16_t*)channel->data;
+  if (addr < channel->start || addr >= (channel->start + channel->length)) {
+    log_debug("%s read fifo invalid addr: addr:%d, start:%d, length:%d\n", channel->name,
+              (int)addr, (int)(channel->start), (int)(channel->length));
+    return RET_INVALID_ADDR;
+  }
+
+  offset = addr - channel->start;
+  modbus_server_channel_lock(channel);
+  n = data[offset];
+  if (n > MODBUS_MAX_FIFO_COUNT || n > *count) {
+    ret = RET_EXCEED_RANGE;
+  } else if ((uint32_t)offset + 1 + n > channel->length) {
+    ret = RET_INVALID_ADDR;
+  } else {
+    for (i = 0; i < n; i++) {
+      buff[i] = int16_to_big_endian(data[offset + 1 + i]);
+    }
+    *count = n;
+  }
+  modbus_server_channel_unlock(channel);
+
+  return ret;
+}
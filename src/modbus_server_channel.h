@@ -77,6 +77,7 @@ typedef struct _modbus_server_channel_t {
 
   /* private */
   tk_mutex_nest_t* lock;
+  bool_t is_static;
 } modbus_server_channel_t;
 
 /**
@@ -102,6 +103,33 @@ modbus_server_channel_t* modbus_server_channel_create_with_conf(conf_node_t* nod
 modbus_server_channel_t* modbus_server_channel_create(const char* name, uint32_t start,
                                                       uint32_t length, bool_t writable);
 
+/**
+ * @method modbus_server_channel_init_static
+ * 在调用者提供的存储上初始化modbus_server_channel对象，不分配堆内存。
+ *
+ * name和data由调用者管理(一般为常量字符串和全局数组)，销毁时不释放。
+ * 不创建锁，只能在一个线程中访问(如只在modbus service的线程中读写)。
+ *
+ *```c
+ * static uint16_t s_regs_data[100];
+ * static modbus_server_channel_t s_regs;
+ * modbus_server_channel_init_static(&s_regs, MODBUS_SERVER_CHANNEL_REGISTERS, 0, 100, TRUE,
+ *                                   (uint8_t*)s_regs_data, sizeof(s_regs_data));
+ *```
+ * @param {modbus_server_channel_t*} channel 对象。
+ * @param {const char*} name 名称。
+ * @param {uint32_t} start Offset。
+ * @param {uint32_t} length Length。
+ * @param {bool_t} writable 是否可写。
+ * @param {uint8_t*} data 保存数据的缓冲区。
+ * @param {uint32_t} size 缓冲区的大小(不能小于length个位或寄存器需要的字节数)。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_server_channel_init_static(modbus_server_channel_t* channel, const char* name,
+                                        uint32_t start, uint32_t length, bool_t writable,
+                                        uint8_t* data, uint32_t size);
+
 /**
  * @method modbus_server_channel_read_bits
  * 读取位数据。
@@ -185,6 +213,36 @@ ret_t modbus_server_channel_write_register(modbus_server_channel_t* channel, uin
 ret_t modbus_server_channel_write_registers(modbus_server_channel_t* channel, uint16_t addr,
                                             uint16_t count, const uint16_t* buff);
 
+/**
+ * @method modbus_server_channel_mask_write_register
+ * 用掩码修改寄存器数据(在锁内完成读取-修改-写入)。
+ * 结果为：(当前值 & and_mask) | (or_mask & ~and_mask)。
+ * 
+ * @param {modbus_server_channel_t*} channel 对象。
+ * @param {uint16_t} addr 地址。
+ * @param {uint16_t} and_mask AND掩码(主机字节序)。
+ * @param {uint16_t} or_mask OR掩码(主机字节序)。
+ * 
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_server_channel_mask_write_register(modbus_server_channel_t* channel, uint16_t addr,
+                                                uint16_t and_mask, uint16_t or_mask);
+
+/**
+ * @method modbus_server_channel_read_fifo_queue
+ * 读取FIFO队列。
+ * addr处的寄存器为队列中数据的个数，后面紧跟着队列中的数据。
+ * 
+ * @param {modbus_server_channel_t*} channel 对象。
+ * @param {uint16_t} addr FIFO指针地址。
+ * @param {uint16_t*} count 输入为buff的容量，输出为队列中数据的个数。
+ * @param {uint16_t*} buff 缓冲区。
+ * 
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_server_channel_read_fifo_queue(modbus_server_channel_t* channel, uint16_t addr,
+                                            uint16_t* count, uint16_t* buff);
+
 /**
  * @method modbus_server_channel_lock
  * 给 channel 对象数据上锁。
@@ -219,6 +277,7 @@ ret_t modbus_server_channel_destroy(modbus_server_channel_t* channel);
 #define MODBUS_SERVER_CHANNEL_REGISTERS "registers"
 #define MODBUS_SERVER_CHANNEL_INPUT_BITS "input_bits"
 #define MODBUS_SERVER_CHANNEL_INPUT_REGISTERS "input_registers"
+#define MODBUS_SERVER_CHANNEL_FILE "file"
 
 END_C_DECLS
 
@@ -20,239 +20,2333 @@
  */
 
 #include "modbus_service.h"
+#include "tkc/thread.h"
+#include "tkc/mutex_nest.h"
+#include "tkc/semaphore.h"
+#include "tkc/timer_manager.h"
 #include "tkc/event_source_fd.h"
+#include "tkc/event_source_timer.h"
 #include "streams/inet/iostream_tcp.h"
 
+#ifdef WITH_SOCKET
+#ifdef WIN32
+#include <winsock2.h>
+#define MODBUS_SERVICE_SHUT_RDWR SD_BOTH
+#else
+#include <sys/socket.h>
+#define MODBUS_SERVICE_SHUT_RDWR SHUT_RDWR
+#endif /*WIN32*/
+#include "tkc/socket_helper.h"
+#ifndef WIN32
+#include <poll.h>
+#include <errno.h>
+#endif /*WIN32*/
+#endif /*WITH_SOCKET*/
+
 BEGIN_C_DECLS
 
-ret_t modbus_service_destroy(modbus_service_t* service);
-ret_t modbus_service_dispatch(modbus_service_t* service);
+ret_t modbus_service_destroy(modbus_service_t* service);
+ret_t modbus_service_dispatch(modbus_service_t* service);
+static ret_t modbus_service_release_cached(modbus_service_t* service);
+
+static uint32_t s_connections_count = 0;
+static uint32_t s_connections_peak = 0;
+/*多个线程运行service时才需要(见modbus_service_enable_thread_safe)，同时保护下面的空闲连接链表*/
+static tk_mutex_nest_t* s_connections_lock = NULL;
+
+/*
+ * TCP连接按最后活动时间排序(表头最久没有活动)，收到请求时移到表尾(O(1))。
+ * 全部连接共用一个超时时间，超时的连接总是在表头，检查时遇到没有超时的连接就可以停止。
+ */
+static modbus_service_t* s_idle_first = NULL;
+static modbus_service_t* s_idle_last = NULL;
+static uint32_t s_idle_count = 0;
+static uint32_t s_idle_timeout = 0;
+static uint32_t s_max_connections = 0;
+static uint32_t s_num_reaped = 0;
+static uint32_t s_num_evicted = 0;
+
+/*合并到服务端累计数据的连接计数*/
+typedef struct _modbus_service_counters_t {
+  uint32_t num_except_reply;
+  uint32_t num_server_msgs;
+  uint32_t num_crc_errors;
+  uint32_t num_broadcasts;
+  uint32_t num_nak;
+  uint32_t num_busy;
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+} modbus_service_counters_t;
+
+/*
+ * 服务端全部连接的累计数据(诊断功能码和诊断寄存器使用)。
+ * 请求数按秒记录在rate_counts中(rate_secs为对应的秒)，读取时再计算速率，没有请求时速率会降为0。
+ */
+typedef struct _modbus_service_totals_t {
+  modbus_service_counters_t counters;
+  uint32_t num_msg_recv;
+  modbus_histogram_t dispatch_time;
+  uint64_t rate_secs[MODBUS_SERVICE_RATE_WINDOW + 1];
+  uint32_t rate_counts[MODBUS_SERVICE_RATE_WINDOW + 1];
+} modbus_service_totals_t;
+
+/*
+ * 累计数据按连接分片(见MODBUS_SERVICE_TOTALS_SHARDS)，处理请求时只锁连接所在的分片，读取时再合并。
+ * lock在modbus_service_enable_thread_safe中创建，单线程时为NULL。
+ */
+typedef struct _modbus_service_totals_shard_t {
+  tk_mutex_nest_t* lock;
+  modbus_service_totals_t totals;
+} modbus_service_totals_shard_t;
+
+static uint32_t s_totals_next = 0;
+static modbus_service_totals_shard_t s_totals[MODBUS_SERVICE_TOTALS_SHARDS];
+
+/*service对象池(空闲对象的单向链表)，也由s_connections_lock保护*/
+static modbus_service_t* s_pool_first = NULL;
+static uint32_t s_pool_size = 0;
+static uint32_t s_pool_free = 0;
+static uint32_t s_pool_allocs = 0;
+static uint32_t s_pool_reuses = 0;
+
+static void modbus_service_connections_lock(void) {
+  if (s_connections_lock != NULL) {
+    tk_mutex_nest_lock(s_connections_lock);
+  }
+}
+
+static void modbus_service_connections_unlock(void) {
+  if (s_connections_lock != NULL) {
+    tk_mutex_nest_unlock(s_connections_lock);
+  }
+}
+
+static void modbus_service_shard_lock(modbus_service_totals_shard_t* shard) {
+  if (shard->lock != NULL) {
+    tk_mutex_nest_lock(shard->lock);
+  }
+}
+
+static void modbus_service_shard_unlock(modbus_service_totals_shard_t* shard) {
+  if (shard->lock != NULL) {
+    tk_mutex_nest_unlock(shard->lock);
+  }
+}
+
+static modbus_service_t* modbus_service_alloc(void) {
+  modbus_service_t* service = NULL;
+
+  modbus_service_connections_lock();
+  if (s_pool_first != NULL) {
+    service = s_pool_first;
+    s_pool_first = service->pool_next;
+    s_pool_free--;
+    s_pool_reuses++;
+  } else {
+    s_pool_allocs++;
+  }
+  modbus_service_connections_unlock();
+
+  if (service != NULL) {
+    /*保留上一个连接的预读缓冲区和延迟回复的上下文*/
+    uint8_t* cached_rbuffer = service->cached_rbuffer;
+    uint32_t cached_rbuffer_size = service->cached_rbuffer_size;
+    modbus_service_deferred_t* cached_deferred = service->cached_deferred;
+
+    memset(service, 0x00, sizeof(*service));
+    service->cached_rbuffer = cached_rbuffer;
+    service->cached_rbuffer_size = cached_rbuffer_size;
+    service->cached_deferred = cached_deferred;
+  } else {
+    service = TKMEM_ZALLOC(modbus_service_t);
+  }
+
+  return service;
+}
+
+static ret_t modbus_service_free(modbus_service_t* service) {
+  modbus_service_connections_lock();
+  if (s_pool_free < s_pool_size) {
+    service->pool_next = s_pool_first;
+    s_pool_first = service;
+    s_pool_free++;
+    service = NULL;
+  }
+  modbus_service_connections_unlock();
+
+  if (service != NULL) {
+    modbus_service_release_cached(service);
+    TKMEM_FREE(service);
+  }
+
+  return RET_OK;
+}
+
+ret_t modbus_service_set_pool_size(uint32_t size) {
+  modbus_service_t* garbage = NULL;
+
+  modbus_service_connections_lock();
+  s_pool_size = size;
+  /*缩小时把多出来的对象取出来释放*/
+  while (s_pool_free > size) {
+    modbus_service_t* iter = s_pool_first;
+    s_pool_first = iter->pool_next;
+    s_pool_free--;
+    iter->pool_next = garbage;
+    garbage = iter;
+  }
+  modbus_service_connections_unlock();
+
+  while (garbage != NULL) {
+    modbus_service_t* next = garbage->pool_next;
+    modbus_service_release_cached(garbage);
+    TKMEM_FREE(garbage);
+    garbage = next;
+  }
+
+  /*预先分配，连接数不超过容量时不再分配*/
+  while (s_pool_free < size) {
+    modbus_service_t* service = TKMEM_ZALLOC(modbus_service_t);
+    return_value_if_fail(service != NULL, RET_OOM);
+
+    modbus_service_connections_lock();
+    s_pool_allocs++;
+    modbus_service_connections_unlock();
+    modbus_service_free(service);
+  }
+
+  return RET_OK;
+}
+
+ret_t modbus_service_get_pool_stats(modbus_service_pool_stats_t* stats) {
+  return_value_if_fail(stats != NULL, RET_BAD_PARAMS);
+
+  modbus_service_connections_lock();
+  stats->size = s_pool_size;
+  stats->free = s_pool_free;
+  stats->allocs = s_pool_allocs;
+  stats->reuses = s_pool_reuses;
+  modbus_service_connections_unlock();
+
+  return RET_OK;
+}
+
+static ret_t modbus_service_inc_connections_count(bool_t inc) {
+  modbus_service_connections_lock();
+  if (inc) {
+    s_connections_count++;
+    s_connections_peak = tk_max(s_connections_peak, s_connections_count);
+  } else if (s_connections_count > 0) {
+    s_connections_count--;
+  }
+  modbus_service_connections_unlock();
+
+  return RET_OK;
+}
+
+/*调用前需要持有s_connections_lock*/
+static void modbus_service_idle_unlink(modbus_service_t* service) {
+  if (service->idle_prev != NULL) {
+    service->idle_prev->idle_next = service->idle_next;
+  } else {
+    s_idle_first = service->idle_next;
+  }
+  if (service->idle_next != NULL) {
+    service->idle_next->idle_prev = service->idle_prev;
+  } else {
+    s_idle_last = service->idle_prev;
+  }
+
+  service->idle_prev = NULL;
+  service->idle_next = NULL;
+  service->idle_linked = FALSE;
+  s_idle_count--;
+}
+
+/*调用前需要持有s_connections_lock*/
+static void modbus_service_idle_append(modbus_service_t* service) {
+  service->idle_prev = s_idle_last;
+  service->idle_next = NULL;
+  if (s_idle_last != NULL) {
+    s_idle_last->idle_next = service;
+  } else {
+    s_idle_first = service;
+  }
+  s_idle_last = service;
+  service->idle_linked = TRUE;
+  s_idle_count++;
+}
+
+/*
+ * 调用前需要持有s_connections_lock。
+ * 只shutdown不关闭socket(连接可能属于其它线程)，由所在的事件循环读取失败时销毁。
+ */
+static void modbus_service_idle_shutdown(modbus_service_t* service) {
+  modbus_service_idle_unlink(service);
+#ifdef WITH_SOCKET
+  int fd = tk_object_get_prop_int(TK_OBJECT(service->idle_io), TK_STREAM_PROP_FD, -1);
+  if (fd >= 0) {
+    shutdown(fd, MODBUS_SERVICE_SHUT_RDWR);
+  }
+#endif /*WITH_SOCKET*/
+}
+
+static ret_t modbus_service_idle_attach(modbus_service_t* service) {
+  /*持有io的引用，保证在链表中时socket不会被关闭(fd不会被重用)*/
+  service->idle_io = service->common.io;
+  TK_OBJECT_REF(service->idle_io);
+
+  modbus_service_connections_lock();
+  service->last_active = time_now_ms();
+  modbus_service_idle_append(service);
+  if (s_max_connections > 0 && s_idle_count > s_max_connections && s_idle_first != service) {
+    modbus_service_idle_shutdown(s_idle_first);
+    s_num_evicted++;
+  }
+  modbus_service_connections_unlock();
+
+  return RET_OK;
+}
+
+static ret_t modbus_service_idle_detach(modbus_service_t* service) {
+  tk_iostream_t* io = service->idle_io;
+
+  if (io != NULL) {
+    modbus_service_connections_lock();
+    if (service->idle_linked) {
+      modbus_service_idle_unlink(service);
+    }
+    service->idle_io = NULL;
+    modbus_service_connections_unlock();
+    TK_OBJECT_UNREF(io);
+  }
+
+  return RET_OK;
+}
+
+static ret_t modbus_service_idle_touch(modbus_service_t* service) {
+  uint64_t now = 0;
+
+  if (service->idle_io == NULL) {
+    return RET_OK;
+  }
+
+  /*last_active只由连接所在的线程修改，刚更新过时不加锁调整链表*/
+  now = time_now_ms();
+  if (now < service->last_active + MODBUS_SERVICE_IDLE_TOUCH_INTERVAL) {
+    return RET_OK;
+  }
+
+  modbus_service_connections_lock();
+  if (service->idle_linked) {
+    service->last_active = now;
+    if (service != s_idle_last) {
+      modbus_service_idle_unlink(service);
+      modbus_service_idle_append(service);
+    }
+  }
+  modbus_service_connections_unlock();
+
+  return RET_OK;
+}
+
+/*延迟回复的上下文(每个连接同时只有一个等待中的请求)，除特别说明外由lock保护*/
+struct _modbus_service_deferred_t {
+  tk_mutex_nest_t* lock;
+  uint32_t timeout;
+  modbus_exeption_code_t timeout_code;
+  /*在s_deferred_slots中的位置(token中也包含该位置)*/
+  uint32_t slot;
+  /*0表示没有等待中的请求*/
+  uint32_t token;
+  /*dispatch已经保存了回复的上下文*/
+  bool_t armed;
+  /*在armed之前已经完成(回调函数中直接完成)*/
+  bool_t completed;
+  /*0表示正常回复*/
+  modbus_exeption_code_t code;
+  uint32_t size;
+  uint64_t start;
+  modbus_resp_data_t resp;
+  uint8_t data[MODBUS_MAX_PDU_SIZE];
+  /*回复完成(或modbus_service_quit)时释放，modbus_service_run在等待回复期间阻塞在上面*/
+  tk_semaphore_t* resumed;
+  /*其它线程释放最后一个引用时释放，modbus_service_remove_deferred等待时阻塞在上面*/
+  tk_semaphore_t* released;
+  /*正在调用回调函数的线程(由s_deferred_lock保护)，modbus_service_defer用它找到当前的service*/
+  bool_t dispatching;
+  uint64_t dispatch_thread;
+};
+
+/*
+ * token到service的映射中的一个位置。
+ * refs不为0时有其它线程正在使用该位置的service(不持有s_deferred_lock)，
+ * 销毁时要等它变为0(draining为等待的上下文)，在此之前该位置也不会被重用。
+ */
+typedef struct _modbus_service_deferred_slot_t {
+  modbus_service_t* service;
+  uint32_t refs;
+  modbus_service_deferred_t* draining;
+} modbus_service_deferred_slot_t;
+
+/*
+ * s_deferred_lock只保护下面的全局数据(token到service的映射)，每次只持有很短的时间，
+ * 调用回调函数和发送回复时都不持有，一个连接回复慢不会影响其它连接。
+ *
+ * 需要同时持有时，先s_deferred_lock后service的deferred->lock。
+ * 位置不够时加倍扩大(最多MODBUS_SERVICE_MAX_DEFERRED个)，只能在持有s_deferred_lock时按下标访问。
+ * 静态内存配置使用固定大小的数组。
+ */
+static tk_mutex_nest_t* s_deferred_lock = NULL;
+static uint32_t s_deferred_next_seq = 0;
+#ifdef MODBUS_STATIC_MEMORY
+static modbus_service_deferred_slot_t s_deferred_slots_data[MODBUS_SERVICE_MAX_DEFERRED];
+static modbus_service_deferred_slot_t* s_deferred_slots = s_deferred_slots_data;
+static uint32_t s_deferred_capacity = MODBUS_SERVICE_MAX_DEFERRED;
+#else
+static modbus_service_deferred_slot_t* s_deferred_slots = NULL;
+static uint32_t s_deferred_capacity = 0;
+#endif /*MODBUS_STATIC_MEMORY*/
+
+/*全部连接中处理中的请求数(可能和deferred->lock嵌套使用，顺序为先deferred->lock后s_in_flight_lock)*/
+static tk_mutex_nest_t* s_in_flight_lock = NULL;
+static uint32_t s_in_flight = 0;
+
+#define MODBUS_SERVICE_RATE_TOKEN 1000000
+
+/*令牌桶，令牌按微秒补充，一个请求消耗MODBUS_SERVICE_RATE_TOKEN*/
+static bool_t modbus_service_take_rate_token(modbus_service_t* service, uint64_t now) {
+  uint64_t capacity = (uint64_t)(service->rate_burst) * MODBUS_SERVICE_RATE_TOKEN;
+
+  if (service->rate_limit == 0) {
+    return TRUE;
+  }
+
+  if (service->rate_refill_time > 0 && now > service->rate_refill_time) {
+    uint64_t elapsed = now - service->rate_refill_time;
+
+    if (elapsed >= capacity / service->rate_limit) {
+      service->rate_tokens = capacity;
+    } else {
+      service->rate_tokens = tk_min(capacity, service->rate_tokens + elapsed * service->rate_limit);
+    }
+  }
+  service->rate_refill_time = now;
+
+  if (service->rate_tokens >= MODBUS_SERVICE_RATE_TOKEN) {
+    service->rate_tokens -= MODBUS_SERVICE_RATE_TOKEN;
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+static bool_t modbus_service_acquire_in_flight(modbus_service_t* service) {
+  bool_t ok = TRUE;
+
+  if (service->max_in_flight == 0 || s_in_flight_lock == NULL) {
+    return TRUE;
+  }
+
+  tk_mutex_nest_lock(s_in_flight_lock);
+  if (!service->in_flight) {
+    if (s_in_flight < service->max_in_flight) {
+      s_in_flight++;
+      service->in_flight = TRUE;
+    } else {
+      ok = FALSE;
+    }
+  }
+  tk_mutex_nest_unlock(s_in_flight_lock);
+
+  return ok;
+}
+
+static ret_t modbus_service_release_in_flight(modbus_service_t* service) {
+  if (s_in_flight_lock == NULL) {
+    return RET_OK;
+  }
+
+  tk_mutex_nest_lock(s_in_flight_lock);
+  if (service->in_flight) {
+    service->in_flight = FALSE;
+    if (s_in_flight > 0) {
+      s_in_flight--;
+    }
+  }
+  tk_mutex_nest_unlock(s_in_flight_lock);
+
+  return RET_OK;
+}
+
+/*过载保护：先检查连接的速率，再检查全局处理中的请求数*/
+static ret_t modbus_service_admit(modbus_service_t* service, uint64_t now) {
+  if (!modbus_service_take_rate_token(service, now)) {
+    service->stats.num_shed_rate_limited++;
+    return RET_BUSY;
+  }
+
+  if (!modbus_service_acquire_in_flight(service)) {
+    service->stats.num_shed_in_flight++;
+    return RET_BUSY;
+  }
+
+  return RET_OK;
+}
+
+ret_t modbus_service_set_rate_limit(modbus_service_t* service, uint32_t rate, uint32_t burst) {
+  return_value_if_fail(service != NULL, RET_BAD_PARAMS);
+
+  service->rate_limit = rate;
+  service->rate_burst = burst > 0 ? burst : rate;
+  service->rate_tokens = (uint64_t)(service->rate_burst) * MODBUS_SERVICE_RATE_TOKEN;
+  service->rate_refill_time = 0;
+
+  return RET_OK;
+}
+
+ret_t modbus_service_set_max_in_flight(modbus_service_t* service, uint32_t max_in_flight) {
+  return_value_if_fail(service != NULL, RET_BAD_PARAMS);
+
+  /*第一次启用时创建(在启动服务的线程中调用)*/
+  if (max_in_flight > 0 && s_in_flight_lock == NULL) {
+    s_in_flight_lock = tk_mutex_nest_create();
+    return_value_if_fail(s_in_flight_lock != NULL, RET_OOM);
+  }
+  service->max_in_flight = max_in_flight;
+
+  return RET_OK;
+}
+
+uint32_t modbus_service_get_in_flight_count(void) {
+  return s_in_flight;
+}
+
+ret_t modbus_service_enable_thread_safe(void) {
+  uint32_t i = 0;
+
+  if (s_connections_lock == NULL) {
+    s_connections_lock = tk_mutex_nest_create();
+    return_value_if_fail(s_connections_lock != NULL, RET_OOM);
+  }
+
+  for (i = 0; i < ARRAY_SIZE(s_totals); i++) {
+    if (s_totals[i].lock == NULL) {
+      s_totals[i].lock = tk_mutex_nest_create();
+      return_value_if_fail(s_totals[i].lock != NULL, RET_OOM);
+    }
+  }
+
+  if (s_in_flight_lock == NULL) {
+    s_in_flight_lock = tk_mutex_nest_create();
+    return_value_if_fail(s_in_flight_lock != NULL, RET_OOM);
+  }
+
+  if (s_deferred_lock == NULL) {
+    s_deferred_lock = tk_mutex_nest_create();
+    return_value_if_fail(s_deferred_lock != NULL, RET_OOM);
+  }
+
+  return RET_OK;
+}
+
+ret_t modbus_service_set_idle_timeout(uint32_t idle_timeout) {
+  s_idle_timeout = idle_timeout;
+
+  return RET_OK;
+}
+
+uint32_t modbus_service_get_idle_timeout(void) {
+  return s_idle_timeout;
+}
+
+ret_t modbus_service_set_max_connections(uint32_t max_connections) {
+  s_max_connections = max_connections;
+
+  return RET_OK;
+}
+
+uint32_t modbus_service_reap_idle(void) {
+  uint32_t n = 0;
+  uint64_t now = 0;
+
+  if (s_idle_timeout == 0) {
+    return 0;
+  }
+
+  now = time_now_ms();
+  modbus_service_connections_lock();
+  /*last_active最多落后MODBUS_SERVICE_IDLE_TOUCH_INTERVAL(见modbus_service_idle_touch)，宁可晚关也不提前关闭*/
+  while (s_idle_first != NULL &&
+         now >= s_idle_first->last_active + s_idle_timeout + MODBUS_SERVICE_IDLE_TOUCH_INTERVAL) {
+    modbus_service_idle_shutdown(s_idle_first);
+    n++;
+  }
+  s_num_reaped += n;
+  modbus_service_connections_unlock();
+
+  return n;
+}
+
+ret_t modbus_service_get_conn_stats(modbus_service_conn_stats_t* stats) {
+  return_value_if_fail(stats != NULL, RET_BAD_PARAMS);
+
+  modbus_service_connections_lock();
+  stats->active = s_connections_count;
+  stats->peak = s_connections_peak;
+  stats->reaped = s_num_reaped;
+  stats->evicted = s_num_evicted;
+  modbus_service_connections_unlock();
+
+  return RET_OK;
+}
+
+static ret_t modbus_service_send_exception_resp(modbus_service_t* service, uint8_t func_code,
+                                                modbus_exeption_code_t code) {
+  ret_t ret = modbus_common_send_exception_resp(MODBUS_COMMON(service), func_code, code);
+
+  if (ret == RET_OK) {
+    service->num_msg_reply++;
+    service->num_except_reply++;
+    service->stats.num_exceptions_by_code[code & (MODBUS_SERVICE_STATS_EXCEPTION_NR - 1)]++;
+  }
+
+  return ret;
+}
+
+/*服务端累计数据的耗时在modbus_service_merge_counters中和其它计数一起计入，不再单独加锁*/
+static ret_t modbus_service_record_dispatch_time(modbus_service_t* service, uint64_t start) {
+  uint64_t cost = time_now_us() - start;
+  uint32_t value = cost > 0xffffffff ? 0xffffffff : (uint32_t)cost;
+
+  service->pending_dispatch_time = value;
+  service->has_pending_dispatch_time = TRUE;
+
+  return modbus_histogram_record(&(service->stats.dispatch_time), value);
+}
+
+/*收到请求时调用(请求数要包括当前请求)，now_us为0时不计入请求速率*/
+static ret_t modbus_service_count_request(modbus_service_t* service, uint64_t now_us) {
+  uint64_t sec = now_us / 1000000;
+  modbus_service_totals_shard_t* shard = s_totals + service->totals_shard;
+  modbus_service_totals_t* totals = &(shard->totals);
+  uint32_t i = sec % ARRAY_SIZE(totals->rate_counts);
+
+  modbus_service_shard_lock(shard);
+  totals->num_msg_recv++;
+  if (now_us > 0) {
+    if (totals->rate_secs[i] != sec) {
+      totals->rate_secs[i] = sec;
+      totals->rate_counts[i] = 0;
+    }
+    totals->rate_counts[i]++;
+  }
+  modbus_service_shard_unlock(shard);
+
+  return RET_OK;
+}
+
+/*只统计已经结束的秒，当前这一秒还没有结束*/
+static uint32_t modbus_service_get_requests_per_sec(const modbus_service_totals_t* totals,
+                                                    uint64_t now_us) {
+  uint32_t i = 0;
+  uint32_t count = 0;
+  uint64_t sec = now_us / 1000000;
+
+  for (i = 0; i < ARRAY_SIZE(totals->rate_counts); i++) {
+    uint64_t iter = totals->rate_secs[i];
+    if (iter < sec && iter + MODBUS_SERVICE_RATE_WINDOW >= sec) {
+      count += totals->rate_counts[i];
+    }
+  }
+
+  return (count + MODBUS_SERVICE_RATE_WINDOW / 2) / MODBUS_SERVICE_RATE_WINDOW;
+}
+
+static void modbus_service_get_counters(modbus_service_t* service,
+                                        modbus_service_counters_t* counters) {
+  modbus_service_stats_t* stats = &(service->stats);
+
+  counters->num_except_reply = service->num_except_reply;
+  counters->num_server_msgs = service->num_read_requests + service->num_write_requests;
+  counters->num_crc_errors = stats->num_crc_errors;
+  counters->num_broadcasts = stats->num_broadcasts;
+  counters->num_nak = stats->num_exceptions_by_code[MODBUS_EXCEPTION_NEGATIVE_ACKNOWLEDGE];
+  counters->num_busy = stats->num_exceptions_by_code[MODBUS_EXCEPTION_SERVER_DEVICE_BUSY];
+  counters->bytes_in = service->common.bytes_in;
+  counters->bytes_out = service->common.bytes_out;
+}
+
+/*连接的计数可能被modbus_service_reset_stats清零，此时整个当前值都是新增的*/
+#define MODBUS_SERVICE_DELTA(name) (after.name >= before->name ? after.name - before->name : after.name)
+
+/*把处理一个请求期间连接计数的增量(和处理耗时)合并到连接所在分片的累计数据*/
+static ret_t modbus_service_merge_counters(modbus_service_t* service,
+                                           const modbus_service_counters_t* before) {
+  modbus_service_counters_t after;
+  modbus_service_totals_shard_t* shard = s_totals + service->totals_shard;
+  modbus_service_counters_t* totals = &(shard->totals.counters);
+
+  modbus_service_get_counters(service, &after);
+  modbus_service_shard_lock(shard);
+  totals->num_except_reply += MODBUS_SERVICE_DELTA(num_except_reply);
+  totals->num_server_msgs += MODBUS_SERVICE_DELTA(num_server_msgs);
+  totals->num_crc_errors += MODBUS_SERVICE_DELTA(num_crc_errors);
+  totals->num_broadcasts += MODBUS_SERVICE_DELTA(num_broadcasts);
+  totals->num_nak += MODBUS_SERVICE_DELTA(num_nak);
+  totals->num_busy += MODBUS_SERVICE_DELTA(num_busy);
+  totals->bytes_in += MODBUS_SERVICE_DELTA(bytes_in);
+  totals->bytes_out += MODBUS_SERVICE_DELTA(bytes_out);
+  if (service->has_pending_dispatch_time) {
+    service->has_pending_dispatch_time = FALSE;
+    modbus_histogram_record(&(shard->totals.dispatch_time), service->pending_dispatch_time);
+  }
+  modbus_service_shard_unlock(shard);
+
+  return RET_OK;
+}
+
+/*合并全部分片的累计数据(读取诊断数据时调用)*/
+static ret_t modbus_service_collect_totals(modbus_service_totals_t* all) {
+  uint32_t i = 0;
+  uint32_t k = 0;
+
+  memset(all, 0x00, sizeof(*all));
+  for (i = 0; i < ARRAY_SIZE(s_totals); i++) {
+    modbus_service_totals_shard_t* shard = s_totals + i;
+    const modbus_service_totals_t* iter = &(shard->totals);
+
+    modbus_service_shard_lock(shard);
+    all->counters.num_except_reply += iter->counters.num_except_reply;
+    all->counters.num_server_msgs += iter->counters.num_server_msgs;
+    all->counters.num_crc_errors += iter->counters.num_crc_errors;
+    all->counters.num_broadcasts += iter->counters.num_broadcasts;
+    all->counters.num_nak += iter->counters.num_nak;
+    all->counters.num_busy += iter->counters.num_busy;
+    all->counters.bytes_in += iter->counters.bytes_in;
+    all->counters.bytes_out += iter->counters.bytes_out;
+    all->num_msg_recv += iter->num_msg_recv;
+    modbus_histogram_merge(&(all->dispatch_time), &(iter->dispatch_time));
+    /*同一个位置可能是不同的秒，保留最近的(旧的已经不在时间窗口内)*/
+    for (k = 0; k < ARRAY_SIZE(all->rate_counts); k++) {
+      if (iter->rate_secs[k] > all->rate_secs[k]) {
+        all->rate_secs[k] = iter->rate_secs[k];
+        all->rate_counts[k] = iter->rate_counts[k];
+      } else if (iter->rate_secs[k] == all->rate_secs[k]) {
+        all->rate_counts[k] += iter->rate_counts[k];
+      }
+    }
+    modbus_service_shard_unlock(shard);
+  }
+
+  return RET_OK;
+}
+
+#define MODBUS_SERVICE_DIAG_VALUES_NB (MODBUS_SERVICE_DIAG_REGISTERS_NB / 2)
+
+/*先合并出全部诊断寄存器的快照(百分位数也只计算一次)，一次读取的多个寄存器来自同一个快照*/
+static ret_t modbus_service_get_diag_values(uint32_t values[MODBUS_SERVICE_DIAG_VALUES_NB]) {
+  modbus_service_totals_t all;
+  modbus_service_counters_t* totals = &(all.counters);
+
+  modbus_service_collect_totals(&all);
+  values[0] = all.num_msg_recv;
+  values[1] = modbus_service_get_requests_per_sec(&all, time_now_us());
+  values[2] = modbus_histogram_get_percentile(&(all.dispatch_time), 50);
+  values[3] = modbus_histogram_get_percentile(&(all.dispatch_time), 99);
+  values[4] = all.dispatch_time.max;
+  values[5] = totals->num_except_reply;
+  values[6] = totals->num_crc_errors;
+  values[7] = modbus_service_get_connections_count();
+  values[8] = (uint32_t)(totals->bytes_in);
+  values[9] = (uint32_t)(totals->bytes_out);
+
+  return RET_OK;
+}
+
+static bool_t modbus_service_is_diag_registers(modbus_service_t* service, uint16_t addr,
+                                               uint16_t count) {
+  uint32_t end = (uint32_t)addr + count;
+
+  if (!service->diag_enable) {
+    return FALSE;
+  }
+
+  return addr < service->diag_addr + MODBUS_SERVICE_DIAG_REGISTERS_NB && end > service->diag_addr;
+}
+
+static ret_t modbus_service_read_diag_registers(modbus_service_t* service, uint16_t addr,
+                                                uint16_t count, uint16_t* buff) {
+  uint16_t i = 0;
+  uint16_t offset = 0;
+  uint32_t values[MODBUS_SERVICE_DIAG_VALUES_NB];
+
+  /*不允许只读取一部分诊断寄存器，以免和memory中的只读寄存器混在一起*/
+  if (addr < service->diag_addr ||
+      (uint32_t)addr + count > (uint32_t)(service->diag_addr) + MODBUS_SERVICE_DIAG_REGISTERS_NB) {
+    return RET_INVALID_ADDR;
+  }
+
+  offset = addr - service->diag_addr;
+  modbus_service_get_diag_values(values);
+  for (i = 0; i < count; i++) {
+    uint16_t index = offset + i;
+    uint32_t value = values[index / 2];
+    uint16_t reg = (index % 2) == 0 ? (uint16_t)(value >> 16) : (uint16_t)(value & 0xffff);
+
+    buff[i] = int16_to_big_endian(reg);
+  }
+
+  return RET_OK;
+}
+
+static ret_t modbus_service_diagnostics(modbus_service_t* service, modbus_req_data_t* req,
+                                        modbus_resp_data_t* resp) {
+  uint32_t i = 0;
+  ret_t ret = RET_OK;
+  modbus_service_totals_t all;
+  uint32_t value = (req->data[0] << 8) | req->data[1];
+  modbus_service_counters_t* totals = &(all.counters);
+
+  if (req->addr != MODBUS_DIAG_RETURN_QUERY_DATA && req->addr != MODBUS_DIAG_CLEAR_COUNTERS) {
+    modbus_service_collect_totals(&all);
+  }
+
+  switch (req->addr) {
+    case MODBUS_DIAG_RETURN_QUERY_DATA: {
+      break;
+    }
+    case MODBUS_DIAG_CLEAR_COUNTERS: {
+      /*清除服务端的累计数据，连接自己的统计数据用modbus_service_reset_stats清除*/
+      for (i = 0; i < ARRAY_SIZE(s_totals); i++) {
+        modbus_service_shard_lock(s_totals + i);
+        memset(&(s_totals[i].totals), 0x00, sizeof(s_totals[i].totals));
+        modbus_service_shard_unlock(s_totals + i);
+      }
+      break;
+    }
+    case MODBUS_DIAG_BUS_MESSAGE_COUNT: {
+      value = all.num_msg_recv;
+      break;
+    }
+    case MODBUS_DIAG_BUS_COMM_ERROR_COUNT: {
+      value = totals->num_crc_errors;
+      break;
+    }
+    case MODBUS_DIAG_BUS_EXCEPTION_ERROR_COUNT: {
+      value = totals->num_except_reply;
+      break;
+    }
+    case MODBUS_DIAG_SERVER_MESSAGE_COUNT: {
+      value = totals->num_server_msgs;
+      break;
+    }
+    case MODBUS_DIAG_SERVER_NAK_COUNT: {
+      value = totals->num_nak;
+      break;
+    }
+    case MODBUS_DIAG_SERVER_BUSY_COUNT: {
+      value = totals->num_busy;
+      break;
+    }
+    case MODBUS_DIAG_SERVER_NO_RESPONSE_COUNT: {
+      value = totals->num_broadcasts;
+      break;
+    }
+    case MODBUS_DIAG_BUS_CHAR_OVERRUN_COUNT: {
+      value = 0;
+      break;
+    }
+    default: {
+      ret = RET_NOT_IMPL;
+      break;
+    }
+  }
+  if (ret != RET_OK) {
+    return ret;
+  }
+
+  /*计数器为16位，超出时保留低16位*/
+  resp->data[0] = (value >> 8) & 0xff;
+  resp->data[1] = value & 0xff;
+
+  return RET_OK;
+}
+
+static ret_t modbus_service_init(modbus_service_t* service, tk_iostream_t* io,
+                                 modbus_proto_t proto, modbus_memory_t* memory) {
+  service->memory = memory;
+  /*使用内嵌的固定缓冲区(不用tk_service_init的可扩展缓冲区)，创建和销毁连接时不分配缓冲区*/
+  service->service.io = io;
+  wbuffer_init(&(service->service.wb), service->wbuffer_data, sizeof(service->wbuffer_data));
+  modbus_common_init(MODBUS_COMMON(service), io, proto, &(service->service.wb));
+
+  if (MODBUS_PROTO_TCP == proto) {
+    modbus_service_set_slave(service, 0xff);
+  }
+  
+  service->service.dispatch = (tk_service_dispatch_t)modbus_service_dispatch;
+  service->service.destroy = (tk_service_destroy_t)modbus_service_destroy;
+  service->service.io = io;
+  service->quit_socks[0] = -1;
+  service->quit_socks[1] = -1;
+  modbus_service_inc_connections_count(TRUE);
+
+  /*新连接轮流使用累计数据的分片*/
+  modbus_service_connections_lock();
+  service->totals_shard = s_totals_next++ % MODBUS_SERVICE_TOTALS_SHARDS;
+  modbus_service_connections_unlock();
+
+  return RET_OK;
+}
+
+modbus_service_t* modbus_service_create_with_io(tk_iostream_t* io, modbus_proto_t proto,
+                                                modbus_memory_t* memory) {
+  modbus_service_t* service = NULL;
+
+  return_value_if_fail(io != NULL, NULL);
+
+  service = modbus_service_alloc();
+  return_value_if_fail(service != NULL, NULL);
+
+  modbus_service_init(service, io, proto, memory);
+
+  return service;
+}
+
+ret_t modbus_service_init_static(modbus_service_t* service, tk_iostream_t* io,
+                                 modbus_proto_t proto, modbus_memory_t* memory) {
+  return_value_if_fail(service != NULL && io != NULL, RET_BAD_PARAMS);
+
+  memset(service, 0x00, sizeof(*service));
+  service->is_static = TRUE;
+
+  return modbus_service_init(service, io, proto, memory);
+}
+
+#if MODBUS_WITH_FILE_RECORD
+static ret_t modbus_service_check_file_sub_req(const uint8_t* p, uint16_t* file_number,
+                                               uint16_t* record_number, uint16_t* length) {
+  if (p[0] != MODBUS_FILE_RECORD_REF_TYPE) {
+    return RET_INVALID_ADDR;
+  }
+
+  *file_number = (p[1] << 8) | p[2];
+  *record_number = (p[3] << 8) | p[4];
+  *length = (p[5] << 8) | p[6];
+  if (*record_number > MODBUS_MAX_FILE_RECORD_NUMBER) {
+    return RET_INVALID_ADDR;
+  }
+
+  return *length > 0 ? RET_OK : RET_EXCEED_RANGE;
+}
+
+static ret_t modbus_service_read_file_record(modbus_memory_t* memory, modbus_req_data_t* req,
+                                             modbus_resp_data_t* resp) {
+  uint32_t i = 0;
+  ret_t ret = RET_OK;
+  uint32_t offset = 0;
+  uint16_t regs[MODBUS_MAX_READ_FILE_RECORD_BYTES / 2];
+
+  if (req->bytes < 7 || req->bytes > MODBUS_MAX_READ_FILE_RECORD_BYTES || (req->bytes % 7) != 0) {
+    return RET_EXCEED_RANGE;
+  }
+
+  /*子响应：长度(1字节) + 参考类型(1字节) + 数据*/
+  for (i = 0; i < req->bytes; i += 7) {
+    uint16_t file_number = 0;
+    uint16_t record_number = 0;
+    uint16_t length = 0;
+
+    ret = modbus_service_check_file_sub_req(req->data + i, &file_number, &record_number, &length);
+    if (ret != RET_OK) {
+      return ret;
+    }
+
+    if (offset + 2 + length * 2 > MODBUS_MAX_READ_FILE_RECORD_BYTES) {
+      return RET_EXCEED_RANGE;
+    }
+
+    ret = modbus_memory_read_file_record(memory, file_number, record_number, length, regs);
+    if (ret != RET_OK) {
+      return ret;
+    }
+
+    resp->data[offset] = 1 + length * 2;
+    resp->data[offset + 1] = MODBUS_FILE_RECORD_REF_TYPE;
+    memcpy(resp->data + offset + 2, regs, length * 2);
+    offset += 2 + length * 2;
+  }
+
+  resp->bytes = offset;
+
+  return RET_OK;
+}
+
+static ret_t modbus_service_write_file_record(modbus_memory_t* memory, modbus_req_data_t* req,
+                                              modbus_resp_data_t* resp) {
+  uint32_t i = 0;
+  ret_t ret = RET_OK;
+  uint16_t file_number = 0;
+  uint16_t record_number = 0;
+  uint16_t length = 0;
+  uint16_t regs[MODBUS_MAX_WRITE_FILE_RECORD_BYTES / 2];
+
+  if (req->bytes < 9 || req->bytes > MODBUS_MAX_WRITE_FILE_RECORD_BYTES) {
+    return RET_EXCEED_RANGE;
+  }
+
+  /*先检查全部子请求，避免只写入一部分*/
+  for (i = 0; i < req->bytes; i += 7 + length * 2) {
+    if (i + 7 > req->bytes) {
+      return RET_EXCEED_RANGE;
+    }
+
+    ret = modbus_service_check_file_sub_req(req->data + i, &file_number, &record_number, &length);
+    if (ret != RET_OK) {
+      return ret;
+    }
+
+    if (i + 7 + length * 2 > req->bytes) {
+      return RET_EXCEED_RANGE;
+    }
+  }
+
+  for (i = 0; i < req->bytes; i += 7 + length * 2) {
+    modbus_service_check_file_sub_req(req->data + i, &file_number, &record_number, &length);
+    memcpy(regs, req->data + i + 7, length * 2);
+
+    ret = modbus_memory_write_file_record(memory, file_number, record_number, length, regs);
+    if (ret != RET_OK) {
+      return ret;
+    }
+  }
+
+  /*正常响应是请求的回显*/
+  resp->data = req->data;
+  resp->bytes = req->bytes;
+
+  return RET_OK;
+}
+#endif /*MODBUS_WITH_FILE_RECORD*/
+
+static bool_t modbus_service_is_deferrable(uint8_t func_code) {
+  switch (func_code) {
+    case MODBUS_FC_READ_COILS:
+    case MODBUS_FC_READ_DISCRETE_INPUTS:
+    case MODBUS_FC_READ_HOLDING_REGISTERS:
+    case MODBUS_FC_READ_INPUT_REGISTERS:
+    case MODBUS_FC_WRITE_SINGLE_COIL:
+    case MODBUS_FC_WRITE_SINGLE_HOLDING_REGISTER:
+    case MODBUS_FC_WRITE_MULTIPLE_COILS:
+    case MODBUS_FC_WRITE_MULTIPLE_HOLDING_REGISTERS:
+    case MODBUS_FC_MASK_WRITE_REGISTER:
+    case MODBUS_FC_WRITE_AND_READ_REGISTERS: {
+      return TRUE;
+    }
+    default: {
+      return FALSE;
+    }
+  }
+}
+
+/*读请求回复的数据由modbus_service_complete_deferred提供，写请求回复请求中的数据*/
+static bool_t modbus_service_is_deferred_read(uint8_t func_code) {
+  return func_code == MODBUS_FC_READ_COILS || func_code == MODBUS_FC_READ_DISCRETE_INPUTS ||
+         func_code == MODBUS_FC_READ_HOLDING_REGISTERS ||
+         func_code == MODBUS_FC_READ_INPUT_REGISTERS ||
+         func_code == MODBUS_FC_WRITE_AND_READ_REGISTERS;
+}
+
+/*调用前需要持有deferred->lock，释放锁之后再调用modbus_service_notify_resumed*/
+static ret_t modbus_service_send_deferred(modbus_service_t* service) {
+  ret_t ret = RET_OK;
+  modbus_service_counters_t before;
+  modbus_service_deferred_t* deferred = service->deferred;
+  modbus_resp_data_t* resp = &(deferred->resp);
+
+  modbus_service_get_counters(service, &before);
+  if (deferred->code == 0 && modbus_service_is_deferred_read(resp->func_code) &&
+      deferred->size < resp->bytes) {
+    log_debug("deferred data too short: %u < %u\n", deferred->size, resp->bytes);
+    deferred->code = MODBUS_EXCEPTION_SERVER_DEVICE_FAILURE;
+  }
+
+  if (deferred->code != 0) {
+    ret = modbus_service_send_exception_resp(service, resp->func_code, deferred->code);
+  } else {
+    ret = modbus_common_send_resp(MODBUS_COMMON(service), resp);
+    if (ret == RET_OK) {
+      service->num_msg_reply++;
+    }
+  }
+  modbus_service_record_dispatch_time(service, deferred->start);
+  modbus_service_release_in_flight(service);
+  modbus_service_merge_counters(service, &before);
+
+  deferred->token = 0;
+  deferred->armed = FALSE;
+  deferred->completed = FALSE;
+  tk_semaphore_post(deferred->resumed);
+
+  return ret;
+}
+
+static ret_t modbus_service_parking_wakeup(modbus_service_parking_t* parking);
+
+static ret_t modbus_service_notify_resumed(modbus_service_t* service) {
+  if (service->parking != NULL) {
+    modbus_service_parking_wakeup(service->parking);
+  }
+
+  if (service->on_resumed != NULL) {
+    service->on_resumed(service, service->on_resumed_ctx);
+  }
+
+  return RET_OK;
+}
+
+/*引用slot位置的service，使用完后调用modbus_service_unref_deferred*/
+static modbus_service_t* modbus_service_ref_deferred(uint32_t slot) {
+  modbus_service_t* service = NULL;
+
+  tk_mutex_nest_lock(s_deferred_lock);
+  if (slot < s_deferred_capacity) {
+    service = s_deferred_slots[slot].service;
+    if (service != NULL) {
+      s_deferred_slots[slot].refs++;
+    }
+  }
+  tk_mutex_nest_unlock(s_deferred_lock);
+
+  return service;
+}
+
+static ret_t modbus_service_unref_deferred(uint32_t slot) {
+  modbus_service_deferred_slot_t* iter = NULL;
+
+  tk_mutex_nest_lock(s_deferred_lock);
+  iter = s_deferred_slots + slot;
+  iter->refs--;
+  /*在锁中释放，modbus_service_remove_deferred拿到锁之后才会销毁deferred*/
+  if (iter->refs == 0 && iter->draining != NULL) {
+    tk_semaphore_post(iter->draining->released);
+    iter->draining = NULL;
+  }
+  tk_mutex_nest_unlock(s_deferred_lock);
+
+  return RET_OK;
+}
+
+/*调用前需要持有s_deferred_lock。位置用完时加倍扩大，返回第一个新的位置*/
+static ret_t modbus_service_grow_deferred_slots(uint32_t* slot) {
+#ifdef MODBUS_STATIC_MEMORY
+  (void)slot;
+  return RET_EXCEED_RANGE;
+#else
+  uint32_t capacity = tk_min(tk_max(s_deferred_capacity * 2, 16), MODBUS_SERVICE_MAX_DEFERRED);
+  modbus_service_deferred_slot_t* slots = NULL;
+
+  if (capacity <= s_deferred_capacity) {
+    return RET_EXCEED_RANGE;
+  }
+
+  slots = TKMEM_REALLOCT(modbus_service_deferred_slot_t, s_deferred_slots, capacity);
+  return_value_if_fail(slots != NULL, RET_OOM);
+
+  memset(slots + s_deferred_capacity, 0x00,
+         (capacity - s_deferred_capacity) * sizeof(modbus_service_deferred_slot_t));
+  *slot = s_deferred_capacity;
+  s_deferred_slots = slots;
+  s_deferred_capacity = capacity;
+
+  return RET_OK;
+#endif /*MODBUS_STATIC_MEMORY*/
+}
+
+static ret_t modbus_service_set_dispatching(modbus_service_deferred_t* deferred,
+                                           bool_t dispatching) {
+  tk_mutex_nest_lock(s_deferred_lock);
+  deferred->dispatching = dispatching;
+  deferred->dispatch_thread = tk_thread_self();
+  tk_mutex_nest_unlock(s_deferred_lock);
+
+  return RET_OK;
+}
+
+static ret_t modbus_service_begin_deferred(modbus_service_t* service, uint8_t func_code) {
+  modbus_service_deferred_t* deferred = service->deferred;
+
+  tk_mutex_nest_lock(deferred->lock);
+  deferred->token = 0;
+  deferred->armed = FALSE;
+  deferred->completed = FALSE;
+  deferred->code = (modbus_exeption_code_t)0;
+  deferred->size = 0;
+  deferred->resp.func_code = func_code;
+  tk_mutex_nest_unlock(deferred->lock);
+
+  return modbus_service_set_dispatching(deferred, TRUE);
+}
+
+/*返回TRUE表示已经延迟回复(或者已经回复)，不需要再回复*/
+static bool_t modbus_service_end_deferred(modbus_service_t* service, modbus_resp_data_t* resp,
+                                          ret_t ret, uint64_t start) {
+  bool_t sent = FALSE;
+  bool_t deferred_resp = FALSE;
+  modbus_service_deferred_t* deferred = service->deferred;
+
+  modbus_service_set_dispatching(deferred, FALSE);
+
+  tk_mutex_nest_lock(deferred->lock);
+  if (deferred->token != 0) {
+    if (ret != RET_OK) {
+      /*回调函数失败，取消延迟，按普通请求回复异常*/
+      deferred->token = 0;
+    } else {
+      bool_t has_data = deferred->completed && modbus_service_is_deferred_read(resp->func_code);
+
+      if (!has_data) {
+        memcpy(deferred->data, resp->data, sizeof(deferred->data));
+      }
+      deferred->resp = *resp;
+      deferred->resp.data = deferred->data;
+      deferred->start = start;
+      deferred->armed = TRUE;
+      service->stats.num_deferred++;
+      deferred_resp = TRUE;
+
+      /*其它线程在回调函数返回前已经完成*/
+      if (deferred->completed) {
+        modbus_service_send_deferred(service);
+        sent = TRUE;
+      }
+    }
+  }
+  tk_mutex_nest_unlock(deferred->lock);
+
+  if (sent) {
+    modbus_service_notify_resumed(service);
+  }
+
+  return deferred_resp;
+}
+
+static ret_t modbus_service_finish_deferred(uint32_t token, modbus_exeption_code_t code,
+                                            const void* data, uint32_t size) {
+  bool_t sent = FALSE;
+  ret_t ret = RET_NOT_FOUND;
+  modbus_service_t* service = NULL;
+  uint32_t slot = (token - 1) % MODBUS_SERVICE_MAX_DEFERRED;
+  return_value_if_fail(token != 0 && s_deferred_lock != NULL, RET_BAD_PARAMS);
+
+  service = modbus_service_ref_deferred(slot);
+  if (service == NULL) {
+    return RET_NOT_FOUND;
+  }
+
+  tk_mutex_nest_lock(service->deferred->lock);
+  if (service->deferred->token == token) {
+    modbus_service_deferred_t* deferred = service->deferred;
+
+    deferred->code = code;
+    if (code == 0 && data != NULL) {
+      deferred->size = tk_min(size, sizeof(deferred->data));
+      memcpy(deferred->data, data, deferred->size);
+    }
+
+    if (deferred->armed) {
+      ret = modbus_service_send_deferred(service);
+      sent = TRUE;
+    } else {
+      deferred->completed = TRUE;
+      ret = RET_OK;
+    }
+  }
+  tk_mutex_nest_unlock(service->deferred->lock);
+
+  if (sent) {
+    modbus_service_notify_resumed(service);
+  }
+  modbus_service_unref_deferred(slot);
+
+  return ret;
+}
+
+uint32_t modbus_service_defer(void) {
+  uint32_t i = 0;
+  uint32_t token = 0;
+  uint64_t self = tk_thread_self();
+  modbus_service_t* service = NULL;
+
+  if (s_deferred_lock == NULL) {
+    return 0;
+  }
+
+  /*token = 序号 * MODBUS_SERVICE_MAX_DEFERRED + 位置 + 1，完成时不用查找就能找到service*/
+  tk_mutex_nest_lock(s_deferred_lock);
+  for (i = 0; i < s_deferred_capacity; i++) {
+    modbus_service_t* iter = s_deferred_slots[i].service;
+    if (iter != NULL && iter->deferred->dispatching && iter->deferred->dispatch_thread == self) {
+      service = iter;
+      s_deferred_next_seq = (s_deferred_next_seq + 1) % (0xffffffff / MODBUS_SERVICE_MAX_DEFERRED);
+      token = s_deferred_next_seq * MODBUS_SERVICE_MAX_DEFERRED + i + 1;
+      break;
+    }
+  }
+  tk_mutex_nest_unlock(s_deferred_lock);
+
+  /*当前线程正在调用该service的回调函数，不用担心它被销毁*/
+  if (service != NULL) {
+    tk_mutex_nest_lock(service->deferred->lock);
+    if (service->deferred->token == 0) {
+      service->deferred->token = token;
+    } else {
+      token = 0;
+    }
+    tk_mutex_nest_unlock(service->deferred->lock);
+  }
+
+  return token;
+}
+
+ret_t modbus_service_complete_deferred(uint32_t token, const void* data, uint32_t size) {
+  return modbus_service_finish_deferred(token, (modbus_exeption_code_t)0, data, size);
+}
+
+ret_t modbus_service_fail_deferred(uint32_t token, modbus_exeption_code_t code) {
+  return_value_if_fail(code != 0, RET_BAD_PARAMS);
+
+  return modbus_service_finish_deferred(token, code, NULL, 0);
+}
+
+static ret_t modbus_service_check_deferred_timeout_impl(modbus_service_t* service, uint64_t now) {
+  bool_t sent = FALSE;
+  modbus_service_deferred_t* deferred = service->deferred;
+
+  if (deferred == NULL) {
+    return RET_OK;
+  }
+
+  tk_mutex_nest_lock(deferred->lock);
+  if (deferred->armed && now - deferred->start >= (uint64_t)(deferred->timeout) * 1000) {
+    log_debug("deferred response timeout: token=%u\n", deferred->token);
+    deferred->code = deferred->timeout_code;
+    service->stats.num_deferred_timeouts++;
+    modbus_service_send_deferred(service);
+    sent = TRUE;
+  }
+  tk_mutex_nest_unlock(deferred->lock);
+
+  if (sent) {
+    modbus_service_notify_resumed(service);
+  }
+
+  return RET_OK;
+}
+
+ret_t modbus_service_check_deferred_timeout(modbus_service_t* service) {
+  uint32_t i = 0;
+  uint64_t now = time_now_us();
+
+  if (s_deferred_lock == NULL) {
+    return RET_OK;
+  }
+
+  if (service != NULL) {
+    return modbus_service_check_deferred_timeout_impl(service, now);
+  }
+
+  /*扩大时只增加位置，超出的下标由modbus_service_ref_deferred检查*/
+  for (i = 0; i < s_deferred_capacity; i++) {
+    modbus_service_t* iter = modbus_service_ref_deferred(i);
+    if (iter != NULL) {
+      modbus_service_check_deferred_timeout_impl(iter, now);
+      modbus_service_unref_deferred(i);
+    }
+  }
+
+  return RET_OK;
+}
+
+static bool_t modbus_service_is_deferred_pending(modbus_service_t* service) {
+  bool_t pending = FALSE;
+  modbus_service_deferred_t* deferred = service->deferred;
+
+  if (deferred != NULL) {
+    tk_mutex_nest_lock(deferred->lock);
+    pending = deferred->armed;
+    tk_mutex_nest_unlock(deferred->lock);
+  }
+
+  return pending;
+}
+
+/*等待中的延迟回复距离超时的时间(毫秒)，0表示没有等待中的请求*/
+static uint32_t modbus_service_get_deferred_remain_time(modbus_service_t* service) {
+  uint64_t elapsed = 0;
+  uint32_t remain = 0;
+  modbus_service_deferred_t* deferred = service->deferred;
+
+  if (deferred != NULL) {
+    tk_mutex_nest_lock(deferred->lock);
+    if (deferred->armed) {
+      elapsed = (time_now_us() - deferred->start) / 1000;
+      remain = elapsed < deferred->timeout ? (uint32_t)(deferred->timeout - elapsed) : 1;
+    }
+    tk_mutex_nest_unlock(deferred->lock);
+  }
+
+  return remain;
+}
+
+static ret_t modbus_service_deferred_destroy(modbus_service_deferred_t* deferred) {
+  if (deferred->resumed != NULL) {
+    tk_semaphore_destroy(deferred->resumed);
+  }
+  if (deferred->released != NULL) {
+    tk_semaphore_destroy(deferred->released);
+  }
+  if (deferred->lock != NULL) {
+    tk_mutex_nest_destroy(deferred->lock);
+  }
+  TKMEM_FREE(deferred);
+
+  return RET_OK;
+}
+
+static modbus_service_deferred_t* modbus_service_deferred_create(void) {
+  modbus_service_deferred_t* deferred = TKMEM_ZALLOC(modbus_service_deferred_t);
+  return_value_if_fail(deferred != NULL, NULL);
+
+  deferred->lock = tk_mutex_nest_create();
+  deferred->resumed = tk_semaphore_create(0, NULL);
+  deferred->released = tk_semaphore_create(0, NULL);
+  if (deferred->lock == NULL || deferred->resumed == NULL || deferred->released == NULL) {
+    modbus_service_deferred_destroy(deferred);
+    return NULL;
+  }
+
+  return deferred;
+}
+
+/*清除上一个连接的状态，留给同一个service对象的下一个连接使用*/
+static ret_t modbus_service_deferred_reset(modbus_service_deferred_t* deferred) {
+  while (tk_semaphore_wait(deferred->resumed, 0) == RET_OK) {
+  }
+  while (tk_semaphore_wait(deferred->released, 0) == RET_OK) {
+  }
+
+  deferred->token = 0;
+  deferred->armed = FALSE;
+  deferred->completed = FALSE;
+  deferred->code = 0;
+  deferred->size = 0;
+  deferred->dispatching = FALSE;
+  deferred->dispatch_thread = 0;
+
+  return RET_OK;
+}
+
+static ret_t modbus_service_release_cached(modbus_service_t* service) {
+  TKMEM_FREE(service->cached_rbuffer);
+  service->cached_rbuffer_size = 0;
+  if (service->cached_deferred != NULL) {
+    modbus_service_deferred_destroy(service->cached_deferred);
+    service->cached_deferred = NULL;
+  }
+
+  return RET_OK;
+}
+
+static ret_t modbus_service_remove_deferred(modbus_service_t* service) {
+  bool_t busy = FALSE;
+  modbus_service_deferred_t* deferred = service->deferred;
+
+  if (deferred == NULL) {
+    return RET_OK;
+  }
+
+  tk_mutex_nest_lock(s_deferred_lock);
+  s_deferred_slots[deferred->slot].service = NULL;
+  busy = s_deferred_slots[deferred->slot].refs > 0;
+  if (busy) {
+    s_deferred_slots[deferred->slot].draining = deferred;
+  }
+  tk_mutex_nest_unlock(s_deferred_lock);
+
+  /*其它线程正在完成回复(最多是一次发送的时间)，释放最后一个引用时唤醒*/
+  while (busy) {
+    tk_semaphore_wait(deferred->released, 100);
+    tk_mutex_nest_lock(s_deferred_lock);
+    busy = s_deferred_slots[deferred->slot].refs > 0;
+    tk_mutex_nest_unlock(s_deferred_lock);
+  }
+
+  /*modbus_service_quit持有s_deferred_lock访问service->deferred*/
+  tk_mutex_nest_lock(s_deferred_lock);
+  service->deferred = NULL;
+  tk_mutex_nest_unlock(s_deferred_lock);
+
+  /*已经没有其它线程使用，缓存起来(对象放回池中时一起保留)*/
+  if (service->cached_deferred == NULL) {
+    modbus_service_deferred_reset(deferred);
+    service->cached_deferred = deferred;
+  } else {
+    modbus_service_deferred_destroy(deferred);
+  }
+
+  return RET_OK;
+}
+
+ret_t modbus_service_set_deferred_timeout(modbus_service_t* service, uint32_t timeout,
+                                          modbus_exeption_code_t timeout_code) {
+  uint32_t i = 0;
+  ret_t ret = RET_OK;
+  modbus_service_deferred_t* deferred = NULL;
+  return_value_if_fail(service != NULL, RET_BAD_PARAMS);
+
+  if (timeout == 0) {
+    return_value_if_fail(!modbus_service_is_deferred_pending(service), RET_FAIL);
+    return modbus_service_remove_deferred(service);
+  }
+
+  /*第一次启用时创建(在启动服务的线程中调用)*/
+  if (s_deferred_lock == NULL) {
+    s_deferred_lock = tk_mutex_nest_create();
+    return_value_if_fail(s_deferred_lock != NULL, RET_OOM);
+  }
+
+  deferred = service->deferred;
+  if (deferred == NULL) {
+    if (service->cached_deferred != NULL) {
+      deferred = service->cached_deferred;
+      service->cached_deferred = NULL;
+    } else {
+      deferred = modbus_service_deferred_create();
+      return_value_if_fail(deferred != NULL, RET_OOM);
+    }
+
+    tk_mutex_nest_lock(s_deferred_lock);
+    for (i = 0; i < s_deferred_capacity; i++) {
+      if (s_deferred_slots[i].service == NULL && s_deferred_slots[i].refs == 0) {
+        break;
+      }
+    }
+    ret = i < s_deferred_capacity ? RET_OK : modbus_service_grow_deferred_slots(&i);
+    if (ret == RET_OK) {
+      deferred->slot = i;
+      service->deferred = deferred;
+      s_deferred_slots[i].service = service;
+    }
+    tk_mutex_nest_unlock(s_deferred_lock);
+
+    if (ret != RET_OK) {
+      service->cached_deferred = deferred;
+      return ret;
+    }
+  }
+
+  tk_mutex_nest_lock(deferred->lock);
+  deferred->timeout = timeout;
+  deferred->timeout_code = timeout_code != 0 ? timeout_code : MODBUS_EXCEPTION_SERVER_DEVICE_BUSY;
+  tk_mutex_nest_unlock(deferred->lock);
+
+  return RET_OK;
+}
+
+/*执行请求，回复的数据放在resp_data中(buff为resp_data->data的缺省缓冲区)*/
+static ret_t modbus_service_handle_req(modbus_service_t* service, modbus_memory_t* memory,
+                                       modbus_req_data_t* req_data, modbus_resp_data_t* resp_data,
+                                       uint16_t* buff) {
+  ret_t ret = RET_OK;
+
+  switch (req_data->func_code) {
+    case MODBUS_FC_READ_COILS: {
+      if (req_data->count > MODBUS_MAX_READ_BITS) {
+        ret = RET_INVALID_ADDR;
+        break;
+      }
+      resp_data->bytes = (req_data->count + 7) / 8;
+      memset(buff, 0x00, resp_data->bytes);
+      ret = modbus_memory_read_bits(memory, req_data->addr, req_data->count, (uint8_t*)buff);
+      service->num_read_requests++;
+      break;
+    }
+    case MODBUS_FC_READ_DISCRETE_INPUTS: {
+      if (req_data->count > MODBUS_MAX_READ_BITS) {
+        ret = RET_INVALID_ADDR;
+        break;
+      }
+      resp_data->bytes = (req_data->count + 7) / 8;
+      memset(buff, 0x00, resp_data->bytes);
+      ret = modbus_memory_read_input_bits(memory, req_data->addr, req_data->count, (uint8_t*)buff);
+      service->num_read_requests++;
+      break;
+    }
+    case MODBUS_FC_READ_HOLDING_REGISTERS: {
+      if (req_data->count > MODBUS_MAX_READ_REGISTERS) {
+        ret = RET_INVALID_ADDR;
+        break;
+      }
+      resp_data->bytes = req_data->count * 2;
+      memset(buff, 0x00, resp_data->bytes);
+      ret = modbus_memory_read_registers(memory, req_data->addr, req_data->count, buff);
+      service->num_read_requests++;
+      break;
+    }
+    case MODBUS_FC_READ_INPUT_REGISTERS: {
+      if (req_data->count > MODBUS_MAX_READ_REGISTERS) {
+        ret = RET_INVALID_ADDR;
+        break;
+      }
+      resp_data->bytes = req_data->count * 2;
+      memset(buff, 0x00, resp_data->bytes);
+      if (modbus_service_is_diag_registers(service, req_data->addr, req_data->count)) {
+        ret = modbus_service_read_diag_registers(service, req_data->addr, req_data->count, buff);
+      } else {
+        ret = modbus_memory_read_input_registers(memory, req_data->addr, req_data->count, buff);
+      }
+      service->num_read_requests++;
+      break;
+    }
+    case MODBUS_FC_WRITE_SINGLE_COIL: {
+      resp_data->data[0] = req_data->data[0];
+      ret = modbus_memory_write_bit(memory, req_data->addr, req_data->data[0]);
+      service->num_write_requests++;
+      break;
+    }
+    case MODBUS_FC_WRITE_SINGLE_HOLDING_REGISTER: {
+      memcpy(resp_data->data, req_data->data, sizeof(uint16_t));
+      ret = modbus_memory_write_register(memory, req_data->addr, *(uint16_t*)(req_data->data));
+      service->num_write_requests++;
+      break;
+    }
+    case MODBUS_FC_WRITE_MULTIPLE_COILS: {
+      if (req_data->count > MODBUS_MAX_WRITE_BITS) {
+        ret = RET_INVALID_ADDR;
+        break;
+      }
+      ret = modbus_memory_write_bits(memory, req_data->addr, req_data->count, req_data->data);
+      service->num_write_requests++;
+      break;
+    }
+    case MODBUS_FC_WRITE_MULTIPLE_HOLDING_REGISTERS: {
+      if (req_data->count > MODBUS_MAX_WRITE_REGISTERS) {
+        ret = RET_INVALID_ADDR;
+        break;
+      }
+      ret = modbus_memory_write_registers(memory, req_data->addr, req_data->count,
+                                          (uint16_t*)req_data->data);
+      service->num_write_requests++; 
+      break;
+    }
+#if MODBUS_WITH_FC23
+    case MODBUS_FC_WRITE_AND_READ_REGISTERS: {
+      if (req_data->count > MODBUS_MAX_WR_READ_REGISTERS || req_data->count_ex > MODBUS_MAX_WR_WRITE_REGISTERS) {
+        ret = RET_INVALID_ADDR;
+        break;
+      }
+      resp_data->bytes = req_data->count * 2;
+      memset(buff, 0x00, resp_data->bytes);
+      modbus_memory_write_registers(memory, req_data->addr_ex, req_data->count_ex, (uint16_t*)req_data->data_ex);
+      ret = modbus_memory_read_registers(memory, req_data->addr, req_data->count, buff);
+      service->num_read_requests++;
+      service->num_write_requests++;
+      break;
+    }
+#endif /*MODBUS_WITH_FC23*/
+    case MODBUS_FC_MASK_WRITE_REGISTER: {
+      uint16_t and_mask = (req_data->data[0] << 8) | req_data->data[1];
+      uint16_t or_mask = (req_data->data[2] << 8) | req_data->data[3];
+      memcpy(resp_data->data, req_data->data, 4);
+      ret = modbus_memory_mask_write_register(memory, req_data->addr, and_mask, or_mask);
+      service->num_write_requests++;
+      break;
+    }
+    case MODBUS_FC_READ_FIFO_QUEUE: {
+      uint16_t count = MODBUS_MAX_FIFO_COUNT;
+      memset(buff, 0x00, count * sizeof(uint16_t));
+      ret = modbus_memory_read_fifo_queue(memory, req_data->addr, &count, buff);
+      resp_data->count = count;
+      resp_data->bytes = count * 2;
+      service->num_read_requests++;
+      break;
+    }
+#if MODBUS_WITH_FILE_RECORD
+    case MODBUS_FC_READ_FILE_RECORD: {
+      ret = modbus_service_read_file_record(memory, req_data, resp_data);
+      service->num_read_requests++;
+      break;
+    }
+    case MODBUS_FC_WRITE_FILE_RECORD: {
+      ret = modbus_service_write_file_record(memory, req_data, resp_data);
+      service->num_write_requests++;
+      break;
+    }
+#endif /*MODBUS_WITH_FILE_RECORD*/
+    case MODBUS_FC_DIAGNOSTICS: {
+      ret = modbus_service_diagnostics(service, req_data, resp_data);
+      break;
+    }
+    default: {
+      ret = RET_NOT_IMPL;
+      break;
+    }
+  }
+
+  return ret;
+}
+
+static bool_t modbus_service_is_write_func_code(uint8_t func_code) {
+  switch (func_code) {
+    case MODBUS_FC_WRITE_SINGLE_COIL:
+    case MODBUS_FC_WRITE_SINGLE_HOLDING_REGISTER:
+    case MODBUS_FC_WRITE_MULTIPLE_COILS:
+    case MODBUS_FC_WRITE_MULTIPLE_HOLDING_REGISTERS:
+    case MODBUS_FC_MASK_WRITE_REGISTER:
+    case MODBUS_FC_WRITE_FILE_RECORD: {
+      return TRUE;
+    }
+    default: {
+      return FALSE;
+    }
+  }
+}
+
+/*广播请求(RTU从站地址为0)：只执行写请求，不回复。使用units时写入全部从站*/
+static ret_t modbus_service_broadcast(modbus_service_t* service, modbus_req_data_t* req_data,
+                                      uint16_t* buff) {
+  uint32_t i = 0;
+  uint32_t k = 0;
+  modbus_resp_data_t resp_data;
+
+  service->stats.num_broadcasts++;
+  if (!modbus_service_is_write_func_code(req_data->func_code)) {
+    log_debug("broadcast fc=%d ignored\n", req_data->func_code);
+    return RET_NOT_IMPL;
+  }
+
+  if (service->units == NULL) {
+    memset(&resp_data, 0x00, sizeof(resp_data));
+    resp_data.data = (uint8_t*)buff;
+    return modbus_service_handle_req(service, service->memory, req_data, &resp_data, buff);
+  }
+
+  for (i = 0; i < MODBUS_SERVICE_UNITS_NR; i++) {
+    modbus_memory_t* memory = service->units[i];
+    if (memory == NULL) {
+      continue;
+    }
+
+    /*多个从站地址可能共用一个memory，只写入一次*/
+    for (k = 0; k < i; k++) {
+      if (service->units[k] == memory) {
+        break;
+      }
+    }
+
+    if (k == i) {
+      memset(&resp_data, 0x00, sizeof(resp_data));
+      resp_data.data = (uint8_t*)buff;
+      modbus_service_handle_req(service, memory, req_data, &resp_data, buff);
+    }
+  }
+
+  return RET_OK;
+}
+
+static ret_t modbus_service_dispatch_impl(modbus_service_t* service) {
+  ret_t ret = RET_OK;
+  uint64_t start = 0;
+  modbus_req_data_t req_data;
+  modbus_resp_data_t resp_data;
+  uint16_t buff[MODBUS_MAX_PDU_SIZE];
+  modbus_exeption_code_t code = MODBUS_EXCEPTION_ILLEGAL_FUNCTION;
+
+  /*buff只在读取时按回复的长度清零(见modbus_service_handle_req)*/
+  memset(&req_data, 0x00, sizeof(req_data));
+  memset(&resp_data, 0x00, sizeof(resp_data));
+
+  modbus_service_idle_touch(service);
+  ret = modbus_common_recv_req(MODBUS_COMMON(service), &req_data);
+
+  // 从站地址不匹配，跳过当前帧（返回时已清空缓冲区）
+  if (ret == RET_SKIP) {
+    service->num_msg_recv++;
+    modbus_service_count_request(service, 0);
+    ENSURE(req_data.slave != service->common.slave);
+#ifdef WITH_MULT_SLAVES
+    log_debug("slave %d != %d, not send to me.\n", req_data.slave, service->common.slave);
+#else
+    log_debug("slave id not match: %d != %d\n", req_data.slave, service->common.slave);
+    modbus_service_send_exception_resp(service, req_data.func_code,
+                                       MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+#endif
+    return RET_OK;
+  }
+
+  if (ret == RET_EOS || ret == RET_IO) {
+    if (!service->common.is_shared_transport) {
+      return RET_REMOVE;
+    }
+    goto shared_transport_error;
+  }
+
+  if (ret == RET_OK) {
+    modbus_memory_t* memory = service->memory;
+    service->num_msg_recv++;
+#if MODBUS_WITH_STATS
+    service->stats.num_requests_by_fc[req_data.func_code & (MODBUS_SERVICE_STATS_FC_NR - 1)]++;
+#endif /*MODBUS_WITH_STATS*/
+    start = time_now_us();
+    modbus_service_count_request(service, start);
+
+    ret = modbus_service_admit(service, start);
+    if (ret != RET_OK) {
+      log_debug("service busy, shed request %d\n", req_data.func_code);
+      if (service->common.proto == MODBUS_PROTO_RTU && req_data.slave == MODBUS_BROADCAST_ADDRESS) {
+        return RET_OK;
+      }
+      goto exception_resp;
+    }
+
+    if (service->common.proto == MODBUS_PROTO_RTU && req_data.slave == MODBUS_BROADCAST_ADDRESS) {
+      modbus_service_broadcast(service, &req_data, buff);
+      modbus_service_record_dispatch_time(service, start);
+      modbus_service_release_in_flight(service);
+      return RET_OK;
+    }
+
+    if (service->units != NULL) {
+      memory = service->units[req_data.slave];
+      service->common.slave = req_data.slave;
+      if (memory == NULL) {
+        if (service->common.proto == MODBUS_PROTO_RTU) {
+          log_debug("unit %d not found, not send to me.\n", req_data.slave);
+          modbus_service_release_in_flight(service);
+          return RET_OK;
+        }
+        ret = RET_NOT_FOUND;
+        goto exception_resp;
+      }
+    }
+
+    resp_data.addr = req_data.addr;
+    resp_data.count = req_data.count;
+    resp_data.func_code = req_data.func_code;
+    resp_data.data = (uint8_t*)buff;
+
+    if (service->deferred != NULL && modbus_service_is_deferrable(req_data.func_code)) {
+      modbus_service_begin_deferred(service, req_data.func_code);
+      ret = modbus_service_handle_req(service, memory, &req_data, &resp_data, buff);
+      if (modbus_service_end_deferred(service, &resp_data, ret, start)) {
+        return RET_OK;
+      }
+    } else {
+      ret = modbus_service_handle_req(service, memory, &req_data, &resp_data, buff);
+    }
+
+    if (ret == RET_OK) {
+      ret = modbus_common_send_resp(MODBUS_COMMON(service), &resp_data);
+      if (ret == RET_OK) {
+        service->num_msg_reply++;
+      }
+      modbus_service_record_dispatch_time(service, start);
+      modbus_service_release_in_flight(service);
+      if (ret != RET_OK && service->common.is_shared_transport) {
+        goto shared_transport_error;
+      }
+      return ret;
+    }
+  }
+
+exception_resp:
+  if (ret == RET_INVALID_ADDR) {
+    code = MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+  } else if (ret == RET_CRC) {
+    service->stats.num_crc_errors++;
+    code = MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+  } else if (ret == RET_EXCEED_RANGE) {
+    code = MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+  } else if (ret == RET_NOT_IMPL) {
+    code = MODBUS_EXCEPTION_ILLEGAL_FUNCTION;
+  } else if (ret == RET_NOT_FOUND) {
+    code = MODBUS_EXCEPTION_GATEWAY_TARGET_DEVICE_FAILED_TO_RESPOND;
+  } else if (ret == RET_BUSY) {
+    code = MODBUS_EXCEPTION_SERVER_DEVICE_BUSY;
+  }
+
+  log_debug("%d failed\n", req_data.func_code);
+  ret = modbus_service_send_exception_resp(service, req_data.func_code, code);
+  if (start > 0) {
+    modbus_service_record_dispatch_time(service, start);
+  }
+  modbus_service_release_in_flight(service);
+  if (ret != RET_OK && service->common.is_shared_transport) {
+    goto shared_transport_error;
+  }
+  return ret;
+
+shared_transport_error:
+  log_debug("shared transport error, flush buffer and continue\n");
+  modbus_common_flush_read_buffer(MODBUS_COMMON(service));
+  return RET_OK;
+}
+
+ret_t modbus_service_dispatch(modbus_service_t* service) {
+  ret_t ret = RET_OK;
+  modbus_service_counters_t before;
+  return_value_if_fail(service != NULL, RET_BAD_PARAMS);
+
+  modbus_service_get_counters(service, &before);
+  ret = modbus_service_dispatch_impl(service);
+  modbus_service_merge_counters(service, &before);
+
+  return ret;
+}
+
+static bool_t modbus_service_is_io_ok(modbus_service_t* service) {
+  return tk_object_get_prop_bool(TK_OBJECT(service->common.io), TK_STREAM_PROP_IS_OK, FALSE);
+}
+
+static ret_t modbus_service_park(modbus_service_t* service);
+
+static ret_t service_on_request(event_source_t* source) {
+  ret_t ret = RET_OK;
+  event_source_fd_t* event_source_fd = (event_source_fd_t*)source;
+  modbus_service_t* service = (modbus_service_t*)(event_source_fd->ctx);
+
+  /*预读缓冲区中的请求不会再触发事件，要一起处理*/
+  do {
+    /*等待延迟回复期间不读取新的请求(保证回复的顺序)，从esm中移除，回复完成或者超时后再加入*/
+    if (modbus_service_is_deferred_pending(service)) {
+      if (service->parking != NULL) {
+        modbus_service_park(service);
+        return RET_REMOVE;
+      }
+      modbus_service_check_deferred_timeout(service);
+      return RET_OK;
+    }
+
+    ret = modbus_service_dispatch(service);
+    if (ret == RET_REMOVE || !modbus_service_is_io_ok(service)) {
+      return RET_REMOVE;
+    }
+  } while (modbus_common_get_buffered_size(MODBUS_COMMON(service)) > 0 ||
+           modbus_service_is_deferred_pending(service));
+
+  return RET_OK;
+}
+
+ret_t modbus_service_dispatch_available(modbus_service_t* service) {
+  ret_t ret = RET_CONTINUE;
+  modbus_common_t* common = MODBUS_COMMON(service);
+  return_value_if_fail(service != NULL, RET_BAD_PARAMS);
+
+  if (common->rbuffer == NULL) {
+    return_value_if_fail(modbus_service_set_read_ahead(service, MODBUS_SERVICE_WBUFFER_SIZE) == RET_OK,
+                         RET_OOM);
+  }
+
+  while (TRUE) {
+    if (modbus_service_is_deferred_pending(service)) {
+      modbus_service_check_deferred_timeout(service);
+      if (modbus_service_is_deferred_pending(service)) {
+        return RET_BUSY;
+      }
+    }
+
+    /*只处理完整的请求，不完整的留在缓冲区中等下次收到数据(不阻塞等待)*/
+    if (modbus_common_has_complete_req(common)) {
+      if (modbus_service_dispatch(service) == RET_REMOVE || !modbus_service_is_io_ok(service)) {
+        return RET_IO;
+      }
+      continue;
+    }
+
+    if (ret != RET_CONTINUE) {
+      /*对方关闭前发送的请求已经处理完*/
+      return ret == RET_OK ? RET_OK : RET_IO;
+    }
+
+    /*缓冲区满了还不是完整的请求(格式错误)*/
+    if (modbus_common_get_buffered_size(common) == common->rbuffer_size) {
+      return RET_IO;
+    }
+
+    ret = modbus_common_fill_read_buffer(common);
+  }
+
+  return RET_OK;
+}
+
+ret_t modbus_service_set_on_resumed(modbus_service_t* service,
+                                    modbus_service_on_resumed_t on_resumed, void* ctx) {
+  return_value_if_fail(service != NULL, RET_BAD_PARAMS);
+
+  service->on_resumed = on_resumed;
+  service->on_resumed_ctx = ctx;
+
+  return RET_OK;
+}
+
+/*
+ * 同一个esm中暂停读取(等待延迟回复)的连接，只在esm所在的线程中访问。
+ * 其它线程完成回复时通过唤醒socket通知esm所在的线程重新加入，超时由定时器检查。
+ * 没有socket时由定时器每隔MODBUS_SERVICE_PARKING_POLL_INTERVAL检查一次。
+ */
+struct _modbus_service_parking_t {
+  event_source_manager_t* esm;
+  timer_manager_t* timer_manager;
+  event_source_t* timer_source;
+  int wakeup_socks[2];
+  event_source_t* wakeup_source;
+  modbus_service_t* parked;
+  uint32_t refs;
+  modbus_service_parking_t* next;
+};
+
+#define MODBUS_SERVICE_PARKING_POLL_INTERVAL 10
+
+/*每个esm一个，由s_connections_lock保护*/
+static modbus_service_parking_t* s_parkings = NULL;
+
+static ret_t modbus_service_parking_wakeup(modbus_service_parking_t* parking) {
+#ifdef WITH_SOCKET
+  if (parking->wakeup_socks[1] >= 0) {
+    char c = 0;
+    /*非阻塞，缓冲区满时已经有未处理的通知，不需要再写*/
+    send(parking->wakeup_socks[1], &c, 1, 0);
+  }
+#endif /*WITH_SOCKET*/
+
+  return RET_OK;
+}
+
+#ifdef WITH_SOCKET
+static ret_t modbus_service_socketpair(int socks[2]) {
+#ifdef WIN32
+  int len = 0;
+  struct sockaddr_in addr;
+  int listen_sock = tk_tcp_listen(0);
+  return_value_if_fail(listen_sock >= 0, RET_FAIL);
+
+  len = sizeof(addr);
+  socks[0] = -1;
+  socks[1] = -1;
+  if (getsockname(listen_sock, (struct sockaddr*)&addr, &len) == 0) {
+    socks[1] = tk_tcp_connect("127.0.0.1", ntohs(addr.sin_port));
+    if (socks[1] >= 0) {
+      socks[0] = tk_tcp_accept(listen_sock);
+    }
+  }
+  tk_socket_close(listen_sock);
+
+  if (socks[0] < 0) {
+    if (socks[1] >= 0) {
+      tk_socket_close(socks[1]);
+    }
+    return RET_FAIL;
+  }
+
+  return RET_OK;
+#else
+  return socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == 0 ? RET_OK : RET_FAIL;
+#endif /*WIN32*/
+}
+#endif /*WITH_SOCKET*/
+
+static ret_t modbus_service_on_source_destroy(void* ctx, event_t* e) {
+  modbus_service_t* service = (modbus_service_t*)ctx;
+
+  /*暂停读取或者销毁service时移除的事件源，service->source已经被清除*/
+  if (service->source == EVENT_SOURCE(e->target)) {
+    service->source = NULL;
+    if (service->destroy_on_disconnect) {
+      tk_iostream_t* io = service->common.io;
+      tk_service_destroy(&(service->service));
+      TK_OBJECT_UNREF(io);
+    }
+  }
+
+  return RET_OK;
+}
+
+static ret_t modbus_service_add_source(modbus_service_t* service) {
+  int fd = tk_object_get_prop_int(TK_OBJECT(service->common.io), TK_STREAM_PROP_FD, -1);
+  event_source_t* source = event_source_fd_create(fd, service_on_request, service);
+  return_value_if_fail(source != NULL, RET_OOM);
+
+  service->source = source;
+  emitter_on(EMITTER(source), EVT_DESTROY, modbus_service_on_source_destroy, service);
+  event_source_manager_add(service->parking->esm, source);
+  TK_OBJECT_UNREF(source);
+
+  return RET_OK;
+}
+
+static ret_t modbus_service_on_parked_timer(const timer_info_t* info);
+
+static ret_t modbus_service_add_parked_timer(modbus_service_t* service) {
+  modbus_service_parking_t* parking = service->parking;
+  uint32_t duration = modbus_service_get_deferred_remain_time(service);
+
+  /*没有唤醒socket(或者esm正在销毁)时定期检查*/
+  if (parking->wakeup_source == NULL) {
+    duration = tk_min(duration, MODBUS_SERVICE_PARKING_POLL_INTERVAL);
+  }
+
+  service->parked_timer_id = timer_manager_add(parking->timer_manager,
+                                               modbus_service_on_parked_timer, service,
+                                               tk_max(duration, 1));
+
+  return RET_OK;
+}
+
+static ret_t modbus_service_unlink_parked(modbus_service_t* service) {
+  modbus_service_t** iter = &(service->parking->parked);
+
+  while (*iter != NULL) {
+    if (*iter == service) {
+      *iter = service->parked_next;
+      break;
+    }
+    iter = &((*iter)->parked_next);
+  }
+
+  service->parked = FALSE;
+  service->parked_next = NULL;
+  if (service->parked_timer_id != TK_INVALID_ID) {
+    timer_manager_remove(service->parking->timer_manager, service->parked_timer_id);
+    service->parked_timer_id = TK_INVALID_ID;
+  }
+
+  return RET_OK;
+}
+
+/*在esm所在的线程中调用，调用后返回RET_REMOVE把事件源从esm中移除*/
+static ret_t modbus_service_park(modbus_service_t* service) {
+  modbus_service_parking_t* parking = service->parking;
+
+  service->source = NULL;
+  service->parked = TRUE;
+  service->parked_next = parking->parked;
+  parking->parked = service;
+
+  return modbus_service_add_parked_timer(service);
+}
+
+static ret_t modbus_service_unpark(modbus_service_t* service) {
+  event_source_t* source = NULL;
+
+  modbus_service_unlink_parked(service);
+  return_value_if_fail(modbus_service_add_source(service) == RET_OK, RET_OOM);
+
+  /*暂停期间已经读到预读缓冲区中的请求不会再触发事件*/
+  source = service->source;
+  if (modbus_common_get_buffered_size(MODBUS_COMMON(service)) > 0) {
+    if (service_on_request(source) == RET_REMOVE) {
+      event_source_manager_remove(source->manager, source);
+    }
+  }
+
+  return RET_OK;
+}
+
+static ret_t modbus_service_on_parked_timer(const timer_info_t* info) {
+  modbus_service_t* service = (modbus_service_t*)(info->ctx);
+
+  /*返回RET_REMOVE后定时器自动移除*/
+  service->parked_timer_id = TK_INVALID_ID;
+  modbus_service_check_deferred_timeout(service);
+  if (modbus_service_is_deferred_pending(service)) {
+    modbus_service_add_parked_timer(service);
+  } else {
+    modbus_service_unpark(service);
+  }
+
+  return RET_REMOVE;
+}
+
+#ifdef WITH_SOCKET
+static ret_t modbus_service_parking_on_wakeup(event_source_t* source) {
+  event_source_fd_t* event_source_fd = (event_source_fd_t*)source;
+  modbus_service_parking_t* parking = (modbus_service_parking_t*)(event_source_fd->ctx);
+  modbus_service_t* iter = parking->parked;
+  char buff[32];
+
+  while (recv(parking->wakeup_socks[0], buff, sizeof(buff), 0) > 0) {
+  }
+
+  while (iter != NULL) {
+    modbus_service_t* next = iter->parked_next;
+    if (!modbus_service_is_deferred_pending(iter)) {
+      modbus_service_unpark(iter);
+    }
+    iter = next;
+  }
+
+  return RET_OK;
+}
+#endif /*WITH_SOCKET*/
+
+static ret_t modbus_service_parking_destroy(modbus_service_parking_t* parking) {
+  if (parking->timer_manager != NULL) {
+    timer_manager_destroy(parking->timer_manager);
+  }
+#ifdef WITH_SOCKET
+  if (parking->wakeup_socks[0] >= 0) {
+    tk_socket_close(parking->wakeup_socks[0]);
+    tk_socket_close(parking->wakeup_socks[1]);
+  }
+#endif /*WITH_SOCKET*/
+  TKMEM_FREE(parking);
+
+  return RET_OK;
+}
+
+/*
+ * parking的事件源随esm一起销毁，esm销毁时连接可能还没有销毁(它们的事件源在esm中的顺序不确定)，
+ * 事件源都已经销毁并且没有service引用时才释放，需要持有s_connections_lock。
+ */
+static ret_t modbus_service_parking_try_destroy(modbus_service_parking_t* parking) {
+  modbus_service_parking_t** iter = &s_parkings;
 
-modbus_service_t* modbus_service_create_with_io(tk_iostream_t* io, modbus_proto_t proto,
-                                                modbus_memory_t* memory) {
-  modbus_service_t* service = NULL;
+  if (parking->refs > 0 || parking->timer_source != NULL || parking->wakeup_source != NULL) {
+    return RET_OK;
+  }
 
-  return_value_if_fail(io != NULL, NULL);
+  while (*iter != NULL) {
+    if (*iter == parking) {
+      *iter = parking->next;
+      break;
+    }
+    iter = &((*iter)->next);
+  }
 
-  service = TKMEM_ZALLOC(modbus_service_t);
-  return_value_if_fail(service != NULL, NULL);
+  return modbus_service_parking_destroy(parking);
+}
 
-  service->memory = memory;
-  tk_service_init(&(service->service), io);
-  modbus_common_init(MODBUS_COMMON(service), io, proto, &(service->service.wb));
+static ret_t modbus_service_parking_on_source_destroy(void* ctx, event_t* e) {
+  modbus_service_parking_t* parking = (modbus_service_parking_t*)ctx;
 
-  if (MODBUS_PROTO_TCP == proto) {
-    modbus_service_set_slave(service, 0xff);
+  modbus_service_connections_lock();
+  if (parking->timer_source == EVENT_SOURCE(e->target)) {
+    parking->timer_source = NULL;
+  } else if (parking->wakeup_source == EVENT_SOURCE(e->target)) {
+    parking->wakeup_source = NULL;
   }
-  
-  service->service.dispatch = (tk_service_dispatch_t)modbus_service_dispatch;
-  service->service.destroy = (tk_service_destroy_t)modbus_service_destroy;
-  service->service.io = io;
-
+  modbus_service_parking_try_destroy(parking);
+  modbus_service_connections_unlock();
 
-  return service;
+  return RET_OK;
 }
 
-ret_t modbus_service_dispatch(modbus_service_t* service) {
-  ret_t ret = RET_OK;
-  modbus_req_data_t req_data;
-  modbus_resp_data_t resp_data;
-  uint16_t buff[MODBUS_MAX_PDU_SIZE];
-  modbus_exeption_code_t code = MODBUS_EXCEPTION_ILLEGAL_FUNCTION;
-  return_value_if_fail(service != NULL, RET_BAD_PARAMS);
+static ret_t modbus_service_parking_add_source(modbus_service_parking_t* parking,
+                                               event_source_t* source) {
+  emitter_on(EMITTER(source), EVT_DESTROY, modbus_service_parking_on_source_destroy, parking);
+  event_source_manager_add(parking->esm, source);
+  TK_OBJECT_UNREF(source);
 
-  memset(buff, 0x00, sizeof(buff));
-  memset(&req_data, 0x00, sizeof(req_data));
-  memset(&resp_data, 0x00, sizeof(resp_data));
+  return RET_OK;
+}
 
-  ret = modbus_common_recv_req(MODBUS_COMMON(service), &req_data);
+static modbus_service_parking_t* modbus_service_parking_create(event_source_manager_t* esm) {
+  modbus_service_parking_t* parking = TKMEM_ZALLOC(modbus_service_parking_t);
+  return_value_if_fail(parking != NULL, NULL);
 
-  // 从站地址不匹配，跳过当前帧（返回时已清空缓冲区）
-  if (ret == RET_SKIP) {
-    service->num_msg_recv++;
-    ENSURE(req_data.slave != service->common.slave);
-#ifdef WITH_MULT_SLAVES
-    log_debug("slave %d != %d, not send to me.\n", req_data.slave, service->common.slave);
-#else
-    log_debug("slave id not match: %d != %d\n", req_data.slave, service->common.slave);
-    if (RET_OK == modbus_common_send_exception_resp(MODBUS_COMMON(service), req_data.func_code,
-                                                    MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS)) {
-      service->num_msg_reply++;
-      service->num_except_reply++;
-    }
-#endif
-    return RET_OK;
+  parking->esm = esm;
+  parking->wakeup_socks[0] = -1;
+  parking->wakeup_socks[1] = -1;
+  parking->timer_manager = timer_manager_create();
+  if (parking->timer_manager != NULL) {
+    parking->timer_source = event_source_timer_create(parking->timer_manager);
+  }
+  if (parking->timer_source == NULL) {
+    modbus_service_parking_destroy(parking);
+    return NULL;
   }
 
-  if (ret == RET_EOS || ret == RET_IO) {
-    if (!service->common.is_shared_transport) {
-      return RET_REMOVE;
-    }
-    goto shared_transport_error;
+#ifdef WITH_SOCKET
+  if (modbus_service_socketpair(parking->wakeup_socks) == RET_OK) {
+    tk_socket_set_blocking(parking->wakeup_socks[0], FALSE);
+    tk_socket_set_blocking(parking->wakeup_socks[1], FALSE);
+    parking->wakeup_source = event_source_fd_create(parking->wakeup_socks[0],
+                                                    modbus_service_parking_on_wakeup, parking);
+  }
+  if (parking->wakeup_source == NULL) {
+    log_warn("create wakeup socket failed, poll parked connections\n");
   }
+#endif /*WITH_SOCKET*/
 
-  if (ret == RET_OK) {
-    modbus_memory_t* memory = service->memory;
-    service->num_msg_recv++;
+  modbus_service_parking_add_source(parking, parking->timer_source);
+  if (parking->wakeup_source != NULL) {
+    modbus_service_parking_add_source(parking, parking->wakeup_source);
+  }
 
-    resp_data.addr = req_data.addr;
-    resp_data.count = req_data.count;
-    resp_data.func_code = req_data.func_code;
-    resp_data.data = (uint8_t*)buff;
+  return parking;
+}
 
-    switch (req_data.func_code) {
-      case MODBUS_FC_READ_COILS: {
-        if (req_data.count > MODBUS_MAX_READ_BITS) {
-          ret = RET_INVALID_ADDR;
-          break;
-        }
-        resp_data.bytes = (req_data.count + 7) / 8;
-        ret = modbus_memory_read_bits(memory, req_data.addr, req_data.count, (uint8_t*)buff);
-        service->num_read_requests++;
-        break;
-      }
-      case MODBUS_FC_READ_DISCRETE_INPUTS: {
-        if (req_data.count > MODBUS_MAX_READ_BITS) {
-          ret = RET_INVALID_ADDR;
-          break;
-        }
-        resp_data.bytes = (req_data.count + 7) / 8;
-        ret = modbus_memory_read_input_bits(memory, req_data.addr, req_data.count, (uint8_t*)buff);
-        service->num_read_requests++;
-        break;
-      }
-      case MODBUS_FC_READ_HOLDING_REGISTERS: {
-        if (req_data.count > MODBUS_MAX_READ_REGISTERS) {
-          ret = RET_INVALID_ADDR;
-          break;
-        }
-        resp_data.bytes = req_data.count * 2;
-        ret = modbus_memory_read_registers(memory, req_data.addr, req_data.count, buff);
-        service->num_read_requests++;
-        break;
-      }
-      case MODBUS_FC_READ_INPUT_REGISTERS: {
-        if (req_data.count > MODBUS_MAX_READ_REGISTERS) {
-          ret = RET_INVALID_ADDR;
-          break;
-        }
-        resp_data.bytes = req_data.count * 2;
-        ret = modbus_memory_read_input_registers(memory, req_data.addr, req_data.count, buff);
-        service->num_read_requests++;
-        break;
-      }
-      case MODBUS_FC_WRITE_SINGLE_COIL: {
-        resp_data.data[0] = req_data.data[0];
-        ret = modbus_memory_write_bit(memory, req_data.addr, req_data.data[0]);
-        service->num_write_requests++;
-        break;
-      }
-      case MODBUS_FC_WRITE_SINGLE_HOLDING_REGISTER: {
-        memcpy(resp_data.data, req_data.data, sizeof(uint16_t));
-        ret = modbus_memory_write_register(memory, req_data.addr, *(uint16_t*)(req_data.data));
-        service->num_write_requests++;
-        break;
-      }
-      case MODBUS_FC_WRITE_MULTIPLE_COILS: {
-        if (req_data.count > MODBUS_MAX_WRITE_BITS) {
-          ret = RET_INVALID_ADDR;
-          break;
-        }
-        ret = modbus_memory_write_bits(memory, req_data.addr, req_data.count, req_data.data);
-        service->num_write_requests++;
-        break;
-      }
-      case MODBUS_FC_WRITE_MULTIPLE_HOLDING_REGISTERS: {
-        if (req_data.count > MODBUS_MAX_WRITE_REGISTERS) {
-          ret = RET_INVALID_ADDR;
-          break;
-        }
-        ret = modbus_memory_write_registers(memory, req_data.addr, req_data.count,
-                                            (uint16_t*)req_data.data);
-        service->num_write_requests++; 
-        break;
-      }
-      case MODBUS_FC_WRITE_AND_READ_REGISTERS: {
-        if (req_data.count > MODBUS_MAX_WR_READ_REGISTERS || req_data.count_ex > MODBUS_MAX_WR_WRITE_REGISTERS) {
-          ret = RET_INVALID_ADDR;
-          break;
-        }
-        resp_data.bytes = req_data.count * 2;
-        modbus_memory_write_registers(memory, req_data.addr_ex, req_data.count_ex, (uint16_t*)req_data.data_ex);
-        ret = modbus_memory_read_registers(memory, req_data.addr, req_data.count, buff);
-        service->num_read_requests++;
-        service->num_write_requests++;
-        break;
-      }
-      default: {
-        ret = RET_NOT_IMPL;
-        break;
-      }
-    }
+/*同一个esm中的连接共用，不再使用时保留到esm销毁*/
+static modbus_service_parking_t* modbus_service_parking_ref(event_source_manager_t* esm) {
+  modbus_service_parking_t* parking = NULL;
 
-    if (ret == RET_OK) {
-      ret = modbus_common_send_resp(MODBUS_COMMON(service), &resp_data);
-      if (ret == RET_OK) {
-        service->num_msg_reply++;
-      }
-      if (ret != RET_OK && service->common.is_shared_transport) {
-        goto shared_transport_error;
-      }
-      return ret;
+  modbus_service_connections_lock();
+  for (parking = s_parkings; parking != NULL; parking = parking->next) {
+    if (parking->esm == esm && parking->timer_source != NULL) {
+      parking->refs++;
+      break;
     }
   }
 
-  if (ret == RET_INVALID_ADDR) {
-    code = MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
-  } else if (ret == RET_CRC) {
-    code = MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
-  } else if (ret == RET_EXCEED_RANGE) {
-    code = MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
-  } else if (ret == RET_NOT_IMPL) {
-    code = MODBUS_EXCEPTION_ILLEGAL_FUNCTION;
+  if (parking == NULL) {
+    parking = modbus_service_parking_create(esm);
+    if (parking != NULL) {
+      parking->refs = 1;
+      parking->next = s_parkings;
+      s_parkings = parking;
+    }
   }
+  modbus_service_connections_unlock();
 
-  log_debug("%d failed\n", req_data.func_code);
-  ret =  modbus_common_send_exception_resp(MODBUS_COMMON(service), req_data.func_code, code);
-  if (ret == RET_OK) {
-    service->num_msg_reply++;
-    service->num_except_reply++;
-  }
-  if (ret != RET_OK && service->common.is_shared_transport) {
-    goto shared_transport_error;
-  }
-  return ret;
+  return parking;
+}
+
+static ret_t modbus_service_parking_unref(modbus_service_parking_t* parking) {
+  modbus_service_connections_lock();
+  parking->refs--;
+  modbus_service_parking_try_destroy(parking);
+  modbus_service_connections_unlock();
 
-shared_transport_error:
-  log_debug("shared transport error, flush buffer and continue\n");
-  modbus_common_flush_read_buffer(MODBUS_COMMON(service));
   return RET_OK;
 }
 
-static ret_t service_on_request(event_source_t* source) {
-  event_source_fd_t* event_source_fd = (event_source_fd_t*)source;
-  modbus_service_t* service = (modbus_service_t*)(event_source_fd->ctx);
-  ret_t ret = modbus_service_dispatch(service);
+/*在esm所在的线程中调用*/
+static ret_t modbus_service_detach(modbus_service_t* service) {
+  event_source_t* source = service->source;
 
-  if (tk_object_get_prop_bool(TK_OBJECT(service->common.io), TK_STREAM_PROP_IS_OK, FALSE)) {
-    ret = RET_OK;
-  } else {
-    ret = RET_REMOVE;
+  if (service->parked) {
+    modbus_service_unlink_parked(service);
   }
 
-  return ret;
+  if (source != NULL) {
+    service->source = NULL;
+    event_source_manager_remove(source->manager, source);
+  }
+
+  return RET_OK;
 }
 
 ret_t modbus_service_attach_to_event_source_manager(modbus_service_t* service,
                                                     event_source_manager_t* esm) {
   return_value_if_fail(service != NULL && esm != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(service->parking == NULL, RET_BAD_PARAMS);
 
-  int fd = tk_object_get_prop_int(TK_OBJECT(service->common.io), TK_STREAM_PROP_FD, -1);
-  event_source_t* source = event_source_fd_create(fd, service_on_request, service);
-  event_source_manager_add(esm, source);
-  TK_OBJECT_UNREF(source);
+  service->parking = modbus_service_parking_ref(esm);
+  return_value_if_fail(service->parking != NULL, RET_OOM);
 
-  return RET_OK;
+  return modbus_service_add_source(service);
 }
 
 ret_t modbus_service_destroy(modbus_service_t* service) {
@@ -262,8 +2356,34 @@ ret_t modbus_service_destroy(modbus_service_t* service) {
     service->on_disconnected(service, service->ctx);
   }
 
+  modbus_service_idle_detach(service);
+  modbus_service_detach(service);
+  /*先等其它线程完成回复(会通知parking)，再释放parking*/
+  modbus_service_remove_deferred(service);
+  if (service->parking != NULL) {
+    modbus_service_parking_unref(service->parking);
+    service->parking = NULL;
+  }
+  modbus_service_release_in_flight(service);
+#ifdef WITH_SOCKET
+  if (service->quit_socks[0] >= 0) {
+    tk_socket_close(service->quit_socks[0]);
+    tk_socket_close(service->quit_socks[1]);
+  }
+#endif /*WITH_SOCKET*/
+  /*预读缓冲区跟随对象留在池中(不在池中时由modbus_service_free释放)*/
+  if (service->common.rbuffer != NULL && service->cached_rbuffer == NULL) {
+    service->cached_rbuffer = service->common.rbuffer;
+    service->cached_rbuffer_size = service->common.rbuffer_size;
+    service->common.rbuffer = NULL;
+  }
   modbus_common_deinit(MODBUS_COMMON(service));
-  TKMEM_FREE(service);
+  if (service->is_static) {
+    modbus_service_release_cached(service);
+  } else {
+    modbus_service_free(service);
+  }
+  modbus_service_inc_connections_count(FALSE);
 
   return RET_OK;
 }
@@ -273,6 +2393,10 @@ ret_t modbus_service_wait_for_data(modbus_service_t* service, uint32_t timeout)
   tk_istream_t* in = NULL;
   return_value_if_fail(service != NULL, RET_BAD_PARAMS);
 
+  if (modbus_common_get_buffered_size(MODBUS_COMMON(service)) > 0) {
+    return RET_OK;
+  }
+
   io = service->common.io;
   in = tk_iostream_get_istream(io);
   return_value_if_fail(in != NULL, RET_BAD_PARAMS);
@@ -284,14 +2408,213 @@ ret_t modbus_service_wait_for_data(modbus_service_t* service, uint32_t timeout)
   return tk_istream_wait_for_data(in, timeout);
 }
 
+ret_t modbus_service_set_diag_registers(modbus_service_t* service, bool_t enable, uint16_t addr) {
+  return_value_if_fail(service != NULL, RET_BAD_PARAMS);
+
+  service->diag_enable = enable;
+  service->diag_addr = addr;
+
+  return RET_OK;
+}
+
+uint32_t modbus_service_get_connections_count(void) {
+  return s_connections_count;
+}
+
+ret_t modbus_service_get_stats(modbus_service_t* service, modbus_service_stats_t* stats) {
+  return_value_if_fail(service != NULL && stats != NULL, RET_BAD_PARAMS);
+
+  memcpy(stats, &(service->stats), sizeof(*stats));
+  stats->bytes_in = service->common.bytes_in;
+  stats->bytes_out = service->common.bytes_out;
+
+  return RET_OK;
+}
+
+ret_t modbus_service_reset_stats(modbus_service_t* service) {
+  return_value_if_fail(service != NULL, RET_BAD_PARAMS);
+
+  memset(&(service->stats), 0x00, sizeof(service->stats));
+  service->common.bytes_in = 0;
+  service->common.bytes_out = 0;
+
+  return RET_OK;
+}
+
+ret_t modbus_service_stats_to_str(const modbus_service_stats_t* stats, str_t* str) {
+  uint32_t i = 0;
+  return_value_if_fail(stats != NULL && str != NULL, RET_BAD_PARAMS);
+
+  str_append_format(str, 64, "bytes_in=%llu bytes_out=%llu\n",
+                    (unsigned long long)(stats->bytes_in), (unsigned long long)(stats->bytes_out));
+
+#if MODBUS_WITH_STATS
+  for (i = 0; i < MODBUS_SERVICE_STATS_FC_NR; i++) {
+    if (stats->num_requests_by_fc[i] > 0) {
+      str_append_format(str, 64, "fc%u: requests=%u\n", i, stats->num_requests_by_fc[i]);
+    }
+  }
+#endif /*MODBUS_WITH_STATS*/
+
+  for (i = 0; i < MODBUS_SERVICE_STATS_EXCEPTION_NR; i++) {
+    if (stats->num_exceptions_by_code[i] > 0) {
+      str_append_format(str, 64, "exception%u: count=%u\n", i, stats->num_exceptions_by_code[i]);
+    }
+  }
+
+  if (stats->num_crc_errors > 0) {
+    str_append_format(str, 64, "crc_errors=%u\n", stats->num_crc_errors);
+  }
+
+  if (stats->num_broadcasts > 0) {
+    str_append_format(str, 64, "broadcasts=%u\n", stats->num_broadcasts);
+  }
+
+  if (stats->num_deferred > 0) {
+    str_append_format(str, 64, "deferred=%u timeouts=%u\n", stats->num_deferred,
+                      stats->num_deferred_timeouts);
+  }
+
+  if (stats->num_shed_rate_limited > 0 || stats->num_shed_in_flight > 0) {
+    str_append_format(str, 64, "shed: rate_limited=%u in_flight=%u\n",
+                      stats->num_shed_rate_limited, stats->num_shed_in_flight);
+  }
+
+  return modbus_histogram_to_str(&(stats->dispatch_time), "dispatch_us", str);
+}
+
+/*等待延迟回复完成(不读取新的请求，保证回复的顺序)，超时后回复异常*/
+static ret_t modbus_service_wait_for_resumed(modbus_service_t* service) {
+  uint32_t remain = modbus_service_get_deferred_remain_time(service);
+
+  if (remain > 0) {
+    tk_semaphore_wait(service->deferred->resumed, remain);
+  }
+
+  return modbus_service_check_deferred_timeout(service);
+}
+
+/*等待数据或者modbus_service_quit的唤醒，不能直接唤醒时超时检查quit标志*/
+static ret_t modbus_service_run_wait(modbus_service_t* service) {
+#if defined(WITH_SOCKET) && !defined(WIN32)
+  int fd = tk_object_get_prop_int(TK_OBJECT(service->common.io), TK_STREAM_PROP_FD, -1);
+
+  if (service->quit_socks[0] >= 0 && fd >= 0 &&
+      modbus_common_get_buffered_size(MODBUS_COMMON(service)) == 0) {
+    struct pollfd fds[2];
+
+    if (!modbus_service_is_io_ok(service)) {
+      return RET_IO;
+    }
+
+    /*在检查quit之后才调用的modbus_service_quit会写入quit_socks，poll会立即返回*/
+    if (service->quit) {
+      return RET_TIMEOUT;
+    }
+
+    memset(fds, 0x00, sizeof(fds));
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = service->quit_socks[0];
+    fds[1].events = POLLIN;
+    if (poll(fds, ARRAY_SIZE(fds), -1) < 0) {
+      return errno == EINTR ? RET_TIMEOUT : RET_IO;
+    }
+
+    if (fds[1].revents != 0) {
+      char buff[8];
+      while (recv(service->quit_socks[0], buff, sizeof(buff), 0) > 0) {
+      }
+    }
+
+    /*连接断开或者出错时由读取返回错误*/
+    return fds[0].revents != 0 ? RET_OK : RET_TIMEOUT;
+  }
+#endif /*WITH_SOCKET && !WIN32*/
+
+  return modbus_service_wait_for_data(service, MODBUS_SERVICE_RUN_WAIT_TIME);
+}
+
+/*进入循环之前创建quit_socks，在s_deferred_lock中发布给modbus_service_quit*/
+static ret_t modbus_service_run_prepare(modbus_service_t* service) {
+#if defined(WITH_SOCKET) && !defined(WIN32)
+  int socks[2] = {-1, -1};
+  int fd = tk_object_get_prop_int(TK_OBJECT(service->common.io), TK_STREAM_PROP_FD, -1);
+
+  if (service->quit_socks[0] >= 0 || fd < 0) {
+    return RET_OK;
+  }
+
+  if (s_deferred_lock == NULL) {
+    s_deferred_lock = tk_mutex_nest_create();
+    return_value_if_fail(s_deferred_lock != NULL, RET_OOM);
+  }
+
+  if (modbus_service_socketpair(socks) == RET_OK) {
+    tk_socket_set_blocking(socks[0], FALSE);
+    tk_socket_set_blocking(socks[1], FALSE);
+
+    tk_mutex_nest_lock(s_deferred_lock);
+    service->quit_socks[0] = socks[0];
+    service->quit_socks[1] = socks[1];
+    tk_mutex_nest_unlock(s_deferred_lock);
+  }
+#endif /*WITH_SOCKET && !WIN32*/
+
+  return RET_OK;
+}
+
 ret_t modbus_service_run(modbus_service_t* service) {
-  do {
-    if (modbus_service_wait_for_data(service, 1000) == RET_OK) {
-      if (modbus_service_dispatch(service) == RET_IO) break;
-    } else {
-      sleep_ms(10);
+  ret_t ret = RET_OK;
+  return_value_if_fail(service != NULL, RET_BAD_PARAMS);
+
+  modbus_service_run_prepare(service);
+  while (!service->quit) {
+    if (modbus_service_is_deferred_pending(service)) {
+      modbus_service_wait_for_resumed(service);
+      continue;
+    }
+
+    ret = modbus_service_run_wait(service);
+    if (ret == RET_OK) {
+      if (modbus_service_dispatch(service) == RET_IO) {
+        return RET_IO;
+      }
+    } else if (ret != RET_TIMEOUT) {
+      log_debug("modbus_service_run: wait for data failed: %d\n", ret);
+      return ret;
     }
-  } while (TRUE);
+  }
+
+  return RET_OK;
+}
+
+ret_t modbus_service_quit(modbus_service_t* service) {
+  return_value_if_fail(service != NULL, RET_BAD_PARAMS);
+
+  if (s_deferred_lock == NULL) {
+    /*modbus_service_run还没有创建quit_socks，进入循环时检查quit*/
+    service->quit = TRUE;
+    return RET_OK;
+  }
+
+  /*
+   * 持有s_deferred_lock时deferred不会被销毁(见modbus_service_remove_deferred)，
+   * quit_socks也在s_deferred_lock中发布(见modbus_service_run_prepare)：
+   * 在这之前设置的quit会在进入循环时看到，在这之后创建的quit_socks一定能在这里看到。
+   */
+  tk_mutex_nest_lock(s_deferred_lock);
+  service->quit = TRUE;
+  if (service->deferred != NULL) {
+    tk_semaphore_post(service->deferred->resumed);
+  }
+#ifdef WITH_SOCKET
+  if (service->quit_socks[1] >= 0) {
+    char c = 0;
+    send(service->quit_socks[1], &c, 1, 0);
+  }
+#endif /*WITH_SOCKET*/
+  tk_mutex_nest_unlock(s_deferred_lock);
 
   return RET_OK;
 }
@@ -305,6 +2628,15 @@ ret_t modbus_service_set_slave(modbus_service_t* service, uint8_t slave) {
   return RET_OK;
 }
 
+ret_t modbus_service_set_units(modbus_service_t* service, modbus_memory_t** units) {
+  return_value_if_fail(service != NULL, RET_BAD_PARAMS);
+
+  service->units = units;
+  service->common.any_slave = units != NULL;
+
+  return RET_OK;
+}
+
 ret_t modbus_service_set_shared_transport(modbus_service_t* service, bool_t is_shared_transport) {
   return_value_if_fail(service != NULL, RET_BAD_PARAMS);
 
@@ -313,6 +2645,24 @@ ret_t modbus_service_set_shared_transport(modbus_service_t* service, bool_t is_s
   return RET_OK;
 }
 
+ret_t modbus_service_set_read_ahead(modbus_service_t* service, uint32_t size) {
+  modbus_common_t* common = MODBUS_COMMON(service);
+  return_value_if_fail(service != NULL, RET_BAD_PARAMS);
+
+  if (size > 0 && common->rbuffer == NULL && service->cached_rbuffer_size == size) {
+    common->rbuffer = service->cached_rbuffer;
+    common->rbuffer_size = size;
+    common->rstart = 0;
+    common->rend = 0;
+    service->cached_rbuffer = NULL;
+    service->cached_rbuffer_size = 0;
+
+    return RET_OK;
+  }
+
+  return modbus_common_set_read_ahead(common, size);
+}
+
 tk_service_t* modbus_service_create(tk_iostream_t* io, void* args) {
   modbus_service_t* service = NULL;
   modbus_service_args_t* service_args = (modbus_service_args_t*)args;
@@ -328,10 +2678,27 @@ tk_service_t* modbus_service_create(tk_iostream_t* io, void* args) {
     }
   }
   modbus_service_set_slave(service, service_args->slave);
+  modbus_service_set_units(service, service_args->units);
+  modbus_service_set_diag_registers(service, service_args->diag_enable, service_args->diag_addr);
+  if (service_args->deferred_timeout > 0) {
+    if (modbus_service_set_deferred_timeout(service, service_args->deferred_timeout,
+                                            service_args->deferred_timeout_code) != RET_OK) {
+      /*不能延迟回复时回调函数的行为会不一样，拒绝连接而不是悄悄地退化*/
+      log_warn("no deferred slot left (MODBUS_SERVICE_MAX_DEFERRED=%u), reject connection\n",
+               (uint32_t)MODBUS_SERVICE_MAX_DEFERRED);
+      modbus_service_destroy(service);
+      return NULL;
+    }
+  }
+  modbus_service_set_rate_limit(service, service_args->rate_limit, service_args->rate_burst);
+  modbus_service_set_max_in_flight(service, service_args->max_in_flight);
+#if MODBUS_WITH_TCP
   if (service_args->proto == MODBUS_PROTO_TCP) {
+    modbus_service_idle_attach(service);
     if (service_args->keep_idle > 0 && service_args->keep_interval > 0 && service_args->keep_count > 0) {
       tk_iostream_tcp_set_tcp_keep_info(io, service_args->keep_idle, service_args->keep_interval, service_args->keep_count);
     }
   }
+#endif /*MODBUS_WITH_TCP*/
   return (tk_service_t*)service;
 }
@@ -24,6 +24,7 @@
 
 #include "modbus_common.h"
 #include "modbus_memory.h"
+#include "modbus_histogram.h"
 #include "service/service.h"
 
 BEGIN_C_DECLS
@@ -31,17 +32,90 @@ BEGIN_C_DECLS
 struct _modbus_service_t;
 typedef struct _modbus_service_t modbus_service_t;
 
+struct _modbus_service_deferred_t;
+typedef struct _modbus_service_deferred_t modbus_service_deferred_t;
+typedef struct _modbus_service_parking_t modbus_service_parking_t;
+
 typedef ret_t (*modbus_service_on_connected_t)(modbus_service_t* service, void* ctx);
 typedef ret_t (*modbus_service_on_disconnected_t)(modbus_service_t* service, void* ctx);
+typedef ret_t (*modbus_service_on_resumed_t)(modbus_service_t* service, void* ctx);
+
+/**
+ * @enum modbus_service_backend_t
+ * @prefix MODBUS_SERVICE_BACKEND_
+ * modbus service TCP 的事件循环后端。
+ */
+typedef enum _modbus_service_backend_t {
+  /**
+   * @const MODBUS_SERVICE_BACKEND_DEFAULT
+   * 每个连接一个event_source_fd，由event_source_manager分发。
+   */
+  MODBUS_SERVICE_BACKEND_DEFAULT = 0,
+  /**
+   * @const MODBUS_SERVICE_BACKEND_EPOLL
+   * 使用epoll(边沿触发)分发全部连接(仅Linux，其它平台使用DEFAULT)。
+   */
+  MODBUS_SERVICE_BACKEND_EPOLL
+} modbus_service_backend_t;
+
+/**
+ * @const MODBUS_SERVICE_UNITS_NR
+ * 从站地址映射表的元素个数。
+ */
+#define MODBUS_SERVICE_UNITS_NR 256
+
+/**
+ * @const MODBUS_SERVICE_MAX_DEFERRED
+ * 最多同时支持延迟回复的service(连接)个数。
+ *
+ * 位置按需加倍扩大(静态内存配置为固定大小)，用完时modbus_service_set_deferred_timeout返回RET_EXCEED_RANGE，
+ * modbus_service_create(启用了deferred_timeout时)拒绝新的连接。
+ */
+#ifndef MODBUS_SERVICE_MAX_DEFERRED
+#define MODBUS_SERVICE_MAX_DEFERRED 4096
+#endif /*MODBUS_SERVICE_MAX_DEFERRED*/
+
+/**
+ * @const MODBUS_SERVICE_WBUFFER_SIZE
+ * 每个service内嵌的收发缓冲区大小(不小于最大的ADU)。
+ */
+#ifndef MODBUS_SERVICE_WBUFFER_SIZE
+#define MODBUS_SERVICE_WBUFFER_SIZE 512
+#endif /*MODBUS_SERVICE_WBUFFER_SIZE*/
+
+/**
+ * @const MODBUS_SERVICE_RUN_WAIT_TIME
+ * modbus_service_run每次等待数据的最长时间(毫秒)。
+ *
+ * 数据到达时立即处理，该值只决定modbus_service_quit最迟多久生效。
+ * 只用于没有fd的流(如内存流)和Windows，其它情况modbus_service_quit直接唤醒等待。
+ */
+#ifndef MODBUS_SERVICE_RUN_WAIT_TIME
+#define MODBUS_SERVICE_RUN_WAIT_TIME 100
+#endif /*MODBUS_SERVICE_RUN_WAIT_TIME*/
 
 typedef struct _modbus_service_args_t {
   modbus_proto_t proto;
   modbus_memory_t* memory;
+  modbus_memory_t** units;    // 从站地址到memory的映射表(MODBUS_SERVICE_UNITS_NR个元素，由调用者管理)，为NULL时只使用memory
   uint8_t slave;
   const wchar_t* ifname;
   void* ctx;
   modbus_service_on_connected_t on_connected;
   bool_t is_shared_transport; // 是共享资源（如串口），错误时不能直接断开，需要flush继续
+  bool_t diag_enable;         // 是否启用诊断寄存器(只读寄存器，见MODBUS_SERVICE_DIAG_REGISTERS_NB)
+  uint16_t diag_addr;         // 诊断寄存器的起始地址
+  uint32_t deferred_timeout;  // 延迟回复的超时时间(毫秒)，为0时不支持延迟回复
+  modbus_exeption_code_t deferred_timeout_code; // 延迟回复超时时回复的异常码，为0时使用SERVER_DEVICE_BUSY
+  uint32_t rate_limit;        // 每个连接每秒最多处理的请求数，为0时不限制
+  uint32_t rate_burst;        // 每个连接允许的突发请求数(令牌桶容量)，为0时等于rate_limit
+  uint32_t max_in_flight;     // 全部连接同时处理中的请求数上限，为0时不限制
+  modbus_service_backend_t backend; // TCP 事件循环后端(EPOLL后端忽略ifname，监听全部地址)
+  uint32_t read_ahead;        // 预读缓冲区大小(字节)，只用于EPOLL后端(总是预读，至少MODBUS_SERVICE_WBUFFER_SIZE)
+  uint32_t listeners;         // 监听线程数，大于1时用SO_REUSEPORT在同一个端口上监听多次，每个线程一个EPOLL后端(仅Linux)
+  uint32_t idle_timeout;      // TCP连接的空闲超时时间(毫秒)，超时后关闭连接，为0时不限制(见modbus_service_set_idle_timeout)
+  uint32_t max_connections;   // TCP连接数上限，超过时关闭最久没有活动的连接，为0时不限制(见modbus_service_set_max_connections)
+  uint32_t pool_size;         // 缓存的service对象个数，连接断开后对象放回池中给新连接使用，为0时不缓存(见modbus_service_set_pool_size)
 
   /* tcp prop */
   int keep_idle;
@@ -49,6 +123,150 @@ typedef struct _modbus_service_args_t {
   int keep_count;
 } modbus_service_args_t;
 
+/**
+ * @const MODBUS_SERVICE_STATS_FC_NR
+ * 按功能码统计的数组大小(功能码的最高位用于表示异常，所以只有128个)。
+ */
+#define MODBUS_SERVICE_STATS_FC_NR 128
+
+/**
+ * @const MODBUS_SERVICE_STATS_EXCEPTION_NR
+ * 按异常码统计的数组大小。
+ */
+#define MODBUS_SERVICE_STATS_EXCEPTION_NR 16
+
+/**
+ * @const MODBUS_SERVICE_DIAG_REGISTERS_NB
+ * 诊断寄存器的个数。
+ *
+ * 启用后，可以用读取只读寄存器(0x04)的方式读取以下数据(每项占两个寄存器，高16位在前)：
+ *
+ * | 偏移 | 说明 |
+ * |------|------|
+ * | 0    | 收到的请求数 |
+ * | 2    | 每秒请求数(最近MODBUS_SERVICE_RATE_WINDOW秒的平均值) |
+ * | 4    | 处理耗时p50(微秒) |
+ * | 6    | 处理耗时p99(微秒) |
+ * | 8    | 处理耗时最大值(微秒) |
+ * | 10   | 异常回复数 |
+ * | 12   | CRC错误数 |
+ * | 14   | 当前连接数 |
+ * | 16   | 接收的字节数(低32位) |
+ * | 18   | 发送的字节数(低32位) |
+ *
+ * > 都是服务端全部连接的累计数据(诊断功能码的计数器也是)，清除计数器(0x08 0x0A)时一起清零。
+ */
+#define MODBUS_SERVICE_DIAG_REGISTERS_NB 20
+
+/**
+ * @const MODBUS_SERVICE_RATE_WINDOW
+ * 计算每秒请求数的时间窗口(秒)。
+ *
+ * 按秒记录请求数，读取时取最近几个完整的秒的平均值，没有请求时会降为0。
+ */
+#ifndef MODBUS_SERVICE_RATE_WINDOW
+#define MODBUS_SERVICE_RATE_WINDOW 5
+#endif /*MODBUS_SERVICE_RATE_WINDOW*/
+
+/**
+ * @const MODBUS_SERVICE_TOTALS_SHARDS
+ * 服务端累计数据(诊断功能码和诊断寄存器使用)的分片数。
+ *
+ * 连接轮流使用各个分片，处理请求时只锁自己的分片，读取诊断数据时再合并。
+ * 多个线程运行service(如listeners大于1)时，不同连接的请求不再争用同一把锁。
+ */
+#ifndef MODBUS_SERVICE_TOTALS_SHARDS
+#define MODBUS_SERVICE_TOTALS_SHARDS 8
+#endif /*MODBUS_SERVICE_TOTALS_SHARDS*/
+
+/**
+ * @const MODBUS_SERVICE_IDLE_TOUCH_INTERVAL
+ * 收到请求时更新空闲连接链表的最小间隔(毫秒)。
+ *
+ * 距离上次更新不到这个时间时不加锁调整链表，空闲超时因此最多推迟这么长时间(不会提前)。
+ */
+#ifndef MODBUS_SERVICE_IDLE_TOUCH_INTERVAL
+#define MODBUS_SERVICE_IDLE_TOUCH_INTERVAL 100
+#endif /*MODBUS_SERVICE_IDLE_TOUCH_INTERVAL*/
+
+/**
+ * @class modbus_service_stats_t
+ * modbus service的统计数据。
+ *
+ * 统计数据只由处理请求的线程更新，其它线程可以不加锁直接读取(或者用modbus_service_get_stats获取快照)，
+ * 读到的数据最多与正在处理的请求相差一次。
+ */
+typedef struct _modbus_service_stats_t {
+#if MODBUS_WITH_STATS
+  /**
+   * @property {uint32_t*} num_requests_by_fc
+   * @annotation ["readable"]
+   * 按功能码统计的请求次数(MODBUS_WITH_STATS为0时没有)。
+   */
+  uint32_t num_requests_by_fc[MODBUS_SERVICE_STATS_FC_NR];
+#endif /*MODBUS_WITH_STATS*/
+  /**
+   * @property {uint32_t*} num_exceptions_by_code
+   * @annotation ["readable"]
+   * 按异常码统计的异常回复次数。
+   */
+  uint32_t num_exceptions_by_code[MODBUS_SERVICE_STATS_EXCEPTION_NR];
+  /**
+   * @property {uint32_t} num_crc_errors
+   * @annotation ["readable"]
+   * CRC错误的请求数。
+   */
+  uint32_t num_crc_errors;
+  /**
+   * @property {uint32_t} num_broadcasts
+   * @annotation ["readable"]
+   * 广播请求数(RTU从站地址为0，不回复)。
+   */
+  uint32_t num_broadcasts;
+  /**
+   * @property {uint32_t} num_deferred
+   * @annotation ["readable"]
+   * 延迟回复的请求数。
+   */
+  uint32_t num_deferred;
+  /**
+   * @property {uint32_t} num_deferred_timeouts
+   * @annotation ["readable"]
+   * 延迟回复超时的请求数。
+   */
+  uint32_t num_deferred_timeouts;
+  /**
+   * @property {uint32_t} num_shed_rate_limited
+   * @annotation ["readable"]
+   * 超过连接速率限制而拒绝(回复SERVER_DEVICE_BUSY)的请求数。
+   */
+  uint32_t num_shed_rate_limited;
+  /**
+   * @property {uint32_t} num_shed_in_flight
+   * @annotation ["readable"]
+   * 超过全局处理中请求数上限而拒绝(回复SERVER_DEVICE_BUSY)的请求数。
+   */
+  uint32_t num_shed_in_flight;
+  /**
+   * @property {uint64_t} bytes_in
+   * @annotation ["readable"]
+   * 接收的字节数。
+   */
+  uint64_t bytes_in;
+  /**
+   * @property {uint64_t} bytes_out
+   * @annotation ["readable"]
+   * 发送的字节数。
+   */
+  uint64_t bytes_out;
+  /**
+   * @property {modbus_histogram_t} dispatch_time
+   * @annotation ["readable"]
+   * 请求处理耗时(从收到完整请求到发送完回复，单位为微秒)。
+   */
+  modbus_histogram_t dispatch_time;
+} modbus_service_stats_t;
+
 /**
  * @class modbus_service_t
  * 
@@ -58,13 +276,58 @@ struct _modbus_service_t {
   tk_service_t service;
   modbus_common_t common;
   modbus_memory_t* memory;
+  modbus_memory_t** units;      /* 从站地址到memory的映射表(可选) */
   uint32_t num_msg_recv;        /* 已接收消息总数 */
   uint32_t num_msg_reply;       /* 已回复消息总数 */
   uint32_t num_except_reply;    /* 自服务启用后发送的异常回复数量（标识功能码非法） */
   uint32_t num_read_requests;   /* 读请求次数 */
   uint32_t num_write_requests;  /* 写请求次数 */
+  modbus_service_stats_t stats; /* 按功能码/异常码统计的数据和处理耗时 */
+  bool_t diag_enable;           /* 是否启用诊断寄存器 */
+  uint16_t diag_addr;           /* 诊断寄存器的起始地址 */
+  /*private*/
   void* ctx;
   modbus_service_on_disconnected_t on_disconnected;
+  modbus_service_deferred_t* deferred;
+  uint32_t rate_limit;
+  uint32_t rate_burst;
+  uint64_t rate_tokens; /* 令牌数(单位为百万分之一个请求) */
+  uint64_t rate_refill_time;
+  uint32_t max_in_flight;
+  bool_t in_flight;
+  modbus_service_on_resumed_t on_resumed;
+  void* on_resumed_ctx;
+  /* 使用的累计数据分片(见MODBUS_SERVICE_TOTALS_SHARDS)，处理耗时在合并计数时一起计入分片 */
+  uint32_t totals_shard;
+  uint32_t pending_dispatch_time;
+  bool_t has_pending_dispatch_time;
+  /* 空闲连接链表(按最后活动时间排序) */
+  bool_t idle_linked;
+  uint64_t last_active;
+  tk_iostream_t* idle_io;
+  modbus_service_t* idle_prev;
+  modbus_service_t* idle_next;
+  /* 对象池中的下一个空闲对象 */
+  modbus_service_t* pool_next;
+  /* 放回对象池时保留的预读缓冲区和延迟回复的上下文，给下一个连接使用 */
+  uint8_t* cached_rbuffer;
+  uint32_t cached_rbuffer_size;
+  modbus_service_deferred_t* cached_deferred;
+  /* 由调用者提供存储(见modbus_service_init_static)，销毁时不释放 */
+  bool_t is_static;
+  /* 由modbus_service_quit设置，modbus_service_run检查后返回 */
+  volatile bool_t quit;
+  /* modbus_service_run进入循环之前创建(在s_deferred_lock中发布)，modbus_service_quit写入一个字节唤醒等待 */
+  int quit_socks[2];
+  /* 关联到esm后读取请求的事件源，等待延迟回复期间从esm中移除(暂停读取) */
+  modbus_service_parking_t* parking;
+  event_source_t* source;
+  bool_t parked;
+  uint32_t parked_timer_id;
+  modbus_service_t* parked_next;
+  /* 连接断开(事件源被移除)时销毁service(TCP缺省后端) */
+  bool_t destroy_on_disconnect;
+  uint8_t wbuffer_data[MODBUS_SERVICE_WBUFFER_SIZE];
 };
 
 /**
@@ -87,6 +350,24 @@ tk_service_t* modbus_service_create(tk_iostream_t* io, void* args);
 modbus_service_t* modbus_service_create_with_io(tk_iostream_t* io, modbus_proto_t proto,
                                                 modbus_memory_t* memory);
 
+/**
+ * @method modbus_service_init_static
+ * 在调用者提供的存储(如全局变量)上初始化modbus service，不分配堆内存。
+ * 功能和modbus_service_create_with_io相同，modbus_service_destroy时只释放资源，不释放service本身。
+ *
+ *```c
+ * static modbus_service_t s_service;
+ * modbus_service_init_static(&s_service, io, MODBUS_PROTO_RTU, memory);
+ *```
+ * @param {modbus_service_t*} service 存储modbus service的对象。
+ * @param {tk_iostream_t*} io io对象。
+ * @param {modbus_proto_t} proto 协议。
+ * @param {modbus_memory_t*} memory memory对象。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_service_init_static(modbus_service_t* service, tk_iostream_t* io,
+                                 modbus_proto_t proto, modbus_memory_t* memory);
+
 /**
  * @method modbus_service_set_slave
  * 设置slave。
@@ -96,6 +377,19 @@ modbus_service_t* modbus_service_create_with_io(tk_iostream_t* io, modbus_proto_
  */
 ret_t modbus_service_set_slave(modbus_service_t* service, uint8_t slave);
 
+/**
+ * @method modbus_service_set_units
+ * 设置从站地址到memory的映射表，用于一个服务模拟多个从站。
+ *
+ * 设置后，按请求中的从站地址在映射表中查找memory(不再使用slave和memory)。
+ * 找不到时，RTU不回复(总线上可能有其它从站)，TCP回复异常(网关目标设备无响应)。
+ *
+ * @param {modbus_service_t*} service modbus service对象。
+ * @param {modbus_memory_t**} units 映射表(MODBUS_SERVICE_UNITS_NR个元素，由调用者管理，服务运行期间不能释放)。为NULL时取消映射。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_service_set_units(modbus_service_t* service, modbus_memory_t** units);
+
 /**
  * @method modbus_service_set_shared_transport
  * 设置底层传输是否是共享资源。
@@ -105,6 +399,18 @@ ret_t modbus_service_set_slave(modbus_service_t* service, uint8_t slave);
  */
 ret_t modbus_service_set_shared_transport(modbus_service_t* service, bool_t is_shared_transport);
 
+/**
+ * @method modbus_service_set_read_ahead
+ * 设置预读缓冲区的大小(见modbus_common_set_read_ahead)。
+ *
+ * 从对象池中取出的service保留了上一个连接的预读缓冲区，大小相同时直接使用，不再分配。
+ *
+ * @param {modbus_service_t*} service modbus service对象。
+ * @param {uint32_t} size 预读缓冲区的大小，为0时不预读。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_service_set_read_ahead(modbus_service_t* service, uint32_t size);
+
 /**
  * @method modbus_service_dispatch
  * 分发请求。
@@ -113,6 +419,32 @@ ret_t modbus_service_set_shared_transport(modbus_service_t* service, bool_t is_s
  */
 ret_t modbus_service_dispatch(modbus_service_t* service);
 
+/**
+ * @method modbus_service_dispatch_available
+ * 处理已经收到的全部请求，直到没有数据(用于边沿触发的事件循环)。
+ *
+ * 流需要是非阻塞的：读取已经收到的数据到预读缓冲区(没有时按MODBUS_SERVICE_WBUFFER_SIZE创建)，只解析完整的请求，
+ * 不完整的请求留在缓冲区中等下次调用，不会阻塞等待数据。
+ *
+ * @param {modbus_service_t*} service modbus service对象。
+ * @return {ret_t} 返回RET_OK表示已经没有数据，RET_BUSY表示在等待延迟回复(完成后调用on_resumed)，RET_IO表示连接已经断开。
+ */
+ret_t modbus_service_dispatch_available(modbus_service_t* service);
+
+/**
+ * @method modbus_service_set_on_resumed
+ * 设置延迟回复完成(可以继续读取请求)时的回调函数。
+ *
+ * > 回调函数可能在调用modbus_service_complete_deferred的线程中调用，只能做唤醒之类的操作。
+ *
+ * @param {modbus_service_t*} service modbus service对象。
+ * @param {modbus_service_on_resumed_t} on_resumed 回调函数。
+ * @param {void*} ctx 回调函数的上下文。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_service_set_on_resumed(modbus_service_t* service,
+                                    modbus_service_on_resumed_t on_resumed, void* ctx);
+
 /**
  * @method modbus_service_wait_for_data
  * 等待数据。
@@ -133,6 +465,10 @@ ret_t modbus_service_destroy(modbus_service_t* service);
 /**
  * @method modbus_service_attach_to_event_source_manager
  * 关联到esm。
+ *
+ * 等待延迟回复期间从esm中移除，不再检查是否有数据(也就不会反复触发)，
+ * 回复完成(可以在其它线程)或者超时后再加入，超时由esm中的定时器检查，不需要调用modbus_service_check_deferred_timeout。
+ *
  * @param {modbus_service_t*} service modbus service对象。
  * @param {event_source_manager_t*} esm 事件管理器。
  * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
@@ -141,13 +477,328 @@ ret_t modbus_service_attach_to_event_source_manager(modbus_service_t* service,
                                                     event_source_manager_t* esm);
 
 /**
- * @method modbus_service_run
- * 阻塞运行。
+ * @method modbus_service_set_diag_registers
+ * 设置诊断寄存器(只读寄存器)。
+ * 诊断寄存器会覆盖memory中同一地址范围的只读寄存器。
+ * @param {modbus_service_t*} service modbus service对象。
+ * @param {bool_t} enable 是否启用。
+ * @param {uint16_t} addr 起始地址。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_service_set_diag_registers(modbus_service_t* service, bool_t enable, uint16_t addr);
+
+/**
+ * @method modbus_service_get_connections_count
+ * 获取当前的连接数(即存在的modbus service对象的个数)。
+ * @return {uint32_t} 返回连接数。
+ */
+uint32_t modbus_service_get_connections_count(void);
+
+/**
+ * @class modbus_service_conn_stats_t
+ * TCP连接的统计数据(全部连接)。
+ */
+typedef struct _modbus_service_conn_stats_t {
+  /**
+   * @property {uint32_t} active
+   * @annotation ["readable"]
+   * 当前的连接数(即存在的modbus service对象的个数，包括已经关闭还没有销毁的)。
+   */
+  uint32_t active;
+  /**
+   * @property {uint32_t} peak
+   * @annotation ["readable"]
+   * 最大的连接数。
+   */
+  uint32_t peak;
+  /**
+   * @property {uint32_t} reaped
+   * @annotation ["readable"]
+   * 因为空闲超时关闭的连接数。
+   */
+  uint32_t reaped;
+  /**
+   * @property {uint32_t} evicted
+   * @annotation ["readable"]
+   * 因为超过连接数上限关闭的连接数。
+   */
+  uint32_t evicted;
+} modbus_service_conn_stats_t;
+
+/**
+ * @method modbus_service_set_idle_timeout
+ * 设置TCP连接的空闲超时时间(全部连接共用)。
+ *
+ * 通过modbus_service_create创建的TCP连接按最后活动时间放在一个链表中，收到请求时移到表尾
+ * (最多每MODBUS_SERVICE_IDLE_TOUCH_INTERVAL毫秒一次)，超时的连接总是在表头，modbus_service_reap_idle只需要检查表头。
+ * 超时的连接会被shutdown，由所在的事件循环在读取失败时关闭并销毁。
+ *
+ * > 超时时间要大于延迟回复的超时时间，否则等待延迟回复的连接可能被关闭。
+ *
+ * @param {uint32_t} idle_timeout 超时时间(毫秒)，为0时不限制。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_service_set_idle_timeout(uint32_t idle_timeout);
+
+/**
+ * @method modbus_service_get_idle_timeout
+ * 获取TCP连接的空闲超时时间。
+ * @return {uint32_t} 返回超时时间(毫秒)。
+ */
+uint32_t modbus_service_get_idle_timeout(void);
+
+/**
+ * @method modbus_service_set_max_connections
+ * 设置TCP连接数上限(全部连接共用)。
+ *
+ * 新连接使连接数超过上限时，关闭最久没有活动的连接。
+ *
+ * @param {uint32_t} max_connections 连接数上限，为0时不限制。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_service_set_max_connections(uint32_t max_connections);
+
+/**
+ * @method modbus_service_reap_idle
+ * 关闭空闲超时的TCP连接。
+ *
+ * EPOLL后端和esm中运行的缺省后端会定期调用，其它情况需要自己定期调用。
+ *
+ * @return {uint32_t} 返回本次关闭的连接数。
+ */
+uint32_t modbus_service_reap_idle(void);
+
+/**
+ * @method modbus_service_get_conn_stats
+ * 获取TCP连接的统计数据。
+ * @param {modbus_service_conn_stats_t*} stats 用于返回统计数据。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_service_get_conn_stats(modbus_service_conn_stats_t* stats);
+
+/**
+ * @class modbus_service_pool_stats_t
+ * service对象池的统计数据。
+ */
+typedef struct _modbus_service_pool_stats_t {
+  /**
+   * @property {uint32_t} size
+   * @annotation ["readable"]
+   * 对象池的容量。
+   */
+  uint32_t size;
+  /**
+   * @property {uint32_t} free
+   * @annotation ["readable"]
+   * 对象池中空闲的对象个数。
+   */
+  uint32_t free;
+  /**
+   * @property {uint32_t} allocs
+   * @annotation ["readable"]
+   * 从堆中分配service对象的次数(包括预先分配的)。
+   */
+  uint32_t allocs;
+  /**
+   * @property {uint32_t} reuses
+   * @annotation ["readable"]
+   * 从对象池中取出service对象的次数。
+   */
+  uint32_t reuses;
+} modbus_service_pool_stats_t;
+
+/**
+ * @method modbus_service_set_pool_size
+ * 设置service对象池的容量(全部连接共用)，并预先分配对象。
+ *
+ * 连接断开时对象放回池中(池满时释放)，新连接优先使用池中的对象。
+ * 收发缓冲区内嵌在对象中，预读缓冲区(见modbus_service_set_read_ahead)和延迟回复的上下文跟随对象留在池中，
+ * 所以连接数不超过容量时，创建和销毁service都不需要分配内存。EPOLL后端的连接节点也按同样的容量缓存。
+ *
+ * > 每个连接的io流(tk_iostream_tcp_create)和esm的事件源由后端在接受连接时创建，不在池中。
+ *
+ * @param {uint32_t} size 容量，为0时释放全部缓存的对象。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_service_set_pool_size(uint32_t size);
+
+/**
+ * @method modbus_service_get_pool_stats
+ * 获取service对象池的统计数据。
+ * @param {modbus_service_pool_stats_t*} stats 用于返回统计数据。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_service_get_pool_stats(modbus_service_pool_stats_t* stats);
+
+/**
+ * @method modbus_service_get_stats
+ * 获取统计数据的快照。
+ * @param {modbus_service_t*} service modbus service对象。
+ * @param {modbus_service_stats_t*} stats 用于返回统计数据。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_service_get_stats(modbus_service_t* service, modbus_service_stats_t* stats);
+
+/**
+ * @method modbus_service_reset_stats
+ * 清除统计数据。
+ * @param {modbus_service_t*} service modbus service对象。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_service_reset_stats(modbus_service_t* service);
+
+/**
+ * @method modbus_service_stats_to_str
+ * 把统计数据以文本的形式追加到str中(只输出非0的项)。
+ * @param {const modbus_service_stats_t*} stats 统计数据。
+ * @param {str_t*} str 用于返回结果。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_service_stats_to_str(const modbus_service_stats_t* stats, str_t* str);
+
+/**
+ * @method modbus_service_set_deferred_timeout
+ * 启用延迟回复。
+ *
+ * 启用后，modbus_memory_t的回调函数中可以调用modbus_service_defer延迟回复当前请求，
+ * 不用在回调函数中等待硬件或者下游设备，稍后(可以在其它线程)调用modbus_service_complete_deferred
+ * 或者modbus_service_fail_deferred完成回复。
+ *
+ * * 等待回复期间不再读取该连接的请求，以保证回复的顺序和请求的顺序一致。
+ * * 超时后回复异常timeout_code。关联到esm(包括TCP服务)或者使用modbus_service_run时自动检查，
+ *   其它情况需要定期调用modbus_service_check_deferred_timeout检查。
+ * * 只支持功能码0x01-0x06/0x0F/0x10/0x16/0x17。
+ *
+ * @param {modbus_service_t*} service modbus service对象。
+ * @param {uint32_t} timeout 超时时间(毫秒)，为0时不支持延迟回复。
+ * @param {modbus_exeption_code_t} timeout_code 超时时回复的异常码，为0时使用MODBUS_EXCEPTION_SERVER_DEVICE_BUSY(网关可以使用MODBUS_EXCEPTION_GATEWAY_TARGET_DEVICE_FAILED_TO_RESPOND)。
+ * @return {ret_t} 返回RET_OK表示成功，超过MODBUS_SERVICE_MAX_DEFERRED个连接时返回RET_EXCEED_RANGE，否则表示失败。
+ */
+ret_t modbus_service_set_deferred_timeout(modbus_service_t* service, uint32_t timeout,
+                                          modbus_exeption_code_t timeout_code);
+
+/**
+ * @method modbus_service_defer
+ * 延迟回复当前请求(只能在modbus_memory_t的回调函数中调用)。
+ *
+ * 调用后回调函数返回RET_OK即可(回调函数返回其它值时取消延迟，按原来的方式回复异常)。
+ *
+ *```c
+ * static ret_t my_read_registers(modbus_memory_t* memory, uint16_t addr, uint16_t count,
+ *                                uint16_t* buff) {
+ *   uint32_t token = modbus_service_defer();
+ *   if (token == 0) {
+ *     return RET_NOT_IMPL;
+ *   }
+ *   start_async_read(token, addr, count);
+ *   return RET_OK;
+ * }
+ *
+ * //读取完成后(可以在其它线程)
+ * modbus_service_complete_deferred(token, buff, count * 2);
+ *```
+ *
+ * @return {uint32_t} 返回token，返回0表示当前请求不支持延迟回复。
+ */
+uint32_t modbus_service_defer(void);
+
+/**
+ * @method modbus_service_complete_deferred
+ * 完成延迟回复(可以在任何线程中调用)。
+ * @param {uint32_t} token modbus_service_defer返回的token。
+ * @param {const void*} data 读请求的数据(格式和modbus_memory_t回调函数的buff相同)，写请求为NULL。
+ * @param {uint32_t} size 数据的字节数。
+ * @return {ret_t} 返回RET_OK表示成功，RET_NOT_FOUND表示已经超时或者连接已经断开。
+ */
+ret_t modbus_service_complete_deferred(uint32_t token, const void* data, uint32_t size);
+
+/**
+ * @method modbus_service_fail_deferred
+ * 用异常完成延迟回复(可以在任何线程中调用)。
+ * @param {uint32_t} token modbus_service_defer返回的token。
+ * @param {modbus_exeption_code_t} code 异常码。
+ * @return {ret_t} 返回RET_OK表示成功，RET_NOT_FOUND表示已经超时或者连接已经断开。
+ */
+ret_t modbus_service_fail_deferred(uint32_t token, modbus_exeption_code_t code);
+
+/**
+ * @method modbus_service_check_deferred_timeout
+ * 检查延迟回复是否超时，超时则回复异常。
+ * @param {modbus_service_t*} service modbus service对象，为NULL时检查全部service。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_service_check_deferred_timeout(modbus_service_t* service);
+
+/**
+ * @method modbus_service_set_rate_limit
+ * 设置连接的速率限制(令牌桶)。
+ *
+ * 超过限制的请求回复异常MODBUS_EXCEPTION_SERVER_DEVICE_BUSY(RTU广播请求直接丢弃)，
+ * 并计入stats.num_shed_rate_limited。
+ *
  * @param {modbus_service_t*} service modbus service对象。
+ * @param {uint32_t} rate 每秒最多处理的请求数，为0时不限制。
+ * @param {uint32_t} burst 允许的突发请求数，为0时等于rate。
  * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
  */
+ret_t modbus_service_set_rate_limit(modbus_service_t* service, uint32_t rate, uint32_t burst);
+
+/**
+ * @method modbus_service_set_max_in_flight
+ * 设置全部连接同时处理中的请求数上限。
+ *
+ * 请求从收到到回复完成(包括延迟回复)都算处理中，超过上限的请求回复异常
+ * MODBUS_EXCEPTION_SERVER_DEVICE_BUSY，并计入stats.num_shed_in_flight。
+ * 计数是全局的，上限由各个service自己设置(一般在同一个服务的所有连接中使用相同的值)。
+ *
+ * @param {modbus_service_t*} service modbus service对象。
+ * @param {uint32_t} max_in_flight 上限，为0时不限制。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_service_set_max_in_flight(modbus_service_t* service, uint32_t max_in_flight);
+
+/**
+ * @method modbus_service_get_in_flight_count
+ * 获取全部连接中处理中的请求数(只统计设置了max_in_flight的service)。
+ * @return {uint32_t} 返回处理中的请求数。
+ */
+uint32_t modbus_service_get_in_flight_count(void);
+
+/**
+ * @method modbus_service_enable_thread_safe
+ * 预先创建全局数据(连接数、处理中的请求数和延迟回复)使用的锁。
+ *
+ * 多个线程同时运行service(如modbus_service_args_t的listeners大于1)时，在启动线程前调用。
+ *
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_service_enable_thread_safe(void);
+
+/**
+ * @method modbus_service_run
+ * 阻塞运行，直到调用modbus_service_quit或者连接断开。
+ *
+ * 阻塞在等待数据上(不按固定间隔休眠)，数据到达时立即处理请求。
+ * 有等待中的延迟回复时，阻塞到回复完成或者超时。
+ *
+ * @param {modbus_service_t*} service modbus service对象。
+ * @return {ret_t} 返回RET_OK表示调用了modbus_service_quit，RET_IO表示连接断开，否则表示失败。
+ */
 ret_t modbus_service_run(modbus_service_t* service);
 
+/**
+ * @method modbus_service_quit
+ * 让modbus_service_run返回(可以在其它线程中调用，在modbus_service_run之前调用也有效)。
+ *
+ * > 正在等待数据或者延迟回复时直接唤醒。
+ * > 在其它线程中调用时，应该先调用modbus_service_enable_thread_safe(创建用于同步的锁)。
+ * > 流没有fd(如内存流)或者在Windows上时，等待数据最迟MODBUS_SERVICE_RUN_WAIT_TIME毫秒后返回。
+ *
+ * @param {modbus_service_t*} service modbus service对象。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_service_quit(modbus_service_t* service);
+
 END_C_DECLS
 
 #endif /*TK_MODBUS_SERVICE_H*/
@@ -0,0 +1,429 @@
+/**
+ * File:   modbus_service_epoll.c
+ * Author: AWTK Develop Team
+ * Brief:  modbus service tcp with epoll (edge-triggered)
+ *
+ * Copyright (c) 2023 - 2025 Guangzhou ZHIYUAN Electronics Co.,Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * License file for more details.
+ *
+ */
+
+/**
+ * History:
+ * ================================================================
+ * 2026-10-19 Li XianJing <lixianjing@zlg.cn> created
+ *
+ */
+
+#include "modbus_service_epoll.h"
+
+#if defined(WITH_SOCKET) && defined(__linux__) && MODBUS_WITH_TCP
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "tkc/socket_helper.h"
+#include "streams/inet/iostream_tcp.h"
+
+#define MODBUS_SERVICE_EPOLL_EVENTS_NR 64
+
+/*有延迟回复等待中的连接，每隔多久检查一次超时(毫秒)*/
+#define MODBUS_SERVICE_EPOLL_DEFERRED_CHECK_INTERVAL 10
+
+/*设置了空闲超时时，每隔多久检查一次空闲连接(毫秒)*/
+#define MODBUS_SERVICE_EPOLL_IDLE_CHECK_INTERVAL 100
+
+typedef struct _modbus_service_epoll_conn_t {
+  modbus_service_t* service;
+  /*等待延迟回复，暂停读取(边沿触发，恢复后要主动读取已经收到的数据)*/
+  bool_t stalled;
+  struct _modbus_service_epoll_conn_t* prev;
+  struct _modbus_service_epoll_conn_t* next;
+} modbus_service_epoll_conn_t;
+
+struct _modbus_service_epoll_t {
+  int epfd;
+  int listen_fd;
+  /*用于唤醒(延迟回复完成、停止)*/
+  int event_fd;
+  bool_t quit;
+  uint32_t connections;
+  uint32_t stalled;
+  modbus_service_args_t* args;
+  modbus_service_epoll_conn_t* conns;
+  /*断开的连接节点(最多args->pool_size个)，给新连接使用*/
+  modbus_service_epoll_conn_t* free_conns;
+  uint32_t free_conns_nr;
+};
+
+static modbus_service_epoll_conn_t* modbus_service_epoll_alloc_conn(modbus_service_epoll_t* loop) {
+  modbus_service_epoll_conn_t* conn = loop->free_conns;
+
+  if (conn == NULL) {
+    return TKMEM_ZALLOC(modbus_service_epoll_conn_t);
+  }
+
+  loop->free_conns = conn->next;
+  loop->free_conns_nr--;
+  memset(conn, 0x00, sizeof(*conn));
+
+  return conn;
+}
+
+static ret_t modbus_service_epoll_free_conn(modbus_service_epoll_t* loop,
+                                            modbus_service_epoll_conn_t* conn) {
+  if (loop->free_conns_nr < loop->args->pool_size) {
+    conn->next = loop->free_conns;
+    loop->free_conns = conn;
+    loop->free_conns_nr++;
+  } else {
+    TKMEM_FREE(conn);
+  }
+
+  return RET_OK;
+}
+
+static ret_t modbus_service_epoll_wakeup(modbus_service_epoll_t* loop) {
+  uint64_t value = 1;
+
+  return write(loop->event_fd, &value, sizeof(value)) == sizeof(value) ? RET_OK : RET_FAIL;
+}
+
+static ret_t modbus_service_epoll_on_resumed(modbus_service_t* service, void* ctx) {
+  return modbus_service_epoll_wakeup((modbus_service_epoll_t*)ctx);
+}
+
+static ret_t modbus_service_epoll_add_fd(modbus_service_epoll_t* loop, int fd, void* ptr) {
+  struct epoll_event ev;
+
+  memset(&ev, 0x00, sizeof(ev));
+  ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+  ev.data.ptr = ptr;
+
+  return epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) == 0 ? RET_OK : RET_FAIL;
+}
+
+static ret_t modbus_service_epoll_close_conn(modbus_service_epoll_t* loop,
+                                             modbus_service_epoll_conn_t* conn) {
+  modbus_service_t* service = conn->service;
+  tk_iostream_t* io = service->common.io;
+  int fd = tk_object_get_prop_int(TK_OBJECT(io), TK_STREAM_PROP_FD, -1);
+
+  epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+  if (conn->prev != NULL) {
+    conn->prev->next = conn->next;
+  } else {
+    loop->conns = conn->next;
+  }
+  if (conn->next != NULL) {
+    conn->next->prev = conn->prev;
+  }
+  if (conn->stalled) {
+    loop->stalled--;
+  }
+  loop->connections--;
+
+  tk_service_destroy(&(service->service));
+  TK_OBJECT_UNREF(io);
+  modbus_service_epoll_free_conn(loop, conn);
+
+  return RET_OK;
+}
+
+static ret_t modbus_service_epoll_on_data(modbus_service_epoll_t* loop,
+                                          modbus_service_epoll_conn_t* conn) {
+  /*边沿触发，要读完已经收到的全部数据*/
+  ret_t ret = modbus_service_dispatch_available(conn->service);
+
+  if (ret == RET_IO) {
+    return modbus_service_epoll_close_conn(loop, conn);
+  }
+
+  if (ret == RET_BUSY) {
+    if (!conn->stalled) {
+      conn->stalled = TRUE;
+      loop->stalled++;
+    }
+  } else if (conn->stalled) {
+    conn->stalled = FALSE;
+    loop->stalled--;
+  }
+
+  return RET_OK;
+}
+
+static ret_t modbus_service_epoll_on_accept(modbus_service_epoll_t* loop) {
+  int sock = -1;
+
+  while ((sock = tk_tcp_accept(loop->listen_fd)) >= 0) {
+    modbus_service_t* service = NULL;
+    modbus_service_epoll_conn_t* conn = NULL;
+    tk_iostream_t* io = tk_iostream_tcp_create(sock);
+
+    if (io == NULL) {
+      tk_socket_close(sock);
+      continue;
+    }
+
+    service = (modbus_service_t*)modbus_service_create(io, loop->args);
+    if (service == NULL) {
+      TK_OBJECT_UNREF(io);
+      continue;
+    }
+
+    /*非阻塞读取，不完整的请求留在预读缓冲区中(见modbus_service_dispatch_available)*/
+    tk_socket_set_blocking(sock, FALSE);
+    if (modbus_service_set_read_ahead(service,
+                                      tk_max(loop->args->read_ahead, MODBUS_SERVICE_WBUFFER_SIZE)) !=
+        RET_OK) {
+      tk_service_destroy(&(service->service));
+      TK_OBJECT_UNREF(io);
+      continue;
+    }
+
+    conn = modbus_service_epoll_alloc_conn(loop);
+    if (conn == NULL || modbus_service_epoll_add_fd(loop, sock, conn) != RET_OK) {
+      log_warn("epoll add connection failed\n");
+      if (conn != NULL) {
+        modbus_service_epoll_free_conn(loop, conn);
+      }
+      tk_service_destroy(&(service->service));
+      TK_OBJECT_UNREF(io);
+      continue;
+    }
+
+    conn->service = service;
+    conn->next = loop->conns;
+    if (loop->conns != NULL) {
+      loop->conns->prev = conn;
+    }
+    loop->conns = conn;
+    loop->connections++;
+    modbus_service_set_on_resumed(service, modbus_service_epoll_on_resumed, loop);
+  }
+
+  return RET_OK;
+}
+
+static ret_t modbus_service_epoll_on_wakeup(modbus_service_epoll_t* loop) {
+  uint64_t value = 0;
+  modbus_service_epoll_conn_t* iter = loop->conns;
+
+  while (read(loop->event_fd, &value, sizeof(value)) == sizeof(value)) {
+  }
+
+  while (iter != NULL && loop->stalled > 0) {
+    modbus_service_epoll_conn_t* next = iter->next;
+    if (iter->stalled) {
+      modbus_service_epoll_on_data(loop, iter);
+    }
+    iter = next;
+  }
+
+  return RET_OK;
+}
+
+/*多个监听socket绑定同一个端口，由内核把新连接分配到各个socket*/
+static int modbus_service_epoll_listen_reuse_port(int port) {
+  int on = 1;
+  struct sockaddr_in addr;
+  int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  return_value_if_fail(sock >= 0, -1);
+
+  memset(&addr, 0x00, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 ||
+      setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0 ||
+      bind(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(sock, SOMAXCONN) != 0) {
+    log_warn("listen on port %d with SO_REUSEPORT failed\n", port);
+    close(sock);
+    return -1;
+  }
+
+  return sock;
+}
+
+modbus_service_epoll_t* modbus_service_epoll_create(modbus_service_args_t* args, int port) {
+  modbus_service_epoll_t* loop = NULL;
+  return_value_if_fail(args != NULL, NULL);
+
+  loop = TKMEM_ZALLOC(modbus_service_epoll_t);
+  return_value_if_fail(loop != NULL, NULL);
+
+  loop->args = args;
+  loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+  loop->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  loop->listen_fd = args->listeners > 1 ? modbus_service_epoll_listen_reuse_port(port)
+                                        : tk_tcp_listen(port);
+  goto_error_if_fail(loop->epfd >= 0 && loop->event_fd >= 0 && loop->listen_fd >= 0);
+
+  tk_socket_set_blocking(loop->listen_fd, FALSE);
+  goto_error_if_fail(modbus_service_epoll_add_fd(loop, loop->listen_fd, loop) == RET_OK);
+  goto_error_if_fail(modbus_service_epoll_add_fd(loop, loop->event_fd, &(loop->event_fd)) ==
+                     RET_OK);
+
+  return loop;
+error:
+  if (loop->listen_fd >= 0) {
+    tk_socket_close(loop->listen_fd);
+  }
+  if (loop->event_fd >= 0) {
+    close(loop->event_fd);
+  }
+  if (loop->epfd >= 0) {
+    close(loop->epfd);
+  }
+  TKMEM_FREE(loop);
+
+  return NULL;
+}
+
+int modbus_service_epoll_get_fd(modbus_service_epoll_t* loop) {
+  return_value_if_fail(loop != NULL, -1);
+
+  return loop->epfd;
+}
+
+uint32_t modbus_service_epoll_get_check_interval(modbus_service_epoll_t* loop) {
+  return_value_if_fail(loop != NULL, 0);
+
+  if (loop->stalled > 0) {
+    return MODBUS_SERVICE_EPOLL_DEFERRED_CHECK_INTERVAL;
+  }
+
+  if (modbus_service_get_idle_timeout() > 0) {
+    return MODBUS_SERVICE_EPOLL_IDLE_CHECK_INTERVAL;
+  }
+
+  return 0;
+}
+
+ret_t modbus_service_epoll_dispatch(modbus_service_epoll_t* loop, int32_t timeout) {
+  int i = 0;
+  int n = 0;
+  bool_t woken = FALSE;
+  uint32_t interval = 0;
+  struct epoll_event events[MODBUS_SERVICE_EPOLL_EVENTS_NR];
+  return_value_if_fail(loop != NULL, RET_BAD_PARAMS);
+
+  interval = modbus_service_epoll_get_check_interval(loop);
+  if (interval > 0 && (timeout < 0 || timeout > (int32_t)interval)) {
+    timeout = interval;
+  }
+
+  n = epoll_wait(loop->epfd, events, ARRAY_SIZE(events), timeout);
+  for (i = 0; i < n; i++) {
+    void* ptr = events[i].data.ptr;
+
+    if (ptr == loop) {
+      modbus_service_epoll_on_accept(loop);
+    } else if (ptr == &(loop->event_fd)) {
+      woken = TRUE;
+    } else {
+      modbus_service_epoll_on_data(loop, (modbus_service_epoll_conn_t*)ptr);
+    }
+  }
+
+  /*处理完本轮事件再恢复暂停的连接，避免关闭本轮事件中还要用到的连接*/
+  if (woken) {
+    modbus_service_epoll_on_wakeup(loop);
+  }
+
+  if (loop->stalled > 0) {
+    /*超时后回复异常，并通过on_resumed唤醒*/
+    modbus_service_check_deferred_timeout(NULL);
+  }
+
+  /*超时的连接被shutdown，下一轮收到事件时关闭*/
+  modbus_service_reap_idle();
+
+  return n >= 0 ? RET_OK : RET_FAIL;
+}
+
+ret_t modbus_service_epoll_run(modbus_service_epoll_t* loop) {
+  return_value_if_fail(loop != NULL, RET_BAD_PARAMS);
+
+  while (!loop->quit) {
+    modbus_service_epoll_dispatch(loop, -1);
+  }
+
+  return RET_OK;
+}
+
+ret_t modbus_service_epoll_stop(modbus_service_epoll_t* loop) {
+  return_value_if_fail(loop != NULL, RET_BAD_PARAMS);
+
+  loop->quit = TRUE;
+
+  return modbus_service_epoll_wakeup(loop);
+}
+
+uint32_t modbus_service_epoll_get_connections_count(modbus_service_epoll_t* loop) {
+  return_value_if_fail(loop != NULL, 0);
+
+  return loop->connections;
+}
+
+ret_t modbus_service_epoll_destroy(modbus_service_epoll_t* loop) {
+  return_value_if_fail(loop != NULL, RET_BAD_PARAMS);
+
+  while (loop->conns != NULL) {
+    modbus_service_epoll_close_conn(loop, loop->conns);
+  }
+
+  while (loop->free_conns != NULL) {
+    modbus_service_epoll_conn_t* next = loop->free_conns->next;
+    TKMEM_FREE(loop->free_conns);
+    loop->free_conns = next;
+  }
+
+  tk_socket_close(loop->listen_fd);
+  close(loop->event_fd);
+  close(loop->epfd);
+  TKMEM_FREE(loop);
+
+  return RET_OK;
+}
+
+#else
+modbus_service_epoll_t* modbus_service_epoll_create(modbus_service_args_t* args, int port) {
+  return NULL;
+}
+
+int modbus_service_epoll_get_fd(modbus_service_epoll_t* loop) {
+  return -1;
+}
+
+ret_t modbus_service_epoll_dispatch(modbus_service_epoll_t* loop, int32_t timeout) {
+  return RET_NOT_IMPL;
+}
+
+ret_t modbus_service_epoll_run(modbus_service_epoll_t* loop) {
+  return RET_NOT_IMPL;
+}
+
+ret_t modbus_service_epoll_stop(modbus_service_epoll_t* loop) {
+  return RET_NOT_IMPL;
+}
+
+uint32_t modbus_service_epoll_get_connections_count(modbus_service_epoll_t* loop) {
+  return 0;
+}
+
+uint32_t modbus_service_epoll_get_check_interval(modbus_service_epoll_t* loop) {
+  return 0;
+}
+
+ret_t modbus_service_epoll_destroy(modbus_service_epoll_t* loop) {
+  return RET_NOT_IMPL;
+}
+#endif /*WITH_SOCKET && __linux__ && MODBUS_WITH_TCP*/
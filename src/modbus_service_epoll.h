@@ -0,0 +1,117 @@
+/**
+ * File:   modbus_service_epoll.h
+ * Author: AWTK Develop Team
+ * Brief:  modbus service tcp with epoll (edge-triggered)
+ *
+ * Copyright (c) 2023 - 2025 Guangzhou ZHIYUAN Electronics Co.,Ltd.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * License file for more details.
+ *
+ */
+
+/**
+ * History:
+ * ================================================================
+ * 2026-10-19 Li XianJing <lixianjing@zlg.cn> created
+ *
+ */
+
+#ifndef TK_MODBUS_SERVICE_EPOLL_H
+#define TK_MODBUS_SERVICE_EPOLL_H
+
+#include "modbus_service.h"
+
+BEGIN_C_DECLS
+
+struct _modbus_service_epoll_t;
+typedef struct _modbus_service_epoll_t modbus_service_epoll_t;
+
+/**
+ * @class modbus_service_epoll_t
+ * 基于epoll(边沿触发)的modbus service TCP(仅Linux)。
+ *
+ * 监听socket和全部连接都放在一个epoll中，每次分发的开销只和有事件的连接数相关，和连接总数无关。
+ * 一般通过modbus_service_args_t的backend选择(见modbus_service_tcp_start_by_args)，也可以直接使用：
+ *
+ *```c
+ * modbus_service_epoll_t* loop = modbus_service_epoll_create(&args, 502);
+ * modbus_service_epoll_run(loop);
+ * modbus_service_epoll_destroy(loop);
+ *```
+ */
+
+/**
+ * @method modbus_service_epoll_create
+ * 创建监听socket和epoll。
+ *
+ * args->listeners大于1时，监听socket设置SO_REUSEPORT，可以在多个线程中各创建一个对象监听同一个端口。
+ * @param {modbus_service_args_t*} args modbus 服务参数(运行期间不能释放)。
+ * @param {int} port 端口。
+ * @return {modbus_service_epoll_t*} 返回对象，不支持epoll时返回NULL。
+ */
+modbus_service_epoll_t* modbus_service_epoll_create(modbus_service_args_t* args, int port);
+
+/**
+ * @method modbus_service_epoll_get_fd
+ * 获取epoll的fd(有事件时可读，可以放到其它事件循环中)。
+ * @param {modbus_service_epoll_t*} loop 对象。
+ * @return {int} 返回fd。
+ */
+int modbus_service_epoll_get_fd(modbus_service_epoll_t* loop);
+
+/**
+ * @method modbus_service_epoll_dispatch
+ * 等待并分发事件(接受新连接、处理请求、关闭断开的连接)。
+ * @param {modbus_service_epoll_t*} loop 对象。
+ * @param {int32_t} timeout 超时时间(毫秒)，为-1时一直等待。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_service_epoll_dispatch(modbus_service_epoll_t* loop, int32_t timeout);
+
+/**
+ * @method modbus_service_epoll_run
+ * 阻塞运行，直到调用modbus_service_epoll_stop。
+ * @param {modbus_service_epoll_t*} loop 对象。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_service_epoll_run(modbus_service_epoll_t* loop);
+
+/**
+ * @method modbus_service_epoll_stop
+ * 停止运行(可以在其它线程中调用)。
+ * @param {modbus_service_epoll_t*} loop 对象。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_service_epoll_stop(modbus_service_epoll_t* loop);
+
+/**
+ * @method modbus_service_epoll_get_connections_count
+ * 获取当前的连接数。
+ * @param {modbus_service_epoll_t*} loop 对象。
+ * @return {uint32_t} 返回连接数。
+ */
+uint32_t modbus_service_epoll_get_connections_count(modbus_service_epoll_t* loop);
+
+/**
+ * @method modbus_service_epoll_get_check_interval
+ * 获取定期检查(延迟回复超时和空闲连接)的间隔。
+ * 在esm中运行时，没有事件也要按这个间隔调用modbus_service_epoll_dispatch(超时时间为0)。
+ * @param {modbus_service_epoll_t*} loop 对象。
+ * @return {uint32_t} 返回间隔(毫秒)，为0时不需要检查。
+ */
+uint32_t modbus_service_epoll_get_check_interval(modbus_service_epoll_t* loop);
+
+/**
+ * @method modbus_service_epoll_destroy
+ * 关闭全部连接和监听socket，销毁对象。
+ * @param {modbus_service_epoll_t*} loop 对象。
+ * @return {ret_t} 返回RET_OK表示成功，否则表示失败。
+ */
+ret_t modbus_service_epoll_destroy(modbus_service_epoll_t* loop);
+
+END_C_DECLS
+
+#endif /*TK_MODBUS_SERVICE_EPOLL_H*/
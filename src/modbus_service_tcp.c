@@ -20,31 +20,345 @@
  */
 
 #include "modbus_service_tcp.h"
-#ifdef WITH_SOCKET
+#include "modbus_service_epoll.h"
+#if defined(WITH_SOCKET) && MODBUS_WITH_TCP
 
+#include "tkc/thread.h"
+#include "tkc/timer_manager.h"
+#include "tkc/event_source_fd.h"
+#include "tkc/event_source_timer.h"
+#include "tkc/socket_helper.h"
 #include "streams/inet/iostream_tcp.h"
 
+typedef struct _modbus_service_tcp_listener_t {
+  tk_thread_t* thread;
+  modbus_service_epoll_t* loop;
+} modbus_service_tcp_listener_t;
+
 static event_source_t* s_service_source = NULL;
+static modbus_service_epoll_t* s_service_epoll = NULL;
+
+/*多个监听线程(SO_REUSEPORT)*/
+static uint32_t s_listeners_nr = 0;
+static bool_t s_listeners_blocking = FALSE;
+static modbus_service_tcp_listener_t* s_listeners = NULL;
+
+/*缺省后端在esm中定期关闭空闲连接(毫秒)*/
+#define MODBUS_SERVICE_TCP_IDLE_CHECK_INTERVAL 100
+
+static timer_manager_t* s_reaper_timer_manager = NULL;
+static event_source_t* s_reaper_source = NULL;
+
+/*EPOLL后端在esm中运行时，没有事件也要定期检查延迟回复超时和空闲连接*/
+static uint32_t s_epoll_check_id = TK_INVALID_ID;
+static uint32_t s_epoll_check_interval = 0;
+
+static ret_t on_reaper_timer(const timer_info_t* info) {
+  (void)info;
+  modbus_service_reap_idle();
+
+  return RET_REPEAT;
+}
+
+static ret_t modbus_service_tcp_schedule_epoll_check(void);
+
+static ret_t on_epoll_check_timer(const timer_info_t* info) {
+  (void)info;
+  if (s_service_epoll == NULL) {
+    s_epoll_check_id = TK_INVALID_ID;
+    s_epoll_check_interval = 0;
+    return RET_REMOVE;
+  }
+
+  modbus_service_epoll_dispatch(s_service_epoll, 0);
+  if (modbus_service_epoll_get_check_interval(s_service_epoll) != s_epoll_check_interval) {
+    /*有连接等待延迟回复时检查得更频繁*/
+    s_epoll_check_id = TK_INVALID_ID;
+    s_epoll_check_interval = 0;
+    modbus_service_tcp_schedule_epoll_check();
+    return RET_REMOVE;
+  }
+
+  return RET_REPEAT;
+}
+
+static ret_t modbus_service_tcp_schedule_epoll_check(void) {
+  uint32_t interval = 0;
+
+  if (s_reaper_timer_manager == NULL || s_service_epoll == NULL) {
+    return RET_OK;
+  }
+
+  interval = modbus_service_epoll_get_check_interval(s_service_epoll);
+  if (interval == s_epoll_check_interval) {
+    return RET_OK;
+  }
+
+  if (s_epoll_check_id != TK_INVALID_ID) {
+    timer_manager_remove(s_reaper_timer_manager, s_epoll_check_id);
+    s_epoll_check_id = TK_INVALID_ID;
+  }
+
+  s_epoll_check_interval = interval;
+  if (interval > 0) {
+    s_epoll_check_id =
+        timer_manager_add(s_reaper_timer_manager, on_epoll_check_timer, NULL, interval);
+  }
+
+  return RET_OK;
+}
+
+static ret_t on_reaper_source_destroy(void* ctx, event_t* e) {
+  (void)ctx;
+  (void)e;
+  s_epoll_check_id = TK_INVALID_ID;
+  s_epoll_check_interval = 0;
+  s_reaper_source = NULL;
+  timer_manager_destroy(s_reaper_timer_manager);
+  s_reaper_timer_manager = NULL;
+
+  return RET_OK;
+}
+
+static ret_t modbus_service_tcp_start_reaper(event_source_manager_t* esm) {
+  s_reaper_timer_manager = timer_manager_create();
+  return_value_if_fail(s_reaper_timer_manager != NULL, RET_OOM);
+
+  /*EPOLL后端在modbus_service_epoll_dispatch中检查空闲连接*/
+  if (s_service_epoll == NULL) {
+    timer_manager_add(s_reaper_timer_manager, on_reaper_timer, NULL,
+                      MODBUS_SERVICE_TCP_IDLE_CHECK_INTERVAL);
+  }
+  s_reaper_source = event_source_timer_create(s_reaper_timer_manager);
+  if (s_reaper_source == NULL) {
+    timer_manager_destroy(s_reaper_timer_manager);
+    s_reaper_timer_manager = NULL;
+    return RET_OOM;
+  }
+
+  emitter_on(EMITTER(s_reaper_source), EVT_DESTROY, on_reaper_source_destroy, NULL);
+  event_source_manager_add(esm, s_reaper_source);
+  TK_OBJECT_UNREF(s_reaper_source);
+
+  return RET_OK;
+}
+
+static ret_t modbus_service_tcp_stop_reaper(void) {
+  if (s_reaper_source != NULL && s_reaper_source->manager != NULL) {
+    return event_source_manager_remove(s_reaper_source->manager, s_reaper_source);
+  }
+
+  return RET_OK;
+}
 
 static ret_t on_service_source_destroy(void* ctx, event_t* e) {
   (void)ctx;
   (void)e;
   s_service_source = NULL;
+  if (s_service_epoll != NULL) {
+    modbus_service_epoll_destroy(s_service_epoll);
+    s_service_epoll = NULL;
+  }
+
+  return RET_OK;
+}
+
+static ret_t on_service_epoll_event(event_source_t* source) {
+  event_source_fd_t* event_source_fd = (event_source_fd_t*)source;
+
+  modbus_service_epoll_dispatch((modbus_service_epoll_t*)(event_source_fd->ctx), 0);
+  modbus_service_tcp_schedule_epoll_check();
+
+  return RET_OK;
+}
+
+/*
+ * 缺省后端由本模块接受连接，连接通过modbus_service_attach_to_event_source_manager加入esm，
+ * 等待延迟回复期间暂停读取，断开时销毁。
+ */
+static modbus_service_args_t* s_default_args = NULL;
+
+static ret_t on_service_client(event_source_t* source) {
+  tk_iostream_t* io = NULL;
+  tk_service_t* service = NULL;
+  event_source_fd_t* event_source_fd = (event_source_fd_t*)source;
+  int sock = tk_tcp_accept(event_source_fd->fd);
+  return_value_if_fail(sock >= 0, RET_OK);
+
+  io = tk_iostream_tcp_create(sock);
+  if (io == NULL) {
+    tk_socket_close(sock);
+    return RET_OK;
+  }
+
+  service = modbus_service_create(io, s_default_args);
+  if (service == NULL) {
+    TK_OBJECT_UNREF(io);
+    return RET_OK;
+  }
+
+  ((modbus_service_t*)service)->destroy_on_disconnect = TRUE;
+  if (modbus_service_attach_to_event_source_manager((modbus_service_t*)service, source->manager) !=
+      RET_OK) {
+    tk_service_destroy(service);
+    TK_OBJECT_UNREF(io);
+  }
+
+  return RET_OK;
+}
+
+static ret_t modbus_service_tcp_start_epoll(event_source_manager_t* esm,
+                                            modbus_service_epoll_t* loop) {
+  event_source_t* source = NULL;
+
+  s_service_epoll = loop;
+  if (esm == NULL) {
+    modbus_service_epoll_run(loop);
+    s_service_epoll = NULL;
+    return modbus_service_epoll_destroy(loop);
+  }
+
+  /*esm只需要等待epoll的fd，由epoll分发全部连接*/
+  source = event_source_fd_create(modbus_service_epoll_get_fd(loop), on_service_epoll_event, loop);
+  if (source == NULL) {
+    s_service_epoll = NULL;
+    modbus_service_epoll_destroy(loop);
+    return RET_OOM;
+  }
+
+  s_service_source = source;
+  emitter_on(EMITTER(source), EVT_DESTROY, on_service_source_destroy, NULL);
+  event_source_manager_add(esm, source);
+  TK_OBJECT_UNREF(source);
+
+  /*epoll的fd只在有事件时可读，超时检查由esm中的定时器驱动*/
+  if (modbus_service_tcp_start_reaper(esm) == RET_OK) {
+    modbus_service_tcp_schedule_epoll_check();
+  }
+
+  return RET_OK;
+}
+
+static void* modbus_service_tcp_listener_main(void* args) {
+  modbus_service_epoll_run((modbus_service_epoll_t*)args);
+
+  return NULL;
+}
+
+/*等待全部监听线程退出，然后关闭连接*/
+static ret_t modbus_service_tcp_destroy_listeners(void) {
+  uint32_t i = 0;
+  uint32_t nr = s_listeners_nr;
+  modbus_service_tcp_listener_t* listeners = s_listeners;
+
+  for (i = 0; i < nr; i++) {
+    tk_thread_destroy(listeners[i].thread);
+  }
+  for (i = 0; i < nr; i++) {
+    modbus_service_epoll_destroy(listeners[i].loop);
+  }
+
+  s_listeners = NULL;
+  s_listeners_nr = 0;
+  s_listeners_blocking = FALSE;
+  TKMEM_FREE(listeners);
+
+  return RET_OK;
+}
+
+static ret_t modbus_service_tcp_start_listeners(event_source_manager_t* esm,
+                                                modbus_service_args_t* args, int port) {
+  uint32_t i = 0;
+  uint32_t nr = args->listeners;
+
+  /*多个线程共用连接计数和延迟回复列表等全局状态*/
+  return_value_if_fail(modbus_service_enable_thread_safe() == RET_OK, RET_FAIL);
+  s_listeners = TKMEM_ZALLOCN(modbus_service_tcp_listener_t, nr);
+  return_value_if_fail(s_listeners != NULL, RET_OOM);
+
+  for (i = 0; i < nr; i++) {
+    modbus_service_tcp_listener_t* iter = s_listeners + i;
+
+    iter->loop = modbus_service_epoll_create(args, port);
+    if (iter->loop == NULL) {
+      break;
+    }
+
+    iter->thread = tk_thread_create(modbus_service_tcp_listener_main, iter->loop);
+    if (iter->thread == NULL || tk_thread_start(iter->thread) != RET_OK) {
+      if (iter->thread != NULL) {
+        tk_thread_destroy(iter->thread);
+        iter->thread = NULL;
+      }
+      modbus_service_epoll_destroy(iter->loop);
+      iter->loop = NULL;
+      break;
+    }
+    s_listeners_nr++;
+  }
+
+  if (s_listeners_nr == 0) {
+    TKMEM_FREE(s_listeners);
+    return RET_FAIL;
+  }
+
+  if (s_listeners_nr < nr) {
+    log_warn("only %u of %u listeners started\n", s_listeners_nr, nr);
+  }
+
+  if (esm == NULL) {
+    s_listeners_blocking = TRUE;
+    return modbus_service_tcp_destroy_listeners();
+  }
 
   return RET_OK;
 }
 
-static ret_t modbus_service_tcp_start_impl(event_source_manager_t* esm, const char* url,
+static ret_t modbus_service_tcp_start_impl(event_source_manager_t* esm, const char* url, int port,
                                            modbus_service_args_t* args) {
   event_source_t* source = NULL;
   return_value_if_fail(args != NULL, RET_BAD_PARAMS);
-  return_value_if_fail(s_service_source == NULL, RET_FAIL);
+  return_value_if_fail(!modbus_service_tcp_is_started(), RET_FAIL);
+
+  if (args->idle_timeout > 0) {
+    modbus_service_set_idle_timeout(args->idle_timeout);
+  }
+  if (args->max_connections > 0) {
+    modbus_service_set_max_connections(args->max_connections);
+  }
+  if (args->pool_size > 0) {
+    modbus_service_set_pool_size(args->pool_size);
+  }
+
+  if (args->listeners > 1) {
+    if (modbus_service_tcp_start_listeners(esm, args, port) == RET_OK) {
+      return RET_OK;
+    }
+    log_warn("SO_REUSEPORT listeners are not available, use one listener\n");
+  }
+
+  if (args->backend == MODBUS_SERVICE_BACKEND_EPOLL) {
+    modbus_service_epoll_t* loop = modbus_service_epoll_create(args, port);
+    if (loop != NULL) {
+      return modbus_service_tcp_start_epoll(esm, loop);
+    }
+    log_warn("epoll backend is not available, use default backend\n");
+  }
 
   return_value_if_fail(tk_service_start_ex(esm, url, modbus_service_create, args, &source) == RET_OK, RET_FAIL);
   return_value_if_fail(source != NULL, RET_FAIL);
 
   s_service_source = source;
   emitter_on(EMITTER(source), EVT_DESTROY, on_service_source_destroy, NULL);
+  if (esm != NULL) {
+    s_default_args = args;
+    ((event_source_fd_t*)source)->on_event = on_service_client;
+  }
+
+  /*EPOLL后端见modbus_service_tcp_start_epoll*/
+  if (esm != NULL && modbus_service_get_idle_timeout() > 0) {
+    modbus_service_tcp_start_reaper(esm);
+  }
 
   return RET_OK;
 }
@@ -60,7 +374,7 @@ ret_t modbus_service_tcp_start(event_source_manager_t* esm, modbus_memory_t* mem
   args.slave = slave;
   tk_snprintf(url, sizeof(url), "tcp://localhost:%d", port);
 
-  return modbus_service_tcp_start_impl(esm, url, &args);
+  return modbus_service_tcp_start_impl(esm, url, port, &args);
 }
 
 ret_t modbus_service_tcp_start_by_args(event_source_manager_t* esm, modbus_service_args_t* args, int port) {
@@ -81,21 +395,38 @@ ret_t modbus_service_tcp_start_by_args(event_source_manager_t* esm, modbus_servi
   if (!is_set_url) {
     tk_snprintf(url, sizeof(url), "tcp://localhost:%d", port);
   }
-  return modbus_service_tcp_start_impl(esm, url, args);
+  return modbus_service_tcp_start_impl(esm, url, port, args);
 }
 
 ret_t modbus_service_tcp_stop(void) {
-  if (s_service_source != NULL) {
+  modbus_service_tcp_stop_reaper();
+
+  if (s_listeners != NULL) {
+    uint32_t i = 0;
+    uint32_t nr = s_listeners_nr;
+    bool_t blocking = s_listeners_blocking;
+    modbus_service_tcp_listener_t* listeners = s_listeners;
+
+    for (i = 0; i < nr; i++) {
+      modbus_service_epoll_stop(listeners[i].loop);
+    }
+
+    /*阻塞运行时由modbus_service_tcp_start_by_args负责回收*/
+    return blocking ? RET_OK : modbus_service_tcp_destroy_listeners();
+  } else if (s_service_source != NULL) {
     event_source_manager_t* manager = s_service_source->manager;
     return_value_if_fail(manager != NULL, RET_FAIL);
     return event_source_manager_remove(manager, s_service_source);
+  } else if (s_service_epoll != NULL) {
+    /*阻塞运行的epoll*/
+    return modbus_service_epoll_stop(s_service_epoll);
   }
 
   return RET_OK;
 }
 
 bool_t modbus_service_tcp_is_started(void) {
-  return s_service_source != NULL;
+  return s_service_source != NULL || s_service_epoll != NULL || s_listeners != NULL;
 }
 
 #else
@@ -113,4 +444,4 @@ ret_t modbus_service_tcp_stop(void) {
 bool_t modbus_service_tcp_is_started(void) {
   return FALSE;
 }
-#endif /*WITH_SOCKET*/
+#endif /*WITH_SOCKET && MODBUS_WITH_TCP*/
@@ -48,6 +48,9 @@ ret_t modbus_service_tcp_start(event_source_manager_t* esm, modbus_memory_t* mem
 /**
  * @method modbus_service_tcp_start_by_args
  * 创建modbus service TCP。
+ *
+ * args->listeners大于1时(仅Linux)，启动多个监听线程，每个线程一个EPOLL后端，不使用esm，
+ * 要调用modbus_service_tcp_stop停止。多个线程共用args->memory，自定义的memory要自己保证线程安全。
  * @param {event_source_manager_t*} esm 事件管理对象(为NULL则阻塞运行)。
  * @param {modbus_service_args_t*} args modbus 服务参数。
  * @param {int} port 端口。
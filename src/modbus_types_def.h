@@ -66,6 +66,11 @@ typedef enum _modbus_function_code_t {
    * 写入单个HOLDING_REGISTER。
    */
   MODBUS_FC_WRITE_SINGLE_HOLDING_REGISTER = 6,
+  /**
+   * @const MODBUS_FC_DIAGNOSTICS
+   * 诊断(仅从站支持)。
+   */
+  MODBUS_FC_DIAGNOSTICS = 8,
   /**
    * @const MODBUS_FC_WRITE_MULTIPLE_COILS
    * 写入多个COILS。
@@ -76,11 +81,31 @@ typedef enum _modbus_function_code_t {
    * 写入多个HOLDING_REGISTERS。
    */
   MODBUS_FC_WRITE_MULTIPLE_HOLDING_REGISTERS = 16,
+  /**
+   * @const MODBUS_FC_READ_FILE_RECORD
+   * 读取文件记录。
+   */
+  MODBUS_FC_READ_FILE_RECORD = 20,
+  /**
+   * @const MODBUS_FC_WRITE_FILE_RECORD
+   * 写入文件记录。
+   */
+  MODBUS_FC_WRITE_FILE_RECORD = 21,
+  /**
+   * @const MODBUS_FC_MASK_WRITE_REGISTER
+   * 用AND/OR掩码修改单个HOLDING_REGISTER。
+   */
+  MODBUS_FC_MASK_WRITE_REGISTER = 22,
   /**
    * @const MODBUS_FC_WRITE_AND_READ_REGISTERS
    * 读写多个HOLDING_REGISTERS。
    */
-  MODBUS_FC_WRITE_AND_READ_REGISTERS = 23
+  MODBUS_FC_WRITE_AND_READ_REGISTERS = 23,
+  /**
+   * @const MODBUS_FC_READ_FIFO_QUEUE
+   * 读取FIFO队列。
+   */
+  MODBUS_FC_READ_FIFO_QUEUE = 24
 } modbus_function_code_t;
 
 /**
@@ -242,6 +267,34 @@ typedef struct _modbus_req_data_t {
   uint8_t* data_ex;
 } modbus_req_data_t, modbus_resp_data_t;
 
+/**
+ * @class modbus_file_record_t
+ * 文件记录(用于0x14/0x15功能码)。
+ * 文件中的每个记录是一个16位的数据，记录号从0开始，不超过MODBUS_MAX_FILE_RECORD_NUMBER。
+*/
+typedef struct _modbus_file_record_t {
+  /**
+   * @property {uint16_t} file_number
+   * 文件号(从1开始)。
+   */
+  uint16_t file_number;
+  /**
+   * @property {uint16_t} record_number
+   * 起始记录号。
+   */
+  uint16_t record_number;
+  /**
+   * @property {uint16_t} record_length
+   * 记录的个数。
+   */
+  uint16_t record_length;
+  /**
+   * @property {uint16_t*} data
+   * 数据(读取时用于返回数据，写入时只读)。
+   */
+  uint16_t* data;
+} modbus_file_record_t;
+
 #pragma pack(push, 1)
 /**
  * @class modbus_tcp_header_t
@@ -293,6 +346,18 @@ typedef struct _modbus_rtu_header_t {
 } modbus_rtu_header_t;
 #pragma pack(pop)
 
+/*诊断(0x08)子功能码*/
+#define MODBUS_DIAG_RETURN_QUERY_DATA 0x00
+#define MODBUS_DIAG_CLEAR_COUNTERS 0x0A
+#define MODBUS_DIAG_BUS_MESSAGE_COUNT 0x0B
+#define MODBUS_DIAG_BUS_COMM_ERROR_COUNT 0x0C
+#define MODBUS_DIAG_BUS_EXCEPTION_ERROR_COUNT 0x0D
+#define MODBUS_DIAG_SERVER_MESSAGE_COUNT 0x0E
+#define MODBUS_DIAG_SERVER_NO_RESPONSE_COUNT 0x0F
+#define MODBUS_DIAG_SERVER_NAK_COUNT 0x10
+#define MODBUS_DIAG_SERVER_BUSY_COUNT 0x11
+#define MODBUS_DIAG_BUS_CHAR_OVERRUN_COUNT 0x12
+
 #define MODBUS_MAX_PDU_SIZE 256
 #define MODBUS_MAX_READ_BITS 2000
 #define MODBUS_MAX_WRITE_BITS 1968
@@ -300,6 +365,131 @@ typedef struct _modbus_rtu_header_t {
 #define MODBUS_MAX_WRITE_REGISTERS 123
 #define MODBUS_MAX_WR_READ_REGISTERS 125
 #define MODBUS_MAX_WR_WRITE_REGISTERS 121
+#define MODBUS_MAX_FIFO_COUNT 31
+#define MODBUS_FILE_RECORD_REF_TYPE 6
+#define MODBUS_MAX_FILE_RECORD_NUMBER 0x270F
+#define MODBUS_MAX_READ_FILE_RECORD_BYTES 0xF5
+#define MODBUS_MAX_WRITE_FILE_RECORD_BYTES 0xFB
+
+/*广播地址(仅RTU有效)：从站只执行写请求，不回复*/
+#define MODBUS_BROADCAST_ADDRESS 0
+
+/**
+ * @const MODBUS_STATIC_BUFFERS
+ * 编译选项(缺省不定义)。定义后，客户端和服务端处理请求时只使用创建时分配好的缓冲区，不再分配内存：
+ *
+ * * modbus_client_t内嵌收发缓冲区(MODBUS_CLIENT_WBUFFER_SIZE)和批量读取用的临时缓冲区。
+ * * modbus_client_read_ranges一次最多读取MODBUS_CLIENT_MAX_RANGES个区间。
+ *
+ * 会改变modbus_client_t的大小，库和应用程序都要定义(scons STATIC_BUFFERS=True 或者 cmake -DAWTK_MODBUS_STATIC_BUFFERS=ON)。
+ * 服务端(modbus_service_t)总是使用内嵌的缓冲区(见MODBUS_SERVICE_WBUFFER_SIZE)。
+ */
+
+/**
+ * @const MODBUS_STATIC_MEMORY
+ * 编译选项(缺省不定义)。静态内存配置，用于RAM较小的MCU(如stm32f103)：
+ *
+ * * 同时定义MODBUS_STATIC_BUFFERS。
+ * * 收发缓冲区只保留一个ADU的大小(MODBUS_SERVICE_WBUFFER_SIZE/MODBUS_CLIENT_WBUFFER_SIZE)。
+ * * 批量读取不使用流水线(MODBUS_CLIENT_PIPELINE_DEPTH为1)，延迟回复最多支持4个service。
+ * * 不保留详细的统计数据(MODBUS_WITH_STATS为0)，服务端累计数据不分片(MODBUS_SERVICE_TOTALS_SHARDS为1)。
+ *
+ * 对象可以放在调用者提供的静态存储中(见modbus_service_init_static/modbus_memory_default_init_static/
+ * modbus_server_channel_init_static)。scons STATIC_MEMORY=True 或者 cmake -DAWTK_MODBUS_STATIC_MEMORY=ON。
+ */
+#ifdef MODBUS_STATIC_MEMORY
+#ifndef MODBUS_STATIC_BUFFERS
+#define MODBUS_STATIC_BUFFERS 1
+#endif /*MODBUS_STATIC_BUFFERS*/
+
+#ifndef MODBUS_SERVICE_WBUFFER_SIZE
+#define MODBUS_SERVICE_WBUFFER_SIZE (MODBUS_MAX_PDU_SIZE + 16)
+#endif /*MODBUS_SERVICE_WBUFFER_SIZE*/
+
+#ifndef MODBUS_CLIENT_WBUFFER_SIZE
+#define MODBUS_CLIENT_WBUFFER_SIZE (MODBUS_MAX_PDU_SIZE + 16)
+#endif /*MODBUS_CLIENT_WBUFFER_SIZE*/
+
+#ifndef MODBUS_CLIENT_PIPELINE_DEPTH
+#define MODBUS_CLIENT_PIPELINE_DEPTH 1
+#endif /*MODBUS_CLIENT_PIPELINE_DEPTH*/
+
+#ifndef MODBUS_SERVICE_MAX_DEFERRED
+#define MODBUS_SERVICE_MAX_DEFERRED 4
+#endif /*MODBUS_SERVICE_MAX_DEFERRED*/
+
+#ifndef MODBUS_WITH_STATS
+#define MODBUS_WITH_STATS 0
+#endif /*MODBUS_WITH_STATS*/
+
+#ifndef MODBUS_SERVICE_TOTALS_SHARDS
+#define MODBUS_SERVICE_TOTALS_SHARDS 1
+#endif /*MODBUS_SERVICE_TOTALS_SHARDS*/
+#endif /*MODBUS_STATIC_MEMORY*/
+
+/**
+ * @const MODBUS_WITH_CLIENT
+ * 编译选项(缺省为1)。为0时不编译客户端(modbus_client_t/modbus_client_channel_t/modbus_init_req)和请求的编码，
+ * 只做从站的设备可以用 -DMODBUS_WITH_CLIENT=0 减小代码。
+ */
+#ifndef MODBUS_WITH_CLIENT
+#define MODBUS_WITH_CLIENT 1
+#endif /*MODBUS_WITH_CLIENT*/
+
+/**
+ * @const MODBUS_WITH_TCP
+ * 编译选项(缺省为1)。为0时不编译TCP服务(modbus_service_tcp/modbus_service_epoll)，
+ * modbus_service_tcp_start等函数返回RET_NOT_IMPL。
+ */
+#ifndef MODBUS_WITH_TCP
+#define MODBUS_WITH_TCP 1
+#endif /*MODBUS_WITH_TCP*/
+
+/**
+ * @const MODBUS_WITH_FC23
+ * 编译选项(缺省为1)。为0时不支持读写多个寄存器(0x17)：服务端回复ILLEGAL_FUNCTION异常，
+ * modbus_client_write_and_read_registers返回RET_NOT_IMPL。
+ */
+#ifndef MODBUS_WITH_FC23
+#define MODBUS_WITH_FC23 1
+#endif /*MODBUS_WITH_FC23*/
+
+/**
+ * @const MODBUS_WITH_FILE_RECORD
+ * 编译选项(缺省为1)。为0时不支持读写文件记录(0x14/0x15)：服务端回复ILLEGAL_FUNCTION异常，
+ * modbus_client_read_file_records/modbus_client_write_file_records返回RET_NOT_IMPL。
+ */
+#ifndef MODBUS_WITH_FILE_RECORD
+#define MODBUS_WITH_FILE_RECORD 1
+#endif /*MODBUS_WITH_FILE_RECORD*/
+
+/**
+ * @const MODBUS_WITH_STATS
+ * 编译选项(缺省为1，MODBUS_STATIC_MEMORY时为0)。为0时不保留详细的统计数据：
+ *
+ * * modbus_histogram_t不分桶，只记录个数/最小/最大/总和，百分位数返回最大值。
+ * * modbus_service_stats_t没有按功能码统计的请求次数(num_requests_by_fc)。
+ * * modbus_client_t不按从站地址统计，modbus_client_get_unit_stats返回RET_NOT_IMPL。
+ *
+ * 会改变modbus_service_t/modbus_client_t的大小，库和应用程序都要定义。
+ */
+#ifndef MODBUS_WITH_STATS
+#define MODBUS_WITH_STATS 1
+#endif /*MODBUS_WITH_STATS*/
+
+/**
+ * @const MODBUS_FRAME_GAP_SPIN_TIME
+ * 等待帧间隔(t3.5)和广播等待时间时，最后忙等的时间(微秒，见modbus_common_wait_until)。
+ *
+ * 为0时只用sleep_us等待。
+ */
+#ifndef MODBUS_FRAME_GAP_SPIN_TIME
+#define MODBUS_FRAME_GAP_SPIN_TIME 200
+#endif /*MODBUS_FRAME_GAP_SPIN_TIME*/
+
+#ifndef MODBUS_TURNAROUND_DELAY
+#define MODBUS_TURNAROUND_DELAY 100 /*ms*/
+#endif                              /*MODBUS_TURNAROUND_DELAY*/
 
 #ifndef MODBUS_WRITE_TIMEOUT
 #define MODBUS_WRITE_TIMEOUT 500 /*0.5s*/
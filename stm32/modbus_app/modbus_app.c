@@ -13,21 +13,30 @@
 
 static bool_t s_modbus_running = FALSE;
 static tk_thread_t* s_modbus_thread = NULL;
+static modbus_service_t* volatile s_modbus_service_running = NULL;
+
+#ifdef MODBUS_STATIC_MEMORY
+/*静态内存配置：service放在全局变量中，不占用堆内存*/
+static modbus_service_t s_modbus_service;
+#endif /*MODBUS_STATIC_MEMORY*/
 
 static void* modbus_service_func(void* args) {
   const char* device = (const char*)args;
   tk_iostream_t* io = tk_iostream_serial_create(device);
   modbus_memory_t* memory = modbus_memory_custom_create();
+#ifdef MODBUS_STATIC_MEMORY
+  modbus_service_t* service = &s_modbus_service;
+  modbus_service_init_static(service, io, MODBUS_PROTO_RTU, memory);
+#else
   modbus_service_t* service = modbus_service_create_with_io(io, MODBUS_PROTO_RTU, memory);
+#endif /*MODBUS_STATIC_MEMORY*/
 
-  s_modbus_running = TRUE;
   modbus_service_set_slave(service, MODBUS_DEMO_SLAVE_ID);
-  while (s_modbus_running) {
-    if (modbus_service_wait_for_data(service, 10) == RET_OK) {
-      modbus_service_dispatch(service);
-    } else {
-      sleep_ms(10);
-    }
+  /*先设置service再检查s_modbus_running，和modbus_service_stop的顺序相反，不会错过quit*/
+  s_modbus_service_running = service;
+  if (s_modbus_running) {
+    /*阻塞在串口的接收中断上，收到数据立即处理，modbus_service_stop时返回*/
+    modbus_service_run(service);
   }
 
   modbus_memory_destroy(memory);
@@ -46,6 +55,7 @@ ret_t modbus_service_start(const char* device) {
   tk_thread_set_name(s_modbus_thread, "modbus");
   tk_thread_set_stack_size(s_modbus_thread, 0x1000);
 
+  s_modbus_running = TRUE;
   tk_thread_start(s_modbus_thread);
 
   return RET_OK;
@@ -55,8 +65,12 @@ ret_t modbus_service_stop(void) {
   return_value_if_fail(s_modbus_running == TRUE, RET_OK);
 
   s_modbus_running = FALSE;
+  if (s_modbus_service_running != NULL) {
+    modbus_service_quit(s_modbus_service_running);
+  }
   tk_thread_destroy(s_modbus_thread);
   s_modbus_thread = NULL;
+  s_modbus_service_running = NULL;
 
   return RET_OK;
 }
@@ -336,13 +336,21 @@ static ret_t modbus_memory_custom_destroy(modbus_memory_t* memory) {
   modbus_memory_custom_t* memory_custom = MODBUS_MEMORY_CUSTOM(memory);
   return_value_if_fail(memory_custom != NULL, RET_BAD_PARAMS);
 
+#ifndef MODBUS_STATIC_MEMORY
   TKMEM_FREE(memory_custom);
+#endif /*MODBUS_STATIC_MEMORY*/
 
   return RET_OK;
 }
 
 modbus_memory_t* modbus_memory_custom_create(void) {
+#ifdef MODBUS_STATIC_MEMORY
+  /*没有状态，静态内存配置下使用全局对象*/
+  static modbus_memory_custom_t s_memory;
+  modbus_memory_custom_t* memory = &s_memory;
+#else
   modbus_memory_custom_t* memory = TKMEM_ZALLOC(modbus_memory_custom_t);
+#endif /*MODBUS_STATIC_MEMORY*/
   return_value_if_fail(memory != NULL, NULL);
 
   memory->memory.read_bits = modbus_memory_custom_read_bits;
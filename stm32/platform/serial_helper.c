@@ -80,7 +80,7 @@ ret_t serial_oflush(serial_handle_t handle) {
 ret_t serial_wait_for_data(serial_handle_t handle, uint32_t timeout_ms) {
   return_value_if_fail(handle != NULL, RET_BAD_PARAMS);
 
-  return uart_has_data(handle->dev) ? RET_OK : RET_TIMEOUT;
+  return uart_wait_for_data(handle->dev, timeout_ms);
 }
 
 #endif /*TK_IS_PC*/
@@ -22,6 +22,12 @@
 #include "tkc/utils.h"
 #include "tkc/platform.h"
 #include "uart_hal.h"
+#include "FreeRTOS.h"
+#include "semphr.h"
+
+struct _uart_device_t;
+/*在接收中断中调用，唤醒uart_wait_for_data*/
+static void uart_on_rx_from_isr(struct _uart_device_t* dev);
 
 #ifdef HMI_ZDP1440D
 #define WITH_UART 1
@@ -41,6 +47,19 @@
 
 #ifdef WITH_UART
 
+/*每个串口一个信号量，接收中断中释放，uart_wait_for_data等待(不用轮询)*/
+static SemaphoreHandle_t s_uart_rx_sems[MAX_UART_COUNT];
+
+static void uart_on_rx_from_isr(struct _uart_device_t* dev) {
+  BaseType_t woken = pdFALSE;
+  SemaphoreHandle_t sem = s_uart_rx_sems[dev - s_uart_devices];
+
+  if (sem != NULL) {
+    xSemaphoreGiveFromISR(sem, &woken);
+    portYIELD_FROM_ISR(woken);
+  }
+}
+
 int uart_debug(const char* format, ...) {
   int ret = 0;
   va_list va;
@@ -77,6 +96,7 @@ int uart_open(const char* name, int baudrate) {
   }
 
   dev->rx_ring_buff = ring_buffer_create(2048, 2048);
+  s_uart_rx_sems[fd - 1] = xSemaphoreCreateBinary();
 	
 	uart_do_open(dev, fd, baudrate);
 	
@@ -90,6 +110,10 @@ int uart_close(int fd) {
   uart_do_close(dev);
   ring_buffer_destroy(dev->rx_ring_buff);
   dev->rx_ring_buff = NULL;
+  if (s_uart_rx_sems[fd - 1] != NULL) {
+    vSemaphoreDelete(s_uart_rx_sems[fd - 1]);
+    s_uart_rx_sems[fd - 1] = NULL;
+  }
 
   return 0;
 }
@@ -110,6 +134,23 @@ bool_t uart_has_data(int fd) {
   return !ring_buffer_is_empty(dev->rx_ring_buff);
 }
 
+ret_t uart_wait_for_data(int fd, uint32_t timeout_ms) {
+  uart_device_t* dev = uart_get_dev(fd);
+  SemaphoreHandle_t sem = NULL;
+  return_value_if_fail(dev != NULL, RET_BAD_PARAMS);
+  return_value_if_fail(dev->rx_ring_buff != NULL, RET_BAD_PARAMS);
+
+  sem = s_uart_rx_sems[fd - 1];
+  while (ring_buffer_is_empty(dev->rx_ring_buff)) {
+    /*信号量可能是之前已经读走的数据释放的，取到后再检查一次*/
+    if (sem == NULL || xSemaphoreTake(sem, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+      return RET_TIMEOUT;
+    }
+  }
+
+  return RET_OK;
+}
+
 int uart_write(int fd, const void* buffer, uint32_t size) {
   uart_device_t* dev = uart_get_dev(fd);
   return_value_if_fail(dev != NULL, -1);
@@ -53,6 +53,15 @@ int uart_read(int fd, void *buff, uint32_t nbytes);
 */
 bool_t uart_has_data(int fd);
 
+/**
+ * @method uart_wait_for_data
+ * 阻塞等待串口数据(由接收中断唤醒)。
+ * @param {int} fd 串口句柄。
+ * @param {uint32_t} timeout_ms 超时时间(毫秒)。
+ * @return {ret_t} 返回RET_OK表示有数据，RET_TIMEOUT表示超时。
+*/
+ret_t uart_wait_for_data(int fd, uint32_t timeout_ms);
+
 /**
  * @method uart_write
  * 写串口。
@@ -804,3 +804,78 @@ TEST(modbus_client_channel, statistics) {
   modbus_memory_destroy(args.memory);
   modbus_client_destroy(client);
 }
+
+TEST(modbus_client_channel, write_only_on_change) {
+  uint32_t i = 0;
+  uint16_t* w = NULL;
+  uint16_t* r = NULL;
+  uint8_t slave = 0xFF;
+  modbus_service_args_t args;
+  memset(&args, 0x0, sizeof(modbus_service_args_t));
+  args.slave = slave;
+  args.proto = MODBUS_PROTO_TCP;
+  args.memory = modbus_memory_default_create_foo();
+
+  tk_thread_t* thread = tk_thread_create(thread_server_func, &args);
+  running = TRUE;
+  tk_thread_start(thread);
+  sleep_ms(1000);
+  modbus_client_t* client = modbus_client_create("tcp://localhost:2502");
+  sleep_ms(500);
+  modbus_client_channel_t* write_registers = modbus_client_channel_create_with_json(
+      "file://./tests/testdata/write_registers_on_change.json");
+  modbus_client_channel_t* read_registers =
+      modbus_client_channel_create_with_json("file://./tests/testdata/read_registers_1000.json");
+  ASSERT_EQ(write_registers->write_only_on_change, TRUE);
+  ASSERT_EQ(write_registers->shadow_buffer != NULL, true);
+
+  w = (uint16_t*)write_registers->write_buffer;
+  for (i = 0; i < write_registers->write_buffer_length / 2; i++) {
+    w[i] = i;
+  }
+
+  modbus_client_set_slave(client, slave);
+  modbus_client_channel_set_unit_id(write_registers, slave);
+  modbus_client_channel_set_unit_id(read_registers, slave);
+  modbus_client_channel_set_client(write_registers, client);
+  modbus_client_channel_set_client(read_registers, client);
+
+  /*第一次全部写入(1000个寄存器需要分9个请求)*/
+  ASSERT_EQ(modbus_client_channel_write(write_registers), RET_OK);
+  ASSERT_EQ(s_service->num_write_requests, 9);
+
+  /*没有变化，不发送请求*/
+  modbus_memory_write_register(args.memory, 0, 0x1111);
+  ASSERT_EQ(modbus_client_channel_write(write_registers), RET_OK);
+  ASSERT_EQ(s_service->num_write_requests, 9);
+  ASSERT_EQ(write_registers->write_skip_count, 1);
+
+  /*只写入变化的部分，相邻的变化合并为一个请求*/
+  w[5] = 0x2222;
+  w[500] = 0x3333;
+  w[502] = 0x4444;
+  ASSERT_EQ(modbus_client_channel_write(write_registers), RET_OK);
+  ASSERT_EQ(s_service->num_write_requests, 11);
+  ASSERT_EQ(write_registers->write_skip_count, 1);
+
+  ASSERT_EQ(modbus_client_channel_read(read_registers), RET_OK);
+  r = (uint16_t*)read_registers->read_buffer;
+  ASSERT_EQ(r[0], 0x1111);
+  ASSERT_EQ(r[1], 1);
+  ASSERT_EQ(r[5], 0x2222);
+  ASSERT_EQ(r[500], 0x3333);
+  ASSERT_EQ(r[501], 501);
+  ASSERT_EQ(r[502], 0x4444);
+
+  /*标记为脏后需要立即更新*/
+  ASSERT_EQ(modbus_client_channel_mark_dirty(write_registers), RET_OK);
+  ASSERT_EQ(write_registers->dirty, TRUE);
+
+  running = FALSE;
+  tk_thread_destroy(thread);
+  sleep_ms(1000);
+  modbus_client_channel_destroy(write_registers);
+  modbus_client_channel_destroy(read_registers);
+  modbus_memory_destroy(args.memory);
+  modbus_client_destroy(client);
+}
@@ -1,5 +1,6 @@
 #include "gtest/gtest.h"
 #include <thread>
+#include <vector>
 #include "tkc/utils.h"
 #include "conf_io/conf_json.h"
 #include "modbus_client_channel.h"
@@ -7,6 +8,13 @@
 #include "modbus_memory_default.h"
 
 #include "modbus_service_helper.h"
+#include "modbus_histogram.h"
+#include "alloc_counter.h"
+#include "tkc/time_now.h"
+#include "tkc/socket_helper.h"
+#include "streams/inet/iostream_tcp.h"
+#include "streams/mem/iostream_mem.h"
+#include <atomic>
 
 TEST(modbus_client, write_registers) {
   modbus_memory_t* memory = modbus_memory_default_create_foo();
@@ -57,6 +65,358 @@ TEST(modbus_client, write_register) {
   modbus_client_destroy(client);
 }
 
+TEST(modbus_client, stats) {
+  str_t str;
+  uint16_t regs[4];
+  modbus_client_stats_t stats;
+  modbus_memory_t* memory = modbus_memory_default_create_foo();
+  tk_thread_t* thread = create_modbus_service(0xff, memory);
+  sleep_ms(1000);
+  modbus_client_t* client = modbus_client_create("tcp://localhost:2502");
+
+#if MODBUS_WITH_STATS
+  ASSERT_EQ(modbus_client_get_unit_stats(client, 0xff, &stats), RET_NOT_FOUND);
+#else
+  ASSERT_EQ(modbus_client_get_unit_stats(client, 0xff, &stats), RET_NOT_IMPL);
+#endif /*MODBUS_WITH_STATS*/
+  ASSERT_EQ(modbus_client_read_registers(client, 0, 4, regs), RET_OK);
+  ASSERT_EQ(modbus_client_write_register(client, 1, 1), RET_OK);
+  ASSERT_NE(modbus_client_read_registers(client, 20000, 4, regs), RET_OK);
+
+  ASSERT_EQ(modbus_client_get_stats(client, &stats), RET_OK);
+  ASSERT_EQ(stats.num_requests, 3u);
+  ASSERT_EQ(stats.num_ok, 2u);
+  ASSERT_EQ(stats.num_exceptions, 1u);
+  ASSERT_EQ(stats.num_retries, 0u);
+  ASSERT_EQ(stats.num_timeouts, 0u);
+  ASSERT_EQ(stats.rtt.total, 3u);
+  ASSERT_EQ(stats.last_error, RET_FAIL);
+  ASSERT_NE(stats.last_error_time, 0u);
+
+#if MODBUS_WITH_STATS
+  ASSERT_EQ(modbus_client_get_unit_stats(client, 0xff, &stats), RET_OK);
+  ASSERT_EQ(stats.num_requests, 3u);
+  ASSERT_EQ(stats.num_exceptions, 1u);
+  ASSERT_EQ(modbus_client_get_unit_stats(client, 1, &stats), RET_NOT_FOUND);
+#endif /*MODBUS_WITH_STATS*/
+
+  str_init(&str, 256);
+  ASSERT_EQ(modbus_client_stats_to_str(&(client->stats), "dev255", &str), RET_OK);
+  ASSERT_EQ(strstr(str.str, "dev255: requests=3 ok=2") != NULL, TRUE);
+  ASSERT_EQ(strstr(str.str, "rtt_us: count=3") != NULL, TRUE);
+  str_reset(&str);
+
+  ASSERT_EQ(modbus_client_reset_stats(client), RET_OK);
+  ASSERT_EQ(client->stats.num_requests, 0u);
+
+  running = FALSE;
+  tk_thread_destroy(thread);
+  sleep_ms(1000);
+  modbus_memory_destroy(memory);
+  modbus_client_destroy(client);
+}
+
+TEST(modbus_client, priority) {
+  uint16_t regs[4];
+  std::vector<int> order;
+  modbus_client_priority_stats_t stats;
+  modbus_memory_t* memory = modbus_memory_default_create_foo();
+  tk_thread_t* thread = create_modbus_service(0xff, memory);
+  sleep_ms(1000);
+  modbus_client_t* client = modbus_client_create("tcp://localhost:2502");
+
+  /*当前线程以低优先级批量执行请求*/
+  ASSERT_EQ(modbus_client_lock(client, MODBUS_CLIENT_PRIORITY_LOW), RET_OK);
+  ASSERT_EQ(modbus_client_read_registers(client, 0, 4, regs), RET_OK);
+
+  std::thread low([&]() {
+    modbus_client_lock(client, MODBUS_CLIENT_PRIORITY_LOW);
+    order.push_back(MODBUS_CLIENT_PRIORITY_LOW);
+    modbus_client_read_registers(client, 0, 4, regs);
+    modbus_client_unlock(client);
+  });
+  sleep_ms(100);
+
+  std::thread high([&]() {
+    modbus_client_lock(client, MODBUS_CLIENT_PRIORITY_HIGH);
+    order.push_back(MODBUS_CLIENT_PRIORITY_HIGH);
+    modbus_client_write_register(client, 1, 0x1111);
+    modbus_client_unlock(client);
+  });
+  sleep_ms(100);
+  ASSERT_EQ(order.size(), 0u);
+
+  /*在下一个请求开始前让出总线，高优先级的请求先于先来的低优先级请求执行*/
+  ASSERT_EQ(modbus_client_read_registers(client, 0, 4, regs), RET_OK);
+  ASSERT_EQ(regs[1], 0x1111);
+  ASSERT_EQ(order[0], MODBUS_CLIENT_PRIORITY_HIGH);
+  ASSERT_EQ(modbus_client_unlock(client), RET_OK);
+  ASSERT_EQ(modbus_client_unlock(client), RET_FAIL);
+
+  high.join();
+  low.join();
+  ASSERT_EQ(order.size(), 2u);
+  ASSERT_EQ(order[1], MODBUS_CLIENT_PRIORITY_LOW);
+
+  ASSERT_EQ(modbus_client_get_priority_stats(client, MODBUS_CLIENT_PRIORITY_HIGH, &stats), RET_OK);
+  ASSERT_EQ(stats.num_requests, 1u);
+  ASSERT_EQ(stats.num_preemptions, 0u);
+  ASSERT_EQ(stats.wait_time.total, 1u);
+  ASSERT_EQ(stats.latency.total, 1u);
+
+  ASSERT_EQ(modbus_client_get_priority_stats(client, MODBUS_CLIENT_PRIORITY_LOW, &stats), RET_OK);
+  ASSERT_EQ(stats.num_requests, 2u);
+  ASSERT_EQ(stats.num_preemptions, 1u);
+  ASSERT_EQ(stats.latency.total, 2u);
+
+  /*没有外层的lock时，请求使用普通优先级*/
+  ASSERT_EQ(modbus_client_read_registers(client, 0, 4, regs), RET_OK);
+  ASSERT_EQ(modbus_client_get_priority_stats(client, MODBUS_CLIENT_PRIORITY_NORMAL, &stats), RET_OK);
+  ASSERT_EQ(stats.num_requests, 1u);
+
+  running = FALSE;
+  tk_thread_destroy(thread);
+  sleep_ms(1000);
+  modbus_memory_destroy(memory);
+  modbus_client_destroy(client);
+}
+
+TEST(modbus_client, read_ranges) {
+  uint32_t i = 0;
+  uint16_t a[300];
+  uint16_t b[20];
+  uint16_t c[1];
+  uint16_t d[20];
+  static uint8_t bits[3000];
+  static uint16_t regs[1000];
+  modbus_memory_t* memory = modbus_memory_default_create_foo();
+  tk_thread_t* thread = create_modbus_service(0xff, memory);
+  sleep_ms(1000);
+  modbus_client_t* client = modbus_client_create("tcp://localhost:2502");
+
+  modbus_client_range_t ranges[] = {
+      {MODBUS_FC_READ_INPUT_REGISTERS, 10, 300, a},
+      {MODBUS_FC_READ_INPUT_REGISTERS, 5000, 1, c},
+      {MODBUS_FC_READ_DISCRETE_INPUTS, 0, 3000, bits},
+      {MODBUS_FC_READ_INPUT_REGISTERS, 300, 20, b},
+  };
+
+  /*[10,135) [135,260) [260,320) [5000,5001) [0,2000) [2000,3000)*/
+  ASSERT_EQ(modbus_client_read_ranges(client, ranges, ARRAY_SIZE(ranges)), RET_OK);
+  ASSERT_EQ(client->stats.num_requests, 6u);
+  for (i = 0; i < ARRAY_SIZE(a); i++) {
+    ASSERT_EQ(a[i], (10 + i) * 2);
+  }
+  for (i = 0; i < ARRAY_SIZE(b); i++) {
+    ASSERT_EQ(b[i], (300 + i) * 2);
+  }
+  ASSERT_EQ(c[0], 10000);
+  for (i = 0; i < ARRAY_SIZE(bits); i++) {
+    ASSERT_EQ(bits[i], ((i / 16) >> (i % 16)) & 0x01);
+  }
+
+  /*单个区间失败不影响其它区间*/
+  modbus_client_range_t bad_ranges[] = {
+      {MODBUS_FC_READ_INPUT_REGISTERS, 9990, 20, d},
+      {MODBUS_FC_WRITE_SINGLE_COIL, 0, 1, d},
+      {MODBUS_FC_READ_INPUT_REGISTERS, 0, 20, b},
+  };
+  ASSERT_NE(modbus_client_read_ranges(client, bad_ranges, ARRAY_SIZE(bad_ranges)), RET_OK);
+  ASSERT_NE(bad_ranges[0].result, RET_OK);
+  ASSERT_EQ(bad_ranges[1].result, RET_BAD_PARAMS);
+  ASSERT_EQ(bad_ranges[2].result, RET_OK);
+  ASSERT_EQ(b[19], 38);
+
+  /*超过单个请求的最大长度时自动拆分*/
+  ASSERT_EQ(modbus_client_read_input_registers(client, 0, 1000, regs), RET_OK);
+  for (i = 0; i < ARRAY_SIZE(regs); i++) {
+    ASSERT_EQ(regs[i], i * 2);
+  }
+
+  running = FALSE;
+  tk_thread_destroy(thread);
+  sleep_ms(1000);
+  modbus_memory_destroy(memory);
+  modbus_client_destroy(client);
+}
+
+TEST(modbus_client, mask_write_and_fifo) {
+  uint16_t value = 0;
+  uint16_t count = 0;
+  uint16_t fifo[MODBUS_MAX_FIFO_COUNT];
+  uint16_t queue[] = {3, 11, 22, 33};
+  modbus_memory_t* memory = modbus_memory_default_create_foo();
+  tk_thread_t* thread = create_modbus_service(0xff, memory);
+  sleep_ms(1000);
+  modbus_client_t* client = modbus_client_create("tcp://localhost:2502");
+
+  /*(0x12 & 0xf2) | (0x25 & ~0xf2) = 0x17*/
+  ASSERT_EQ(modbus_client_write_register(client, 100, 0x12), RET_OK);
+  modbus_client_reset_stats(client);
+  ASSERT_EQ(modbus_client_mask_write_register(client, 100, 0x00f2, 0x0025), RET_OK);
+  ASSERT_EQ(client->stats.num_requests, 1u);
+  ASSERT_EQ(modbus_client_read_registers(client, 100, 1, &value), RET_OK);
+  ASSERT_EQ(value, 0x17);
+
+  ASSERT_EQ(modbus_client_mask_write_register(client, 10000, 0, 0), RET_FAIL);
+  ASSERT_EQ(modbus_common_get_last_exception_code(MODBUS_COMMON(client)),
+            MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+  /*FIFO指针寄存器为队列中数据的个数*/
+  ASSERT_EQ(modbus_client_write_registers(client, 200, ARRAY_SIZE(queue), queue), RET_OK);
+  count = ARRAY_SIZE(fifo);
+  ASSERT_EQ(modbus_client_read_fifo_queue(client, 200, fifo, &count), RET_OK);
+  ASSERT_EQ(count, 3);
+  ASSERT_EQ(fifo[0], 11);
+  ASSERT_EQ(fifo[1], 22);
+  ASSERT_EQ(fifo[2], 33);
+
+  /*读取不清除队列*/
+  count = ARRAY_SIZE(fifo);
+  ASSERT_EQ(modbus_client_read_fifo_queue(client, 200, fifo, &count), RET_OK);
+  ASSERT_EQ(count, 3);
+
+  count = 2;
+  ASSERT_NE(modbus_client_read_fifo_queue(client, 200, fifo, &count), RET_OK);
+
+  /*空队列*/
+  ASSERT_EQ(modbus_client_write_register(client, 300, 0), RET_OK);
+  count = ARRAY_SIZE(fifo);
+  ASSERT_EQ(modbus_client_read_fifo_queue(client, 300, fifo, &count), RET_OK);
+  ASSERT_EQ(count, 0);
+
+  /*超过31个数据时返回异常3*/
+  ASSERT_EQ(modbus_client_write_register(client, 400, MODBUS_MAX_FIFO_COUNT + 1), RET_OK);
+  count = ARRAY_SIZE(fifo);
+  ASSERT_EQ(modbus_client_read_fifo_queue(client, 400, fifo, &count), RET_FAIL);
+  ASSERT_EQ(modbus_common_get_last_exception_code(MODBUS_COMMON(client)),
+            MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE);
+
+  running = FALSE;
+  tk_thread_destroy(thread);
+  sleep_ms(1000);
+  modbus_memory_destroy(memory);
+  modbus_client_destroy(client);
+}
+
+TEST(modbus_client, file_records) {
+  uint32_t i = 0;
+  uint16_t a[300];
+  uint16_t b[5];
+  uint16_t ra[300];
+  uint16_t rb[5];
+  modbus_memory_t* memory = modbus_memory_default_create_foo();
+  modbus_server_channel_t* file = modbus_server_channel_create("file", 0, 1000, TRUE);
+  ASSERT_EQ(modbus_memory_default_add_file(memory, 4, file), RET_OK);
+  tk_thread_t* thread = create_modbus_service(0xff, memory);
+  sleep_ms(1000);
+  modbus_client_t* client = modbus_client_create("tcp://localhost:2502");
+
+  for (i = 0; i < ARRAY_SIZE(a); i++) {
+    a[i] = i * 3 + 1;
+  }
+  for (i = 0; i < ARRAY_SIZE(b); i++) {
+    b[i] = 0xff00 + i;
+  }
+  modbus_file_record_t records[] = {{4, 0, ARRAY_SIZE(a), a}, {4, 500, ARRAY_SIZE(b), b}};
+  modbus_file_record_t read_records[] = {{4, 0, ARRAY_SIZE(ra), ra},
+                                         {4, 500, ARRAY_SIZE(rb), rb}};
+
+  /*写：每个请求最多122个寄存器，第3个请求中包括第2个记录*/
+  modbus_client_reset_stats(client);
+  ASSERT_EQ(modbus_client_write_file_records(client, records, ARRAY_SIZE(records)), RET_OK);
+  ASSERT_EQ(client->stats.num_requests, 3u);
+
+  /*读：每个请求最多121个寄存器*/
+  memset(ra, 0x00, sizeof(ra));
+  memset(rb, 0x00, sizeof(rb));
+  modbus_client_reset_stats(client);
+  ASSERT_EQ(modbus_client_read_file_records(client, read_records, ARRAY_SIZE(read_records)),
+            RET_OK);
+  ASSERT_EQ(client->stats.num_requests, 3u);
+  ASSERT_EQ(memcmp(a, ra, sizeof(a)), 0);
+  ASSERT_EQ(memcmp(b, rb, sizeof(b)), 0);
+
+  /*文件记录和holding registers是独立的*/
+  ASSERT_EQ(modbus_client_read_registers(client, 500, 1, rb), RET_OK);
+  ASSERT_EQ(rb[0], 0);
+
+  /*文件不存在*/
+  read_records[0].file_number = 9;
+  ASSERT_EQ(modbus_client_read_file_records(client, read_records, 1), RET_FAIL);
+  ASSERT_EQ(modbus_common_get_last_exception_code(MODBUS_COMMON(client)),
+            MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+
+  /*记录号超出范围*/
+  read_records[1].record_number = MODBUS_MAX_FILE_RECORD_NUMBER;
+  ASSERT_EQ(modbus_client_read_file_records(client, read_records + 1, 1), RET_BAD_PARAMS);
+
+  running = FALSE;
+  tk_thread_destroy(thread);
+  sleep_ms(1000);
+  modbus_memory_destroy(memory);
+  modbus_client_destroy(client);
+}
+
+static modbus_memory_read_input_registers_t s_read_input_registers;
+
+/*模拟一次最多只能读取64个寄存器的设备*/
+static ret_t read_input_registers_max_64(modbus_memory_t* memory, uint16_t addr, uint16_t count,
+                                         uint16_t* buff) {
+  if (count > 64) {
+    return RET_INVALID_ADDR;
+  }
+
+  return s_read_input_registers(memory, addr, count, buff);
+}
+
+TEST(modbus_client, adaptive_read_size) {
+  uint32_t i = 0;
+  uint32_t num_requests = 0;
+  static uint16_t regs[1000];
+  modbus_memory_t* memory = modbus_memory_default_create_foo();
+  s_read_input_registers = memory->read_input_registers;
+  memory->read_input_registers = read_input_registers_max_64;
+  tk_thread_t* thread = create_modbus_service(0xff, memory);
+  sleep_ms(1000);
+  modbus_client_t* client = modbus_client_create("tcp://localhost:2502");
+
+  ASSERT_EQ(client->adaptive_read_size, FALSE);
+  ASSERT_NE(modbus_client_read_input_registers(client, 0, 100, regs), RET_OK);
+  ASSERT_EQ(client->stats.num_requests, 1u);
+
+  ASSERT_EQ(modbus_client_set_adaptive_read_size(client, TRUE), RET_OK);
+  ASSERT_EQ(modbus_client_read_input_registers(client, 0, 100, regs), RET_OK);
+  ASSERT_EQ(modbus_client_get_max_read_count(client, 0xff, MODBUS_FC_READ_INPUT_REGISTERS), 64u);
+  ASSERT_EQ(modbus_client_get_max_read_count(client, 0xff, MODBUS_FC_READ_HOLDING_REGISTERS), 64u);
+  ASSERT_EQ(modbus_client_get_max_read_count(client, 0xff, MODBUS_FC_READ_COILS),
+            (uint32_t)MODBUS_MAX_READ_BITS);
+  ASSERT_EQ(modbus_client_get_max_read_count(client, 1, MODBUS_FC_READ_INPUT_REGISTERS),
+            (uint32_t)MODBUS_MAX_READ_REGISTERS);
+
+  /*后续的请求直接按学习到的长度拆分*/
+  num_requests = client->stats.num_requests;
+  memset(regs, 0x00, sizeof(regs));
+  ASSERT_EQ(modbus_client_read_input_registers(client, 0, 1000, regs), RET_OK);
+  ASSERT_EQ(client->stats.num_requests - num_requests, 16u);
+  for (i = 0; i < ARRAY_SIZE(regs); i++) {
+    ASSERT_EQ(regs[i], i * 2);
+  }
+
+  /*地址空洞不是长度的限制，不缓存*/
+  ASSERT_EQ(modbus_client_set_max_read_count(client, 0xff, MODBUS_FC_READ_INPUT_REGISTERS, 0),
+            RET_OK);
+  ASSERT_NE(modbus_client_read_input_registers(client, 9990, 20, regs), RET_OK);
+  ASSERT_EQ(modbus_client_get_max_read_count(client, 0xff, MODBUS_FC_READ_INPUT_REGISTERS),
+            (uint32_t)MODBUS_MAX_READ_REGISTERS);
+
+  running = FALSE;
+  tk_thread_destroy(thread);
+  sleep_ms(1000);
+  modbus_memory_destroy(memory);
+  modbus_client_destroy(client);
+}
+
 static void test_modbus_client_all(modbus_client_t* client, modbus_memory_default_t* default_memory) {
   uint8_t addr = 0x01;
   bool_t value;
@@ -183,6 +543,350 @@ TEST(modbus_client, rtu_over_tcp_all) {
   modbus_client_destroy(client);
 }
 
+TEST(modbus_client, rtu_broadcast) {
+  uint16_t value = 0;
+  uint16_t regs[3] = {0x11, 0x22, 0x33};
+  uint16_t result[3] = {0};
+  modbus_memory_t* memory = modbus_memory_default_create_foo();
+  event_source_manager_t* esm = event_source_manager_default_create();
+
+  modbus_service_args_t args = {};
+  args.memory = memory;
+  args.slave = 0x01;
+  args.proto = MODBUS_PROTO_RTU;
+
+  ASSERT_EQ(modbus_service_tcp_start_by_args(esm, &args, 2502), RET_OK);
+  bool running = true;
+  std::thread thread = std::thread([esm, &running]() {
+    while (running) {
+      event_source_manager_dispatch(esm);
+      std::this_thread::sleep_for(std::chrono::milliseconds(15));
+    }
+  });
+  modbus_client_t* client = modbus_client_create("rtu+tcp://localhost:2502");
+  modbus_client_set_turnaround_delay(client, 50);
+
+  /*广播写不等待响应*/
+  modbus_client_set_slave(client, MODBUS_BROADCAST_ADDRESS);
+  modbus_client_reset_stats(client);
+  ASSERT_EQ(modbus_client_write_register(client, 10, 0x1234), RET_OK);
+  ASSERT_EQ(modbus_client_write_registers(client, 20, ARRAY_SIZE(regs), regs), RET_OK);
+  ASSERT_EQ(modbus_client_write_bit(client, 30, 1), RET_OK);
+  ASSERT_EQ(client->stats.num_requests, 3u);
+  ASSERT_EQ(client->stats.num_timeouts, 0u);
+
+  /*广播不能读*/
+  ASSERT_EQ(modbus_client_read_registers(client, 10, 1, &value), RET_BAD_PARAMS);
+
+  /*从站没有回复广播，后面的请求不会收到多余的响应*/
+  modbus_client_set_slave(client, args.slave);
+  ASSERT_EQ(modbus_client_read_registers(client, 10, 1, &value), RET_OK);
+  ASSERT_EQ(value, 0x1234);
+  ASSERT_EQ(modbus_client_read_registers(client, 20, ARRAY_SIZE(result), result), RET_OK);
+  ASSERT_EQ(memcmp(regs, result, sizeof(regs)), 0);
+  ASSERT_EQ(modbus_client_read_bits(client, 30, 1, (uint8_t*)&value), RET_OK);
+  ASSERT_EQ(value & 0x01, 1);
+
+  running = false;
+  if (thread.joinable()) {
+    thread.join();
+  }
+  event_source_manager_destroy(esm);
+  modbus_memory_destroy(memory);
+  modbus_client_destroy(client);
+}
+
+TEST(modbus_client, tcp_no_alloc) {
+  uint8_t bits[16];
+  uint16_t regs[16];
+  modbus_memory_t* memory = modbus_memory_default_create_foo();
+  event_source_manager_t* esm = event_source_manager_default_create();
+
+  modbus_service_args_t args = {};
+  args.memory = memory;
+  args.slave = 0xff;
+  args.proto = MODBUS_PROTO_TCP;
+
+  ASSERT_EQ(modbus_service_tcp_start_by_args(esm, &args, 2502), RET_OK);
+  bool running = true;
+  std::thread thread = std::thread([esm, &running]() {
+    while (running) {
+      event_source_manager_dispatch(esm);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  });
+  modbus_client_t* client = modbus_client_create("tcp://localhost:2502");
+  memset(bits, 0x01, sizeof(bits));
+  memset(regs, 0x00, sizeof(regs));
+
+  /*预热(统计数据等在第一次请求时分配)，之后客户端的请求不应该再分配内存*/
+  for (int round = 0; round < 2; round++) {
+    if (round == 1) {
+      alloc_counter_begin();
+    }
+    for (int i = 0; i < 10; i++) {
+      ASSERT_EQ(modbus_client_write_registers(client, 10, ARRAY_SIZE(regs), regs), RET_OK);
+      ASSERT_EQ(modbus_client_read_registers(client, 10, ARRAY_SIZE(regs), regs), RET_OK);
+      ASSERT_EQ(modbus_client_write_bits(client, 10, ARRAY_SIZE(bits), bits), RET_OK);
+      ASSERT_EQ(modbus_client_read_bits(client, 10, ARRAY_SIZE(bits), bits), RET_OK);
+    }
+  }
+  ASSERT_EQ(alloc_counter_end(), 0u);
+
+  running = false;
+  if (thread.joinable()) {
+    thread.join();
+  }
+  event_source_manager_destroy(esm);
+  modbus_memory_destroy(memory);
+  modbus_client_destroy(client);
+}
+
+TEST(modbus_client, tcp_epoll_all) {
+  uint16_t value = 0;
+  modbus_memory_t* memory = modbus_memory_default_create_foo();
+  modbus_memory_default_t* default_memory = (modbus_memory_default_t*)memory;
+  event_source_manager_t* esm = event_source_manager_default_create();
+
+  modbus_service_args_t args = {};
+  args.memory = memory;
+  args.slave = 0xff;
+  args.proto = MODBUS_PROTO_TCP;
+  args.backend = MODBUS_SERVICE_BACKEND_EPOLL;
+
+  ASSERT_EQ(modbus_service_tcp_start_by_args(esm, &args, 2502), RET_OK);
+  bool running = true;
+  std::thread thread = std::thread([esm, &running]() {
+    while (running) {
+      event_source_manager_dispatch(esm);
+      std::this_thread::sleep_for(std::chrono::milliseconds(15));
+    }
+  });
+  modbus_client_t* client = modbus_client_create("tcp://localhost:2502");
+  modbus_client_t* client2 = modbus_client_create("tcp://localhost:2502");
+
+  ASSERT_NO_FATAL_FAILURE(test_modbus_client_all(client, default_memory));
+
+  /*多个连接由同一个epoll分发*/
+  ASSERT_EQ(modbus_client_write_register(client2, 10, 0x5678), RET_OK);
+  ASSERT_EQ(modbus_client_read_registers(client, 10, 1, &value), RET_OK);
+  ASSERT_EQ(value, 0x5678);
+  modbus_client_destroy(client2);
+  ASSERT_EQ(modbus_client_read_registers(client, 10, 1, &value), RET_OK);
+
+  running = false;
+  if (thread.joinable()) {
+    thread.join();
+  }
+  ASSERT_EQ(modbus_service_tcp_is_started(), TRUE);
+  event_source_manager_destroy(esm);
+  ASSERT_EQ(modbus_service_tcp_is_started(), FALSE);
+  modbus_memory_destroy(memory);
+  modbus_client_destroy(client);
+}
+
+TEST(modbus_client, tcp_epoll_partial_frame) {
+  uint8_t resp[32];
+  /*读取寄存器10，分两次发送*/
+  const uint8_t req[] = {0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0xff, 0x03, 0x00, 0x0a, 0x00, 0x01};
+  modbus_memory_t* memory = modbus_memory_default_create_foo();
+  event_source_manager_t* esm = event_source_manager_default_create();
+
+  modbus_service_args_t args = {};
+  args.memory = memory;
+  args.slave = 0xff;
+  args.proto = MODBUS_PROTO_TCP;
+  args.backend = MODBUS_SERVICE_BACKEND_EPOLL;
+
+  ASSERT_EQ(modbus_service_tcp_start_by_args(esm, &args, 2502), RET_OK);
+  bool running = true;
+  std::thread thread = std::thread([esm, &running]() {
+    while (running) {
+      event_source_manager_dispatch(esm);
+      std::this_thread::sleep_for(std::chrono::milliseconds(15));
+    }
+  });
+
+  int sock = tk_tcp_connect("localhost", 2502);
+  ASSERT_GE(sock, 0);
+  tk_iostream_t* io = tk_iostream_tcp_create(sock);
+  ASSERT_EQ(tk_iostream_write_len(io, req, 5, 1000), 5);
+
+  /*不完整的请求留在缓冲区中，不阻塞其它连接*/
+  modbus_client_t* client = modbus_client_create("tcp://localhost:2502");
+  modbus_client_set_response_timeout(client, 200);
+  ASSERT_EQ(modbus_client_write_register(client, 10, 0x1234), RET_OK);
+
+  /*收到剩下的数据后再处理*/
+  ASSERT_EQ(tk_iostream_write_len(io, req + 5, sizeof(req) - 5, 1000), (int32_t)(sizeof(req) - 5));
+  ASSERT_EQ(tk_iostream_read_len(io, resp, 11, 1000), 11);
+  ASSERT_EQ(resp[7], MODBUS_FC_READ_HOLDING_REGISTERS);
+  ASSERT_EQ((resp[9] << 8) | resp[10], 0x1234);
+
+  TK_OBJECT_UNREF(io);
+  modbus_client_destroy(client);
+  running = false;
+  if (thread.joinable()) {
+    thread.join();
+  }
+  event_source_manager_destroy(esm);
+  modbus_memory_destroy(memory);
+}
+
+TEST(modbus_client, tcp_reuseport) {
+  uint16_t value = 0;
+  modbus_memory_t* memory = modbus_memory_default_create_foo();
+  modbus_memory_default_t* default_memory = (modbus_memory_default_t*)memory;
+  event_source_manager_t* esm = event_source_manager_default_create();
+  modbus_client_t* clients[8];
+
+  modbus_service_args_t args = {};
+  args.memory = memory;
+  args.slave = 0xff;
+  args.proto = MODBUS_PROTO_TCP;
+  args.listeners = 4;
+
+  /*每个监听线程自己分发，不需要调度esm*/
+  ASSERT_EQ(modbus_service_tcp_start_by_args(esm, &args, 2502), RET_OK);
+  ASSERT_EQ(modbus_service_tcp_is_started(), TRUE);
+
+  for (uint32_t i = 0; i < ARRAY_SIZE(clients); i++) {
+    clients[i] = modbus_client_create("tcp://localhost:2502");
+    ASSERT_TRUE(clients[i] != NULL);
+  }
+  ASSERT_NO_FATAL_FAILURE(test_modbus_client_all(clients[0], default_memory));
+
+  /*连接分布在不同的线程中，共用同一个memory*/
+  for (uint32_t i = 0; i < ARRAY_SIZE(clients); i++) {
+    ASSERT_EQ(modbus_client_write_register(clients[i], 10, 0x1000 + i), RET_OK);
+    ASSERT_EQ(modbus_client_read_registers(clients[(i + 1) % ARRAY_SIZE(clients)], 10, 1, &value),
+              RET_OK);
+    ASSERT_EQ(value, 0x1000 + i);
+  }
+
+  ASSERT_EQ(modbus_service_tcp_stop(), RET_OK);
+  ASSERT_EQ(modbus_service_tcp_is_started(), FALSE);
+  for (uint32_t i = 0; i < ARRAY_SIZE(clients); i++) {
+    modbus_client_destroy(clients[i]);
+  }
+  event_source_manager_destroy(esm);
+  modbus_memory_destroy(memory);
+}
+
+TEST(modbus_client, tcp_idle_timeout) {
+  uint16_t value = 0;
+  modbus_service_conn_stats_t base;
+  modbus_service_conn_stats_t stats;
+  modbus_memory_t* memory = modbus_memory_default_create_foo();
+  event_source_manager_t* esm = event_source_manager_default_create();
+
+  modbus_service_args_t args = {};
+  args.memory = memory;
+  args.slave = 0xff;
+  args.proto = MODBUS_PROTO_TCP;
+  args.idle_timeout = 200;
+
+  ASSERT_EQ(modbus_service_get_conn_stats(&base), RET_OK);
+  ASSERT_EQ(modbus_service_tcp_start_by_args(esm, &args, 2502), RET_OK);
+  bool running = true;
+  std::thread thread = std::thread([esm, &running]() {
+    while (running) {
+      event_source_manager_dispatch(esm);
+      std::this_thread::sleep_for(std::chrono::milliseconds(15));
+    }
+  });
+
+  modbus_client_t* client = modbus_client_create("tcp://localhost:2502");
+  ASSERT_EQ(modbus_client_read_registers(client, 10, 1, &value), RET_OK);
+  ASSERT_EQ(modbus_service_get_connections_count(), base.active + 1);
+
+  /*没有请求的连接超时后被服务端关闭*/
+  sleep_ms(600);
+  ASSERT_EQ(modbus_service_get_conn_stats(&stats), RET_OK);
+  ASSERT_EQ(stats.reaped, base.reaped + 1);
+  ASSERT_EQ(stats.active, base.active);
+
+  running = false;
+  if (thread.joinable()) {
+    thread.join();
+  }
+  event_source_manager_destroy(esm);
+  ASSERT_EQ(modbus_service_tcp_is_started(), FALSE);
+  modbus_service_set_idle_timeout(0);
+  modbus_client_destroy(client);
+  modbus_memory_destroy(memory);
+}
+
+TEST(modbus_client, tcp_service_run_latency) {
+  str_t str;
+  uint16_t value = 0;
+  uint64_t start = 0;
+  ret_t run_ret = RET_FAIL;
+  modbus_histogram_t latency;
+  std::atomic<modbus_service_t*> service(nullptr);
+  modbus_memory_t* memory = modbus_memory_default_create_foo();
+  int listen_sock = tk_tcp_listen(2502);
+  ASSERT_GE(listen_sock, 0);
+
+  std::thread thread = std::thread([listen_sock, memory, &service, &run_ret]() {
+    int sock = tk_tcp_accept(listen_sock);
+    tk_iostream_t* io = tk_iostream_tcp_create(sock);
+    modbus_service_t* s = modbus_service_create_with_io(io, MODBUS_PROTO_TCP, memory);
+    modbus_service_set_slave(s, 0xff);
+    service = s;
+    run_ret = modbus_service_run(s);
+    modbus_service_destroy(s);
+    TK_OBJECT_UNREF(io);
+  });
+
+  modbus_client_t* client = modbus_client_create("tcp://localhost:2502");
+  ASSERT_TRUE(client != NULL);
+  while (service == nullptr) {
+    sleep_ms(1);
+  }
+
+  modbus_histogram_init(&latency);
+  for (int i = 0; i < 200; i++) {
+    /*让服务端空闲一段时间，确认请求到达时立即处理(不是等到下一次轮询)*/
+    if (i % 20 == 0) {
+      sleep_ms(30);
+    }
+    start = time_now_us();
+    ASSERT_EQ(modbus_client_read_registers(client, 10, 1, &value), RET_OK);
+    modbus_histogram_record(&latency, (uint32_t)(time_now_us() - start));
+  }
+
+  /*modbus_service_quit直接唤醒等待(Windows上最迟MODBUS_SERVICE_RUN_WAIT_TIME毫秒)*/
+  start = time_now_us();
+  ASSERT_EQ(modbus_service_quit(service), RET_OK);
+  thread.join();
+  ASSERT_EQ(run_ret, RET_OK);
+
+  /*耗时受调度影响，只输出分布不做断言*/
+  str_init(&str, 256);
+  modbus_histogram_to_str(&latency, "  request latency(us)", &str);
+  str_append_format(&str, 64, "  quit latency(us): %u\n", (uint32_t)(time_now_us() - start));
+  log_info("%s", str.str);
+  str_reset(&str);
+
+  modbus_client_destroy(client);
+  tk_socket_close(listen_sock);
+  modbus_memory_destroy(memory);
+}
+
+TEST(modbus_client, frame_gap_spin_time) {
+  uint8_t buff[32];
+  tk_iostream_t* io = tk_iostream_mem_create(buff, sizeof(buff), buff, sizeof(buff), FALSE);
+  modbus_client_t* client = modbus_client_create_with_io(io, MODBUS_PROTO_RTU);
+
+  ASSERT_EQ(client->frame_gap_spin_time, (uint32_t)MODBUS_FRAME_GAP_SPIN_TIME);
+  ASSERT_EQ(modbus_client_set_frame_gap_spin_time(client, 0), RET_OK);
+  ASSERT_EQ(client->frame_gap_spin_time, 0u);
+  ASSERT_EQ(modbus_client_set_frame_gap_spin_time(NULL, 0), RET_BAD_PARAMS);
+
+  modbus_client_destroy(client);
+}
+
 #if 0
 // 需要设置两个虚拟串口设备才能测试
 #include "modbus_service_rtu.h"
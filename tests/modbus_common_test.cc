@@ -0,0 +1,55 @@
+#include "gtest/gtest.h"
+#include "tkc/utils.h"
+#include "tkc/str.h"
+#include "tkc/time_now.h"
+#include "modbus_common.h"
+#include "modbus_histogram.h"
+
+/*统计等待的误差(实际返回时间-截止时间)，提前返回的次数记录在early中*/
+static void test_wait_until_error(uint32_t gap, uint32_t spin_time, modbus_histogram_t* error,
+                                  uint32_t* early) {
+  for (int i = 0; i < 100; i++) {
+    uint64_t deadline = time_now_us() + gap;
+    ASSERT_EQ(modbus_common_wait_until(deadline, spin_time), RET_OK);
+    uint64_t now = time_now_us();
+    if (now < deadline) {
+      (*early)++;
+    }
+    modbus_histogram_record(error, now > deadline ? (uint32_t)(now - deadline) : 0);
+  }
+}
+
+TEST(modbus_common, wait_until) {
+  str_t str;
+  uint32_t sleep_early = 0;
+  uint32_t spin_early = 0;
+  modbus_histogram_t sleep_error;
+  modbus_histogram_t spin_error;
+  /*115200和9600波特率时的t3.5*/
+  uint32_t gaps[] = {304, 3646};
+
+  ASSERT_EQ(modbus_common_wait_until(0, MODBUS_FRAME_GAP_SPIN_TIME), RET_OK);
+
+  str_init(&str, 256);
+  for (uint32_t i = 0; i < ARRAY_SIZE(gaps); i++) {
+    sleep_early = 0;
+    spin_early = 0;
+    modbus_histogram_init(&sleep_error);
+    modbus_histogram_init(&spin_error);
+    ASSERT_NO_FATAL_FAILURE(test_wait_until_error(gaps[i], 0, &sleep_error, &sleep_early));
+    ASSERT_NO_FATAL_FAILURE(
+        test_wait_until_error(gaps[i], MODBUS_FRAME_GAP_SPIN_TIME, &spin_error, &spin_early));
+
+    /*误差受调度影响，只输出分布不做断言*/
+    str_set(&str, "");
+    str_append_format(&str, 64, "frame gap %uus\n", gaps[i]);
+    modbus_histogram_to_str(&sleep_error, "  sleep error(us)", &str);
+    modbus_histogram_to_str(&spin_error, "  sleep+spin error(us)", &str);
+    log_info("%s", str.str);
+
+    /*不论是否忙等，都不能早于截止时间返回*/
+    ASSERT_EQ(sleep_early, 0u);
+    ASSERT_EQ(spin_early, 0u);
+  }
+  str_reset(&str);
+}
@@ -0,0 +1,98 @@
+#include "gtest/gtest.h"
+#include "tkc/utils.h"
+#include "modbus_histogram.h"
+
+TEST(modbus_histogram, basic) {
+  modbus_histogram_t h;
+  ASSERT_EQ(modbus_histogram_init(&h), RET_OK);
+  ASSERT_EQ(modbus_histogram_get_percentile(&h, 50), 0u);
+  ASSERT_EQ(modbus_histogram_get_mean(&h), 0u);
+
+  ASSERT_EQ(modbus_histogram_record(&h, 3), RET_OK);
+  ASSERT_EQ(modbus_histogram_record(&h, 5), RET_OK);
+  ASSERT_EQ(modbus_histogram_record(&h, 7), RET_OK);
+  ASSERT_EQ(h.total, 3u);
+  ASSERT_EQ(h.min, 3u);
+  ASSERT_EQ(h.max, 7u);
+  ASSERT_EQ(modbus_histogram_get_mean(&h), 5u);
+
+#if MODBUS_WITH_STATS
+  /*小于16的值是精确的*/
+  ASSERT_EQ(modbus_histogram_get_percentile(&h, 0), 3u);
+  ASSERT_EQ(modbus_histogram_get_percentile(&h, 50), 5u);
+#else
+  /*不分桶时返回最大值*/
+  ASSERT_EQ(modbus_histogram_get_percentile(&h, 0), 7u);
+  ASSERT_EQ(modbus_histogram_get_percentile(&h, 50), 7u);
+#endif /*MODBUS_WITH_STATS*/
+  ASSERT_EQ(modbus_histogram_get_percentile(&h, 100), 7u);
+
+  ASSERT_EQ(modbus_histogram_reset(&h), RET_OK);
+  ASSERT_EQ(h.total, 0u);
+}
+
+#if MODBUS_WITH_STATS
+TEST(modbus_histogram, percentile) {
+  uint32_t i = 0;
+  modbus_histogram_t h;
+  modbus_histogram_init(&h);
+
+  for (i = 1; i <= 100000; i++) {
+    modbus_histogram_record(&h, i);
+  }
+
+  uint32_t p50 = modbus_histogram_get_percentile(&h, 50);
+  uint32_t p99 = modbus_histogram_get_percentile(&h, 99);
+  uint32_t p999 = modbus_histogram_get_percentile(&h, 99.9);
+
+  ASSERT_GE(p50, 50000u);
+  ASSERT_LE(p50, 50000u + 50000u / 16);
+  ASSERT_GE(p99, 99000u);
+  ASSERT_LE(p99, 100000u);
+  ASSERT_GE(p999, 99900u);
+  ASSERT_LE(p999, 100000u);
+}
+
+TEST(modbus_histogram, tail) {
+  uint32_t i = 0;
+  modbus_histogram_t h;
+  modbus_histogram_init(&h);
+
+  for (i = 0; i < 990; i++) {
+    modbus_histogram_record(&h, 100);
+  }
+  for (i = 0; i < 10; i++) {
+    modbus_histogram_record(&h, 5000);
+  }
+  modbus_histogram_record(&h, 0xffffffff);
+
+  ASSERT_GE(modbus_histogram_get_percentile(&h, 50), 100u);
+  ASSERT_LE(modbus_histogram_get_percentile(&h, 50), 100u + 100u / 16);
+  ASSERT_GE(modbus_histogram_get_percentile(&h, 99.9), 5000u);
+  ASSERT_LE(modbus_histogram_get_percentile(&h, 99.9), 5000u + 5000u / 16);
+  ASSERT_EQ(modbus_histogram_get_percentile(&h, 100), 0xffffffffu);
+}
+#endif /*MODBUS_WITH_STATS*/
+
+TEST(modbus_histogram, merge) {
+  str_t str;
+  modbus_histogram_t a;
+  modbus_histogram_t b;
+  modbus_histogram_init(&a);
+  modbus_histogram_init(&b);
+
+  modbus_histogram_record(&a, 10);
+  modbus_histogram_record(&b, 2);
+  modbus_histogram_record(&b, 1000);
+
+  ASSERT_EQ(modbus_histogram_merge(&a, &b), RET_OK);
+  ASSERT_EQ(a.total, 3u);
+  ASSERT_EQ(a.min, 2u);
+  ASSERT_EQ(a.max, 1000u);
+  ASSERT_EQ(a.sum, 1012u);
+
+  str_init(&str, 100);
+  ASSERT_EQ(modbus_histogram_to_str(&a, "rtt", &str), RET_OK);
+  ASSERT_EQ(strstr(str.str, "rtt: count=3 min=2") != NULL, TRUE);
+  str_reset(&str);
+}
@@ -6,7 +6,11 @@
 #include "modbus_memory_default.h"
 #include "modbus_service_helper.h"
 #include "modbus_client.h"
+#include "streams/mem/iostream_mem.h"
+#include "alloc_counter.h"
+#include <atomic>
 #include <thread>
+#include <vector>
 
 static ret_t modbus_service_start(event_source_manager_t* esm, modbus_memory_t* memory, const char* url) {
   ret_t ret = RET_FAIL;
@@ -227,3 +231,885 @@ TEST(modbus, server_rtu_error) {
   test_server_slave_error(server_url, client_url, 0x01, MODBUS_PROTO_RTU);
 }
 #endif
+
+TEST(modbus, service_stats) {
+  str_t str;
+  uint16_t regs[4];
+  uint8_t req_buff[512];
+  uint8_t resp_buff[512];
+  wbuffer_t client_wb;
+  modbus_common_t client;
+  modbus_service_stats_t stats;
+  modbus_memory_t* memory = modbus_memory_default_create_test();
+  tk_iostream_t* client_io =
+      tk_iostream_mem_create(resp_buff, sizeof(resp_buff), req_buff, sizeof(req_buff), FALSE);
+  tk_iostream_t* server_io =
+      tk_iostream_mem_create(req_buff, sizeof(req_buff), resp_buff, sizeof(resp_buff), FALSE);
+  modbus_service_t* service = modbus_service_create_with_io(server_io, MODBUS_PROTO_TCP, memory);
+
+  wbuffer_init_extendable(&client_wb);
+  modbus_common_init(&client, client_io, MODBUS_PROTO_TCP, &client_wb);
+  client.slave = 0xff;
+
+  ASSERT_EQ(modbus_common_send_read_registers_req(&client, MODBUS_FC_READ_HOLDING_REGISTERS,
+                                                  MODBUS_DEMO_REGISTERS_ADDRESS, 4),
+            RET_OK);
+  ASSERT_EQ(modbus_service_dispatch(service), RET_OK);
+  ASSERT_EQ(modbus_common_send_write_register_req(&client, MODBUS_DEMO_REGISTERS_ADDRESS, 1), RET_OK);
+  ASSERT_EQ(modbus_service_dispatch(service), RET_OK);
+  ASSERT_EQ(modbus_common_send_read_registers_req(&client, MODBUS_FC_READ_HOLDING_REGISTERS, 0, 4),
+            RET_OK);
+  ASSERT_EQ(modbus_service_dispatch(service), RET_OK);
+
+  uint16_t count = 4;
+  ASSERT_EQ(modbus_common_recv_read_registers_resp(&client, MODBUS_FC_READ_HOLDING_REGISTERS, regs,
+                                                   &count),
+            RET_OK);
+
+  ASSERT_EQ(modbus_service_get_stats(service, &stats), RET_OK);
+#if MODBUS_WITH_STATS
+  ASSERT_EQ(stats.num_requests_by_fc[MODBUS_FC_READ_HOLDING_REGISTERS], 2u);
+  ASSERT_EQ(stats.num_requests_by_fc[MODBUS_FC_WRITE_SINGLE_HOLDING_REGISTER], 1u);
+#endif /*MODBUS_WITH_STATS*/
+  ASSERT_EQ(stats.num_exceptions_by_code[MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS], 1u);
+  ASSERT_EQ(stats.dispatch_time.total, 3u);
+  ASSERT_EQ(stats.bytes_in, client.bytes_out);
+  ASSERT_EQ(stats.bytes_out, 17u + 12u + 9u);
+
+  str_init(&str, 256);
+  ASSERT_EQ(modbus_service_stats_to_str(&stats, &str), RET_OK);
+#if MODBUS_WITH_STATS
+  ASSERT_EQ(strstr(str.str, "fc3: requests=2") != NULL, TRUE);
+#endif /*MODBUS_WITH_STATS*/
+  ASSERT_EQ(strstr(str.str, "exception2: count=1") != NULL, TRUE);
+  ASSERT_EQ(strstr(str.str, "dispatch_us: count=3") != NULL, TRUE);
+  str_reset(&str);
+
+  ASSERT_EQ(modbus_service_reset_stats(service), RET_OK);
+  ASSERT_EQ(modbus_service_get_stats(service, &stats), RET_OK);
+  ASSERT_EQ(stats.dispatch_time.total, 0u);
+  ASSERT_EQ(stats.bytes_in, 0u);
+
+  modbus_common_deinit(&client);
+  wbuffer_deinit(&client_wb);
+  modbus_service_destroy(service);
+  TK_OBJECT_UNREF(client_io);
+  TK_OBJECT_UNREF(server_io);
+  modbus_memory_destroy(memory);
+}
+
+TEST(modbus, service_diagnostics) {
+  uint8_t req_buff[512] = {
+      /*0x08 0x0A: 清除计数器(计数器是全部连接的累计值，先清除前面测试的数据)*/
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x06, 0xff, 0x08, 0x00, 0x0A, 0x00, 0x00,
+      /*0x08 0x00: 返回请求的数据*/
+      0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0xff, 0x08, 0x00, 0x00, 0x12, 0x34,
+      /*0x08 0x0B: 总线消息数*/
+      0x00, 0x02, 0x00, 0x00, 0x00, 0x06, 0xff, 0x08, 0x00, 0x0B, 0x00, 0x00,
+      /*读取全部诊断寄存器*/
+      0x00, 0x03, 0x00, 0x00, 0x00, 0x06, 0xff, 0x04, 0x10, 0x00, 0x00, 0x14,
+      /*只读取一部分诊断寄存器，返回异常*/
+      0x00, 0x04, 0x00, 0x00, 0x00, 0x06, 0xff, 0x04, 0x10, 0x10, 0x00, 0x08,
+      /*不支持的子功能码*/
+      0x00, 0x05, 0x00, 0x00, 0x00, 0x06, 0xff, 0x08, 0x00, 0x30, 0x00, 0x00,
+  };
+  uint8_t req_buff2[512] = {
+      /*0x08 0x0B: 总线消息数*/
+      0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0xff, 0x08, 0x00, 0x0B, 0x00, 0x00,
+      /*0x08 0x0D: 异常回复数*/
+      0x00, 0x02, 0x00, 0x00, 0x00, 0x06, 0xff, 0x08, 0x00, 0x0D, 0x00, 0x00,
+  };
+  uint8_t resp_buff[512];
+  uint8_t resp_buff2[512];
+  const uint8_t* p = resp_buff;
+  modbus_memory_t* memory = modbus_memory_default_create_test();
+  tk_iostream_t* server_io =
+      tk_iostream_mem_create(req_buff, sizeof(req_buff), resp_buff, sizeof(resp_buff), FALSE);
+  modbus_service_t* service = modbus_service_create_with_io(server_io, MODBUS_PROTO_TCP, memory);
+  tk_iostream_t* server_io2 =
+      tk_iostream_mem_create(req_buff2, sizeof(req_buff2), resp_buff2, sizeof(resp_buff2), FALSE);
+  modbus_service_t* service2 = modbus_service_create_with_io(server_io2, MODBUS_PROTO_TCP, memory);
+
+  uint32_t conns = modbus_service_get_connections_count();
+
+  memset(resp_buff, 0x00, sizeof(resp_buff));
+  ASSERT_GE(conns, 2u);
+  ASSERT_EQ(modbus_service_set_diag_registers(service, TRUE, 0x1000), RET_OK);
+  ASSERT_EQ(modbus_service_dispatch(service), RET_OK);
+  ASSERT_EQ(memcmp(p, req_buff, 12), 0);
+  p += 12;
+  ASSERT_EQ(modbus_service_dispatch(service), RET_OK);
+  ASSERT_EQ(modbus_service_dispatch(service), RET_OK);
+  ASSERT_EQ(modbus_service_dispatch(service), RET_OK);
+  ASSERT_EQ(modbus_service_dispatch(service), RET_OK);
+  ASSERT_EQ(modbus_service_dispatch(service), RET_OK);
+
+  /*echo*/
+  ASSERT_EQ(memcmp(p, req_buff + 12, 12), 0);
+  p += 12;
+
+  /*总线消息数(包括当前请求)*/
+  ASSERT_EQ(p[7], 0x08);
+  ASSERT_EQ(p[9], 0x0B);
+  ASSERT_EQ((p[10] << 8) | p[11], 2);
+  p += 12;
+
+  /*诊断寄存器*/
+  ASSERT_EQ(p[7], 0x04);
+  ASSERT_EQ(p[8], MODBUS_SERVICE_DIAG_REGISTERS_NB * 2);
+  ASSERT_EQ((p[9 + 0] << 24) | (p[9 + 1] << 16) | (p[9 + 2] << 8) | p[9 + 3], 3);
+  ASSERT_EQ((p[9 + 28] << 24) | (p[9 + 29] << 16) | (p[9 + 30] << 8) | p[9 + 31], (int)conns);
+  p += 9 + MODBUS_SERVICE_DIAG_REGISTERS_NB * 2;
+
+  ASSERT_EQ(p[7], 0x84);
+  ASSERT_EQ(p[8], MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+  p += 9;
+
+  ASSERT_EQ(p[7], 0x88);
+  ASSERT_EQ(p[8], MODBUS_EXCEPTION_ILLEGAL_FUNCTION);
+
+  /*另一个连接读到的是服务端的累计值*/
+  p = resp_buff2;
+  ASSERT_EQ(modbus_service_dispatch(service2), RET_OK);
+  ASSERT_EQ(modbus_service_dispatch(service2), RET_OK);
+  ASSERT_EQ(p[9], 0x0B);
+  ASSERT_EQ((p[10] << 8) | p[11], 6);
+  p += 12;
+  ASSERT_EQ(p[9], 0x0D);
+  ASSERT_EQ((p[10] << 8) | p[11], 2);
+  ASSERT_EQ(service2->num_except_reply, 0u);
+
+  modbus_service_destroy(service2);
+  modbus_service_destroy(service);
+  ASSERT_EQ(modbus_service_get_connections_count(), conns - 2);
+  TK_OBJECT_UNREF(server_io2);
+  TK_OBJECT_UNREF(server_io);
+  modbus_memory_destroy(memory);
+}
+
+TEST(modbus, service_units) {
+  uint8_t req_buff[512] = {
+      /*unit 1: 读取1个寄存器*/
+      0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0x01, 0x03, 0x01, 0x60, 0x00, 0x01,
+      /*unit 2: 读取1个寄存器*/
+      0x00, 0x02, 0x00, 0x00, 0x00, 0x06, 0x02, 0x03, 0x01, 0x60, 0x00, 0x01,
+      /*unit 3: 不存在*/
+      0x00, 0x03, 0x00, 0x00, 0x00, 0x06, 0x03, 0x03, 0x01, 0x60, 0x00, 0x01,
+  };
+  uint8_t resp_buff[512];
+  const uint8_t* p = resp_buff;
+  modbus_memory_t* units[MODBUS_SERVICE_UNITS_NR];
+  modbus_memory_t* memory1 = modbus_memory_default_create_test();
+  modbus_memory_t* memory2 = modbus_memory_default_create_test();
+  tk_iostream_t* server_io =
+      tk_iostream_mem_create(req_buff, sizeof(req_buff), resp_buff, sizeof(resp_buff), FALSE);
+  modbus_service_t* service = modbus_service_create_with_io(server_io, MODBUS_PROTO_TCP, NULL);
+
+  memset(units, 0x00, sizeof(units));
+  memset(resp_buff, 0x00, sizeof(resp_buff));
+  units[1] = memory1;
+  units[2] = memory2;
+  modbus_memory_write_register(memory1, MODBUS_DEMO_REGISTERS_ADDRESS, 0x1111);
+  modbus_memory_write_register(memory2, MODBUS_DEMO_REGISTERS_ADDRESS, 0x2222);
+
+  ASSERT_EQ(modbus_service_set_units(service, units), RET_OK);
+  ASSERT_EQ(modbus_service_dispatch(service), RET_OK);
+  ASSERT_EQ(modbus_service_dispatch(service), RET_OK);
+  ASSERT_EQ(modbus_service_dispatch(service), RET_OK);
+
+  ASSERT_EQ(p[6], 0x01);
+  ASSERT_EQ(p[7], MODBUS_FC_READ_HOLDING_REGISTERS);
+  ASSERT_EQ((p[9] << 8) | p[10], 0x1111);
+  p += 11;
+
+  ASSERT_EQ(p[6], 0x02);
+  ASSERT_EQ(p[7], MODBUS_FC_READ_HOLDING_REGISTERS);
+  ASSERT_EQ((p[9] << 8) | p[10], 0x2222);
+  p += 11;
+
+  ASSERT_EQ(p[6], 0x03);
+  ASSERT_EQ(p[7], MODBUS_FC_READ_HOLDING_REGISTERS | 0x80);
+  ASSERT_EQ(p[8], MODBUS_EXCEPTION_GATEWAY_TARGET_DEVICE_FAILED_TO_RESPOND);
+
+  modbus_service_destroy(service);
+  TK_OBJECT_UNREF(server_io);
+  modbus_memory_destroy(memory1);
+  modbus_memory_destroy(memory2);
+}
+
+static uint32_t s_deferred_token = 0;
+
+static ret_t read_registers_deferred(modbus_memory_t* memory, uint16_t addr, uint16_t count,
+                                     uint16_t* buff) {
+  s_deferred_token = modbus_service_defer();
+
+  return s_deferred_token != 0 ? RET_OK : RET_FAIL;
+}
+
+/*在回调函数中直接完成*/
+static ret_t write_register_deferred(modbus_memory_t* memory, uint16_t addr, uint16_t value) {
+  uint32_t token = modbus_service_defer();
+
+  return modbus_service_complete_deferred(token, NULL, 0);
+}
+
+TEST(modbus, service_deferred) {
+  uint8_t req_buff[512] = {
+      /*读取1个寄存器，在其它线程完成*/
+      0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0xff, 0x03, 0x01, 0x60, 0x00, 0x01,
+      /*读取1个寄存器，回复异常*/
+      0x00, 0x02, 0x00, 0x00, 0x00, 0x06, 0xff, 0x03, 0x01, 0x60, 0x00, 0x01,
+      /*读取1个寄存器，超时*/
+      0x00, 0x03, 0x00, 0x00, 0x00, 0x06, 0xff, 0x03, 0x01, 0x60, 0x00, 0x01,
+      /*写1个寄存器，在回调函数中完成*/
+      0x00, 0x04, 0x00, 0x00, 0x00, 0x06, 0xff, 0x06, 0x01, 0x60, 0x12, 0x34,
+  };
+  uint8_t resp_buff[512];
+  const uint8_t* p = resp_buff;
+  modbus_service_stats_t stats;
+  modbus_memory_t* memory = modbus_memory_default_create_test();
+  tk_iostream_t* server_io =
+      tk_iostream_mem_create(req_buff, sizeof(req_buff), resp_buff, sizeof(resp_buff), FALSE);
+  modbus_service_t* service = modbus_service_create_with_io(server_io, MODBUS_PROTO_TCP, memory);
+
+  memory->read_registers = read_registers_deferred;
+  memory->write_register = write_register_deferred;
+  memset(resp_buff, 0x00, sizeof(resp_buff));
+  ASSERT_EQ(modbus_service_set_deferred_timeout(service, 50, (modbus_exeption_code_t)0), RET_OK);
+  ASSERT_EQ(modbus_service_defer(), 0u);
+
+  /*在其它线程完成*/
+  ASSERT_EQ(modbus_service_dispatch(service), RET_OK);
+  ASSERT_NE(s_deferred_token, 0u);
+  ASSERT_EQ(p[7], 0);
+  std::thread worker([]() {
+    uint8_t data[] = {0xab, 0xcd};
+    ASSERT_EQ(modbus_service_complete_deferred(s_deferred_token, data, sizeof(data)), RET_OK);
+  });
+  worker.join();
+  ASSERT_EQ(p[1], 0x01);
+  ASSERT_EQ(p[7], MODBUS_FC_READ_HOLDING_REGISTERS);
+  ASSERT_EQ((p[9] << 8) | p[10], 0xabcd);
+  p += 11;
+
+  /*token只能使用一次*/
+  ASSERT_EQ(modbus_service_complete_deferred(s_deferred_token, NULL, 0), RET_NOT_FOUND);
+
+  /*回复异常*/
+  ASSERT_EQ(modbus_service_dispatch(service), RET_OK);
+  ASSERT_EQ(modbus_service_fail_deferred(s_deferred_token, MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE),
+            RET_OK);
+  ASSERT_EQ(p[1], 0x02);
+  ASSERT_EQ(p[7], MODBUS_FC_READ_HOLDING_REGISTERS | 0x80);
+  ASSERT_EQ(p[8], MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE);
+  p += 9;
+
+  /*超时*/
+  ASSERT_EQ(modbus_service_dispatch(service), RET_OK);
+  ASSERT_EQ(modbus_service_check_deferred_timeout(NULL), RET_OK);
+  ASSERT_EQ(p[7], 0);
+  sleep_ms(60);
+  ASSERT_EQ(modbus_service_check_deferred_timeout(NULL), RET_OK);
+  ASSERT_EQ(p[1], 0x03);
+  ASSERT_EQ(p[7], MODBUS_FC_READ_HOLDING_REGISTERS | 0x80);
+  ASSERT_EQ(p[8], MODBUS_EXCEPTION_SERVER_DEVICE_BUSY);
+  ASSERT_EQ(modbus_service_complete_deferred(s_deferred_token, NULL, 0), RET_NOT_FOUND);
+  p += 9;
+
+  /*在回调函数中完成*/
+  ASSERT_EQ(modbus_service_dispatch(service), RET_OK);
+  ASSERT_EQ(memcmp(p, req_buff + 36, 12), 0);
+
+  ASSERT_EQ(modbus_service_get_stats(service, &stats), RET_OK);
+  ASSERT_EQ(stats.num_deferred, 4u);
+  ASSERT_EQ(stats.num_deferred_timeouts, 1u);
+  ASSERT_EQ(stats.dispatch_time.total, 4u);
+
+  modbus_service_destroy(service);
+  TK_OBJECT_UNREF(server_io);
+  modbus_memory_destroy(memory);
+}
+
+static std::atomic<bool> s_blocking_entered(false);
+static std::atomic<bool> s_blocking_released(false);
+
+/*回调函数执行很慢(不延迟回复)*/
+static ret_t read_registers_blocking(modbus_memory_t* memory, uint16_t addr, uint16_t count,
+                                     uint16_t* buff) {
+  s_blocking_entered = true;
+  while (!s_blocking_released) {
+    sleep_ms(1);
+  }
+
+  return RET_OK;
+}
+
+TEST(modbus, service_deferred_independent) {
+  uint8_t req_buff[512] = {
+      0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0xff, 0x03, 0x01, 0x60, 0x00, 0x01,
+  };
+  uint8_t resp_buff1[512];
+  uint8_t resp_buff2[512];
+  modbus_memory_t* memory1 = modbus_memory_default_create_test();
+  modbus_memory_t* memory2 = modbus_memory_default_create_test();
+  tk_iostream_t* io1 =
+      tk_iostream_mem_create(req_buff, sizeof(req_buff), resp_buff1, sizeof(resp_buff1), FALSE);
+  tk_iostream_t* io2 =
+      tk_iostream_mem_create(req_buff, sizeof(req_buff), resp_buff2, sizeof(resp_buff2), FALSE);
+  modbus_service_t* service1 = modbus_service_create_with_io(io1, MODBUS_PROTO_TCP, memory1);
+  modbus_service_t* service2 = modbus_service_create_with_io(io2, MODBUS_PROTO_TCP, memory2);
+
+  memory1->read_registers = read_registers_blocking;
+  memory2->read_registers = read_registers_deferred;
+  memset(resp_buff1, 0x00, sizeof(resp_buff1));
+  memset(resp_buff2, 0x00, sizeof(resp_buff2));
+  ASSERT_EQ(modbus_service_set_deferred_timeout(service1, 1000, (modbus_exeption_code_t)0), RET_OK);
+  ASSERT_EQ(modbus_service_set_deferred_timeout(service2, 1000, (modbus_exeption_code_t)0), RET_OK);
+
+  ASSERT_EQ(modbus_service_dispatch(service2), RET_OK);
+  ASSERT_NE(s_deferred_token, 0u);
+
+  /*一个连接的回调函数阻塞时，其它连接仍然可以完成延迟回复*/
+  s_blocking_entered = false;
+  s_blocking_released = false;
+  std::thread worker([service1]() { modbus_service_dispatch(service1); });
+  while (!s_blocking_entered) {
+    sleep_ms(1);
+  }
+  ASSERT_EQ(modbus_service_defer(), 0u);
+  ASSERT_EQ(modbus_service_complete_deferred(s_deferred_token, "\x12\x34", 2), RET_OK);
+  ASSERT_EQ(resp_buff2[7], MODBUS_FC_READ_HOLDING_REGISTERS);
+  ASSERT_EQ((resp_buff2[9] << 8) | resp_buff2[10], 0x1234);
+  ASSERT_EQ(resp_buff1[7], 0);
+
+  s_blocking_released = true;
+  worker.join();
+  ASSERT_EQ(resp_buff1[7], MODBUS_FC_READ_HOLDING_REGISTERS);
+
+  modbus_service_destroy(service1);
+  modbus_service_destroy(service2);
+  TK_OBJECT_UNREF(io1);
+  TK_OBJECT_UNREF(io2);
+  modbus_memory_destroy(memory1);
+  modbus_memory_destroy(memory2);
+}
+
+TEST(modbus, service_deferred_slots) {
+  uint32_t i = 0;
+  uint8_t req_buff[512] = {
+      0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0xff, 0x03, 0x01, 0x60, 0x00, 0x01,
+  };
+  uint8_t resp_buff[512];
+  const uint32_t nr = tk_min(MODBUS_SERVICE_MAX_DEFERRED, 100);
+  modbus_memory_t* memory = modbus_memory_default_create_test();
+  tk_iostream_t* io =
+      tk_iostream_mem_create(req_buff, sizeof(req_buff), resp_buff, sizeof(resp_buff), FALSE);
+  std::vector<modbus_service_t*> services;
+
+  memory->read_registers = read_registers_deferred;
+  memset(resp_buff, 0x00, sizeof(resp_buff));
+
+  /*位置按需扩大，直到MODBUS_SERVICE_MAX_DEFERRED*/
+  for (i = 0; i < nr; i++) {
+    modbus_service_t* service = modbus_service_create_with_io(io, MODBUS_PROTO_TCP, memory);
+    ASSERT_EQ(modbus_service_set_deferred_timeout(service, 1000, (modbus_exeption_code_t)0), RET_OK);
+    services.push_back(service);
+  }
+  if (nr == MODBUS_SERVICE_MAX_DEFERRED) {
+    modbus_service_t* service = modbus_service_create_with_io(io, MODBUS_PROTO_TCP, memory);
+    ASSERT_EQ(modbus_service_set_deferred_timeout(service, 1000, (modbus_exeption_code_t)0),
+              RET_EXCEED_RANGE);
+    modbus_service_destroy(service);
+  }
+
+  /*最后一个连接的位置是扩大之后的，token仍然能找到它*/
+  ASSERT_EQ(modbus_service_dispatch(services.back()), RET_OK);
+  ASSERT_NE(s_deferred_token, 0u);
+  ASSERT_EQ(modbus_service_complete_deferred(s_deferred_token, "\x12\x34", 2), RET_OK);
+  ASSERT_EQ(resp_buff[7], MODBUS_FC_READ_HOLDING_REGISTERS);
+  ASSERT_EQ((resp_buff[9] << 8) | resp_buff[10], 0x1234);
+
+  for (i = 0; i < services.size(); i++) {
+    modbus_service_destroy(services[i]);
+  }
+  TK_OBJECT_UNREF(io);
+  modbus_memory_destroy(memory);
+}
+
+static std::atomic<uint32_t> s_parked_token(0);
+
+static ret_t read_registers_parked(modbus_memory_t* memory, uint16_t addr, uint16_t count,
+                                   uint16_t* buff) {
+  s_parked_token = modbus_service_defer();
+
+  return s_parked_token != 0 ? RET_OK : RET_FAIL;
+}
+
+TEST(modbus, service_deferred_esm) {
+  bool running = true;
+  uint16_t value = 0;
+  modbus_service_args_t args = {};
+  modbus_memory_t* memory = modbus_memory_default_create_test();
+  event_source_manager_t* esm = event_source_manager_default_create();
+
+  memory->read_registers = read_registers_parked;
+  memory->write_register = write_register_deferred;
+  args.memory = memory;
+  args.proto = MODBUS_PROTO_TCP;
+  args.slave = MODBUS_DEMO_SLAVE_ID;
+  args.deferred_timeout = 50;
+  ASSERT_EQ(modbus_service_tcp_start_by_args(esm, &args, 2512), RET_OK);
+
+  std::thread thread([esm, &running]() {
+    while (running) {
+      event_source_manager_dispatch(esm);
+    }
+  });
+
+  modbus_client_t* client = modbus_client_create("tcp://localhost:2512");
+  ASSERT_TRUE(client != NULL);
+  modbus_client_set_slave(client, MODBUS_DEMO_SLAVE_ID);
+
+  /*等待回复期间连接从esm中移除，在其它线程完成后由唤醒socket重新加入*/
+  s_parked_token = 0;
+  std::thread worker([]() {
+    uint8_t data[] = {0xab, 0xcd};
+    while (s_parked_token == 0) {
+      sleep_ms(1);
+    }
+    sleep_ms(20);
+    ASSERT_EQ(modbus_service_complete_deferred(s_parked_token, data, sizeof(data)), RET_OK);
+  });
+  ASSERT_EQ(modbus_client_read_registers(client, 0x160, 1, &value), RET_OK);
+  ASSERT_EQ(value, 0xabcd);
+  worker.join();
+
+  /*没有数据可读时也由定时器检查超时*/
+  s_parked_token = 0;
+  ASSERT_NE(modbus_client_read_registers(client, 0x160, 1, &value), RET_OK);
+  ASSERT_NE(s_parked_token, 0u);
+  ASSERT_EQ(modbus_service_complete_deferred(s_parked_token, NULL, 0), RET_NOT_FOUND);
+
+  /*超时后继续读取请求*/
+  ASSERT_EQ(modbus_client_write_register(client, 0x160, 0x1234), RET_OK);
+
+  /*断开连接唤醒esm*/
+  running = false;
+  modbus_client_destroy(client);
+  thread.join();
+
+  ASSERT_EQ(modbus_service_tcp_stop(), RET_OK);
+  event_source_manager_destroy(esm);
+  modbus_memory_destroy(memory);
+}
+
+TEST(modbus, service_epoll_esm) {
+  bool running = true;
+  uint16_t value = 0;
+  modbus_client_stats_t stats;
+  modbus_service_args_t args = {};
+  modbus_memory_t* memory = modbus_memory_default_create_test();
+  event_source_manager_t* esm = event_source_manager_default_create();
+
+  memory->read_registers = read_registers_parked;
+  args.memory = memory;
+  args.proto = MODBUS_PROTO_TCP;
+  args.slave = MODBUS_DEMO_SLAVE_ID;
+  args.backend = MODBUS_SERVICE_BACKEND_EPOLL;
+  args.deferred_timeout = 50;
+  ASSERT_EQ(modbus_service_tcp_start_by_args(esm, &args, 2513), RET_OK);
+
+  std::thread thread([esm, &running]() {
+    while (running) {
+      event_source_manager_dispatch(esm);
+    }
+  });
+
+  modbus_client_t* client = modbus_client_create("tcp://localhost:2513");
+  ASSERT_TRUE(client != NULL);
+  modbus_client_set_slave(client, MODBUS_DEMO_SLAVE_ID);
+  modbus_client_set_response_timeout(client, 1000);
+
+  /*epoll的fd没有事件时，由esm中的定时器检查超时并回复异常(不是客户端超时)*/
+  s_parked_token = 0;
+  ASSERT_NE(modbus_client_read_registers(client, 0x160, 1, &value), RET_OK);
+  ASSERT_NE(s_parked_token, 0u);
+  ASSERT_EQ(modbus_client_get_stats(client, &stats), RET_OK);
+  ASSERT_EQ(stats.num_timeouts, 0u);
+  ASSERT_EQ(stats.num_exceptions, 1u);
+  ASSERT_EQ(modbus_service_complete_deferred(s_parked_token, NULL, 0), RET_NOT_FOUND);
+
+  running = false;
+  modbus_client_destroy(client);
+  thread.join();
+
+  ASSERT_EQ(modbus_service_tcp_stop(), RET_OK);
+  event_source_manager_destroy(esm);
+  modbus_memory_destroy(memory);
+}
+
+TEST(modbus, service_rate_limit) {
+  uint8_t req_buff[512] = {
+      0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0xff, 0x03, 0x01, 0x60, 0x00, 0x01,
+      0x00, 0x02, 0x00, 0x00, 0x00, 0x06, 0xff, 0x03, 0x01, 0x60, 0x00, 0x01,
+      /*超过突发请求数*/
+      0x00, 0x03, 0x00, 0x00, 0x00, 0x06, 0xff, 0x03, 0x01, 0x60, 0x00, 0x01,
+  };
+  uint8_t resp_buff[512];
+  const uint8_t* p = resp_buff;
+  modbus_service_stats_t stats;
+  modbus_memory_t* memory = modbus_memory_default_create_test();
+  tk_iostream_t* server_io =
+      tk_iostream_mem_create(req_buff, sizeof(req_buff), resp_buff, sizeof(resp_buff), FALSE);
+  modbus_service_t* service = modbus_service_create_with_io(server_io, MODBUS_PROTO_TCP, memory);
+
+  memset(resp_buff, 0x00, sizeof(resp_buff));
+  ASSERT_EQ(modbus_service_set_rate_limit(service, 1, 2), RET_OK);
+
+  ASSERT_EQ(modbus_service_dispatch(service), RET_OK);
+  ASSERT_EQ(p[7], MODBUS_FC_READ_HOLDING_REGISTERS);
+  p += 11;
+  ASSERT_EQ(modbus_service_dispatch(service), RET_OK);
+  ASSERT_EQ(p[7], MODBUS_FC_READ_HOLDING_REGISTERS);
+  p += 11;
+  ASSERT_EQ(modbus_service_dispatch(service), RET_OK);
+  ASSERT_EQ(p[1], 0x03);
+  ASSERT_EQ(p[7], MODBUS_FC_READ_HOLDING_REGISTERS | 0x80);
+  ASSERT_EQ(p[8], MODBUS_EXCEPTION_SERVER_DEVICE_BUSY);
+
+  ASSERT_EQ(modbus_service_get_stats(service, &stats), RET_OK);
+  ASSERT_EQ(stats.num_shed_rate_limited, 1u);
+  ASSERT_EQ(stats.num_shed_in_flight, 0u);
+  ASSERT_EQ(stats.num_exceptions_by_code[MODBUS_EXCEPTION_SERVER_DEVICE_BUSY], 1u);
+
+  modbus_service_destroy(service);
+  TK_OBJECT_UNREF(server_io);
+  modbus_memory_destroy(memory);
+}
+
+TEST(modbus, service_max_in_flight) {
+  uint8_t req_buff1[512] = {
+      0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0xff, 0x03, 0x01, 0x60, 0x00, 0x01,
+  };
+  uint8_t req_buff2[512] = {
+      /*另外一个连接的请求还没有回复*/
+      0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0xff, 0x03, 0x01, 0x60, 0x00, 0x01,
+      0x00, 0x02, 0x00, 0x00, 0x00, 0x06, 0xff, 0x03, 0x01, 0x60, 0x00, 0x01,
+  };
+  uint8_t resp_buff1[512];
+  uint8_t resp_buff2[512];
+  const uint8_t* p = resp_buff2;
+  modbus_service_stats_t stats;
+  modbus_memory_t* memory1 = modbus_memory_default_create_test();
+  modbus_memory_t* memory2 = modbus_memory_default_create_test();
+  tk_iostream_t* io1 =
+      tk_iostream_mem_create(req_buff1, sizeof(req_buff1), resp_buff1, sizeof(resp_buff1), FALSE);
+  tk_iostream_t* io2 =
+      tk_iostream_mem_create(req_buff2, sizeof(req_buff2), resp_buff2, sizeof(resp_buff2), FALSE);
+  modbus_service_t* service1 = modbus_service_create_with_io(io1, MODBUS_PROTO_TCP, memory1);
+  modbus_service_t* service2 = modbus_service_create_with_io(io2, MODBUS_PROTO_TCP, memory2);
+
+  memory1->read_registers = read_registers_deferred;
+  memset(resp_buff1, 0x00, sizeof(resp_buff1));
+  memset(resp_buff2, 0x00, sizeof(resp_buff2));
+  ASSERT_EQ(modbus_service_set_deferred_timeout(service1, 1000, (modbus_exeption_code_t)0), RET_OK);
+  ASSERT_EQ(modbus_service_set_max_in_flight(service1, 1), RET_OK);
+  ASSERT_EQ(modbus_service_set_max_in_flight(service2, 1), RET_OK);
+
+  ASSERT_EQ(modbus_service_dispatch(service1), RET_OK);
+  ASSERT_EQ(modbus_service_get_in_flight_count(), 1u);
+
+  ASSERT_EQ(modbus_service_dispatch(service2), RET_OK);
+  ASSERT_EQ(p[7], MODBUS_FC_READ_HOLDING_REGISTERS | 0x80);
+  ASSERT_EQ(p[8], MODBUS_EXCEPTION_SERVER_DEVICE_BUSY);
+  p += 9;
+
+  /*回复完成后释放*/
+  ASSERT_EQ(modbus_service_complete_deferred(s_deferred_token, "\x12\x34", 2), RET_OK);
+  ASSERT_EQ(resp_buff1[7], MODBUS_FC_READ_HOLDING_REGISTERS);
+  ASSERT_EQ(modbus_service_get_in_flight_count(), 0u);
+
+  ASSERT_EQ(modbus_service_dispatch(service2), RET_OK);
+  ASSERT_EQ(p[1], 0x02);
+  ASSERT_EQ(p[7], MODBUS_FC_READ_HOLDING_REGISTERS);
+  ASSERT_EQ(modbus_service_get_in_flight_count(), 0u);
+
+  ASSERT_EQ(modbus_service_get_stats(service2, &stats), RET_OK);
+  ASSERT_EQ(stats.num_shed_in_flight, 1u);
+  ASSERT_EQ(stats.num_shed_rate_limited, 0u);
+
+  modbus_service_destroy(service1);
+  modbus_service_destroy(service2);
+  TK_OBJECT_UNREF(io1);
+  TK_OBJECT_UNREF(io2);
+  modbus_memory_destroy(memory1);
+  modbus_memory_destroy(memory2);
+}
+
+TEST(modbus, service_read_ahead) {
+  uint8_t req_buff[36] = {
+      0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0xff, 0x03, 0x01, 0x60, 0x00, 0x01,
+      0x00, 0x02, 0x00, 0x00, 0x00, 0x06, 0xff, 0x06, 0x01, 0x60, 0x12, 0x34,
+      0x00, 0x03, 0x00, 0x00, 0x00, 0x06, 0xff, 0x03, 0x01, 0x60, 0x00, 0x01,
+  };
+  uint8_t resp_buff[512];
+  const uint8_t* p = resp_buff;
+  modbus_memory_t* memory = modbus_memory_default_create_test();
+  tk_iostream_t* server_io =
+      tk_iostream_mem_create(req_buff, sizeof(req_buff), resp_buff, sizeof(resp_buff), FALSE);
+  modbus_service_t* service = modbus_service_create_with_io(server_io, MODBUS_PROTO_TCP, memory);
+
+  memset(resp_buff, 0x00, sizeof(resp_buff));
+  ASSERT_EQ(modbus_common_set_read_ahead(MODBUS_COMMON(service), 256), RET_OK);
+
+  /*一次读取全部请求*/
+  ASSERT_EQ(modbus_service_dispatch(service), RET_OK);
+  ASSERT_EQ(service->common.num_reads, 1u);
+  ASSERT_EQ(modbus_common_get_buffered_size(MODBUS_COMMON(service)), 24u);
+  ASSERT_EQ(modbus_service_wait_for_data(service, 0), RET_OK);
+  ASSERT_EQ(p[1], 0x01);
+  p += 11;
+
+  ASSERT_EQ(modbus_service_dispatch(service), RET_OK);
+  ASSERT_EQ(memcmp(p, req_buff + 12, 12), 0);
+  p += 12;
+
+  ASSERT_EQ(modbus_service_dispatch(service), RET_OK);
+  ASSERT_EQ(p[1], 0x03);
+  ASSERT_EQ(p[7], MODBUS_FC_READ_HOLDING_REGISTERS);
+  ASSERT_EQ((p[9] << 8) | p[10], 0x1234);
+  ASSERT_EQ(service->common.num_reads, 1u);
+  ASSERT_EQ(service->common.bytes_in, sizeof(req_buff));
+  ASSERT_EQ(modbus_common_get_buffered_size(MODBUS_COMMON(service)), 0u);
+
+  modbus_service_destroy(service);
+  TK_OBJECT_UNREF(server_io);
+  modbus_memory_destroy(memory);
+}
+
+TEST(modbus, service_idle_reap) {
+  uint8_t req_buff1[512] = {
+      0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0xff, 0x03, 0x01, 0x60, 0x00, 0x01,
+  };
+  uint8_t req_buff2[512] = {0};
+  uint8_t req_buff3[512] = {0};
+  uint8_t resp_buff1[512];
+  uint8_t resp_buff2[512];
+  uint8_t resp_buff3[512];
+  modbus_service_conn_stats_t base;
+  modbus_service_conn_stats_t stats;
+  modbus_service_args_t args = {};
+  modbus_memory_t* memory = modbus_memory_default_create_test();
+  tk_iostream_t* io1 =
+      tk_iostream_mem_create(req_buff1, sizeof(req_buff1), resp_buff1, sizeof(resp_buff1), FALSE);
+  tk_iostream_t* io2 =
+      tk_iostream_mem_create(req_buff2, sizeof(req_buff2), resp_buff2, sizeof(resp_buff2), FALSE);
+  tk_iostream_t* io3 =
+      tk_iostream_mem_create(req_buff3, sizeof(req_buff3), resp_buff3, sizeof(resp_buff3), FALSE);
+
+  args.memory = memory;
+  args.slave = 0xff;
+  args.proto = MODBUS_PROTO_TCP;
+  ASSERT_EQ(modbus_service_get_conn_stats(&base), RET_OK);
+  ASSERT_EQ(modbus_service_set_idle_timeout(100), RET_OK);
+
+  modbus_service_t* service1 = (modbus_service_t*)modbus_service_create(io1, &args);
+  modbus_service_t* service2 = (modbus_service_t*)modbus_service_create(io2, &args);
+  ASSERT_EQ(modbus_service_reap_idle(), 0u);
+
+  /*service1收到请求后移到表尾，service2变成最久没有活动的连接*/
+  sleep_ms(60);
+  ASSERT_EQ(modbus_service_dispatch(service1), RET_OK);
+  sleep_ms(60);
+  ASSERT_EQ(modbus_service_reap_idle(), 1u);
+  ASSERT_EQ(service1->idle_linked, TRUE);
+  ASSERT_EQ(service2->idle_linked, FALSE);
+
+  /*超过连接数上限时关闭最久没有活动的连接*/
+  ASSERT_EQ(modbus_service_set_idle_timeout(0), RET_OK);
+  ASSERT_EQ(modbus_service_set_max_connections(1), RET_OK);
+  modbus_service_t* service3 = (modbus_service_t*)modbus_service_create(io3, &args);
+  ASSERT_EQ(service1->idle_linked, FALSE);
+  ASSERT_EQ(service3->idle_linked, TRUE);
+  ASSERT_EQ(modbus_service_set_max_connections(0), RET_OK);
+
+  ASSERT_EQ(modbus_service_get_conn_stats(&stats), RET_OK);
+  ASSERT_EQ(stats.active, base.active + 3);
+  ASSERT_EQ(stats.reaped, base.reaped + 1);
+  ASSERT_EQ(stats.evicted, base.evicted + 1);
+  ASSERT_GE(stats.peak, base.active + 3);
+
+  modbus_service_destroy(service1);
+  modbus_service_destroy(service2);
+  modbus_service_destroy(service3);
+  ASSERT_EQ(modbus_service_get_conn_stats(&stats), RET_OK);
+  ASSERT_EQ(stats.active, base.active);
+
+  TK_OBJECT_UNREF(io1);
+  TK_OBJECT_UNREF(io2);
+  TK_OBJECT_UNREF(io3);
+  modbus_memory_destroy(memory);
+}
+
+TEST(modbus, service_pool) {
+  uint8_t req_buff[] = {
+      0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0xff, 0x03, 0x01, 0x60, 0x00, 0x01,
+  };
+  uint8_t resp_buff[4][32];
+  tk_iostream_t* ios[4];
+  modbus_service_pool_stats_t base;
+  modbus_service_pool_stats_t stats;
+  modbus_service_args_t args = {};
+  modbus_memory_t* memory = modbus_memory_default_create_test();
+
+  args.memory = memory;
+  args.slave = 0xff;
+  args.proto = MODBUS_PROTO_TCP;
+  args.deferred_timeout = 100;
+  memset(resp_buff, 0x00, sizeof(resp_buff));
+  /*每个连接一个流(预读会读走流中后面的数据)*/
+  for (uint32_t i = 0; i < ARRAY_SIZE(ios); i++) {
+    ios[i] = tk_iostream_mem_create(req_buff, sizeof(req_buff), resp_buff[i], sizeof(resp_buff[i]),
+                                    FALSE);
+  }
+
+  ASSERT_EQ(modbus_service_set_pool_size(2), RET_OK);
+  ASSERT_EQ(modbus_service_get_pool_stats(&base), RET_OK);
+  ASSERT_EQ(base.size, 2u);
+  ASSERT_EQ(base.free, 2u);
+
+  /*
+   * 每次模拟一个连接：建立连接、处理一个请求、断开连接。
+   * 第一个连接分配预读缓冲区和延迟回复的上下文，之后的连接直接使用池中对象保留的。
+   */
+  for (uint32_t i = 0; i < ARRAY_SIZE(ios); i++) {
+    if (i == 1) {
+      alloc_counter_begin();
+    }
+    modbus_service_t* service = (modbus_service_t*)modbus_service_create(ios[i], &args);
+    ASSERT_TRUE(service != NULL);
+    ASSERT_TRUE(service->deferred != NULL);
+    ASSERT_EQ(service->service.wb.data, service->wbuffer_data);
+    ASSERT_EQ(modbus_service_set_read_ahead(service, 64), RET_OK);
+    ASSERT_EQ(modbus_service_dispatch(service), RET_OK);
+    modbus_service_destroy(service);
+  }
+
+  /*稳定状态下建立和断开连接都不再分配内存*/
+  ASSERT_EQ(alloc_counter_end(), 0u);
+  ASSERT_EQ(modbus_service_get_pool_stats(&stats), RET_OK);
+  ASSERT_EQ(stats.allocs, base.allocs);
+  ASSERT_EQ(stats.reuses, base.reuses + 4);
+  ASSERT_EQ(stats.free, 2u);
+
+  for (uint32_t i = 0; i < ARRAY_SIZE(ios); i++) {
+    ASSERT_EQ(resp_buff[i][1], 0x01);
+    ASSERT_EQ(resp_buff[i][7], MODBUS_FC_READ_HOLDING_REGISTERS);
+    TK_OBJECT_UNREF(ios[i]);
+  }
+
+  ASSERT_EQ(modbus_service_set_pool_size(0), RET_OK);
+  ASSERT_EQ(modbus_service_get_pool_stats(&stats), RET_OK);
+  ASSERT_EQ(stats.free, 0u);
+
+  modbus_memory_destroy(memory);
+}
+
+TEST(modbus, service_no_alloc) {
+  uint8_t req_buff[1024];
+  uint8_t resp_buff[4096];
+  const uint8_t reqs[][12] = {
+      {0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0xff, 0x03, 0x01, 0x60, 0x00, 0x10},
+      {0x00, 0x02, 0x00, 0x00, 0x00, 0x06, 0xff, 0x06, 0x01, 0x60, 0x12, 0x34},
+      {0x00, 0x03, 0x00, 0x00, 0x00, 0x06, 0xff, 0x01, 0x01, 0x30, 0x00, 0x10},
+      {0x00, 0x04, 0x00, 0x00, 0x00, 0x06, 0xff, 0x05, 0x01, 0x30, 0xff, 0x00},
+  };
+  uint32_t rounds = sizeof(req_buff) / sizeof(reqs);
+  modbus_memory_t* memory = modbus_memory_default_create_test();
+  tk_iostream_t* io =
+      tk_iostream_mem_create(req_buff, sizeof(req_buff), resp_buff, sizeof(resp_buff), FALSE);
+  modbus_service_t* service = modbus_service_create_with_io(io, MODBUS_PROTO_TCP, memory);
+
+  if (!alloc_counter_is_supported()) {
+    modbus_service_destroy(service);
+    TK_OBJECT_UNREF(io);
+    modbus_memory_destroy(memory);
+    return;
+  }
+
+  for (uint32_t i = 0; i < rounds; i++) {
+    memcpy(req_buff + i * sizeof(reqs), reqs, sizeof(reqs));
+  }
+
+  /*第一轮预热，之后处理请求不应该再分配内存*/
+  for (uint32_t i = 0; i < ARRAY_SIZE(reqs); i++) {
+    ASSERT_EQ(modbus_service_dispatch(service), RET_OK);
+  }
+
+  alloc_counter_begin();
+  for (uint32_t i = ARRAY_SIZE(reqs); i < rounds * ARRAY_SIZE(reqs); i++) {
+    modbus_service_dispatch(service);
+  }
+  ASSERT_EQ(alloc_counter_end(), 0u);
+  ASSERT_EQ(service->stats.dispatch_time.total, rounds * ARRAY_SIZE(reqs));
+
+  modbus_service_destroy(service);
+  TK_OBJECT_UNREF(io);
+  modbus_memory_destroy(memory);
+}
+
+TEST(modbus, service_init_static) {
+  uint8_t req_buff[] = {
+      0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0xff, 0x06, 0x01, 0x60, 0x12, 0x34,
+      0x00, 0x02, 0x00, 0x00, 0x00, 0x06, 0xff, 0x03, 0x01, 0x60, 0x00, 0x01,
+  };
+  uint8_t resp_buff[64];
+  static uint8_t s_bits_data[(MODBUS_DEMO_BITS_NB + 7) / 8];
+  static uint16_t s_registers_data[MODBUS_DEMO_REGISTERS_NB];
+  static modbus_server_channel_t s_bits;
+  static modbus_server_channel_t s_registers;
+  static modbus_memory_default_t s_memory;
+  static modbus_service_t s_service;
+  modbus_memory_t* memory = NULL;
+  modbus_service_t* service = &s_service;
+  tk_iostream_t* io =
+      tk_iostream_mem_create(req_buff, sizeof(req_buff), resp_buff, sizeof(resp_buff), FALSE);
+  memset(resp_buff, 0x00, sizeof(resp_buff));
+
+  /*缓冲区太小*/
+  ASSERT_EQ(modbus_server_channel_init_static(&s_registers, MODBUS_SERVER_CHANNEL_REGISTERS,
+                                              MODBUS_DEMO_REGISTERS_ADDRESS,
+                                              MODBUS_DEMO_REGISTERS_NB, TRUE,
+                                              (uint8_t*)s_registers_data, 2),
+            RET_BAD_PARAMS);
+
+  alloc_counter_begin();
+  ASSERT_EQ(modbus_server_channel_init_static(&s_bits, MODBUS_SERVER_CHANNEL_BITS,
+                                              MODBUS_DEMO_BITS_ADDRESS, MODBUS_DEMO_BITS_NB, TRUE,
+                                              s_bits_data, sizeof(s_bits_data)),
+            RET_OK);
+  ASSERT_EQ(modbus_server_channel_init_static(&s_registers, MODBUS_SERVER_CHANNEL_REGISTERS,
+                                              MODBUS_DEMO_REGISTERS_ADDRESS,
+                                              MODBUS_DEMO_REGISTERS_NB, TRUE,
+                                              (uint8_t*)s_registers_data, sizeof(s_registers_data)),
+            RET_OK);
+  memory = modbus_memory_default_init_static(&s_memory, &s_bits, NULL, &s_registers, NULL);
+  ASSERT_EQ(memory, (modbus_memory_t*)&s_memory);
+  ASSERT_EQ(modbus_service_init_static(service, io, MODBUS_PROTO_TCP, memory), RET_OK);
+  ASSERT_EQ(alloc_counter_end(), 0u);
+
+  ASSERT_EQ(modbus_service_dispatch(service), RET_OK);
+  ASSERT_EQ(modbus_service_dispatch(service), RET_OK);
+  ASSERT_EQ(s_registers_data[0], 0x1234);
+  ASSERT_EQ(resp_buff[12 + 7], MODBUS_FC_READ_HOLDING_REGISTERS);
+  ASSERT_EQ(resp_buff[12 + 8], 2);
+  ASSERT_EQ(resp_buff[12 + 9], 0x12);
+  ASSERT_EQ(resp_buff[12 + 10], 0x34);
+
+  /*只释放资源，不释放调用者提供的存储*/
+  alloc_counter_begin();
+  ASSERT_EQ(modbus_service_destroy(service), RET_OK);
+  ASSERT_EQ(modbus_memory_destroy(memory), RET_OK);
+  ASSERT_EQ(alloc_counter_end(), 0u);
+  TK_OBJECT_UNREF(io);
+}